@@ -0,0 +1,518 @@
+#define _NEKO_SOURCE
+#include "allocator.hpp"
+#include "threading.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <utility>
+#include <array>
+#include <mutex>
+#include <vector>
+
+#ifdef _WIN32
+    #include <Windows.h>
+#else
+    #include <sys/mman.h>
+#endif
+
+NEKO_NS_BEGIN
+
+NEKO_IMPL_BEGIN
+
+/**
+ * @brief Put before every block of libc::malloc, so libc::free knows where it come from
+ *
+ */
+struct alignas(std::max_align_t) BlockHeader {
+    Allocator *allocator;
+    uint64_t   size     : 56; //< The size requested by user
+    uint64_t   category : 8;
+};
+
+static constexpr size_t NumOfCategories = size_t(AllocCategory::NumberOfCategories);
+
+// Size classes, step is 16 bytes to 128, then 4 classes per power of two
+static constexpr size_t SizeClasses [] {
+    32,   48,   64,   80,   96,   112,  128,
+    160,  192,  224,  256,
+    320,  384,  448,  512,
+    640,  768,  896,  1024,
+};
+static constexpr size_t NumOfSizeClasses = std::size(SizeClasses);
+static constexpr size_t MaxSmallSize = SizeClasses[NumOfSizeClasses - 1];
+static constexpr size_t BatchSize = 32; //< Blocks moved between the thread cache and the depot at once
+static constexpr size_t MaxDepotBatches = 64; //< Per size class, more blocks go back to the system
+
+// Map (size + 15) / 16 to the size class
+static constexpr auto SizeClassTable = []() {
+    std::array<uint8_t, MaxSmallSize / 16 + 1> table { };
+    size_t cls = 0;
+    for (size_t n = 0; n < table.size(); n++) {
+        while (SizeClasses[cls] < n * 16) {
+            cls += 1;
+        }
+        table[n] = uint8_t(cls);
+    }
+    return table;
+}();
+
+static size_t GetSizeClass(size_t size) noexcept {
+    return SizeClassTable[(size + 15) / 16];
+}
+
+struct FreeBlock {
+    FreeBlock *next;
+};
+struct FreeBatch {
+    FreeBlock *head;
+    size_t     count;
+};
+
+/**
+ * @brief The shared free blocks of a size class, only touched in batches
+ *
+ */
+struct Depot {
+    std::mutex             mutex;
+    std::vector<FreeBatch> batches;
+};
+
+static Depot *GetDepots() {
+    // Never destroyed, threads may still free after the exit of main
+    static auto depots = new Depot[NumOfSizeClasses];
+    return depots;
+}
+static void ReleaseBatch(FreeBatch batch) noexcept {
+    while (batch.head) {
+        auto next = batch.head->next;
+        ::free(batch.head);
+        batch.head = next;
+    }
+}
+
+/**
+ * @brief The per-thread free lists of the default allocator
+ *
+ */
+class ThreadCache {
+public:
+    ThreadCache() = default;
+    ThreadCache(const ThreadCache &) = delete;
+    ~ThreadCache() {
+        for (size_t cls = 0; cls < NumOfSizeClasses; cls++) {
+            if (mLists[cls].head) {
+                _pushDepot(cls, mLists[cls]);
+            }
+        }
+    }
+
+    void *allocate(size_t cls) {
+        auto &list = mLists[cls];
+        if (!list.head && !_popDepot(cls, list)) {
+            return ::malloc(SizeClasses[cls]);
+        }
+        auto block = list.head;
+        list.head = block->next;
+        list.count -= 1;
+        return block;
+    }
+    void  deallocate(size_t cls, void *ptr) {
+        auto &list = mLists[cls];
+        auto block = static_cast<FreeBlock*>(ptr);
+        block->next = list.head;
+        list.head = block;
+        list.count += 1;
+        if (list.count < BatchSize * 2) {
+            return;
+        }
+        // Too many, move a batch to the depot
+        FreeBatch batch { list.head, BatchSize };
+        auto last = list.head;
+        for (size_t n = 1; n < BatchSize; n++) {
+            last = last->next;
+        }
+        list.head = last->next;
+        list.count -= BatchSize;
+        last->next = nullptr;
+        _pushDepot(cls, batch);
+    }
+private:
+    static void _pushDepot(size_t cls, FreeBatch batch) {
+        auto &depot = GetDepots()[cls];
+        std::unique_lock lock(depot.mutex);
+        if (depot.batches.size() < MaxDepotBatches) {
+            depot.batches.push_back(batch);
+            return;
+        }
+        lock.unlock();
+        ReleaseBatch(batch);
+    }
+    static bool _popDepot(size_t cls, FreeBatch &list) {
+        auto &depot = GetDepots()[cls];
+        std::lock_guard lock(depot.mutex);
+        if (depot.batches.empty()) {
+            return false;
+        }
+        list = depot.batches.back();
+        depot.batches.pop_back();
+        return true;
+    }
+
+    FreeBatch mLists[NumOfSizeClasses] { };
+};
+
+/**
+ * @brief Accounting of a thread, only written by its owner, so no atomic RMW on the hot path
+ *
+ */
+struct ThreadStats {
+    struct Counter {
+        Atomic<int64_t>  bytes {0};
+        Atomic<int64_t>  blocks {0};
+        Atomic<uint64_t> allocations {0};
+    };
+
+    void add(AllocCategory category, int64_t bytes, int64_t blocks, uint64_t allocations) noexcept {
+        auto &c = counters[size_t(category)];
+        c.bytes.store(c.bytes.load(std::memory_order_relaxed) + bytes, std::memory_order_relaxed);
+        c.blocks.store(c.blocks.load(std::memory_order_relaxed) + blocks, std::memory_order_relaxed);
+        c.allocations.store(c.allocations.load(std::memory_order_relaxed) + allocations, std::memory_order_relaxed);
+    }
+
+    Counter      counters[NumOfCategories];
+    ThreadStats *prev = nullptr;
+    ThreadStats *next = nullptr;
+};
+
+/**
+ * @brief All alive ThreadStats, and the counters of the exited threads
+ *
+ */
+struct StatsRegistry {
+    std::mutex           mutex;
+    ThreadStats         *head = nullptr;
+    ThreadStats::Counter retired[NumOfCategories];
+};
+
+static StatsRegistry *GetStatsRegistry() {
+    // Never destroyed, like the depots
+    static auto registry = new StatsRegistry;
+    return registry;
+}
+
+/**
+ * @brief All per-thread states, reached by one TLS pointer
+ *
+ */
+class ThreadState {
+public:
+    ThreadState();
+    ThreadState(const ThreadState &) = delete;
+    ~ThreadState();
+
+    ThreadCache cache;
+    ThreadStats stats;
+};
+
+// nullptr on not created, DeadState on destroyed (the thread is exiting)
+static ThreadState *const DeadState = reinterpret_cast<ThreadState*>(uintptr_t(1));
+#if defined(__GNUC__) && !defined(_WIN32)
+static thread_local ThreadState *tState __attribute__((tls_model("initial-exec"))) = nullptr;
+#else
+static thread_local ThreadState *tState = nullptr;
+#endif
+
+ThreadState::ThreadState() {
+    auto registry = GetStatsRegistry();
+    std::lock_guard lock(registry->mutex);
+    stats.next = registry->head;
+    if (stats.next) {
+        stats.next->prev = &stats;
+    }
+    registry->head = &stats;
+}
+ThreadState::~ThreadState() {
+    auto registry = GetStatsRegistry();
+    std::unique_lock lock(registry->mutex);
+    for (size_t n = 0; n < NumOfCategories; n++) {
+        registry->retired[n].bytes += stats.counters[n].bytes.load(std::memory_order_relaxed);
+        registry->retired[n].blocks += stats.counters[n].blocks.load(std::memory_order_relaxed);
+        registry->retired[n].allocations += stats.counters[n].allocations.load(std::memory_order_relaxed);
+    }
+    if (stats.prev) {
+        stats.prev->next = stats.next;
+    }
+    else {
+        registry->head = stats.next;
+    }
+    if (stats.next) {
+        stats.next->prev = stats.prev;
+    }
+    lock.unlock();
+    tState = DeadState; //< The cache is flushed below, the frees later bypass it
+}
+
+static ThreadState *CreateThreadState() {
+    if (tState == DeadState) {
+        return nullptr;
+    }
+    static thread_local ThreadState state;
+    tState = &state;
+    return &state;
+}
+/**
+ * @brief Get the state of the calling thread
+ *
+ * @return ThreadState* (nullptr on the thread is exiting)
+ */
+static inline ThreadState *GetThreadState() {
+    auto state = tState;
+    if (uintptr_t(state) > 1) [[likely]] {
+        return state;
+    }
+    return CreateThreadState();
+}
+
+/**
+ * @brief Size-class thread caches over ::malloc, large blocks go to ::malloc directly
+ *
+ */
+class DefaultAllocator final : public Allocator {
+public:
+    void *allocate(size_t size) override {
+        auto state = size <= MaxSmallSize ? GetThreadState() : nullptr;
+        if (!state) {
+            return ::malloc(size);
+        }
+        return state->cache.allocate(GetSizeClass(size));
+    }
+    void  deallocate(void *ptr, size_t size) override {
+        auto state = size <= MaxSmallSize ? GetThreadState() : nullptr;
+        if (!state) {
+            return ::free(ptr);
+        }
+        return state->cache.deallocate(GetSizeClass(size), ptr);
+    }
+};
+
+static Allocator *GetDefaultAllocator() {
+    // Never destroyed, like the depots
+    static auto allocator = new DefaultAllocator;
+    return allocator;
+}
+
+static void Account(AllocCategory category, int64_t bytes, int64_t blocks, uint64_t allocations) noexcept {
+    if (auto state = GetThreadState(); state) {
+        return state->stats.add(category, bytes, blocks, allocations);
+    }
+    // Thread is exiting, put it to retired directly
+    auto &c = GetStatsRegistry()->retired[size_t(category)];
+    c.bytes += bytes;
+    c.blocks += blocks;
+    c.allocations += allocations;
+}
+
+static Atomic<Allocator *> gAllocator {nullptr};
+
+NEKO_IMPL_END
+
+void SetAllocator(Allocator *allocator) {
+    gAllocator.store(allocator, std::memory_order_release);
+}
+Allocator *GetAllocator() {
+    auto allocator = gAllocator.load(std::memory_order_acquire);
+    if (!allocator) {
+        allocator = GetDefaultAllocator();
+    }
+    return allocator;
+}
+AllocStats GetAllocStats(AllocCategory category) {
+    auto registry = GetStatsRegistry();
+    auto idx = size_t(category);
+    std::lock_guard lock(registry->mutex);
+    AllocStats stats {
+        registry->retired[idx].bytes.load(),
+        registry->retired[idx].blocks.load(),
+        registry->retired[idx].allocations.load()
+    };
+    for (auto cur = registry->head; cur; cur = cur->next) {
+        stats.bytes += cur->counters[idx].bytes.load(std::memory_order_relaxed);
+        stats.blocks += cur->counters[idx].blocks.load(std::memory_order_relaxed);
+        stats.allocations += cur->counters[idx].allocations.load(std::memory_order_relaxed);
+    }
+    return stats;
+}
+
+// HugePageResource
+static size_t RoundToHugePage(size_t n) noexcept {
+    return (n + HugePageResource::PageSize - 1) & ~(HugePageResource::PageSize - 1);
+}
+static void *MapPages(size_t size, HugePages mode) noexcept {
+#if   defined(_WIN32)
+    if (mode == HugePages::Explicit) {
+        // Needs SeLockMemoryPrivilege, fallback on failed
+        auto large = ::GetLargePageMinimum();
+        if (large && size % large == 0) {
+            if (auto ptr = ::VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE); ptr) {
+                return ptr;
+            }
+        }
+    }
+    return ::VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+#if defined(MAP_HUGETLB)
+    if (mode == HugePages::Explicit) {
+        auto ptr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (ptr != MAP_FAILED) {
+            return ptr;
+        }
+    }
+#endif
+    // Over map one page, then trim it to a huge page boundary, the kernel only uses huge pages on the aligned range
+    auto map = static_cast<uint8_t*>(::mmap(nullptr, size + HugePageResource::PageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (map == MAP_FAILED) {
+        return nullptr;
+    }
+    auto ptr = reinterpret_cast<uint8_t*>(RoundToHugePage(reinterpret_cast<uintptr_t>(map)));
+    if (ptr != map) {
+        ::munmap(map, ptr - map);
+    }
+    if (auto tail = map + size + HugePageResource::PageSize - (ptr + size); tail > 0) {
+        ::munmap(ptr + size, tail);
+    }
+#if defined(MADV_HUGEPAGE)
+    ::madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+    return ptr;
+#endif
+}
+// Release the mapping of MapPages() holding the block [ptr, ptr + bytes)
+static void UnmapPages(void *ptr, size_t bytes) noexcept {
+#if defined(_WIN32)
+    // VirtualAlloc() is only 64 KB aligned, the base recorded by the system is the one to release
+    MEMORY_BASIC_INFORMATION info;
+    if (::VirtualQuery(ptr, &info, sizeof(info)) != sizeof(info)) {
+        return;
+    }
+    ::VirtualFree(info.AllocationBase, 0, MEM_RELEASE);
+#else
+    // The mapping was trimmed to start at the huge page boundary under it
+    auto map = reinterpret_cast<uintptr_t>(ptr) & ~uintptr_t(HugePageResource::PageSize - 1);
+    ::munmap(reinterpret_cast<void*>(map), RoundToHugePage(bytes + reinterpret_cast<uintptr_t>(ptr) - map));
+#endif
+}
+
+void *HugePageResource::do_allocate(size_t bytes, size_t alignment) {
+    if (mMode == HugePages::Off || bytes < Threshold || alignment > PageSize) {
+        return mUpstream->allocate(bytes, alignment);
+    }
+    // Start the blocks at different offsets in the huge page, or two frames of the same size map to the same
+    // cache sets (the physical address bits under 2 MB are the same), a src -> dst pass thrashes the cache
+    static Atomic<size_t> counter {0};
+    size_t color = (counter.fetch_add(1, std::memory_order_relaxed) % NumOfColors) * ColorStep;
+    color &= ~(std::max<size_t>(alignment, 1) - 1);
+
+    auto ptr = static_cast<uint8_t*>(MapPages(RoundToHugePage(bytes + color), mMode));
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr + color;
+}
+void HugePageResource::do_deallocate(void *ptr, size_t bytes, size_t alignment) {
+    if (mMode == HugePages::Off || bytes < Threshold || alignment > PageSize) {
+        return mUpstream->deallocate(ptr, bytes, alignment);
+    }
+    UnmapPages(ptr, bytes);
+}
+
+static Atomic<HugePages> gFrameHugePages {HugePages::Off};
+
+void SetFrameHugePages(HugePages mode) {
+    gFrameHugePages.store(mode, std::memory_order_relaxed);
+}
+std::pmr::memory_resource *GetFrameMemoryResource() {
+    // Never destroyed, the frames released at exit still give the buffers back
+    static auto transparent = new HugePageResource(HugePages::Transparent);
+    static auto explicitPages = new HugePageResource(HugePages::Explicit);
+    switch (gFrameHugePages.load(std::memory_order_relaxed)) {
+        case HugePages::Transparent: return transparent;
+        case HugePages::Explicit: return explicitPages;
+        default: return std::pmr::get_default_resource();
+    }
+}
+
+// MemoryBudget
+static thread_local const MemoryBudget *_notifyingBudget = nullptr; //< The budget calling the waiters on this thread
+
+void MemoryBudget::setLimit(size_t bytes) {
+    mLimit.store(bytes, std::memory_order_relaxed);
+    _notifyAll();
+}
+void MemoryBudget::join(Waiter *waiter) {
+    std::lock_guard lock(mMutex);
+    mMembers += 1;
+    if (waiter) {
+        mWaiters.push_back(waiter);
+    }
+}
+void MemoryBudget::leave(Waiter *waiter) {
+    std::unique_lock lock(mMutex);
+    mMembers -= 1;
+    if (auto iter = std::find(mWaiters.begin(), mWaiters.end(), waiter); iter != mWaiters.end()) {
+        mWaiters.erase(iter);
+    }
+    // A notify out of the lock may still use the waiter, unless it is us leaving from the callback
+    if (_notifyingBudget != this) {
+        mIdle.wait(lock, [this]() { return mNotifying == 0; });
+    }
+    lock.unlock();
+    _notifyAll(); //< The shares of others grow
+}
+void MemoryBudget::_notifyAll() {
+    // Call them out of the lock, notify() may run a AsyncScope callback, which could touch the budget
+    std::unique_lock lock(mMutex);
+    if (mWaiters.empty()) {
+        return;
+    }
+    auto waiters = mWaiters;
+    mNotifying += 1;
+    lock.unlock();
+
+    auto prev = std::exchange(_notifyingBudget, this);
+    for (auto waiter : waiters) {
+        waiter->notify();
+    }
+    _notifyingBudget = prev;
+
+    lock.lock();
+    if (--mNotifying == 0) {
+        mIdle.notify_all();
+    }
+}
+
+namespace libc {
+
+void *malloc(size_t n, AllocCategory category) {
+    auto allocator = GetAllocator();
+    auto header = static_cast<BlockHeader*>(allocator->allocate(n + sizeof(BlockHeader)));
+    if (!header) {
+        return nullptr;
+    }
+    header->allocator = allocator;
+    header->size = n;
+    header->category = uint8_t(category);
+    Account(category, n, 1, 1);
+    return header + 1;
+}
+void  free(void *ptr) {
+    if (!ptr) {
+        return;
+    }
+    auto header = static_cast<BlockHeader*>(ptr) - 1;
+    size_t n = header->size;
+    Account(AllocCategory(header->category), -int64_t(n), -1, 0);
+    header->allocator->deallocate(header, n + sizeof(BlockHeader));
+}
+
+}
+
+NEKO_NS_END
@@ -0,0 +1,261 @@
+#pragma once
+
+#include "defs.hpp"
+#include <memory_resource>
+#include <condition_variable>
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+NEKO_NS_BEGIN
+
+class Waiter;
+
+/**
+ * @brief Interface of the memory source behind libc::malloc / libc::free
+ * @details The default one keeps per-thread caches of small size classes, only touching the system allocator
+ * (and a shared depot) in batches. Every block remembers its Allocator, so a installed Allocator must outlive
+ * all blocks it returned.
+ *
+ */
+class NEKO_API Allocator {
+public:
+    virtual ~Allocator() = default;
+
+    /**
+     * @brief Allocate a block, aligned to max_align_t
+     *
+     * @param size
+     * @return void* (nullptr on failed)
+     */
+    virtual void *allocate(size_t size) = 0;
+    /**
+     * @brief Free the block, it may be called at any thread
+     *
+     * @param ptr
+     * @param size The size passed to allocate()
+     */
+    virtual void  deallocate(void *ptr, size_t size) = 0;
+};
+
+/**
+ * @brief The accounting of a AllocCategory
+ *
+ */
+struct AllocStats {
+    int64_t  bytes = 0;       //< Bytes in use
+    int64_t  blocks = 0;      //< Blocks in use
+    uint64_t allocations = 0; //< Number of allocations since start
+};
+
+/**
+ * @brief Install the allocator used by libc::malloc, call it at startup
+ *
+ * @param allocator The allocator, nullptr on restoring the default one
+ */
+extern NEKO_API void SetAllocator(Allocator *allocator);
+/**
+ * @brief Get the allocator used by libc::malloc
+ *
+ * @return Allocator*
+ */
+extern NEKO_API Allocator *GetAllocator();
+/**
+ * @brief Get the accounting of the category
+ *
+ * @param category
+ * @return AllocStats
+ */
+extern NEKO_API AllocStats GetAllocStats(AllocCategory category);
+
+/**
+ * @brief The page backing of the large frame buffers
+ *
+ */
+enum class HugePages : int {
+    Off,         //< Normal pages from the upstream resource (default)
+    Transparent, //< mmap + madvise(MADV_HUGEPAGE), the kernel backs it by huge pages when it can
+    Explicit,    //< mmap(MAP_HUGETLB) from the reserved pages, fallback to Transparent on no reserved pages
+};
+
+/**
+ * @brief The memory resource of big buffers (like 4K / 8K frames) backed by huge pages, less TLB misses on touching them
+ * @details The blocks smaller than Threshold still go to the upstream resource. The mapped blocks start at a rotating
+ * offset (a multiple of the alignment) from the huge page boundary, so the same sized frames don't share cache sets.
+ * On the platform without huge pages, it maps the normal pages.
+ *
+ */
+class NEKO_API HugePageResource final : public std::pmr::memory_resource {
+public:
+    static constexpr size_t PageSize = 2 * 1024 * 1024;
+    static constexpr size_t Threshold = PageSize; //< The smaller blocks go to the upstream
+    static constexpr size_t ColorStep = 4096 + 64; //< Offset between the starts of blocks, breaks the cache set aliasing
+    static constexpr size_t NumOfColors = 16;
+
+    explicit HugePageResource(HugePages mode, std::pmr::memory_resource *upstream = std::pmr::get_default_resource()) :
+        mMode(mode), mUpstream(upstream) { }
+
+    HugePages mode() const noexcept {
+        return mMode;
+    }
+private:
+    void *do_allocate(size_t bytes, size_t alignment) override;
+    void  do_deallocate(void *ptr, size_t bytes, size_t alignment) override;
+    bool  do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        return this == &other;
+    }
+
+    HugePages                  mMode;
+    std::pmr::memory_resource *mUpstream;
+};
+
+/**
+ * @brief Set the huge page mode of the frame buffers, used by CreateVideoFrame(), the frame pools of converters and the filters
+ * @details Call it at startup, a buffer is always given back to the resource it came from, so changing it later is safe
+ *
+ * @param mode HugePages::Off by default
+ */
+extern NEKO_API void SetFrameHugePages(HugePages mode);
+/**
+ * @brief Get the memory resource of the frame buffers, by the mode of SetFrameHugePages()
+ *
+ * @return std::pmr::memory_resource* (never destroyed)
+ */
+extern NEKO_API std::pmr::memory_resource *GetFrameMemoryResource();
+
+/**
+ * @brief The memory budget of a pipeline, divided across its queues, the Pipeline puts it into the Context
+ * @details Every member gets a equal share of the limit. A member under its share never waits, a member over
+ * its share borrows the idle part of others, it only waits when the whole budget is used up. 
+ * So the buffered bytes of a pipeline stay around the limit (plus the last item of each member), 
+ * and a low bitrate stream is never starved by a large one.
+ * 
+ */
+class NEKO_API MemoryBudget {
+public:
+    MemoryBudget() = default;
+    MemoryBudget(const MemoryBudget &) = delete;
+    ~MemoryBudget() = default;
+
+    /**
+     * @brief Set the limit, the members waiting for space are woken up
+     * 
+     * @param bytes The limit in bytes, 0 on unlimited
+     */
+    void   setLimit(size_t bytes);
+    /**
+     * @brief Join the budget, the shares are divided again
+     * 
+     * @param waiter The waiter of the producer, notified when the budget frees up (could be nullptr)
+     */
+    void   join(Waiter *waiter);
+    /**
+     * @brief Leave the budget, the member should give back its bytes by consume() first
+     * 
+     * @param waiter The waiter passed to join()
+     */
+    void   leave(Waiter *waiter);
+    /**
+     * @brief Add (or give back on negative) the bytes used by a member
+     * 
+     * @param bytes 
+     */
+    void   consume(int64_t bytes) noexcept {
+        auto limit = mLimit.load(std::memory_order_relaxed);
+        auto prev = mUsed.fetch_add(bytes, std::memory_order_relaxed);
+        if (bytes < 0 && limit && prev >= int64_t(limit) && prev + bytes < int64_t(limit)) {
+            // Back under the limit, the members over their shares may go on
+            _notifyAll();
+        }
+    }
+    /**
+     * @brief Check the member can take more, the member waits on false
+     * 
+     * @param memberBytes The bytes used by the member now
+     * @return true 
+     * @return false
+     */
+    bool   hasSpace(size_t memberBytes) const noexcept {
+        auto limit = mLimit.load(std::memory_order_relaxed);
+        if (limit == 0 || memberBytes <= share()) {
+            return true;
+        }
+        return mUsed.load(std::memory_order_relaxed) < int64_t(limit);
+    }
+
+    size_t limit() const noexcept {
+        return mLimit.load(std::memory_order_relaxed);
+    }
+    size_t used() const noexcept {
+        return size_t(std::max<int64_t>(mUsed.load(std::memory_order_relaxed), 0));
+    }
+    /**
+     * @brief Get the share of every member
+     * 
+     * @return size_t (0 on unlimited)
+     */
+    size_t share() const noexcept {
+        return mLimit.load(std::memory_order_relaxed) / std::max<size_t>(mMembers.load(std::memory_order_relaxed), 1);
+    }
+private:
+    void _notifyAll();
+
+    Atomic<size_t>        mLimit {0};
+    Atomic<int64_t>       mUsed {0};
+    Atomic<size_t>        mMembers {0};
+    std::mutex              mMutex; //< Protect mWaiters and mNotifying
+    std::condition_variable mIdle; //< Signaled when no notify in progress
+    std::vector<Waiter *>   mWaiters;
+    size_t                  mNotifying = 0; //< The number of _notifyAll() calling the waiters out of the lock
+};
+
+/**
+ * @brief The std allocator over libc::malloc with a category, for containers and std::allocate_shared
+ *
+ * @tparam T
+ * @tparam Category
+ */
+template <typename T, AllocCategory Category = AllocCategory::General>
+class StdAllocator {
+public:
+    using value_type = T;
+    template <typename U>
+    struct rebind {
+        using other = StdAllocator<U, Category>;
+    };
+
+    StdAllocator() = default;
+    template <typename U>
+    StdAllocator(const StdAllocator<U, Category> &) noexcept { }
+
+    T *allocate(size_t n) {
+        auto ptr = libc::malloc(n * sizeof(T), Category);
+        if (!ptr) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T*>(ptr);
+    }
+    void deallocate(T *ptr, size_t) noexcept {
+        libc::free(ptr);
+    }
+    template <typename U>
+    bool operator ==(const StdAllocator<U, Category> &) const noexcept {
+        return true;
+    }
+};
+
+/**
+ * @brief Create a Arc of giving type, the object and its control block are from libc::malloc with the category
+ *
+ * @tparam T
+ * @tparam Category
+ * @tparam Args
+ * @param args
+ * @return Arc<T>
+ */
+template <typename T, AllocCategory Category, typename ...Args>
+Arc<T> AllocateShared(Args &&...args) {
+    return std::allocate_shared<T>(StdAllocator<T, Category>(), std::forward<Args>(args)...);
+}
+
+NEKO_NS_END
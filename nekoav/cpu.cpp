@@ -0,0 +1,70 @@
+#define _NEKO_SOURCE
+#include "cpu.hpp"
+#include <algorithm>
+
+#if defined(NEKO_X86) && defined(_MSC_VER)
+    #include <intrin.h>
+    #include <immintrin.h>
+#endif
+
+NEKO_NS_BEGIN
+
+NEKO_IMPL_BEGIN
+
+SimdLevel DetectSimdLevel() noexcept {
+#if !defined(NEKO_X86)
+    return SimdLevel::None;
+#elif defined(_MSC_VER)
+    int info[4];
+    ::__cpuid(info, 0);
+    int maxLeaf = info[0];
+    ::__cpuid(info, 1);
+    if (!(info[3] & (1 << 26))) {
+        return SimdLevel::None;
+    }
+    // AVX needs the OS saves the YMM (and ZMM) registers
+    bool osxsave = info[2] & (1 << 27);
+    if (!osxsave || maxLeaf < 7) {
+        return SimdLevel::SSE2;
+    }
+    auto xcr0 = ::_xgetbv(0);
+    ::__cpuidex(info, 7, 0);
+    if ((xcr0 & 0xE6) == 0xE6 && (info[1] & (1 << 16)) && (info[1] & (1 << 30))) {
+        return SimdLevel::AVX512;
+    }
+    if ((xcr0 & 0x06) == 0x06 && (info[1] & (1 << 5))) {
+        return SimdLevel::AVX2;
+    }
+    return SimdLevel::SSE2;
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+        return SimdLevel::AVX512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return SimdLevel::AVX2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return SimdLevel::SSE2;
+    }
+    return SimdLevel::None;
+#endif
+}
+
+Atomic<int> gSimdLevel {-1}; //< -1 on not limited, constant initialized so it works in the static constructors
+
+NEKO_IMPL_END
+
+SimdLevel GetCPUSimdLevel() noexcept {
+    static const SimdLevel level = DetectSimdLevel();
+    return level;
+}
+SimdLevel GetSimdLevel() noexcept {
+    auto level = gSimdLevel.load(std::memory_order_relaxed);
+    return level < 0 ? GetCPUSimdLevel() : SimdLevel(level);
+}
+void      SetSimdLevel(SimdLevel level) noexcept {
+    gSimdLevel.store(int(std::min(level, GetCPUSimdLevel())), std::memory_order_relaxed);
+}
+
+NEKO_NS_END
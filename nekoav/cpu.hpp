@@ -0,0 +1,49 @@
+#pragma once
+
+#include "defs.hpp"
+
+// Let a function use the instructions of the level, without building the whole file for it (GCC / Clang)
+#if defined(__GNUC__)
+#define NEKO_TARGET(x) __attribute__((target(x)))
+#else
+#define NEKO_TARGET(x)
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define NEKO_X86
+#endif
+
+NEKO_NS_BEGIN
+
+/**
+ * @brief The SIMD instruction set used by the kernels, every level includes the lower ones
+ *
+ */
+enum class SimdLevel : int {
+    None,   //< Plain C
+    SSE2,
+    AVX2,
+    AVX512, //< AVX-512 F + BW
+};
+
+/**
+ * @brief Get the SIMD level used by the kernels, the highest one the CPU supports by default
+ *
+ * @return SimdLevel
+ */
+extern NEKO_API SimdLevel GetSimdLevel() noexcept;
+/**
+ * @brief Limit the SIMD level used by the kernels, for testing and benchmarking the lower ones
+ * @details A level above the CPU supports is clamped to it
+ *
+ * @param level The max level, the kernels pick the highest one up to it
+ */
+extern NEKO_API void      SetSimdLevel(SimdLevel level) noexcept;
+/**
+ * @brief Get the highest SIMD level the CPU supports, detected once
+ *
+ * @return SimdLevel
+ */
+extern NEKO_API SimdLevel GetCPUSimdLevel() noexcept;
+
+NEKO_NS_END
@@ -109,8 +109,11 @@ class Property;
 class Pipeline;
 class Thread;
 
+template <typename T>
+class Ref;
+
 /**
- * @brief Wrapper for RAW Pointer, implict cast from Arc and RAW Pointer
+ * @brief Wrapper for RAW Pointer, implict cast from Arc, Ref and RAW Pointer
  * 
  * @tparam T 
  */
@@ -122,6 +125,8 @@ public:
     View(const Arc<U> &ptr) : mPtr(ptr.get()) { }
     template <typename U>
     View(const Box<U> &ptr) : mPtr(ptr.get()) { }
+    template <typename U>
+    View(const Ref<U> &ptr) : mPtr(ptr.get()) { }
     View(T *ptr) : mPtr(ptr) { }
     View(const View &) = default;
     ~View() = default;
@@ -211,17 +216,33 @@ Arc<T> MakeShared(Args &&...args) {
     return std::make_shared<T>(std::forward<Args>(args)...);
 }
 
+/**
+ * @brief The category of a allocation from libc::malloc, for accounting
+ * 
+ */
+enum class AllocCategory : uint8_t {
+    General,
+    Element,  //< Elements and Pads
+    Thread,   //< Threads and Tasks
+    Frame,
+    Packet,
+    Event,
+    Property,
+    NumberOfCategories,
+};
+
 // Some useful function
 namespace libc {
     /**
-     * @brief Allocate memory
+     * @brief Allocate memory, small blocks are served by the thread local caches of the installed Allocator
      * 
      * @param n 
+     * @param category The category for accounting
      * @return void* 
      */
-    extern NEKO_API void *malloc(size_t n);
+    extern NEKO_API void *malloc(size_t n, AllocCategory category = AllocCategory::General);
     /**
-     * @brief Free memory
+     * @brief Free memory from libc::malloc, at any thread
      * 
      * @param ptr 
      */
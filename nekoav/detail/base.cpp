@@ -195,10 +195,7 @@ Pad *ElementBase::_polishPad(Pad *pad) {
     }
     if (pad->type() == Pad::Input) {
         // Input Pad
-        // pad->setCallback(std::bind(ElementBase::_onSinkPushed, this, std::ref(*pad), std::placeholders::_2));
-        pad->setCallback([this, pad](View<Resource> resource) -> Error {
-            return _onSinkPush(pad, resource);
-        });
+        pad->setTypedCallback<Resource, &ElementBase::_onSinkPush>(this);
         pad->setEventCallback([this, pad](View<Event> event) -> Error {
             // return 
             return _onSinkEvent(pad, event);
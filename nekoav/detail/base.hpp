@@ -1,6 +1,10 @@
 #pragma once
 
 #include "../elements.hpp"
+#include "../threading.hpp"
+#include "../context.hpp"
+#include "../event.hpp"
+#include "coroutine.hpp"
 #include <functional>
 
 #ifndef NDEBUG
@@ -361,12 +365,245 @@ using ThreadingImpl = _Impl<ElementBase::Threading, Ts...>;
 template <typename ...Ts>
 using ThreadingExImpl = _Impl<ElementBase::ThreadingEx, Ts...>;
 
+/**
+ * @brief Threading Element Impl scheduled on the Executor in the context (Executor::shared() if not found)
+ * @details The onLoop() should return NoImpl (event driven), or it will occupy a worker of executor
+ * 
+ * @tparam Ts 
+ */
+template <typename ...Ts>
+class ExecutorImpl : public ThreadingExImpl<Ts...> {
+protected:
+    Thread *allocThread() override {
+        Executor *executor = nullptr;
+        if (auto ctxt = this->context(); ctxt) {
+            executor = ctxt->template queryObject<Executor>();
+        }
+        if (!executor) {
+            executor = Executor::shared();
+        }
+        return executor->allocThread();
+    }
+    void freeThread(Thread *thread) override {
+        thread->executor()->freeThread(thread);
+    }
+};
+
+/**
+ * @brief Threading Element Impl with a C++20 coroutine loop, scheduled on the Executor like ExecutorImpl
+ * @details Override onAsyncLoop() instead of onLoop(), it can co_await state changes, events, timers and pad capacity,
+ * the worker is released at each co_await, so many elements can share a small pool. 
+ * The coroutine is always resumed at the element thread, so it is serialized with the state changes and events
+ * @note The loop should co_return when stopRequested() is true, at Teardown it is resumed once and then destroyed
+ * 
+ * @tparam Ts 
+ */
+template <typename ...Ts>
+class CoroutineImpl : public ExecutorImpl<Ts...> {
+protected:
+    /**
+     * @brief The loop of this element, started after Initialize
+     * 
+     * @return CoLoop 
+     */
+    virtual CoLoop onAsyncLoop() = 0;
+    /**
+     * @brief Keep the event for waitEvent(), override it if you want handle event synchronously
+     * 
+     * @param event 
+     * @return Error 
+     */
+    Error onEvent(View<Event> event) override {
+        mEvents.push(Ref<Event>(event.get()));
+        if (mCoContext) {
+            mCoContext->wake(CoContext::EventArrived);
+        }
+        return Error::Ok;
+    }
+    Error changeState(StateChange change) override {
+        if (change == StateChange::Teardown && this->thread()) {
+            // The coroutine must be gone before the thread freed
+            this->invokeMethodQueued(&CoroutineImpl::_stopLoop, this);
+        }
+        auto err = ExecutorImpl<Ts...>::changeState(change);
+        if (err == Error::Ok && change != StateChange::Initialize && change != StateChange::Teardown) {
+            this->thread()->postTask([this, state = GetTargetState(change)]() {
+                mLoopState = state;
+                mStates.push(State(state));
+                if (mCoContext) {
+                    mCoContext->wake(CoContext::StateChanged);
+                }
+            });
+        }
+        return err;
+    }
+    /**
+     * @brief Check should the loop return
+     * 
+     * @return true 
+     * @return false 
+     */
+    bool stopRequested() const noexcept {
+        return mStopping;
+    }
+    /**
+     * @brief Get the state seen by the loop, state() is updated after all changes done, so it may be late than it
+     * 
+     * @return State 
+     */
+    State loopState() const noexcept {
+        return mLoopState;
+    }
+    /**
+     * @brief co_await it to get the state reached by next state change (State::Null on stop requested)
+     * 
+     * @return auto 
+     */
+    auto waitStateChange() {
+        class Awaiter {
+        public:
+            bool  await_ready() const noexcept {
+                return !mSelf->mStates.empty() || mSelf->mStopping;
+            }
+            bool  await_suspend(std::coroutine_handle<> h) {
+                return mSelf->mCoContext->suspend(h, CoContext::StateChanged | CoContext::Stopped);
+            }
+            State await_resume() {
+                return mSelf->mStates.empty() ? State::Null : mSelf->mStates.pop();
+            }
+
+            CoroutineImpl *mSelf;
+        };
+        return Awaiter {this};
+    }
+    /**
+     * @brief co_await it to get the next event received by onEvent() (nullptr on stop requested)
+     * 
+     * @return auto 
+     */
+    auto waitEvent() {
+        class Awaiter {
+        public:
+            bool  await_ready() const noexcept {
+                return !mSelf->mEvents.empty() || mSelf->mStopping;
+            }
+            bool  await_suspend(std::coroutine_handle<> h) {
+                return mSelf->mCoContext->suspend(h, CoContext::EventArrived | CoContext::Stopped);
+            }
+            Ref<Event> await_resume() {
+                return mSelf->mEvents.empty() ? nullptr : mSelf->mEvents.pop();
+            }
+
+            CoroutineImpl *mSelf;
+        };
+        return Awaiter {this};
+    }
+    /**
+     * @brief co_await it to sleep, like Thread::msleep() it is interrupted by state changes and events
+     * 
+     * @param milliseconds The time you want to sleep (<= 0 on no-op)
+     * @return auto co_await it for Ok on timeout, Interrupted on state changed, event arrived or stop requested 
+     */
+    auto sleepFor(int64_t milliseconds) {
+        class Awaiter {
+        public:
+            bool  await_ready() const noexcept {
+                return mMilliseconds <= 0 || mSelf->mStopping;
+            }
+            bool  await_suspend(std::coroutine_handle<> h) {
+                auto context = mSelf->mCoContext.get();
+                context->wakeAfter(mMilliseconds);
+                return context->suspend(h, CoContext::Timeout | CoContext::StateChanged | CoContext::EventArrived | CoContext::Stopped);
+            }
+            Error await_resume() const noexcept {
+                if (mMilliseconds <= 0) {
+                    return Error::Ok;
+                }
+                if (mSelf->mStopping || mSelf->mCoContext->reason() != CoContext::Timeout) {
+                    return Error::Interrupted;
+                }
+                return Error::Ok;
+            }
+
+            CoroutineImpl *mSelf;
+            int64_t        mMilliseconds;
+        };
+        return Awaiter {this, milliseconds};
+    }
+    /**
+     * @brief co_await it to push the resource, if the downstream is full, suspend until it has space instead of blocking the worker
+     * 
+     * @param pad 
+     * @param resource 
+     * @return auto co_await it for the Error of Pad::push
+     */
+    auto pushAsync(View<Pad> pad, View<Resource> resource) {
+        class Awaiter {
+        public:
+            bool  await_ready() {
+                auto context = mSelf->mCoContext;
+                Waiter::AsyncScope scope([context, id = context->id()]() {
+                    context->wake(CoContext::Writable, id);
+                });
+                mError = mSelf->pushTo(mPad, mResource);
+                return !scope.armed() || mSelf->mStopping;
+            }
+            bool  await_suspend(std::coroutine_handle<> h) {
+                return mSelf->mCoContext->suspend(h, CoContext::Writable | CoContext::Stopped);
+            }
+            Error await_resume() const noexcept {
+                return mError;
+            }
+
+            CoroutineImpl *mSelf;
+            View<Pad>      mPad;
+            View<Resource> mResource;
+            Error          mError = Error::Ok;
+        };
+        return Awaiter {this, pad, resource};
+    }
+private:
+    Error onLoop() final {
+        mStopping = false;
+        mLoopState = this->state();
+        mCoContext = std::make_shared<CoContext>(this->thread());
+        mLoop = onAsyncLoop();
+        mLoop.setCompletion([this](Error err) {
+            if (err != Error::Ok) {
+                this->raiseError(err);
+            }
+        });
+        mCoContext->start(mLoop.handle());
+        return Error::NoImpl; //< Keep the thread serving tasks, the coroutine is resumed by them
+    }
+    void  _stopLoop() {
+        mStopping = true;
+        if (mCoContext) {
+            mCoContext->stop();
+        }
+        mLoop = CoLoop(); //< Destroy the frame if it did not return
+        mCoContext.reset();
+        mStates.clear();
+        mEvents.clear();
+        mLoopState = State::Null;
+    }
+
+    Arc<CoContext>         mCoContext;
+    CoLoop                 mLoop;
+    RingBuffer<State>      mStates; //< State changes not taken by waitStateChange()
+    RingBuffer<Ref<Event>> mEvents; //< Events not taken by waitEvent()
+    State                  mLoopState = State::Null;
+    bool                   mStopping = false;
+};
+
 }
 
 #ifndef NEKO_NO_DEFAULT_IMPL
 using _abiv1::Impl;
 using _abiv1::ThreadingImpl;
 using _abiv1::ThreadingExImpl;
+using _abiv1::ExecutorImpl;
+using _abiv1::CoroutineImpl;
 #endif
 
 NEKO_NS_END
\ No newline at end of file
@@ -0,0 +1,103 @@
+#define _NEKO_SOURCE
+#include "../threading.hpp"
+#include "../utils.hpp"
+#include "coroutine.hpp"
+#include <chrono>
+
+NEKO_NS_BEGIN
+
+CoContext::CoContext(Thread *thread) : mThread(thread) {
+    NEKO_ASSERT(thread);
+}
+CoContext::~CoContext() {
+
+}
+void CoContext::start(std::coroutine_handle<> handle) {
+    NEKO_ASSERT(Thread::currentThread() == mThread);
+    handle.resume();
+}
+bool CoContext::suspend(std::coroutine_handle<> handle, uint32_t mask) {
+    std::lock_guard lock(mMutex);
+    if (mStopped) {
+        // Never resume it again, the frame will be destroyed by the owner
+        mHandle = handle;
+        mMask = 0;
+        return true;
+    }
+    if (mPending & mask) {
+        // Already happened, go on
+        mReason = mPending & mask;
+        mPending = 0;
+        mId += 1;
+        return false;
+    }
+    mHandle = handle;
+    mMask = mask;
+    return true;
+}
+void CoContext::wake(Reason reason, uint64_t id) {
+    std::lock_guard lock(mMutex);
+    if (mStopped) {
+        return;
+    }
+    if (id != 0 && id != mId) {
+        // Stale, this suspension was finished
+        return;
+    }
+    if (!mHandle) {
+        // Running, keep it for the coming suspension
+        if (id != 0) {
+            mPending |= reason;
+        }
+        return;
+    }
+    if (!(mMask & reason)) {
+        return;
+    }
+    mMask = 0; //< Only one resume per suspension
+    mThread->postTask([self = shared_from_this(), id = mId, reason]() {
+        self->_resume(id, reason);
+    });
+}
+void CoContext::wakeAfter(int64_t ms) {
+    if (ms <= 0) {
+        return wake(Timeout, mId);
+    }
+    mThread->postDelayed([self = weak_from_this(), id = mId]() {
+        if (auto context = self.lock(); context) {
+            context->wake(Timeout, id);
+        }
+    }, std::chrono::milliseconds(ms));
+}
+void CoContext::stop() {
+    NEKO_ASSERT(Thread::currentThread() == mThread);
+    std::unique_lock lock(mMutex);
+    if (mStopped) {
+        return;
+    }
+    auto handle = std::exchange(mHandle, nullptr);
+    mStopped = true;
+    mMask = 0;
+    mId += 1;
+    mReason = Stopped;
+    lock.unlock();
+
+    if (handle) {
+        handle.resume();
+    }
+}
+void CoContext::_resume(uint64_t id, Reason reason) {
+    std::unique_lock lock(mMutex);
+    if (id != mId || !mHandle || mStopped) {
+        return;
+    }
+    auto handle = std::exchange(mHandle, nullptr);
+    mId += 1;
+    mPending = 0;
+    mReason = reason;
+    lock.unlock();
+
+    handle.resume();
+}
+
+NEKO_NS_END
@@ -0,0 +1,185 @@
+#pragma once
+
+#include "../threading.hpp"
+#include "../error.hpp"
+#include "../defs.hpp"
+#include <coroutine>
+#include <functional>
+#include <utility>
+#include <mutex>
+
+NEKO_NS_BEGIN
+
+/**
+ * @brief The coroutine type of CoroutineImpl::onAsyncLoop(), return the Error by co_return
+ *
+ */
+class CoLoop {
+public:
+    class promise_type {
+    public:
+        CoLoop get_return_object() noexcept {
+            return CoLoop(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept {
+            return { };
+        }
+        auto final_suspend() noexcept {
+            class FinalAwaiter {
+            public:
+                bool await_ready() noexcept { return false; }
+                void await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+                    auto &promise = h.promise();
+                    if (promise.mCompletion) {
+                        promise.mCompletion(promise.mResult);
+                    }
+                }
+                void await_resume() noexcept { }
+            };
+            return FinalAwaiter { };
+        }
+        void return_value(Error err) noexcept {
+            mResult = err;
+        }
+        void unhandled_exception() noexcept {
+            mResult = Error::Unknown;
+        }
+    private:
+        Error                      mResult = Error::Ok;
+        std::function<void(Error)> mCompletion; //< Invoked at the final suspend point
+
+    friend class CoLoop;
+    };
+    using Handle = std::coroutine_handle<promise_type>;
+
+    CoLoop() = default;
+    CoLoop(const CoLoop &) = delete;
+    CoLoop(CoLoop &&other) noexcept : mHandle(std::exchange(other.mHandle, nullptr)) { }
+    ~CoLoop() {
+        if (mHandle) {
+            mHandle.destroy();
+        }
+    }
+
+    CoLoop &operator =(CoLoop &&other) noexcept {
+        if (this != &other) {
+            if (mHandle) {
+                mHandle.destroy();
+            }
+            mHandle = std::exchange(other.mHandle, nullptr);
+        }
+        return *this;
+    }
+    /**
+     * @brief Set the callback invoked when the coroutine returned
+     *
+     * @param completion
+     */
+    void setCompletion(std::function<void(Error)> &&completion) {
+        mHandle.promise().mCompletion = std::move(completion);
+    }
+    Handle handle() const noexcept {
+        return mHandle;
+    }
+    bool   empty() const noexcept {
+        return !mHandle;
+    }
+private:
+    explicit CoLoop(Handle handle) : mHandle(handle) { }
+
+    Handle mHandle;
+};
+
+/**
+ * @brief Resume bookkeeping of a coroutine bound to a Thread
+ * @details The coroutine is always resumed at its Thread, one suspension is identified by id(),
+ * so a wake for a finished suspension (like a timer fired after the state changed) is ignored.
+ *
+ */
+class NEKO_API CoContext final : public std::enable_shared_from_this<CoContext> {
+public:
+    enum Reason : uint32_t {
+        None         = 0,
+        Timeout      = 1 << 0, //< Timer of sleepFor() fired
+        StateChanged = 1 << 1, //< Element state changed
+        EventArrived = 1 << 2, //< Element got a event
+        Writable     = 1 << 3, //< The downstream has space now
+        Stopped      = 1 << 4, //< Element is tearing down
+    };
+
+    explicit CoContext(Thread *thread);
+    CoContext(const CoContext &) = delete;
+    ~CoContext();
+
+    /**
+     * @brief Get the id of the current (or next) suspension
+     *
+     * @return uint64_t
+     */
+    uint64_t id() const noexcept {
+        return mId;
+    }
+    /**
+     * @brief Get the reason of the last resume
+     *
+     * @return uint32_t
+     */
+    uint32_t reason() const noexcept {
+        return mReason;
+    }
+    /**
+     * @brief Resume the coroutine at the thread for the first time
+     *
+     * @param handle
+     */
+    void     start(std::coroutine_handle<> handle);
+    /**
+     * @brief Suspend the coroutine, called at the thread in await_suspend
+     *
+     * @param handle
+     * @param mask The Reasons can resume it
+     * @return false on a wanted reason already happened, do not suspend
+     */
+    bool     suspend(std::coroutine_handle<> handle, uint32_t mask);
+    /**
+     * @brief Resume the coroutine at its thread, if it is waiting for the reason
+     * @note It is thread safe
+     *
+     * @param reason
+     * @param id The suspension to wake, 0 on the current one
+     */
+    void     wake(Reason reason, uint64_t id = 0);
+    /**
+     * @brief Wake the current suspension with Timeout after milliseconds
+     *
+     * @param milliseconds
+     */
+    void     wakeAfter(int64_t milliseconds);
+    /**
+     * @brief Resume the coroutine with Stopped and never resume it again, called at the thread
+     *
+     */
+    void     stop();
+    /**
+     * @brief Check it was stopped
+     *
+     * @return true
+     * @return false
+     */
+    bool     stopped() const noexcept {
+        return mStopped;
+    }
+private:
+    void _resume(uint64_t id, Reason reason);
+
+    mutable std::mutex      mMutex;
+    Thread                 *mThread = nullptr;
+    std::coroutine_handle<> mHandle; //< Suspended coroutine, null on running
+    uint64_t                mId = 1;
+    uint32_t                mMask = 0;
+    uint32_t                mPending = 0; //< Reasons arrived while it running, for the current id
+    uint32_t                mReason = None;
+    bool                    mStopped = false;
+};
+
+NEKO_NS_END
@@ -2,9 +2,11 @@
 
 #include "../defs.hpp"
 #include <condition_variable>
+#include <algorithm>
 #include <chrono>
 #include <mutex>
 #include <queue>
+#include <bit>
 
 NEKO_NS_BEGIN
 
@@ -88,4 +90,180 @@ private:
     mutable std::mutex      mMutex;
 };
 
+/**
+ * @brief A growable ring buffer, it never shrinks, so no allocation after warm up
+ * @note It is not thread safe
+ * 
+ * @tparam T (must be default constructible and move assignable)
+ */
+template <typename T>
+class RingBuffer {
+public:
+    RingBuffer() = default;
+    RingBuffer(const RingBuffer &) = delete;
+    ~RingBuffer() = default;
+
+    void push(T &&value) {
+        if (mTail - mHead == capacity()) {
+            _grow();
+        }
+        mSlots[mTail & mMask] = std::move(value);
+        mTail += 1;
+    }
+    /**
+     * @brief Pop the front value
+     * @warning The buffer must not be empty
+     * 
+     * @return T 
+     */
+    T    pop() {
+        auto &slot = mSlots[mHead & mMask];
+        T value = std::move(slot);
+        slot = T();
+        mHead += 1;
+        return value;
+    }
+    void clear() {
+        while (!empty()) {
+            pop();
+        }
+    }
+    size_t size() const noexcept {
+        return mTail - mHead;
+    }
+    size_t capacity() const noexcept {
+        return mSlots ? mMask + 1 : 0;
+    }
+    bool   empty() const noexcept {
+        return mTail == mHead;
+    }
+private:
+    void _grow() {
+        size_t newCapacity = std::max<size_t>(capacity() * 2, 16);
+        Box<T[]> slots(new T[newCapacity]);
+        for (size_t n = 0; n < size(); n++) {
+            slots[n] = std::move(mSlots[(mHead + n) & mMask]);
+        }
+        mTail = size();
+        mHead = 0;
+        mMask = newCapacity - 1;
+        mSlots = std::move(slots);
+    }
+
+    Box<T[]> mSlots;
+    size_t   mMask = 0;
+    size_t   mHead = 0;
+    size_t   mTail = 0;
+};
+
+/**
+ * @brief A bounded lock-free Single-Producer / Single-Consumer ring buffer
+ * @details Only one thread may call tryPush() and only one (another) thread may call tryPop() / clear(),
+ * size() and empty() are safe from any thread but only give a snapshot.
+ * The capacity is rounded up to power of 2
+ * 
+ * @tparam T (must be default constructible and move assignable)
+ */
+template <typename T>
+class SpscQueue {
+public:
+    SpscQueue() = default;
+    explicit SpscQueue(size_t capacity) {
+        reset(capacity);
+    }
+    SpscQueue(const SpscQueue &) = delete;
+    ~SpscQueue() = default;
+
+    /**
+     * @brief Reallocate the storage, all items will be dropped
+     * @warning It is not thread safe, nobody should push or pop at this time
+     * 
+     * @param capacity 
+     */
+    void reset(size_t capacity) {
+        capacity = std::bit_ceil(std::max<size_t>(capacity, 2));
+        mSlots.reset(new T[capacity]);
+        mMask = capacity - 1;
+        mHead = 0;
+        mTail = 0;
+        mCachedHead = 0;
+        mCachedTail = 0;
+    }
+    /**
+     * @brief Try push a value into the queue (producer side)
+     * 
+     * @param value The value, it will not be moved on failed
+     * @return true 
+     * @return false on queue is full
+     */
+    bool tryPush(T &&value) {
+        auto tail = mTail.load(std::memory_order_relaxed);
+        if (tail - mCachedHead > mMask) {
+            // Maybe full, refresh the head from consumer
+            mCachedHead = mHead.load(std::memory_order_acquire);
+            if (tail - mCachedHead > mMask) {
+                return false;
+            }
+        }
+        mSlots[tail & mMask] = std::move(value);
+        mTail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+    /**
+     * @brief Try pop a value from the queue (consumer side)
+     * 
+     * @param value The pointer to recv the value
+     * @return true 
+     * @return false on queue is empty
+     */
+    bool tryPop(T *value) {
+        auto head = mHead.load(std::memory_order_relaxed);
+        if (head == mCachedTail) {
+            // Maybe empty, refresh the tail from producer
+            mCachedTail = mTail.load(std::memory_order_acquire);
+            if (head == mCachedTail) {
+                return false;
+            }
+        }
+        auto &slot = mSlots[head & mMask];
+        *value = std::move(slot);
+        slot = T(); //< Release the resource hold by the slot right now
+        mHead.store(head + 1, std::memory_order_release);
+        return true;
+    }
+    /**
+     * @brief Drop all items in queue (consumer side)
+     * 
+     */
+    void clear() {
+        T value;
+        while (tryPop(&value)) { }
+    }
+
+    size_t size() const noexcept {
+        return mTail.load(std::memory_order_acquire) - mHead.load(std::memory_order_acquire);
+    }
+    size_t capacity() const noexcept {
+        return mSlots ? mMask + 1 : 0;
+    }
+    bool   empty() const noexcept {
+        return size() == 0;
+    }
+    bool   full() const noexcept {
+        return size() > mMask;
+    }
+private:
+    // Producer side
+    alignas(64) Atomic<size_t> mTail {0};
+    size_t                     mCachedHead = 0;
+
+    // Consumer side
+    alignas(64) Atomic<size_t> mHead {0};
+    size_t                     mCachedTail = 0;
+
+    // Shared readonly part
+    alignas(64) Box<T[]>       mSlots;
+    size_t                     mMask = 0;
+};
+
 NEKO_NS_END
\ No newline at end of file
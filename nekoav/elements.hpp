@@ -152,7 +152,7 @@ public:
     virtual  Error sendEvent(View<Event> event) = 0;
 
     void *operator new(size_t size) {
-        return libc::malloc(size);
+        return libc::malloc(size, AllocCategory::Element);
     }
     void operator delete(void *ptr) {
         return libc::free(ptr);
@@ -1,34 +1,202 @@
 #define _NEKO_SOURCE
 #include "../detail/template.hpp"
-#include "../detail/queue.hpp"
+#include "../threading.hpp"
 #include "../factory.hpp"
+#include "../event.hpp"
 #include "../pad.hpp"
 #include "appsink.hpp"
 
+#include <condition_variable>
+#include <chrono>
+#include <mutex>
+
 NEKO_NS_BEGIN
 
 class AppSinkImpl final : public Template::GetImpl<AppSink> {
 public:
     AppSinkImpl() {
         mSink = addInput("sink");
-        mSink->setCallback(std::bind(&AppSinkImpl::processInput, this, std::placeholders::_1));
+        mSink->setTypedCallback<Resource, &AppSinkImpl::processInput>(this);
+        mSink->setEventCallback(std::bind(&AppSinkImpl::processEvent, this, std::placeholders::_1));
+        mRing.resize(MinRingSize);
+    }
+    Error onRun() override {
+        mFlowing = true;
+        return Error::Ok;
+    }
+    Error onPause() override {
+        _stopFlowing();
+        return Error::Ok;
+    }
+    Error onStop() override {
+        _stopFlowing();
+        return Error::Ok;
+    }
+    Error onTeardown() override {
+        _stopFlowing();
+        std::lock_guard lock(mMutex);
+        _clear();
+        return Error::Ok;
     }
     Error processInput(View<Resource> resourceView) {
-        mQueue.emplace(resourceView->shared_from_this());
+        std::unique_lock lock(mMutex);
+        if (mCapacity && mCount > mCapacity) {
+            // No slot, only the item pushed over the capacity is here, the producer was interrupted
+            if (mPolicy != DropOldest) {
+                mDropped += 1;
+                return Error::Ok;
+            }
+        }
+        if (mCapacity && mCount >= mCapacity && mPolicy != Block) {
+            if (mPolicy == DropNewest) {
+                mDropped += 1;
+                return Error::Ok;
+            }
+            _popFront();
+            mDropped += 1;
+        }
+        _pushBack(resourceView.get());
+        bool block = mPolicy == Block; //< Read under the lock, setCapacity() may change it
+        lock.unlock();
+        mCondition.notify_one();
+
+        // Block over the capacity, like MediaQueue, the slot for it is preallocated
+        if (block) {
+            _waitForSpace();
+        }
+        return Error::Ok;
+    }
+    Error processEvent(View<Event> event) {
+        if (event && event->type() == Event::FlushRequested) {
+            std::lock_guard lock(mMutex);
+            _clear();
+        }
         return Error::Ok;
     }
+
+    void setCapacity(size_t capacity, Policy policy) override {
+        std::unique_lock lock(mMutex);
+        // Keep the latest ones on shrinking
+        while (capacity && mCount > capacity) {
+            _popFront();
+            mDropped += 1;
+        }
+        mCapacity = capacity;
+        mPolicy = policy;
+        _resizeRing(capacity ? capacity + 1 : std::max(mCount, MinRingSize)); //< A slot for the item over the capacity
+        lock.unlock();
+        mSpaceWaiter.notify();
+    }
+    size_t dropped() const override {
+        return mDropped.load(std::memory_order_relaxed);
+    }
+
     Error pull(Arc<Resource> *resource, int timeout) override {
         if (!resource) {
             return Error::InvalidArguments;
         }
-        if (mQueue.wait(resource, timeout)) {
-            return Error::Ok;
+        Ref<Resource> ref;
+        size_t count = 1;
+        if (auto err = pull(&ref, &count, timeout); err != Error::Ok) {
+            return err;
         }
-        return Error::TemporarilyUnavailable;
+        *resource = ref->shared_from_this(); //< Arc only at the API boundary
+        return Error::Ok;
+    }
+    Error pull(Ref<Resource> *resources, size_t *count, int timeout) override {
+        if (!resources || !count || *count == 0) {
+            return Error::InvalidArguments;
+        }
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::max(timeout, 0));
+        std::unique_lock lock(mMutex);
+        while (mCount == 0) {
+            if (timeout == 0) {
+                *count = 0;
+                return Error::TemporarilyUnavailable;
+            }
+            if (timeout < 0) {
+                mCondition.wait(lock);
+            }
+            else if (mCondition.wait_until(lock, deadline) == std::cv_status::timeout && mCount == 0) {
+                *count = 0;
+                return Error::TemporarilyUnavailable;
+            }
+        }
+        size_t n = std::min(*count, mCount);
+        for (size_t i = 0; i < n; i++) {
+            resources[i] = _popFront();
+        }
+        lock.unlock();
+        mSpaceWaiter.notify();
+
+        *count = n;
+        return Error::Ok;
     }
 private:
-    BlockingQueue<Arc<Resource> > mQueue;
-    Pad                          *mSink = nullptr;
+    static constexpr size_t MinRingSize = 16;
+
+    void _stopFlowing() {
+        mFlowing = false;
+        mSpaceWaiter.notify();
+    }
+    void _waitForSpace() {
+        while (mFlowing) {
+            {
+                std::lock_guard lock(mMutex);
+                if (mCount <= mCapacity || mCapacity == 0 || mPolicy != Block) {
+                    return;
+                }
+            }
+            if (mSpaceWaiter.wait() != Error::Ok) {
+                // Interrupted by a task of the producer's thread, or a coroutine producer, the item is kept
+                return;
+            }
+        }
+    }
+    // The ring, protected by mMutex
+    void _pushBack(Ref<Resource> &&resource) {
+        if (mCount == mRing.size()) {
+            // Only grows on unbounded
+            _resizeRing(mRing.size() * 2);
+        }
+        mRing[(mHead + mCount) % mRing.size()] = std::move(resource);
+        mCount += 1;
+    }
+    Ref<Resource> _popFront() {
+        auto resource = std::move(mRing[mHead]);
+        mHead = (mHead + 1) % mRing.size();
+        mCount -= 1;
+        return resource;
+    }
+    void _resizeRing(size_t size) {
+        if (size == mRing.size()) {
+            return;
+        }
+        Vec<Ref<Resource> > ring(size);
+        for (size_t i = 0; i < mCount; i++) {
+            ring[i] = std::move(mRing[(mHead + i) % mRing.size()]);
+        }
+        mRing = std::move(ring);
+        mHead = 0;
+    }
+    void _clear() {
+        while (mCount) {
+            _popFront();
+        }
+        mSpaceWaiter.notify();
+    }
+
+    Vec<Ref<Resource> >     mRing; //< Preallocated slots, capacity + 1 on bounded
+    size_t                  mHead = 0;
+    size_t                  mCount = 0;
+    size_t                  mCapacity = 0; //< 0 on unbounded
+    Policy                  mPolicy = Block;
+    std::mutex              mMutex;
+    std::condition_variable mCondition; //< Application waits for data
+    Waiter                  mSpaceWaiter; //< Producer waits for free space
+    Atomic<bool>            mFlowing {false};
+    Atomic<size_t>          mDropped {0};
+    Pad                    *mSink = nullptr;
 };
 
 NEKO_REGISTER_ELEMENT(AppSink, AppSinkImpl);
@@ -6,6 +6,31 @@ NEKO_NS_BEGIN
 
 class AppSink : public Element {
 public:
+    /**
+     * @brief What to do when a resource comes to a full sink
+     * 
+     */
+    enum Policy : int {
+        Block,      //< Block the producer until the application pulls (backpressure)
+        DropOldest, //< Drop the oldest resource in the sink, keep the latest ones
+        DropNewest, //< Drop the incoming resource
+    };
+
+    /**
+     * @brief Set the capacity of the sink, the slots are preallocated
+     * @details In Block policy, the producer is released on pause / stop, the resources over the capacity are dropped then
+     * 
+     * @param capacity The max number of resources, 0 on unbounded (default)
+     * @param policy The policy on full
+     */
+    virtual void   setCapacity(size_t capacity, Policy policy = Block) = 0;
+    /**
+     * @brief Get the number of dropped resources by the policy
+     * 
+     * @return size_t 
+     */
+    virtual size_t dropped() const = 0;
+
     /**
      * @brief Pull the sink to get resource in queue
      * 
@@ -14,7 +39,29 @@ public:
      * @return Error 
      */
     virtual Error pull(Arc<Resource> *resource, int timeout = 0) = 0;
+    /**
+     * @brief Pull a batch of resources at once, without any copy or conversion
+     * @details The resources are lent to the application, read the frame memory in place, 
+     * drop the Ref to release the frame (and its buffer) back to the upstream pool.
+     * 
+     * @param resources The array to fill
+     * @param count [in] The size of array, [out] The number of resources filled
+     * @param timeout The timeout in millseconds to wait for the first one, 0 on no-blocking, -1 on INF
+     * @return Error TemporarilyUnavailable on nothing pulled
+     */
+    virtual Error pull(Ref<Resource> *resources, size_t *count, int timeout = 0) = 0;
 
+    /**
+     * @brief Pull a resource without any copy or conversion, see the batch one
+     * 
+     * @param resource 
+     * @param timeout 
+     * @return Error 
+     */
+    inline Error pull(Ref<Resource> *resource, int timeout = 0) {
+        size_t count = 1;
+        return pull(resource, &count, timeout);
+    }
     /**
      * @brief Pull the sink to get resource in queue
      * 
@@ -38,4 +85,4 @@ public:
     }
 };
 
-NEKO_NS_END
\ No newline at end of file
+NEKO_NS_END
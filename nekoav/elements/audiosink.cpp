@@ -1,5 +1,7 @@
 #define _NEKO_SOURCE
 #include "../detail/template.hpp"
+#include "../threading.hpp"
+#include "../context.hpp"
 #include "../factory.hpp"
 #include "../media.hpp"
 #include "../log.hpp"
@@ -24,13 +26,15 @@ public:
             // SampleFormat::S32, 
             SampleFormat::FLT
         });
-        pad->setCallback(std::bind(&AudioSinkImpl::processInput, this, std::placeholders::_1));
+        pad->setTypedCallback<MediaFrame, &AudioSinkImpl::processInput>(this);
         pad->setEventCallback([this](View<Event> event) {
             if (event->type() == Event::FlushRequested) {
-                std::lock_guard locker(mMutex);
+                std::unique_lock locker(mMutex);
                 while (!mFrames.empty()) {
                     mFrames.pop();
                 }
+                locker.unlock();
+                mSpaceWaiter.notify();
                 NEKO_DEBUG("Flush Queue");
                 return Error::Ok;
             }
@@ -50,6 +54,8 @@ public:
         mDevice->setCallback(std::bind(&AudioSinkImpl::audioCallback, this, std::placeholders::_1, std::placeholders::_2));
 
         mController = GetMediaController(this);
+        mPolicies = context() ? context()->queryObject<ThreadPolicyTable>() : nullptr;
+        mPolicyApplied = false;
         return Error::Ok;
     }
     Error onTeardown() override {
@@ -61,31 +67,33 @@ public:
         if (mDevice) {
             mDevice->pause(true);
         }
+        mFlowing = false;
+        mSpaceWaiter.notify();
         return Error::Ok;
     }
     Error onStop() override {
-        std::lock_guard locker(mMutex);
+        std::unique_lock locker(mMutex);
         while (!mFrames.empty()) {
             mFrames.pop();
         }
+        locker.unlock();
+        mFlowing = false;
+        mSpaceWaiter.notify();
         return Error::Ok;
     }
     Error onRun() override {
         if (mDevice) {
             mDevice->pause(false);
         }
+        mFlowing = true;
         return Error::Ok;
     }
-    Error processInput(ResourceView resourceView) {
+    Error processInput(View<MediaFrame> frame) {
         if (state() != State::Running && state() != State::Paused) {
             NEKO_DEBUG("Can not process input at this state");
             NEKO_DEBUG(state());
             return Error::TemporarilyUnavailable;
         }
-        auto frame = resourceView.viewAs<MediaFrame>();
-        if (!frame) {
-            return Error::UnsupportedResource;
-        }
         if (!mOpened) {
             // Try open it
             mOpened = mDevice->open(frame->sampleFormat(), frame->sampleRate(), frame->channels());
@@ -103,12 +111,13 @@ public:
 
         // Is Opened, write to queue
         std::unique_lock lock(mMutex);
-        mFrames.push(frame->shared_from_this<MediaFrame>());
-        while (state() == State::Running && mFrames.size() > mMaxFrames) {
+        mFrames.push(frame.get());
+        while (mFlowing && mFrames.size() > mMaxFrames) {
             lock.unlock();
-            if (Thread::msleep(10) == Error::Interrupted) {
-                // In current thread, new task ready
-                NEKO_DEBUG("Current Thread::msleep interrupted");
+            // Audio callback notify us when it take one
+            if (mSpaceWaiter.wait() != Error::Ok) {
+                // In current thread, new task ready, or the caller is a coroutine
+                NEKO_DEBUG("Current Thread interrupted");
                 return Error::Ok;
             }
             lock.lock();
@@ -123,6 +132,13 @@ public:
         return ClockType::Audio;
     }
     void audioCallback(void *_buf, int len) {
+        if (!mPolicyApplied) {
+            // The callback thread is owned by the device, apply at the first call
+            mPolicyApplied = true;
+            if (mPolicies) {
+                mPolicies->apply(ThreadRole::AudioSink);
+            }
+        }
         auto buf = reinterpret_cast<uint8_t*>(_buf);
         while (len > 0) {
             // No current frame
@@ -134,6 +150,7 @@ public:
                 mCurrentFramePosition = 0; //< Reset position
                 mCurrentFrame = std::move(mFrames.front());
                 mFrames.pop();
+                mSpaceWaiter.notify();
 
                 // Update audio clock
                 mPosition = mCurrentFrame->timestamp();
@@ -185,10 +202,14 @@ private:
 
     // Audio Callback data
     mutable std::mutex           mMutex;
-    std::queue<Arc<MediaFrame> > mFrames;
-    Arc<MediaFrame>              mCurrentFrame;
+    std::queue<Ref<MediaFrame> > mFrames;
+    Ref<MediaFrame>              mCurrentFrame;
+    Waiter                       mSpaceWaiter; //< processInput() wait for free space
+    Atomic<bool>                 mFlowing {false}; //< Between onRun and onPause / onStop
     int                          mCurrentFramePosition = 0;
     size_t                       mMaxFrames = 10;
+    const ThreadPolicyTable     *mPolicies = nullptr;
+    bool                         mPolicyApplied = false;
 };
 
 NEKO_REGISTER_ELEMENT(AudioSink, AudioSinkImpl);
@@ -15,13 +15,37 @@ public:
      * @code {.cpp}
      *  setKernel(array, 3, 3); //< 3x3 
      * @endcode
-     * 
+     * @details It can be called from any thread, the kernel is applied from the next pushed frame,
+     * the frames in flight on OpenCL are pushed before it
      * 
      * @param kernel 
      * @param kernelCol 
      * @param kernelRow 
      */
     virtual Error setKernel(const double *kernel, int kernelCol, int kernelRow) = 0;
+    /**
+     * @brief Set the number of threads of the CPU path, every frame is split into bands of rows
+     * @details It takes effect at the next initialize
+     * 
+     * @param numOfThreads The number of threads including the pushing one (0 on auto, 1 on the pushing thread only)
+     */
+    virtual void  setNumOfThreads(size_t numOfThreads) = 0;
+    /**
+     * @brief Use the fixed point path on CPU (int16 weights, int32 sums), the OpenCL path is always float
+     * @details The result differs from the float one by 1 at most on the weights exact in 1 / 16384 (like the presets),
+     * see Convolver::fixedPointError() for the others
+     * 
+     * @param fixedPoint 
+     */
+    virtual void  setFixedPoint(bool fixedPoint) = 0;
+    /**
+     * @brief Set the number of frames in flight on the OpenCL path, the upload, compute and download of them overlap
+     * @details 1 (default) is blocking. N keeps N - 1 frames until the next ones come, so it adds N - 1 frames of latency,
+     * they are pushed on MediaEndOfFile and dropped on FlushRequested. It takes effect at the next frame size change or initialize
+     * 
+     * @param numOfFrames In [1, 3]
+     */
+    virtual void  setNumOfFramesInFlight(size_t numOfFrames) = 0;
 
     inline Error setEdgeDetectKernel() {
         const double kernel[3][3] = {
@@ -1,24 +1,18 @@
 #define _NEKO_SOURCE
 
 #include "../hwcontext/opencl.hpp"
+#include "../media/convolve.hpp"
 #include "../media/frame.hpp"
 #include "../detail/base.hpp"
 #include "../threading.hpp"
+#include "../allocator.hpp"
 #include "../factory.hpp"
 #include "../libc.hpp"
 #include "../log.hpp"
 #include "../time.hpp"
 #include "../pad.hpp"
 #include "filters.hpp"
-
-// Check OpenMP
-#if defined(_OPENMP)
-    #include <omp.h>
-    #define OMP_Pragma(x) _Pragma(x)
-#else
-    #define OMP_Pragma(x)
-#endif
-
+#include <mutex>
 
 NEKO_NS_BEGIN
 
@@ -51,33 +45,64 @@ __kernel void convolution(__read_only image2d_t input, __write_only image2d_t ou
 )";
 
 class KernelFilterImpl final : public Impl<KernelFilter> {
+    /**
+     * @brief A slot of a frame on the OpenCL path, the upload, the compute and the download are chained by events
+     * 
+     */
+    struct InFlight {
+        cl::Image2D     srcImage;
+        cl::Image2D     dstImage;
+        cl::Buffer      upload;   //< Pinned staging of the source
+        cl::Buffer      download; //< Pinned staging of the result
+        void           *uploadPtr = nullptr; //< Mapped for the whole life of the buffer
+        void           *downloadPtr = nullptr;
+        cl::Event       done;     //< The download completed
+        Ref<MediaFrame> frame;    //< The frame waiting for the result, nullptr on free slot
+    };
 public:
     KernelFilterImpl() {
         mSink->addProperty(Properties::PixelFormatList, {PixelFormat::RGBA});
     }
     Error onInitialize() override {
-        mApply = &KernelFilterImpl::_applyOnCPU;
+        size_t numOfThreads = mNumOfThreads;
+        if (numOfThreads == 0) {
+            numOfThreads = std::clamp<size_t>(std::thread::hardware_concurrency(), 1, MaxAutoThreads);
+        }
+        mSlices.setNumOfThreads(numOfThreads);
 
         // OpenCL parts
         mOpenCLContext = OpenCLContext::create(this);
         if (mOpenCLContext) {
-            mApply = &KernelFilterImpl::_applyOnOpenCL;
-            if (!mKernel.empty()) {
-                _compileCLProgram();
+            // The transfers have their own queues, so they overlap the compute of the other frames
+            cl_int err = CL_SUCCESS;
+            auto device = mOpenCLContext->context().getInfo<CL_CONTEXT_DEVICES>().front();
+            mUploadQueue = cl::CommandQueue(mOpenCLContext->context(), device, 0, &err);
+            if (err == CL_SUCCESS) {
+                mDownloadQueue = cl::CommandQueue(mOpenCLContext->context(), device, 0, &err);
+            }
+            if (err != CL_SUCCESS) {
+                NEKO_DEBUG(GetOpenCLErrorCodeName(err));
+                mOpenCLContext->releaseObjects(&mUploadQueue, &mDownloadQueue);
+                mOpenCLContext.reset(); //< Fallback to CPU
             }
         }
+        _takeKernel();
+        if (mOpenCLContext && !mKernel.empty()) {
+            _compileCLProgram();
+        }
         return Error::Ok;
     }
     Error onTeardown() override {
-        // Cleanup opencl
+        // Cleanup opencl, the frames in flight are dropped
         if (mOpenCLContext) {
-            mOpenCLContext->releaseObjects(&mSrcImage, &mDstImage, &mSampler, &mProgram, &mCLKernel);
+            _drainOpenCL(false);
+            _freeOpenCL();
+            mOpenCLContext->releaseObjects(&mSampler, &mProgram, &mCLKernel, &mUploadQueue, &mDownloadQueue);
             mOpenCLContext.reset();
         }
 
-        std::free(mRGBABuffer);
-        mRGBABuffer = nullptr;
-        mRGBABufferSize = 0;
+        _freeBuffer();
+        mSlices.setNumOfThreads(1);
         return Error::Ok;
     }
 
@@ -86,15 +111,23 @@ public:
         if (kernelCol <= 0 || kernelRow <= 0 || kernel == nullptr) {
             return Error::InvalidArguments;
         }
-        mKernelCol = kernelCol;
-        mKernelRow = kernelRow;
-        mKernel.assign(kernel, kernel + kernelCol * kernelRow);
-
-        if (mOpenCLContext) {
-            _compileCLProgram();
-        }
+        // Applied by the next push, the frames in flight and the CPU bands still use the current one
+        std::lock_guard lock(mPendingMutex);
+        mPendingKernel.assign(kernel, kernel + kernelCol * kernelRow);
+        mPendingCol = kernelCol;
+        mPendingRow = kernelRow;
+        mKernelChanged.store(true, std::memory_order_release);
         return Error::Ok;
     }
+    void setNumOfThreads(size_t numOfThreads) override {
+        mNumOfThreads = numOfThreads;
+    }
+    void setFixedPoint(bool fixedPoint) override {
+        mConvolver.setFixedPoint(fixedPoint);
+    }
+    void setNumOfFramesInFlight(size_t numOfFrames) override {
+        mNumOfFramesInFlight = std::clamp<size_t>(numOfFrames, 1, MaxFramesInFlight);
+    }
     Error _applyOnCPU(MediaFrame *frame) {
         if (auto err = frame->makeWritable(); !err) {
             return Error::Unknown;
@@ -102,116 +135,190 @@ public:
         uint8_t *dst = (uint8_t*) frame->data(0);
         int width = frame->width();
         int height = frame->height();
-        _resizeBuffer(width * height * 4);
-
-
-        ::memcpy(mRGBABuffer, dst, width * height * 4);
-
-        // Begin 
-        double sum[4] {0, 0, 0, 0};
-        
-        for (int y = 0; y < height; y++) {
-            for (int x = 0; x < width; x++) {
-                uint8_t *src = mRGBABuffer + (y * width + x) * 4;
-
-                OMP_Pragma("omp parallel for")
-                for (int i = 0; i < mKernelRow; i++) {
-                    for (int j = 0; j < mKernelCol; j++) {
-                        int xx = x + j - mKernelCol / 2;
-                        int yy = y + i - mKernelRow / 2;
-
-                        // Mirror coord if out of 
-                        if (xx < 0) {
-                            xx = -xx;
-                        } 
-                        else if (xx >= width) {
-                            xx = 2 * width - 1 - xx;
-                        }
-                        if (yy < 0) {
-                            yy = -yy;
-                        } 
-                        else if (yy >= height) {
-                            yy = 2 * height - 1 - yy;
-                        }
-
-                        if (xx >= 0 && xx < width && yy >= 0 && yy < height) {
-                            uint8_t *src2 = mRGBABuffer + (yy * width + xx) * 4;
-                            sum[0] += mKernel[i * mKernelCol + j] * src2[0];
-                            sum[1] += mKernel[i * mKernelCol + j] * src2[1];
-                            sum[2] += mKernel[i * mKernelCol + j] * src2[2];
-                            sum[3] += mKernel[i * mKernelCol + j] * src2[3];
-                        }
-                    }
-                }
-
-                for (auto &v : sum) {
-                    v = std::clamp(v, 0.0, 255.0);
-                }
-
-                dst[(y * width + x) * 4 + 0] = sum[0];
-                dst[(y * width + x) * 4 + 1] = sum[1];
-                dst[(y * width + x) * 4 + 2] = sum[2];
-                // dst[(y * width + x) * 4 + 3] = sum[3];
+        int pitch = frame->linesize(0);
+        _resizeBuffer(size_t(pitch) * height);
 
-                for (auto &v : sum) {
-                    v = 0;
-                }
-            }
-        }
-        return Error::Ok;
+        // The source is a copy, the kernel reads the rows around the written one
+        ::memcpy(mRGBABuffer, dst, size_t(pitch) * height);
+        return mConvolver.apply(mRGBABuffer, pitch, dst, pitch, width, height, &mSlices);
     }
-    Error _applyOnOpenCL(MediaFrame *frame) {
-        frame->makeWritable();
-
-        cl_int err = 0;
-        auto &commandQueue = mOpenCLContext->commandQueue();
-        auto &ctxt = mOpenCLContext->context();
+    Error _submitOnOpenCL(MediaFrame *frame) {
+        if (auto err = frame->makeWritable(); !err) {
+            return Error::Unknown;
+        }
         int width = frame->width();
         int height = frame->height();
         int pitch = frame->linesize(0);
-        if (mSrcImage.get() == nullptr) {
-            cl::ImageFormat format(CL_RGBA, CL_UNORM_INT8);
-            mSrcImage = cl::Image2D(ctxt, CL_MEM_READ_ONLY, format, width, height, pitch, nullptr, &err);
-            if (err != CL_SUCCESS) { 
-                NEKO_DEBUG(GetOpenCLErrorCodeName(err)); 
+        if (width != mCLWidth || height != mCLHeight || pitch != mCLPitch) {
+            // The frames in flight are in the old size, push them before the images recreated
+            if (auto err = _drainOpenCL(true); err != Error::Ok) {
+                return err;
             }
-            mDstImage = cl::Image2D(ctxt, CL_MEM_WRITE_ONLY, format, width, height, pitch, nullptr, &err);
-            if (err != CL_SUCCESS) { 
-                NEKO_DEBUG(GetOpenCLErrorCodeName(err)); 
+            if (auto err = _allocOpenCL(width, height, pitch); err != Error::Ok) {
+                return err;
             }
-            mSampler = cl::Sampler(ctxt, CL_FALSE, CL_ADDRESS_MIRRORED_REPEAT, CL_FILTER_NEAREST, &err);
-            if (err != CL_SUCCESS) { 
-                NEKO_DEBUG(GetOpenCLErrorCodeName(err)); 
+        }
+
+        NEKO_TRACE_TIME(duration) {
+            // The slots are a ring, the next one is the oldest in flight
+            auto &slot = mSlots[mNextSlot];
+            mNextSlot = (mNextSlot + 1) % mSlots.size();
+
+            cl_int err = CL_SUCCESS;
+            cl::Event uploaded;
+            cl::Event computed;
+            cl::array<cl::size_type, 2> origin = {0, 0};
+            cl::array<cl::size_type, 2> region = {cl::size_type(width), cl::size_type(height)};
+            ::memcpy(slot.uploadPtr, frame->data(0), size_t(pitch) * height);
+            err = mUploadQueue.enqueueWriteImage(slot.srcImage, CL_FALSE, origin, region, pitch, 0, slot.uploadPtr, nullptr, &uploaded);
+            if (err == CL_SUCCESS) {
+                mCLKernel.setArg(0, slot.srcImage);
+                mCLKernel.setArg(1, slot.dstImage);
+                mCLKernel.setArg(2, mSampler);
+                cl::vector<cl::Event> waits {uploaded};
+                err = mOpenCLContext->commandQueue().enqueueNDRangeKernel(
+                    mCLKernel, cl::NullRange, cl::NDRange(width, height), cl::NullRange, &waits, &computed
+                );
+            }
+            if (err == CL_SUCCESS) {
+                cl::vector<cl::Event> waits {computed};
+                err = mDownloadQueue.enqueueReadImage(slot.dstImage, CL_FALSE, origin, region, pitch, 0, slot.downloadPtr, &waits, &slot.done);
+            }
+            if (err != CL_SUCCESS) {
+                NEKO_DEBUG(GetOpenCLErrorCodeName(err));
+                return Error::External;
             }
+            // Start them now, not on the wait
+            mUploadQueue.flush();
+            mOpenCLContext->commandQueue().flush();
+            mDownloadQueue.flush();
+            slot.frame = frame;
         }
+        mTimeCosted = duration;
 
-        // Update to buffer
-        cl::array<cl::size_type, 2> origin = {0, 0};
-        cl::array<cl::size_type, 2> region = {cl::size_type(width), cl::size_type(height)};
-        err = commandQueue.enqueueWriteImage(mSrcImage, CL_TRUE, origin, region, pitch, 0, frame->data(0));
-        // err = commandQueue.enqueueReadImage(mSrcImage, CL_TRUE, origin, region, 0, 0, frame->data(0));
-        if (err != CL_SUCCESS) { 
-            NEKO_DEBUG(GetOpenCLErrorCodeName(err)); 
+        // Keep numOfFramesInFlight - 1 frames, so 1 is blocking
+        if (auto &oldest = mSlots[mNextSlot]; oldest.frame) {
+            return _retireOnOpenCL(oldest, true);
         }
+        return Error::Ok;
+    }
+    Error _retireOnOpenCL(InFlight &slot, bool push) {
+        auto err = slot.done.wait();
+        auto frame = std::move(slot.frame);
+        slot.done = cl::Event();
+        if (err != CL_SUCCESS) {
+            NEKO_DEBUG(GetOpenCLErrorCodeName(err));
+            return Error::External;
+        }
+        if (!push) {
+            return Error::Ok;
+        }
+        ::memcpy(frame->data(0), slot.downloadPtr, size_t(mCLPitch) * mCLHeight);
+        return pushTo(mSrc, frame);
+    }
+    Error _drainOpenCL(bool push) {
+        Error result = Error::Ok;
+        for (size_t n = 0; n < mSlots.size(); n++) {
+            auto &slot = mSlots[(mNextSlot + n) % mSlots.size()];
+            if (!slot.frame) {
+                continue;
+            }
+            if (auto err = _retireOnOpenCL(slot, push); result == Error::Ok) {
+                result = err;
+            }
+        }
+        return result;
+    }
+    Error _allocOpenCL(int width, int height, int pitch) {
+        _freeOpenCL();
 
-        cl::KernelFunctor<cl::Image2D, cl::Image2D, cl::Sampler> fn {mCLKernel};
-        fn(
-            cl::EnqueueArgs(commandQueue, cl::NDRange(width, height)), 
-            mSrcImage, 
-            mDstImage, 
-            mSampler, 
-            err
-        );
-        if (err != CL_SUCCESS) { 
-            NEKO_DEBUG(GetOpenCLErrorCodeName(err)); 
-        }
-        err = commandQueue.enqueueReadImage(mDstImage, CL_TRUE, origin, region, pitch, 0, frame->data(0));
-        if (err != CL_SUCCESS) { 
-            NEKO_DEBUG(GetOpenCLErrorCodeName(err)); 
+        cl_int err = CL_SUCCESS;
+        auto &ctxt = mOpenCLContext->context();
+        auto check = [&]() {
+            if (err != CL_SUCCESS) {
+                NEKO_DEBUG(GetOpenCLErrorCodeName(err));
+            }
+            return err == CL_SUCCESS;
+        };
+        if (mSampler.get() == nullptr) {
+            mSampler = cl::Sampler(ctxt, CL_FALSE, CL_ADDRESS_MIRRORED_REPEAT, CL_FILTER_NEAREST, &err);
+            if (!check()) {
+                return Error::External;
+            }
+        }
+        // Pinned (CL_MEM_ALLOC_HOST_PTR) staging buffers, mapped for the whole life, are the fast path of the transfers
+        cl::ImageFormat format(CL_RGBA, CL_UNORM_INT8);
+        size_t size = size_t(pitch) * height;
+        mSlots.resize(mNumOfFramesInFlight.load());
+        for (auto &slot : mSlots) {
+            slot.srcImage = cl::Image2D(ctxt, CL_MEM_READ_ONLY, format, width, height, 0, nullptr, &err);
+            if (check()) {
+                slot.dstImage = cl::Image2D(ctxt, CL_MEM_WRITE_ONLY, format, width, height, 0, nullptr, &err);
+            }
+            if (check()) {
+                slot.upload = cl::Buffer(ctxt, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, size, nullptr, &err);
+            }
+            if (check()) {
+                slot.uploadPtr = mUploadQueue.enqueueMapBuffer(slot.upload, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, size, nullptr, nullptr, &err);
+            }
+            if (check()) {
+                slot.download = cl::Buffer(ctxt, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, size, nullptr, &err);
+            }
+            if (check()) {
+                slot.downloadPtr = mDownloadQueue.enqueueMapBuffer(slot.download, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, size, nullptr, nullptr, &err);
+            }
+            if (!check()) {
+                _freeOpenCL();
+                return Error::External;
+            }
         }
+        mCLWidth = width;
+        mCLHeight = height;
+        mCLPitch = pitch;
+        mNextSlot = 0;
         return Error::Ok;
     }
+    void _freeOpenCL() {
+        for (auto &slot : mSlots) {
+            if (slot.uploadPtr) {
+                mUploadQueue.enqueueUnmapMemObject(slot.upload, slot.uploadPtr);
+            }
+            if (slot.downloadPtr) {
+                mDownloadQueue.enqueueUnmapMemObject(slot.download, slot.downloadPtr);
+            }
+        }
+        if (!mSlots.empty()) {
+            mUploadQueue.finish();
+            mDownloadQueue.finish();
+        }
+        mSlots.clear();
+        mCLWidth = 0;
+        mCLHeight = 0;
+        mCLPitch = 0;
+        mNextSlot = 0;
+    }
+    Error onSinkEvent(View<Pad>, View<Event> event) override {
+        if (!mSlots.empty()) {
+            // The frames before a flush are stale, the last ones of the media have no next frame to push them
+            if (event->type() == Event::FlushRequested) {
+                _drainOpenCL(false);
+            }
+            else if (event->type() == Event::MediaEndOfFile) {
+                _drainOpenCL(true);
+            }
+        }
+        return pushEventToDownstream(event);
+    }
     Error onSinkPush(View<Pad>, View<Resource> resource) override {
+        if (mKernelChanged.load(std::memory_order_acquire) && _takeKernel() && mOpenCLContext) {
+            // Rebuild here, never under a submit, the frames in flight keep the order of the old program
+            if (!mSlots.empty()) {
+                if (auto err = _drainOpenCL(true); err != Error::Ok) {
+                    return err;
+                }
+            }
+            _compileCLProgram();
+        }
         if (mKernel.empty()) {
             // Just forward
             return pushTo(mSrc, resource);
@@ -220,8 +327,18 @@ public:
         if (!frame) {
             return Error::UnsupportedResource;
         }
+        if (mCLKernel.get()) {
+            // Pushed on retired, numOfFramesInFlight - 1 frames later
+            return _submitOnOpenCL(frame);
+        }
+        if (!mSlots.empty()) {
+            // The new kernel failed to build, the frames in flight go out before this one
+            if (auto err = _drainOpenCL(true); err != Error::Ok) {
+                return err;
+            }
+        }
         NEKO_TRACE_TIME(duration) {
-            if (auto err = std::invoke(mApply, this, frame); err != Error::Ok) {
+            if (auto err = _applyOnCPU(frame); err != Error::Ok) {
                 return err;
             }
         }
@@ -230,13 +347,38 @@ public:
     }
     void _resizeBuffer(size_t size) {
         if (mRGBABufferSize < size) {
-            mRGBABuffer = (uint8_t *) std::realloc(mRGBABuffer, size);
+            // Content is overwritten by the caller, no need to keep it
+            _freeBuffer();
+            mRGBAResource = GetFrameMemoryResource(); //< Huge pages on opted in, a 4K frame is 33 MB
+            mRGBABuffer = static_cast<uint8_t *>(mRGBAResource->allocate(size, 64));
             mRGBABufferSize = size;
         }
     }
+    void _freeBuffer() {
+        if (mRGBABuffer) {
+            mRGBAResource->deallocate(mRGBABuffer, mRGBABufferSize, 64);
+        }
+        mRGBABuffer = nullptr;
+        mRGBABufferSize = 0;
+    }
+    // Take the kernel given by setKernel(), return false on nothing changed
+    bool _takeKernel() {
+        std::unique_lock lock(mPendingMutex);
+        if (!mKernelChanged.exchange(false, std::memory_order_acquire)) {
+            return false;
+        }
+        mKernel.swap(mPendingKernel);
+        mKernelCol = mPendingCol;
+        mKernelRow = mPendingRow;
+        lock.unlock();
+        mConvolver.setKernel(mKernel.data(), mKernelCol, mKernelRow);
+        return true;
+    }
     Error _compileCLProgram() {
         std::string programCode;
         cl_int err = 0;
+        mCLKernel = cl::Kernel(); //< CPU on failed
+
         auto [major, minor] = mOpenCLContext->version();
         if (major >= 2) {
             programCode += "#define UNROLL\n"; //< OpenCL 2.0 support __attribute__((opencl_unroll_hint))
@@ -245,7 +387,7 @@ public:
         for (int i = 0; i < mKernelRow; i++) {
             programCode.append("{ ");
             for (int j = 0; j < mKernelCol; j++) {
-                libc::sprintf(&programCode, "%.2f, ", mKernel[i * mKernelCol + j]);
+                libc::sprintf(&programCode, "%.9g, ", mKernel[i * mKernelCol + j]); //< Round trip of float
             }
             // Remove ", "
             programCode.pop_back();
@@ -282,24 +424,42 @@ private:
     int mKernelCol = 0;
     int mKernelRow = 0;
 
+    std::mutex   mPendingMutex; //< Guard the kernel given by setKernel() from any thread
+    Vec<double>  mPendingKernel;
+    int          mPendingCol = 0;
+    int          mPendingRow = 0;
+    Atomic<bool> mKernelChanged {false};
+
     Pad *mSink = addInput("sink");
     Pad *mSrc = addOutput("src");
 
     int64_t mTimeCosted = 0;
 
     // OpenCL part
+    static constexpr size_t MaxFramesInFlight = 3;
+
     Arc<OpenCLContext> mOpenCLContext; //< A sharing context for compute
-    cl::Image2D        mSrcImage;
-    cl::Image2D        mDstImage;
+    cl::CommandQueue   mUploadQueue;
+    cl::CommandQueue   mDownloadQueue;
     cl::Sampler        mSampler;
     cl::Program        mProgram;
-    cl::Kernel         mCLKernel;
+    cl::Kernel         mCLKernel; //< nullptr on the CPU path
+    Vec<InFlight>      mSlots; //< The ring of frames in flight, in the size below
+    size_t             mNextSlot = 0;
+    Atomic<size_t>     mNumOfFramesInFlight {1}; //< Set at the app thread, read at initialize
+    int                mCLWidth = 0;
+    int                mCLHeight = 0;
+    int                mCLPitch = 0;
 
     // Plain CPU
-    uint8_t *mRGBABuffer = nullptr;
-    size_t   mRGBABufferSize = 0;
-
-    Error (KernelFilterImpl::*mApply)(MediaFrame *) = nullptr;
+    static constexpr size_t MaxAutoThreads = 4; //< Auto threads are capped, the decoder and converter need the cores too
+
+    Convolver                  mConvolver; //< The separable / tiled convolution of mKernel
+    SliceRunner                mSlices; //< Threads applying the bands of a frame
+    Atomic<size_t>             mNumOfThreads {0}; //< 0 on auto, set at the app thread
+    uint8_t                   *mRGBABuffer = nullptr;
+    size_t                     mRGBABufferSize = 0;
+    std::pmr::memory_resource *mRGBAResource = nullptr; //< Where mRGBABuffer comes from
 };
 
 NEKO_REGISTER_ELEMENT(KernelFilter, KernelFilterImpl);
@@ -1,5 +1,8 @@
 #define _NEKO_SOURCE
+#include "../detail/queue.hpp"
+#include "../allocator.hpp"
 #include "../threading.hpp"
+#include "../context.hpp"
 #include "../factory.hpp"
 #include "../event.hpp"
 #include "../media.hpp"
@@ -9,18 +12,23 @@
 
 #include <mutex>
 #include <queue>
+#include <deque>
 #include <thread>
 #include <condition_variable>
+#include <cmath>
 
 NEKO_NS_BEGIN
 
 class MediaQueueImpl final : public MediaQueue, public MediaElement {
+    class Item;
+
+    static constexpr size_t MaxDrainBatch = 64; //< Max items pushed by a drain task before yield the worker
 public:
     MediaQueueImpl() {
         mSink = addInput("sink");
         mSrc = addOutput("src");
 
-        mSink->setCallback(std::bind(&MediaQueueImpl::_processInput, this, std::placeholders::_1));
+        mSink->setTypedCallback<Resource, &MediaQueueImpl::_processInput>(this);
         mSink->setEventCallback(std::bind(&MediaQueueImpl::_processEvent, this, std::placeholders::_1));
     }
     ~MediaQueueImpl() {
@@ -32,16 +40,62 @@ public:
     }
     Error changeState(StateChange change) override {
         if (change == StateChange::Initialize) {
+            if (mMode == LockFree) {
+                // Ring buffer need a slot for the item pushed over the capacity
+                mRing.reset(mMaxSize + 1);
+            }
             mRunning = true;
-            mThread = new Thread(&MediaQueueImpl::_threadEntry, this);
+            mBudget = context() ? context()->queryObject<MemoryBudget>() : nullptr;
+            if (mBudget) {
+                mBudget->join(&mSpaceWaiter);
+            }
+            if (auto executor = context() ? context()->queryObject<Executor>() : nullptr; executor) {
+                // Event driven, the consumer is a drain task posted on push, no worker is kept blocked
+                mThread = executor->allocThread();
+                mThread->postTask([this]() { mThread->setName(name()); });
+                mEventDriven = true;
+                mDrainPosted = false;
+                return Error::Ok;
+            }
+            // Assign mThread before the entry runs, it uses mThread
+            mEventDriven = false;
+            mThread = new Thread();
+            if (auto policies = context() ? context()->queryObject<ThreadPolicyTable>() : nullptr; policies) {
+                // The decoders run at this thread
+                policies->apply(ThreadRole::Decoder, mThread);
+            }
+            mThread->postTask(std::bind(&MediaQueueImpl::_threadEntry, this));
+        }
+        else if (change == StateChange::Run) {
+            mFlowing = true;
+            if (mEventDriven) {
+                _scheduleDrain();
+            }
+            else {
+                mThread->wakeup();
+            }
+        }
+        else if (change == StateChange::Pause || change == StateChange::Stop) {
+            // Let the blocked producer return, state() is not updated until all changes done
+            mFlowing = false;
+            mSpaceWaiter.notify();
         }
         else if (change == StateChange::Teardown) {
+            std::unique_lock lock(mMutex);
             mRunning = false;
+            mFlowing = false;
+            lock.unlock();
+
             mCond.notify_one();
+            mSpaceWaiter.notify();
             delete mThread;
             mThread = nullptr;
 
             _clearQueue();
+            if (mBudget) {
+                mBudget->leave(&mSpaceWaiter);
+                mBudget = nullptr;
+            }
         }
         return Error::Ok;
     }
@@ -51,17 +105,22 @@ public:
         }
         
         Item item;
-        item.packet = resource.viewAs<MediaPacket>();
-        item.resource = resource->shared_from_this();
-        
-        if (item.packet) {
-            mDuration += item.packet->duration();
+        item.resource = resource.get();
+        if (auto packet = resource.viewAs<MediaPacket>(); packet) {
+            item.duration = packet->duration();
+            item.bytes = size_t(std::max<int64_t>(packet->size(), 0));
         }
-        else {
-            item.frame = resource.viewAs<MediaFrame>();
-            if (item.frame) {
-                mDuration += item.frame->duration();
-            }
+        else if (auto frame = resource.viewAs<MediaFrame>(); frame) {
+            item.duration = frame->duration();
+            item.bytes = frame->memorySize();
+        }
+        if (!std::isfinite(item.duration) || item.duration < 0) {
+            item.duration = 0.0; //< Unknown, like the video frames without the rate
+        }
+        _account(item, 1);
+
+        if (mMode == LockFree) {
+            return _pushRing(std::move(item));
         }
         return _pushItem(std::move(item));
     }
@@ -80,13 +139,23 @@ public:
         mInterrupted = true;
         mThread->postTask([&, this]() {
             mInterrupted = false;
+            if (mMode == LockFree && event->type() == Event::FlushRequested) {
+                // Only the consumer can drop items in ring, the producer is blocked by latch now
+                _dropRing();
+            }
             NEKO_LOG("Push {} event at {}", event->type(), name());
             mSrc->pushEvent(event);
+            if (mEventDriven) {
+                // Resume the drain interrupted by the event
+                _scheduleDrain();
+            }
             latch.count_down();
         });
+
         lock.unlock(); //< Protect mInterrupted and tasks, Critical Section of event
 
         mCond.notify_one();
+        mSpaceWaiter.notify();
         latch.wait();
         return Error::Ok;
     }
@@ -95,35 +164,96 @@ public:
         mQueue.emplace(std::move(item));
         lock.unlock();
 
-        mCond.notify_one();
+        if (mEventDriven) {
+            _scheduleDrain();
+        }
+        else {
+            mCond.notify_one();
+        }
 
-        lock.lock();
-        while (mQueue.size() > mMaxSize) {
-            lock.unlock();
+        // Throttle, the consumer notify us when it pop one
+        _waitForSpace([this]() {
+            std::lock_guard locker(mMutex);
+            return mQueue.size() <= mMaxSize && _hasBudget();
+        });
+        return Error::Ok;
+    }
+    Error _pushRing(auto &&item) {
+        // Enqueue first as the locked one, never drop. The ring is only full when a throttle wait was given up
+        // (pause, event, coroutine), the items go to the overflow until the consumer drained it, so the order is kept
+        if (mOverflowSize.load(std::memory_order_acquire) != 0 || !mRing.tryPush(std::move(item))) {
+            std::lock_guard locker(mOverflowMutex);
+            mOverflow.emplace_back(std::move(item));
+            mOverflowSize.fetch_add(1, std::memory_order_release);
+        }
+        _notifyConsumer();
 
-            if (Thread::msleep(10) == Error::Interrupted) {
-                // Interrupted
-                return Error::Ok;
+        // Throttle like the locked one, only block when over capacity
+        _waitForSpace([this]() { return _ringSize() <= mMaxSize && _hasBudget(); });
+        return Error::Ok;
+    }
+    /**
+     * @brief Block the producer (the item is already queued) until cond() or interrupted
+     * @details It gives up on event / state change, a new task arrived to the producer's thread,
+     * or the producer is a coroutine (the Waiter keeps its callback, the coroutine suspends and resumes on notify)
+     * 
+     * @return false on the wait was interrupted
+     */
+    template <typename Cond>
+    bool _waitForSpace(Cond &&cond) {
+        while (!cond()) {
+            if (!mRunning || mInterrupted || !mFlowing) {
+                return false;
             }
-            if (state() != State::Running) {
-                // If not running, return directly
-                return Error::Ok;
+            if (mSpaceWaiter.wait() != Error::Ok) {
+                return false;
             }
-
-            lock.lock();
         }
-        return Error::Ok;
+        return true;
+    }
+    size_t _ringSize() const noexcept {
+        return mRing.size() + mOverflowSize.load(std::memory_order_acquire);
+    }
+    // Pop the ring first, the overflow only holds the items newer than all of the ring
+    bool _tryPopRing(Item *item) {
+        if (mRing.tryPop(item)) {
+            return true;
+        }
+        if (mOverflowSize.load(std::memory_order_acquire) == 0) {
+            return false;
+        }
+        std::lock_guard locker(mOverflowMutex);
+        *item = std::move(mOverflow.front());
+        mOverflow.pop_front();
+        mOverflowSize.fetch_sub(1, std::memory_order_release);
+        return true;
+    }
+    void _notifyConsumer() {
+        if (mEventDriven) {
+            _scheduleDrain();
+            return;
+        }
+        // Pair with the fence in _pullRing, only take the lock if consumer is sleeping
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (mConsumerWaiting.load(std::memory_order_relaxed)) {
+            std::lock_guard lock(mMutex);
+            mCond.notify_one();
+        }
     }
     void _threadEntry() {
         mThread->setName(name().c_str());
         while (mRunning) {
-            mThread->dispatchTask();
-            while (state() == State::Running && mRunning) {
+            // Woken by Run or Teardown, state() is not updated yet, so check mFlowing
+            mThread->waitTask();
+            while (mFlowing && mRunning) {
                 mThread->dispatchTask();
-                _pullQueue();
+                if (mMode == LockFree) {
+                    _pullRing();
+                }
+                else {
+                    _pullQueue();
+                }
             }
-            std::this_thread::yield();
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
         }
     }
     void _pullQueue() {
@@ -138,32 +268,161 @@ public:
         if (!mQueue.empty()) {
             Item item = std::move(mQueue.front());
             mQueue.pop();
+            _account(item, -1);
             lock.unlock();
+            mSpaceWaiter.notify();
 
-            if (item.packet) {
-                mDuration -= item.packet->duration();
-            }
-            else if (item.frame) {
-                mDuration -= item.frame->duration();
-            }
             mSrc->push(item.resource);
 
             lock.lock();
         }
     }
+    void _pullRing() {
+        Item item;
+        if (!_tryPopRing(&item)) {
+            std::unique_lock lock(mMutex);
+            mConsumerWaiting = true;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            while (mRunning && !_tryPopRing(&item)) {
+                if (mInterrupted) {
+                    NEKO_DEBUG("Interrupted by pad event");
+                    mConsumerWaiting = false;
+                    return;
+                }
+                mCond.wait(lock);
+            }
+            mConsumerWaiting = false;
+            if (!item.resource) {
+                // Stopped
+                return;
+            }
+        }
+        _account(item, -1);
+        mSpaceWaiter.notify();
+
+        mSrc->push(item.resource);
+    }
+    /**
+     * @brief Post the drain task to the executor thread, if it is not posted yet
+     * 
+     */
+    void _scheduleDrain() {
+        if (mDrainPosted.exchange(true)) {
+            return;
+        }
+        std::lock_guard locker(mMutex);
+        if (mRunning) {
+            //< Under the lock, Teardown can not delete mThread now
+            mThread->postTask(std::bind(&MediaQueueImpl::_drain, this));
+        }
+    }
+    /**
+     * @brief The consumer on the executor, push the items until the queue is empty, then release the worker
+     * 
+     */
+    void _drain() {
+        // Clear it before pop, the item pushed after here posts a new drain
+        mDrainPosted = false;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        Item item;
+        for (size_t n = 0; mFlowing && mRunning; n++) {
+            if (mInterrupted) {
+                // The event task is posted, it posts the drain again after the event pushed
+                NEKO_DEBUG("Interrupted by pad event");
+                return;
+            }
+            if (n == MaxDrainBatch) {
+                // Yield the worker to other threads
+                _scheduleDrain();
+                return;
+            }
+            if (!_tryPop(&item)) {
+                return;
+            }
+            _account(item, -1);
+            mSpaceWaiter.notify();
+
+            mSrc->push(item.resource);
+            item.resource.reset();
+        }
+    }
+    bool _tryPop(Item *item) {
+        if (mMode == LockFree) {
+            return _tryPopRing(item);
+        }
+        std::lock_guard locker(mMutex);
+        if (mQueue.empty()) {
+            return false;
+        }
+        *item = std::move(mQueue.front());
+        mQueue.pop();
+        return true;
+    }
     void _clearQueue() {
         // Clear Queue
         std::lock_guard locker(mMutex);
         while (!mQueue.empty()) {
+            _account(mQueue.front(), -1);
             mQueue.pop();
         }
-        mDuration = 0.0;
+        if (mMode == LockFree && !mRunning) {
+            // No consumer now, it is safe to drop items here
+            _dropRing();
+        }
+        mSpaceWaiter.notify();
+    }
+    void _dropRing() {
+        Item item;
+        while (_tryPopRing(&item)) {
+            _account(item, -1);
+        }
+    }
+    /**
+     * @brief Add (sign = 1) or remove (sign = -1) the item from the counters and the budget
+     * 
+     */
+    void _account(const Item &item, int sign) {
+        mDuration += sign * item.duration;
+        mBytes += sign * int64_t(item.bytes);
+        if (mBudget && item.bytes) {
+            mBudget->consume(sign * int64_t(item.bytes));
+        }
+    }
+    bool _hasBudget() const {
+        auto bytes = size_t(std::max<int64_t>(mBytes.load(std::memory_order_relaxed), 0));
+        if (mMaxBytes && bytes > mMaxBytes) {
+            return false;
+        }
+        if (mMaxDuration > 0 && mDuration.load(std::memory_order_relaxed) > mMaxDuration) {
+            return false;
+        }
+        return !mBudget || mBudget->hasSpace(bytes);
     }
     double duration() const override {
         return mDuration.load();
     }
+    size_t bytes() const override {
+        return size_t(std::max<int64_t>(mBytes.load(), 0));
+    }
     void setCapacity(size_t n) override {
         mMaxSize = n;
+        mSpaceWaiter.notify();
+    }
+    void setMaxBytes(size_t bytes) override {
+        mMaxBytes = bytes;
+        mSpaceWaiter.notify();
+    }
+    void setMaxDuration(double seconds) override {
+        mMaxDuration = seconds;
+        mSpaceWaiter.notify();
+    }
+    Error setMode(Mode mode) override {
+        if (state() != State::Null) {
+            return Error::InvalidState;
+        }
+        mMode = mode;
+        return Error::Ok;
     }
 
     // Media Element
@@ -171,23 +430,40 @@ public:
         return nullptr;
     }
     bool isEndOfFile() const override {
+        if (mMode == LockFree) {
+            return _ringSize() == 0;
+        }
         std::lock_guard locker(mMutex);
         return mQueue.empty();
     }
 private:
     class Item {
     public:
-        MediaFrame   *frame = nullptr;
-        MediaPacket  *packet = nullptr;
-        Arc<Resource> resource;
+        Ref<Resource> resource;
+        double        duration = 0.0; //< Kept for the pop, no virtual call on the consumer
+        size_t        bytes = 0;
     };
     std::queue<Item>        mQueue;
-    std::condition_variable mCond;
+    SpscQueue<Item>         mRing; //< Storage for LockFree mode
+    std::deque<Item>        mOverflow; //< The items pushed on the full ring, after all of the ring
+    std::mutex              mOverflowMutex; //< Protect mOverflow, only taken when it is in use
+    Atomic<size_t>          mOverflowSize {0};
+    std::condition_variable mCond; //< Consumer wait for data
+    Waiter                  mSpaceWaiter; //< Producer wait for free space
     mutable std::mutex      mMutex;
     Atomic<double>          mDuration {0.0};
+    Atomic<int64_t>         mBytes {0};
     Atomic<bool>            mRunning {false};
     Atomic<bool>            mInterrupted {false};
+    Atomic<bool>            mConsumerWaiting {false};
+    Atomic<bool>            mFlowing {false}; //< Between Run and Pause / Stop, producer can wait for space
+    Atomic<bool>            mDrainPosted {false}; //< The drain task is pending on the executor thread
+    bool                    mEventDriven = false; //< mThread is from the Executor in the context, no blocking consumer loop
     size_t                  mMaxSize = 4000;
+    Atomic<size_t>          mMaxBytes {0}; //< 0 on unlimited
+    Atomic<double>          mMaxDuration {0.0}; //< 0 on unlimited
+    MemoryBudget           *mBudget = nullptr; //< From the Context, shared with other queues
+    Mode                    mMode = Locked;
     Thread                 *mThread = nullptr;
     Pad                    *mSink = nullptr;
     Pad                    *mSrc = nullptr;
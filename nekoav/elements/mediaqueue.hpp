@@ -4,20 +4,61 @@
 
 NEKO_NS_BEGIN
 
+/**
+ * @brief Queue between two threads, the items are pushed to the output at the thread of the queue
+ * @details With an Executor in the Context, the thread is allocated from it and drained by tasks (event driven),
+ * so no worker is kept blocked, or the queue owns an OS thread (with ThreadRole::Decoder policy).
+ * 
+ */
 class MediaQueue : public Element {
 public:
+    /**
+     * @brief Storage mode of the queue
+     * 
+     */
+    enum Mode : int {
+        Locked,   //< std::queue guarded by mutex, lock per item (default)
+        LockFree, //< Bounded Single-Producer / Single-Consumer ring buffer, lock only when empty or full
+    };
+
     /**
      * @brief Get media frame durations at queue
      * 
      * @return double 
      */
     virtual double duration() const = 0;
+    /**
+     * @brief Get the bytes of media data at queue
+     * 
+     * @return size_t 
+     */
+    virtual size_t bytes() const = 0;
     /**
      * @brief Set the Capacity object
      * 
-     * @param capacity 
+     * @param capacity The max number of items
      */
     virtual void setCapacity(size_t capacity) = 0;
+    /**
+     * @brief Set the max bytes of media data, the producer waits on over it
+     * @details The MemoryBudget in the Context (from Pipeline::setMemoryBudget()) limits it too
+     * 
+     * @param bytes The max bytes, 0 on unlimited (default)
+     */
+    virtual void setMaxBytes(size_t bytes) = 0;
+    /**
+     * @brief Set the max duration of media data, the producer waits on over it
+     * 
+     * @param seconds The max duration in seconds, 0 on unlimited (default)
+     */
+    virtual void setMaxDuration(double seconds) = 0;
+    /**
+     * @brief Set the storage mode of the queue
+     * 
+     * @param mode 
+     * @return Error Error::InvalidState on the queue is not at Null state
+     */
+    virtual Error setMode(Mode mode) = 0;
 };
 
-NEKO_NS_END
\ No newline at end of file
+NEKO_NS_END
@@ -5,7 +5,14 @@
 NEKO_NS_BEGIN
 
 class VideoConverter : public Element {
-    
+public:
+    /**
+     * @brief Set the number of threads converting a frame, every frame is split into horizontal slices
+     * @details It takes effect at the next initialize
+     * 
+     * @param numOfThreads The number of threads including the pushing one (0 on auto, 1 on the pushing thread only)
+     */
+    virtual void setNumOfThreads(size_t numOfThreads) = 0;
 };
 
-NEKO_NS_END
\ No newline at end of file
+NEKO_NS_END
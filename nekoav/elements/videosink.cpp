@@ -1,5 +1,6 @@
 #define _NEKO_SOURCE
 #include "../detail/template.hpp"
+#include "../context.hpp"
 #include "../format.hpp"
 #include "../factory.hpp"
 #include "../media.hpp"
@@ -19,7 +20,7 @@ public:
 
     VideoSinkImpl() {
         mSink = addInput("sink");
-        mSink->setCallback(std::bind(&VideoSinkImpl::_onSink, this, std::placeholders::_1));
+        mSink->setTypedCallback<MediaFrame, &VideoSinkImpl::_onSink>(this);
         mSink->setEventCallback(std::bind(&VideoSinkImpl::_onSinkEvent, this, std::placeholders::_1));
     }
     ~VideoSinkImpl() {
@@ -43,6 +44,9 @@ public:
         mSink->addProperty(Properties::PixelFormatList, std::move(prop));
         if (context()) {
             mRenderer->setContext(context());
+            if (auto policies = context()->queryObject<ThreadPolicyTable>(); policies) {
+                policies->apply(ThreadRole::VideoSink, thread());
+            }
         }
         return Error::Ok;
     }
@@ -59,20 +63,16 @@ public:
     Error sendEvent(View<Event> event) override {
         return Error::Ok;
     }
-    Error _onSink(View<Resource> resource) {
-        auto frame = resource.viewAs<MediaFrame>();
-        if (!frame) {
-            return Error::UnsupportedResource;
-        }
+    Error _onSink(View<MediaFrame> frame) {
         if (mAfterSeek) {
             mAfterSeek = false;
             NEKO_LOG("After seek, first frame arrived pts {}", frame->timestamp());
         }
-        // Wait if too much
+        // Wait if too much, the render loop notify us when it take one
         std::unique_lock lock(mMutex);
         while (mFrames.size() > MaxQueueSize) {
             lock.unlock();
-            if (Thread::msleep(10) == Error::Interrupted) {
+            if (mSpaceWaiter.wait() != Error::Ok) {
                 // Is Interrupted, we need return right now
                 lock.lock();
                 break;
@@ -80,8 +80,8 @@ public:
             lock.lock();
         }
         // Push one to the frame queue
-        mFrames.emplace(frame->shared_from_this<MediaFrame>());
-        thread()->postTask([]() {}); //< To wakeup
+        mFrames.emplace(frame.get());
+        thread()->wakeup();
         return Error::Ok;
     }
     Error _onSinkEvent(View<Event> event) {
@@ -94,6 +94,7 @@ public:
             }
             mNumFramesDropped = 0;
             mCondition.notify_one();
+            mSpaceWaiter.notify();
         }
         else if (event->type() == Event::SeekRequested) {
             mAfterSeek = true;
@@ -101,7 +102,7 @@ public:
         }
         return Error::Ok;
     }
-    void _drawFrame(const Arc<MediaFrame> &frame) {
+    void _drawFrame(View<MediaFrame> frame) {
         if (!mController) {
             mRenderer->setFrame(frame);
             return;
@@ -115,7 +116,7 @@ public:
         if (diff < -0.01 && diff > -10.0) {
             // Faster than audio
             std::unique_lock lock(mCondMutex);
-            mCondition.wait_for(lock, std::chrono::milliseconds(int64_t(-diff * 1000)));
+            mCondition.wait_for(lock, std::chrono::microseconds(int64_t(-diff * 1000000)));
         }
         else if (diff > 0.3) {
             // Too slow
@@ -140,12 +141,13 @@ public:
         while (!stopRequested()) {
             thread()->waitTask();
             while (state() == State::Running) {
-                thread()->waitTask(10);
+                thread()->waitTask(); //< Woken by _onSink() or state change
                 std::unique_lock lock(mMutex);
                 while (!mFrames.empty() && state() == State::Running) {
                     auto frame = std::move(mFrames.front());
                     mFrames.pop();
                     lock.unlock();
+                    mSpaceWaiter.notify();
 
                     // Do drawing
                     _drawFrame(frame);
@@ -186,7 +188,8 @@ private:
     std::mutex              mCondMutex;
 
     mutable std::mutex           mMutex;
-    std::queue<Arc<MediaFrame> > mFrames;
+    std::queue<Ref<MediaFrame> > mFrames;
+    Waiter                       mSpaceWaiter; //< _onSink() wait for free space
     
     Atomic<size_t> mNumFramesDropped {0};
     Atomic<double> mPosition {0.0}; //< Current time
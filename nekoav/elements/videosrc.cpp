@@ -9,7 +9,7 @@
 
 NEKO_NS_BEGIN
 
-class TestVideoSourceImpl final : public ThreadingImpl<TestVideoSource> {
+class TestVideoSourceImpl final : public CoroutineImpl<TestVideoSource> {
 public:
     TestVideoSourceImpl() {
         mSrc = addOutput("src");
@@ -17,17 +17,19 @@ public:
     ~TestVideoSourceImpl() {
 
     }
-    Error onLoop() override {
+    CoLoop onAsyncLoop() override {
         while (!stopRequested()) {
-            thread()->waitTask();
-            while (state() == State::Running) {
-                thread()->waitTask(1000 / 30);
-                pushFrame();
+            if (loopState() != State::Running) {
+                co_await waitStateChange();
+                continue;
+            }
+            if (co_await sleepFor(1000 / 30) == Error::Ok) {
+                co_await pushAsync(mSrc, makeFrame());
             }
         }
-        return Error::Ok;
+        co_return Error::Ok;
     }
-    void pushFrame() {
+    Ref<MediaFrame> makeFrame() {
         auto frame = CreateVideoFrame(PixelFormat::RGBA, mWidth, mHeight);
         frame->makeWritable();
 
@@ -37,8 +39,7 @@ public:
 
         frame->setDuration(1000 / 30);
         frame->setTimestamp(mClock);
-
-        pushTo(mSrc, frame);
+        return frame;
     }
     void setOutputSize(int width, int height) override {
         mWidth = width;
@@ -26,6 +26,7 @@ enum class Error : int {
     FileCorrupted,          //< This file is corrupted
     Interrupted,            //< This operation is interrupted by some reason
     EndOfFile,              //< This operation is reached the end of file
+    PermissionDenied,       //< This operation is not permitted, like the real time scheduling
 
     External,               //< External Error, it come from external library
     Unknown,                //< Unknown Error
@@ -3,16 +3,92 @@
 #include "defs.hpp"
 #include "time.hpp"
 #include "resource.hpp"
+#include "allocator.hpp"
+#include "refcounted.hpp"
 #include <functional>
 #include <string>
+#include <new>
 
 NEKO_NS_BEGIN
 
 /**
- * @brief Event Base class
+ * @brief Recycle the storage of a frequently used Event type
+ * @details The storage of a released event is kept (up to Capacity) and reused by the next make(),
+ * so the control traffic (clock updates, seeks, flushes) doesn't hit the allocator.
  * 
+ * @tparam T The Event type
  */
-class Event : public std::enable_shared_from_this<Event> {
+template <typename T>
+class EventPool {
+public:
+    static constexpr size_t Capacity = 32;
+
+    /**
+     * @brief Create a event from the pool
+     * 
+     * @tparam Args 
+     * @param args 
+     * @return Ref<T> 
+     */
+    template <typename ...Args>
+    static Ref<T> make(Args &&...args) {
+        T *event = nullptr;
+        if (auto mem = _pop(); mem) {
+            event = ::new (mem) T(std::forward<Args>(args)...);
+        }
+        else {
+            event = new T(std::forward<Args>(args)...);
+        }
+        event->mRecycle = &EventPool::_recycle;
+        return AdoptRef(event);
+    }
+private:
+    /**
+     * @brief The free storages of the calling thread, no lock, a event released on other thread goes to its pool
+     * 
+     */
+    struct Storage {
+        ~Storage() {
+            for (size_t n = 0; n < count; n++) {
+                T::operator delete(items[n]);
+            }
+            count = 0;
+            dead = true;
+        }
+
+        void  *items[Capacity];
+        size_t count = 0;
+        bool   dead = false; //< The thread is exiting, don't keep anything
+    };
+    static Storage &_storage() noexcept {
+        static thread_local Storage storage;
+        return storage;
+    }
+    static void *_pop() noexcept {
+        auto &storage = _storage();
+        return storage.count ? storage.items[--storage.count] : nullptr;
+    }
+    static void  _recycle(Event *event) noexcept {
+        auto self = static_cast<T*>(event);
+        self->~T();
+
+        auto &storage = _storage();
+        if (storage.count < Capacity && !storage.dead) {
+            storage.items[storage.count++] = self;
+            return;
+        }
+        T::operator delete(self);
+    }
+};
+
+/**
+ * @brief Event Base class, intrusive reference counted, hold it by Ref<Event>
+ * @details Create it by make() to get the pooled storage, a Event owned by Arc (make_shared) still works,
+ * the receivers pin it while they keep a Ref, see SharedRefCounted.
+ * @warning A Event on the stack or as a member must not be sent, it panics on the first Ref
+ * 
+ */
+class Event : public SharedRefCounted<Event> {
 public:
     enum Type : uint32_t {
         None,
@@ -62,15 +138,33 @@ public:
      * 
      * @param type 
      * @param sender 
-     * @return Arc<Event> 
+     * @return Ref<Event> 
      */
-    static Arc<Event> make(Type type, Element *sender) {
-        return std::make_shared<Event>(type, sender);
+    static Ref<Event> make(Type type, Element *sender) {
+        return EventPool<Event>::make(type, sender);
+    }
+
+    void *operator new(size_t size) {
+        return libc::malloc(size, AllocCategory::Event);
+    }
+    void operator delete(void *ptr) {
+        return libc::free(ptr);
+    }
+protected:
+    void _destroy() noexcept override {
+        if (mRecycle) {
+            return mRecycle(this);
+        }
+        delete this;
     }
 private:
     Type     mType = None;
     Element *mSender = nullptr;
     int64_t  mTime = GetTicks();
+    void   (*mRecycle)(Event *) = nullptr; //< Set by the EventPool created it
+
+    template <typename T>
+    friend class EventPool;
 };
 
 using EventType = Event::Type;
@@ -93,11 +187,11 @@ public:
         return mMessage;
     }
 
-    static Arc<ErrorEvent> make(Error error, Element *sender) {
-        return std::make_shared<ErrorEvent>(error, sender);
+    static Ref<ErrorEvent> make(Error error, Element *sender) {
+        return MakeRef<ErrorEvent>(error, sender);
     }
-    static Arc<ErrorEvent> make(Error error, std::string_view message, Element *sender) {
-        return std::make_shared<ErrorEvent>(error, message, sender);
+    static Ref<ErrorEvent> make(Error error, std::string_view message, Element *sender) {
+        return MakeRef<ErrorEvent>(error, message, sender);
     }
 private:
     Error mError;
@@ -117,8 +211,8 @@ public:
         return mPosition;
     }
 
-    static Arc<ClockEvent> make(Type type, double position, Element *sender) {
-        return MakeShared<ClockEvent>(type, position, sender);
+    static Ref<ClockEvent> make(Type type, double position, Element *sender) {
+        return EventPool<ClockEvent>::make(type, position, sender);
     }
 private:
     double mPosition;
@@ -134,8 +228,8 @@ public:
     double position() const noexcept {
         return mPosition;
     }
-    static Arc<SeekEvent> make(double targetSeconds) {
-        return MakeShared<SeekEvent>(targetSeconds);
+    static Ref<SeekEvent> make(double targetSeconds) {
+        return EventPool<SeekEvent>::make(targetSeconds);
     }
 private:
     double mPosition;
@@ -159,8 +253,8 @@ public:
     bool isStarted() const noexcept {
         return mProgress == 0;
     }
-    static Arc<BufferingEvent> make(int progress, Element *sender) {
-        return MakeShared<BufferingEvent>(progress, sender);
+    static Ref<BufferingEvent> make(int progress, Element *sender) {
+        return MakeRef<BufferingEvent>(progress, sender);
     }
 private:
     int mProgress;
@@ -177,8 +271,8 @@ public:
         return mPad;
     }
 
-    static Arc<PadEvent> make(Type type, Pad *pad, Element *sender) {
-        return MakeShared<PadEvent>(type, pad, sender);
+    static Ref<PadEvent> make(Type type, Pad *pad, Element *sender) {
+        return MakeRef<PadEvent>(type, pad, sender);
     }
 private:
     Pad *mPad = nullptr;
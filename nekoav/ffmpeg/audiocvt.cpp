@@ -2,6 +2,7 @@
 #include "../elements/audiocvt.hpp"
 #include "../detail/template.hpp"
 #include "../factory.hpp"
+#include "../log.hpp"
 #include "../pad.hpp"
 #include "common.hpp"
 #include "ffmpeg.hpp"
@@ -15,7 +16,8 @@ public:
     FFAudioConverterImpl() {
         mSinkPad = addInput("sink");
         mSourcePad = addOutput("src");
-        mSinkPad->setCallback(std::bind(&FFAudioConverterImpl::_processInput, this, std::placeholders::_1));
+        mSinkPad->setTypedCallback<Frame, &FFAudioConverterImpl::_processInput>(this);
+        mSourcePad->setResourceType<Frame, MediaFrame>();
         mSinkPad->setEventCallback(std::bind(&Pad::pushEvent, mSourcePad, std::placeholders::_1));
     }
     Error onInitialize() override {
@@ -23,15 +25,13 @@ public:
     }
     Error onTeardown() override {
         swr_free(&mCtxt);
+        NEKO_LOG("FramePool: {} buffers allocated for {} frames", mPool.allocated(), mPool.requested());
+        mPool.reset();
         mPassthrough = false;
         mSwrFormat = AV_SAMPLE_FMT_NONE;
         return Error::Ok;
     }
-    Error _processInput(ResourceView resourceView) {
-        auto frame = resourceView.viewAs<Frame>();
-        if (!frame) {
-            return Error::UnsupportedResource;
-        }
+    Error _processInput(View<Frame> frame) {
         if (!mSourcePad->isLinked()) {
             return Error::NoLink;
         }
@@ -41,36 +41,44 @@ public:
             }
         }
         if (mPassthrough) {
-            mSourcePad->push(resourceView);
+            mSourcePad->push(frame.get());
             return Error::Ok;
         }
 
-        // Alloc frame and data
+        // Alloc frame, the data is from the pool, nb_samples is the capacity for swr
+        auto srcFrame = frame->get();
         auto dstFrame = av_frame_alloc();
         dstFrame->format = mSwrFormat;
-        dstFrame->channel_layout = frame->get()->channel_layout;
-        dstFrame->sample_rate = frame->get()->sample_rate;
+        dstFrame->channel_layout = srcFrame->channel_layout;
+        dstFrame->channels = srcFrame->channels;
+        dstFrame->sample_rate = srcFrame->sample_rate;
+        dstFrame->nb_samples = swr_get_out_samples(mCtxt, srcFrame->nb_samples);
 
-        auto ret = swr_convert_frame(mCtxt, dstFrame, frame->get());
+        auto ret = mPool.getAudioBuffer(dstFrame, srcFrame->channels);
+        if (ret < 0) {
+            av_frame_free(&dstFrame);
+            return ToError(ret);
+        }
+        ret = swr_convert_frame(mCtxt, dstFrame, srcFrame);
         if (ret < 0) {
             av_frame_free(&dstFrame);
             return Error::UnsupportedSampleFormat;
         }
 
         // Copy metadata
-        av_frame_copy_props(dstFrame, frame->get());
+        av_frame_copy_props(dstFrame, srcFrame);
 
         return mSourcePad->push(Frame::make(dstFrame, frame->timebase(), AVMEDIA_TYPE_AUDIO).get());
     }
     Error _initContext(AVFrame *frame) {
         AVSampleFormat fmt;
-        auto &spfmt = mSourcePad->next()->property(Properties::SampleFormatList);
-        if (spfmt.isNull()) {
+        auto spfmt = std::as_const(*mSourcePad->next()).properties().sampleFormatList();
+        if (spfmt.empty()) {
             mPassthrough = true;
             return Error::Ok;
         }
-        for (const auto &v : spfmt.toList()) {
-            fmt = ToAVSampleFormat(v.toEnum<SampleFormat>());
+        for (auto v : spfmt) {
+            fmt = ToAVSampleFormat(v);
             if (fmt == AVSampleFormat(frame->format)) {
                 mPassthrough = true;
                 return Error::Ok;
@@ -106,6 +114,7 @@ private:
     AVSampleFormat mSwrFormat = AV_SAMPLE_FMT_NONE;
     bool        mPassthrough = false;
     SwrContext *mCtxt = nullptr;
+    FramePool   mPool; //< Buffers of the output frames
     Pad        *mSinkPad = nullptr;
     Pad        *mSourcePad = nullptr;
 
@@ -1,18 +1,188 @@
 #pragma once
 
 #include "../media/frame.hpp"
+#include "../allocator.hpp"
 #include "../property.hpp"
 #include "ffmpeg.hpp"
+#include <vector>
+#include <mutex>
 
 extern "C" {
     #include <libavformat/avformat.h>
     #include <libavutil/frame.h>
+    #include <libavutil/buffer.h>
+    #include <libavutil/samplefmt.h>
 }
 
 NEKO_NS_BEGIN
 
 namespace FFmpeg {
 
+/**
+ * @brief A pool of AVFrame data buffers, for the frames produced by one element
+ * @details All planes of a frame share one pooled buffer, it goes back to the pool when the last AVFrame
+ * referencing it dropped. The pool is rebuilt only when a bigger (or a much smaller) buffer is required,
+ * so at steady state allocated() stays unchanged while requested() grows.
+ * Frames still in flight keep the old pool alive, so it is safe to reset() or destroy it at any time.
+ *
+ */
+class FramePool {
+public:
+    FramePool() = default;
+    FramePool(const FramePool &) = delete;
+    ~FramePool() {
+        av_buffer_pool_uninit(&mPool);
+    }
+
+    /**
+     * @brief Attach a image buffer to the frame, the format, width and height of the frame must be set
+     *
+     * @param frame The frame without buffer
+     * @param align The linesize alignment
+     * @return int The FFmpeg error code, < 0 on failed
+     */
+    int getVideoBuffer(AVFrame *frame, int align = 32) {
+        auto fmt = AVPixelFormat(frame->format);
+        int size = av_image_get_buffer_size(fmt, frame->width, frame->height, align);
+        if (size < 0) {
+            return size;
+        }
+        auto buffer = _get(size);
+        if (!buffer) {
+            return AVERROR(ENOMEM);
+        }
+        int ret = av_image_fill_arrays(frame->data, frame->linesize, buffer->data, fmt, frame->width, frame->height, align);
+        if (ret < 0) {
+            av_buffer_unref(&buffer);
+            return ret;
+        }
+        frame->buf[0] = buffer;
+        frame->extended_data = frame->data;
+        return 0;
+    }
+    /**
+     * @brief Attach a sample buffer to the frame, the format and nb_samples (the capacity) of the frame must be set
+     *
+     * @param frame The frame without buffer
+     * @param channels The number of channels
+     * @return int The FFmpeg error code, < 0 on failed
+     */
+    int getAudioBuffer(AVFrame *frame, int channels) {
+        auto fmt = AVSampleFormat(frame->format);
+        if (av_sample_fmt_is_planar(fmt) && channels > AV_NUM_DATA_POINTERS) {
+            // Planes don't fit in data[], it needs the extended_data, let FFmpeg do it
+            mRequested += 1;
+            mAllocated += 1;
+            return av_frame_get_buffer(frame, 0);
+        }
+        int size = av_samples_get_buffer_size(nullptr, channels, frame->nb_samples, fmt, 0);
+        if (size < 0) {
+            return size;
+        }
+        auto buffer = _get(size);
+        if (!buffer) {
+            return AVERROR(ENOMEM);
+        }
+        int ret = av_samples_fill_arrays(frame->data, frame->linesize, buffer->data, channels, frame->nb_samples, fmt, 0);
+        if (ret < 0) {
+            av_buffer_unref(&buffer);
+            return ret;
+        }
+        frame->buf[0] = buffer;
+        frame->extended_data = frame->data;
+        return 0;
+    }
+    /**
+     * @brief Drop the pool, the buffers still in use are freed when their frames dropped
+     *
+     */
+    void reset() {
+        av_buffer_pool_uninit(&mPool);
+        mSize = 0;
+    }
+    /**
+     * @brief Get the number of buffers requested
+     *
+     * @return uint64_t
+     */
+    uint64_t requested() const noexcept {
+        return mRequested;
+    }
+    /**
+     * @brief Get the number of buffers really allocated from the system
+     *
+     * @return uint64_t
+     */
+    uint64_t allocated() const noexcept {
+        return mAllocated;
+    }
+private:
+#if LIBAVUTIL_VERSION_MAJOR < 57
+    using SizeType = int;
+#else
+    using SizeType = size_t;
+#endif
+
+    AVBufferRef *_get(int size) {
+        mRequested += 1;
+        if (mPool && (size > mSize || size < mSize / 2)) {
+            // Size changed, the old buffers are freed when returned
+            av_buffer_pool_uninit(&mPool);
+        }
+        if (!mPool) {
+            mPool = av_buffer_pool_init2(size + AV_INPUT_BUFFER_PADDING_SIZE, this, &FramePool::_alloc, nullptr);
+            mSize = size;
+        }
+        if (!mPool) {
+            return nullptr;
+        }
+        return av_buffer_pool_get(mPool);
+    }
+    /**
+     * @brief A buffer from GetFrameMemoryResource(), keeps what the free needs
+     *
+     */
+    struct MappedBuffer {
+        std::pmr::memory_resource *resource;
+        size_t                     size;
+    };
+
+    static AVBufferRef *_alloc(void *opaque, SizeType size) {
+        // Only called from av_buffer_pool_get(), so the pool is alive
+        static_cast<FramePool *>(opaque)->mAllocated += 1;
+        auto resource = GetFrameMemoryResource();
+        if (resource == std::pmr::get_default_resource() || size_t(size) < HugePageResource::Threshold) {
+            return av_buffer_alloc(size);
+        }
+        // Huge pages opted in, big buffers (like 4K frames) from the resource
+        void *data = nullptr;
+        try {
+            data = resource->allocate(size, FrameAlignment);
+        }
+        catch (std::bad_alloc &) {
+            return nullptr;
+        }
+        auto mapped = new MappedBuffer {resource, size_t(size)};
+        auto buffer = av_buffer_create(static_cast<uint8_t*>(data), size, &FramePool::_free, mapped, 0);
+        if (!buffer) {
+            _free(mapped, static_cast<uint8_t*>(data));
+        }
+        return buffer;
+    }
+    static void _free(void *opaque, uint8_t *data) {
+        auto mapped = static_cast<MappedBuffer *>(opaque);
+        mapped->resource->deallocate(data, mapped->size, FrameAlignment);
+        delete mapped;
+    }
+
+    static constexpr size_t FrameAlignment = 64;
+
+    AVBufferPool *mPool = nullptr;
+    int           mSize = 0; //< Buffer size of mPool, without padding
+    uint64_t      mRequested = 0;
+    uint64_t      mAllocated = 0;
+};
+
 class Frame final : public MediaFrame {
 public:
     explicit Frame(AVFrame* frame, AVRational t, AVMediaType type) : mFrame(frame), mTimebase(t), mType(type) {
@@ -74,6 +244,17 @@ public:
         }
         return mFrame->data[idx];
     }
+    size_t memorySize() const override {
+        // The real buffers, shared ones are counted by every frame
+        size_t bytes = 0;
+        for (auto buf : mFrame->buf) {
+            bytes += buf ? buf->size : 0;
+        }
+        for (int n = 0; n < mFrame->nb_extended_buf; n++) {
+            bytes += mFrame->extended_buf[n]->size;
+        }
+        return bytes;
+    }
 
     int query(Value q) const override {
         switch (q) {
@@ -94,7 +275,7 @@ public:
 
 
     static auto make(AVFrame *f, AVRational timebase, AVMediaType type) {
-        return make_shared<Frame>(f, timebase, type);
+        return MakeRef<Frame>(f, timebase, type);
     }
 private:
     // std::mutex     mMutex;
@@ -103,13 +284,15 @@ private:
     AVMediaType    mType;
 };
 
+class PacketPool;
+
 class Packet final : public MediaPacket {
 public:
     static auto make(AVPacket *p, AVStream *stream) {
-        return make_shared<Packet>(p, stream);
+        return MakeRef<Packet>(p, stream);
     }
 
-    Packet(AVPacket *pack, AVStream *stream) : mPacket(pack), mStream(stream) {
+    Packet(AVPacket *pack, AVStream *stream, Arc<PacketPool> pool = nullptr) : mPacket(pack), mStream(stream), mPool(std::move(pool)) {
         mTimebase = mStream->time_base;
         mType = mStream->codecpar->codec_type;
     }
@@ -148,13 +331,134 @@ public:
     AVMediaType type() const noexcept {
         return mType;
     }
+protected:
+    void _destroy() noexcept override;
 private:
     AVPacket *mPacket {nullptr};
     AVStream *mStream {nullptr};
     AVRational mTimebase;
     AVMediaType mType;
+    Arc<PacketPool> mPool; //< The AVPacket and the storage go back to it
 };
 
+/**
+ * @brief Recycle the Packet wrappers and the AVPackets
+ * @details take() moves the data reference into a pooled Packet, so a packet costs no heap allocation at steady state.
+ * take() is called at the producer thread, the Packets can be released at any thread.
+ * The pool lives until the last Packet from it released.
+ * 
+ */
+class PacketPool final : public std::enable_shared_from_this<PacketPool> {
+public:
+    static Arc<PacketPool> make() {
+        return make_shared<PacketPool>();
+    }
+
+    PacketPool() = default;
+    PacketPool(const PacketPool &) = delete;
+    ~PacketPool() {
+        for (auto packet : mPackets) {
+            av_packet_free(&packet);
+        }
+        for (auto block : mBlocks) {
+            libc::free(block);
+        }
+    }
+
+    /**
+     * @brief Move the data of the packet into a pooled Packet, the src is blank after it
+     * 
+     * @param src The packet just read
+     * @param stream The stream of the packet
+     * @return Ref<Packet>, nullptr on out of memory (the src is untouched)
+     */
+    Ref<Packet> take(AVPacket *src, AVStream *stream) {
+        mRequested += 1;
+        AVPacket *packet = nullptr;
+        {
+            std::lock_guard lock(mMutex);
+            if (!mPackets.empty()) {
+                packet = mPackets.back();
+                mPackets.pop_back();
+            }
+        }
+        if (!packet) {
+            packet = av_packet_alloc();
+            if (!packet) {
+                return nullptr;
+            }
+            mAllocated += 1;
+        }
+        // Get the storage before moving the data, the src is kept on failure
+        auto block = _allocBlock();
+        if (!block) {
+            _recycle(packet);
+            return nullptr;
+        }
+        av_packet_move_ref(packet, src);
+        return AdoptRef(::new (block) Packet(packet, stream, shared_from_this()));
+    }
+    /**
+     * @brief Get the number of packets taken
+     * 
+     * @return uint64_t 
+     */
+    uint64_t requested() const noexcept {
+        return mRequested;
+    }
+    /**
+     * @brief Get the number of AVPackets and blocks allocated from the system
+     * 
+     * @return uint64_t 
+     */
+    uint64_t allocated() const noexcept {
+        return mAllocated;
+    }
+private:
+    void *_allocBlock() noexcept {
+        {
+            std::lock_guard lock(mMutex);
+            if (!mBlocks.empty()) {
+                auto block = mBlocks.back();
+                mBlocks.pop_back();
+                return block;
+            }
+        }
+        auto block = libc::malloc(sizeof(Packet), AllocCategory::Packet);
+        if (block) {
+            mAllocated += 1;
+        }
+        return block;
+    }
+    void _freeBlock(void *block) {
+        std::lock_guard lock(mMutex);
+        mBlocks.push_back(block);
+    }
+    void _recycle(AVPacket *packet) {
+        av_packet_unref(packet);
+        std::lock_guard lock(mMutex);
+        mPackets.push_back(packet);
+    }
+
+    std::mutex             mMutex;
+    std::vector<AVPacket*> mPackets; //< Blank AVPackets
+    std::vector<void*>     mBlocks; //< Free storages of Packet
+    uint64_t               mRequested = 0; //< Only touched at the producer thread
+    uint64_t               mAllocated = 0; //< Only touched at the producer thread
+friend class Packet;
+};
+
+inline void Packet::_destroy() noexcept {
+    if (!mPool) {
+        return MediaPacket::_destroy();
+    }
+    // Pooled, the AVPacket and the storage go back, the pool is kept alive until here
+    auto pool = std::move(mPool);
+    pool->_recycle(std::exchange(mPacket, nullptr));
+    this->~Packet();
+    pool->_freeBlock(this);
+}
+
 }
 
 NEKO_NS_END
\ No newline at end of file
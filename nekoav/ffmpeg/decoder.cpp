@@ -26,13 +26,9 @@ public:
         mSink = addInput("sink");
         mSrc = addOutput("src");
 
-        mSink->setCallback([this](View<Resource> resourceView) {
-            auto v = resourceView.viewAs<Packet>();
-            if (!v) {
-                return Error::UnsupportedResource;
-            }
-            return _process(v);
-        });
+        mSrc->setResourceType<Frame, MediaFrame>();
+
+        mSink->setTypedCallback<Packet, &FFDecoderImpl::_process>(this);
         mSink->setEventCallback([this](View<Event> eventView) {
             if (eventView->type() == Event::FlushRequested) {
                 avcodec_flush_buffers(mCtxt);
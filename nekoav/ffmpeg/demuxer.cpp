@@ -1,6 +1,7 @@
 #define _NEKO_SOURCE
 #include "../elements/demuxer.hpp"
 #include "../detail/template.hpp"
+#include "../context.hpp"
 #include "../factory.hpp"
 #include "../media.hpp"
 #include "../pad.hpp"
@@ -23,6 +24,7 @@ public:
         setFlags(ElementFlags::DynamicOutput);
         
         mPacket = av_packet_alloc();
+        mPacketPool = PacketPool::make();
     }
     ~FFDemuxer() {
         av_packet_free(&mPacket);
@@ -67,6 +69,9 @@ public:
         return metadata;
     }
     Error onInitialize() override {
+        if (auto policies = context() ? context()->queryObject<ThreadPolicyTable>() : nullptr; policies) {
+            policies->apply(ThreadRole::Demuxer, thread());
+        }
         mFormatContext = avformat_alloc_context();
         mFormatContext->interrupt_callback.opaque = this;
         mFormatContext->interrupt_callback.callback = [](void *self) {
@@ -106,6 +111,7 @@ public:
         avformat_close_input(&mFormatContext);
         mStreamMapping.clear();
         mEof = false;
+        NEKO_LOG("PacketPool: {} allocations for {} packets", mPacketPool->allocated(), mPacketPool->requested());
         return Error::Ok;
     }
 
@@ -156,14 +162,16 @@ public:
         if (iter != mStreamMapping.end()) {
             auto [_, pad] = *iter;
             if (pad->isLinked()) {
-                auto packet = Packet::make(
-                    av_packet_clone(mPacket),
-                    mFormatContext->streams[mPacket->stream_index]
-                );
+                // Move the reference into a pooled Packet, no clone
+                auto packet = mPacketPool->take(mPacket, mFormatContext->streams[mPacket->stream_index]);
+                if (!packet) {
+                    av_packet_unref(mPacket);
+                    return Error::OutOfMemory;
+                }
                 pad->push(packet);
             }
         }
-        av_packet_unref(mPacket);   
+        av_packet_unref(mPacket);
         return Error::Ok;
     }
     void _registerStreams() {
@@ -190,6 +198,7 @@ public:
                 snprintf(name, sizeof(name), "subtitle%d", nowSubtitleIndex);
             }
             auto pad = addOutput(name);
+            pad->setResourceType<Packet, MediaPacket>();
             auto &prop = pad->properties();
 
             // Internal types
@@ -270,6 +279,7 @@ public:
 private:
     AVFormatContext *mFormatContext = nullptr;
     AVPacket        *mPacket = nullptr;
+    Arc<PacketPool>  mPacketPool; //< Recycled Packets for the output
     std::string      mSource;
     std::map<int, Pad*> mStreamMapping; //< Mapping from FFmpeg stream index to Pad pointer
     Atomic<bool>        mEof = false;
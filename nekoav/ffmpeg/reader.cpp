@@ -181,7 +181,7 @@ public:
         }
         
         // Output
-        *frame = Frame::make(mFrame, stream->time_base, stream->codecpar->codec_type);
+        *frame = AllocateShared<Frame, AllocCategory::Frame>(mFrame, stream->time_base, stream->codecpar->codec_type);
         mFrame = nullptr;
         return true;
     }
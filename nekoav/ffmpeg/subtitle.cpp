@@ -2,6 +2,7 @@
 #include "../elements/subtitle.hpp"
 #include "../detail/pixutils.hpp"
 #include "../detail/base.hpp"
+#include "../media/blend.hpp"
 #include "../factory.hpp"
 #include "../format.hpp"
 #include "../libc.hpp"
@@ -345,9 +346,9 @@ public:
         return pushTo(mSrc, resource);
     }
 
-    void _resizeRGBABuffer(int w, int h) {
-        if (w * h * 4 > mRGBABufferSize) {
-            mRGBABufferSize = w * h * 4;
+    void _resizeRGBABuffer(size_t size) {
+        if (size > mRGBABufferSize) {
+            mRGBABufferSize = size;
             mRGBABuffer = (uint32_t*) std::realloc(mRGBABuffer, mRGBABufferSize);
         }
     }
@@ -428,26 +429,20 @@ public:
         auto sub = mCurrentAVSubtitle;
 
         // Here use ffplay subtitle code
-        int x = sub->rects[0]->x;
-        int y = sub->rects[0]->y;
-        int w = sub->rects[0]->w;
-        int h = sub->rects[0]->h;
-
         if (!mSubConverted) {
-            for (int i = 0; i < sub->num_rects; i++) {
-                AVSubtitleRect *rect = sub->rects[i];
-
-                _resizeRGBABuffer(rect->w, rect->h); 
+            // All rects are converted into the buffer one after another
+            size_t size = 0;
+            for (unsigned i = 0; i < sub->num_rects; i++) {
+                size += size_t(sub->rects[i]->w) * sub->rects[i]->h * 4;
+            }
+            _resizeRGBABuffer(size);
 
-                x = rect->x;
-                y = rect->y;
-                w = rect->w;
-                h = rect->h;
-                
-                // int x = std::clamp(rect->x, 0, input->width());
-                // int y = std::clamp(rect->y, 0, input->height());
-                // int w = std::clamp(rect->w, 0, input->width() - x);
-                // int h = std::clamp(rect->h, 0, input->height() - y);
+            uint8_t *buffer = reinterpret_cast<uint8_t*>(mRGBABuffer);
+            for (unsigned i = 0; i < sub->num_rects; i++) {
+                AVSubtitleRect *rect = sub->rects[i];
+                if (rect->w <= 0 || rect->h <= 0) {
+                    continue;
+                }
 
                 stream.mSubConvertContext = sws_getCachedContext(
                     stream.mSubConvertContext,
@@ -468,7 +463,7 @@ public:
                 }
                 int dstLinesize[4] {rect->w * 4, 0};
                 uint8_t *dstData[4] {
-                    (uint8_t*) mRGBABuffer,
+                    buffer,
                     nullptr
                 };
                 int n = sws_scale(
@@ -484,23 +479,27 @@ public:
                     // Error
                     ::abort();
                 }
+                buffer += size_t(rect->w) * rect->h * 4;
             }
             mSubConverted = true;
         }
-        // Blend with current image
-        uint32_t *buffer = (uint32_t*) input->data(0);
-        // Let it writeable
-        input->makeWritable();
-        int imageWidth = input->width();
-
-        for (int i = 0; i < w; i++) {
-            for (int k = 0; k < h; k++) {
-                uint32_t &dstPixel = buffer[(y + k) * imageWidth  + (x + i)];
-                uint32_t srcPixel = mRGBABuffer[k * w + i];
-                if (srcPixel != 0) {
-                    dstPixel = srcPixel;
-                }
+        // Blend with current image, let it writeable before we take the pointer
+        if (!input->makeWritable()) {
+            return;
+        }
+        uint8_t *dst = reinterpret_cast<uint8_t*>(input->data(0));
+        const uint8_t *buffer = reinterpret_cast<const uint8_t*>(mRGBABuffer);
+        for (unsigned i = 0; i < sub->num_rects; i++) {
+            const AVSubtitleRect *rect = sub->rects[i];
+            if (rect->w <= 0 || rect->h <= 0) {
+                continue;
             }
+            BlendRGBA(
+                dst, input->linesize(0), input->width(), input->height(),
+                buffer, rect->w * 4, rect->w, rect->h,
+                rect->x, rect->y
+            );
+            buffer += size_t(rect->w) * rect->h * 4;
         }
     }
 #ifdef HAVE_ASS
@@ -527,41 +526,12 @@ public:
         }
     }
     void _blendSingleImage(View<MediaFrame> input, const ASS_Image *image) {
-        uint8_t *dst = reinterpret_cast<uint8_t*>(input->data(0));
-        const int pitch = input->linesize(0);
-        const int width = input->width();
-        const int height = input->height();
-
-        // Read src Pixels RGBA
-        // Code from MPV ass_mp.c
-        const uint32_t r = (image->color >> 24) & 0xff;
-        const uint32_t g = (image->color >> 16) & 0xff;
-        const uint32_t b = (image->color >>  8) & 0xff;
-        const uint32_t a = 0xff - (image->color & 0xff);
-        for (int x = 0; x < image->w; x++) {
-            for (int y = 0; y < image->h; y++) {
-                const uint32_t v = image->bitmap[y * image->stride + x];
-                const int rr = (r * a * v);
-                const int gg = (g * a * v);
-                const int bb = (b * a * v);
-                const int aa =      a * v;
-
-                uint32_t dstr = dst[(image->dst_y + y) * pitch + (image->dst_x + x) * 4 + 0]; //< R
-                uint32_t dstg = dst[(image->dst_y + y) * pitch + (image->dst_x + x) * 4 + 1]; //< G
-                uint32_t dstb = dst[(image->dst_y + y) * pitch + (image->dst_x + x) * 4 + 2]; //< B
-                uint32_t dsta = dst[(image->dst_y + y) * pitch + (image->dst_x + x) * 4 + 3]; //< A
-
-                dstr = (rr       + dstr * (255 * 255 - aa)) / (255 * 255);
-                dstg = (gg       + dstg * (255 * 255 - aa)) / (255 * 255);
-                dstb = (bb       + dstb * (255 * 255 - aa)) / (255 * 255);
-                dsta = (aa * 255 + dsta * (255 * 255 - aa)) / (255 * 255);
-
-                dst[(image->dst_y + y) * pitch + (image->dst_x + x) * 4 + 0] = dstr;
-                dst[(image->dst_y + y) * pitch + (image->dst_x + x) * 4 + 1] = dstg;
-                dst[(image->dst_y + y) * pitch + (image->dst_x + x) * 4 + 2] = dstb;
-                dst[(image->dst_y + y) * pitch + (image->dst_x + x) * 4 + 3] = dsta;
-            }
-        }
+        // By rows with SIMD, clipped by the frame
+        BlendMask(
+            reinterpret_cast<uint8_t*>(input->data(0)), input->linesize(0), input->width(), input->height(),
+            image->bitmap, image->stride, image->w, image->h,
+            image->dst_x, image->dst_y, image->color
+        );
     }
     void _assLog(int level, const char *fmt, va_list va) {
         if (level >= 6) {
@@ -1,12 +1,19 @@
 #define _NEKO_SOURCE
 #include "../elements/videocvt.hpp"
+#include "../media/colorcvt.hpp"
 #include "../detail/template.hpp"
+#include "../threading.hpp"
 #include "../factory.hpp"
 #include "../log.hpp"
 #include "../pad.hpp"
 #include "common.hpp"
 #include "ffmpeg.hpp"
 
+// The frame based api, every context can give a range of the output rows
+#if LIBSWSCALE_VERSION_INT > AV_VERSION_INT(6, 1, 100)
+    #define HAVE_SWS_SLICE
+#endif
+
 #ifdef _WIN32
     #define HAVE_D3D11VA
     #include <VersionHelpers.h>
@@ -24,13 +31,22 @@ public:
     FFVideoConverterImpl() {
         mSinkPad = addInput("sink");
         mSourcePad = addOutput("src");
-        mSinkPad->setCallback(std::bind(&FFVideoConverterImpl::_processInput, this, std::placeholders::_1));
+        mSinkPad->setTypedCallback<Frame, &FFVideoConverterImpl::_processInput>(this);
+        mSourcePad->setResourceType<Frame, MediaFrame>();
         mSinkPad->setEventCallback(std::bind(&Pad::pushEvent, mSourcePad, std::placeholders::_1));
     }
     // void setPixelFormat(PixelFormat format) override {
     //     mTargetFormat = format;
     // }
+    void setNumOfThreads(size_t numOfThreads) override {
+        mNumOfThreads = numOfThreads;
+    }
     Error onInitialize() override {
+        auto numOfThreads = mNumOfThreads;
+        if (numOfThreads == 0) {
+            numOfThreads = std::clamp<size_t>(std::thread::hardware_concurrency(), 1, MaxAutoThreads);
+        }
+        mSlices.setNumOfThreads(numOfThreads);
         return Error::Ok;
     }
     Error onTeardown() override {
@@ -38,7 +54,14 @@ public:
             std::invoke(mCleanup, this);
         }
         sws_freeContext(mCtxt);
+        for (auto ctxt : mSliceCtxts) {
+            sws_freeContext(ctxt);
+        }
+        mSliceCtxts.clear();
+        mSlices.setNumOfThreads(1);
         av_frame_free(&mSwFrame);
+        NEKO_LOG("FramePool: {} buffers allocated for {} frames", mPool.allocated(), mPool.requested());
+        mPool.reset();
         mCopybackFormat = AV_PIX_FMT_NONE;
         mSwsFormat = AV_PIX_FMT_NONE;
         mPassthrough = false;
@@ -47,11 +70,7 @@ public:
         mCtxt = nullptr;
         return Error::Ok;
     }
-    Error _processInput(ResourceView resourceView) {
-        auto frame = resourceView.viewAs<Frame>();
-        if (!frame) {
-            return Error::UnsupportedResource;
-        }
+    Error _processInput(View<Frame> frame) {
         if (!mSourcePad->isLinked()) {
             return Error::NoLink;
         }
@@ -61,7 +80,7 @@ public:
             }
         }
         if (mPassthrough) {
-            mSourcePad->push(resourceView);
+            mSourcePad->push(frame.get());
             return Error::Ok;
         }
 
@@ -75,7 +94,7 @@ public:
         return mSourcePad->push(Frame::make(dstFrame, frame->timebase(), AVMEDIA_TYPE_VIDEO).get());
     }
     Error _initConvertIf(AVFrame *f) {
-        auto peerSupported = _peerSupportedPixelFormat();
+        auto peerSupported = _peerPixelFormats();
         AVPixelFormat fmt = AV_PIX_FMT_RGBA;
         if (mTargetFormat == PixelFormat::None) {
             // Try get info by pad
@@ -86,14 +105,16 @@ public:
                 return Error::Ok;
             }
             // Check has this format
-            auto iter = std::find(peerSupported.begin(), peerSupported.end(), AVPixelFormat(f->format));
+            auto iter = std::find_if(peerSupported.begin(), peerSupported.end(), [&](PixelFormat fmt) {
+                return ToAVPixelFormat(fmt) == AVPixelFormat(f->format);
+            });
             if (iter != peerSupported.end()) {
                 // Support this format, Passthrough
                 mPassthrough = true;
                 return Error::Ok;
             }
             // Select first
-            fmt = peerSupported.front();
+            fmt = ToAVPixelFormat(peerSupported[0]);
         }
         else {
             // Already has target format
@@ -115,11 +136,11 @@ public:
             }
 
             // Check copyback pixel format supported
-            auto iter = std::find_if(peerSupported.begin(), peerSupported.end(), [&](AVPixelFormat fmt) {
-                return std::find(formatsList.begin(), formatsList.end(), fmt) != formatsList.end();
+            auto iter = std::find_if(peerSupported.begin(), peerSupported.end(), [&](PixelFormat fmt) {
+                return std::find(formatsList.begin(), formatsList.end(), ToAVPixelFormat(fmt)) != formatsList.end();
             });
             if (iter != peerSupported.end()) {
-                mCopybackFormat = *iter;
+                mCopybackFormat = ToAVPixelFormat(*iter);
                 mConvert = &FFVideoConverterImpl::_copybackConvert;
                 NEKO_LOG("Init Copyback, to format {}", av_pix_fmt_desc_get(mCopybackFormat)->name);
                 return Error::Ok;
@@ -149,6 +170,9 @@ public:
             f = mSwFrame;
         }
 
+        if (_initYUVConvert(f, fmt) == Error::Ok) {
+            return Error::Ok;
+        }
         return _initSwsConvert(f, fmt);
     }
     // Init Parts
@@ -169,6 +193,20 @@ public:
         if (!mCtxt) {
             return Error::UnsupportedPixelFormat;
         }
+#ifdef HAVE_SWS_SLICE
+        // One more context for every other slice, they share nothing
+        for (size_t n = 1; n < mSlices.numOfThreads(); n++) {
+            auto ctxt = sws_getContext(
+                f->width, f->height, AVPixelFormat(f->format),
+                f->width, f->height, targetFormat,
+                SWS_BICUBIC, nullptr, nullptr, nullptr
+            );
+            if (!ctxt) {
+                break;
+            }
+            mSliceCtxts.push_back(ctxt);
+        }
+#endif
         mSwsFormat = targetFormat;
         NEKO_LOG("Init SwrContext from {} to {}", 
             av_pix_fmt_desc_get(AVPixelFormat(f->format))->name,
@@ -177,52 +215,124 @@ public:
         mConvert = &FFVideoConverterImpl::_swsConvert;
         return Error::Ok;
     }
+    // The same size YUV -> RGBA is only a color conversion, done by our SIMD kernels instead of sws
+    Error _initYUVConvert(AVFrame *f, AVPixelFormat targetFormat) {
+        auto srcFormat = ToPixelFormat(AVPixelFormat(f->format));
+        auto dstFormat = ToPixelFormat(targetFormat);
+        if (!IsYUVToRGBASupported(srcFormat, dstFormat)) {
+            return Error::UnsupportedPixelFormat;
+        }
+        mSwsFormat = targetFormat;
+        NEKO_LOG("Init YUVToRGBA from {} to {}", 
+            av_pix_fmt_desc_get(AVPixelFormat(f->format))->name,
+            av_pix_fmt_desc_get(targetFormat)->name
+        );
+        mConvert = &FFVideoConverterImpl::_yuvConvert;
+        return Error::Ok;
+    }
     // Only copy back
     Error _copybackConvert(AVFrame *dstFrame, AVFrame *srcFrame) {
+        dstFrame->width = srcFrame->width;
+        dstFrame->height = srcFrame->height;
         dstFrame->format = mCopybackFormat;
-        int ret = av_hwframe_transfer_data(dstFrame, srcFrame, 0);
+        int ret = mPool.getVideoBuffer(dstFrame);
         if (ret < 0) {
             return ToError(ret);
         }
+        ret = av_hwframe_transfer_data(dstFrame, srcFrame, 0);
+        if (ret < 0) {
+            return ToError(ret);
+        }
+        av_frame_copy_props(dstFrame, srcFrame);
+        return Error::Ok;
+    }
+    // Copy back the hardware frame to mSwFrame, replace the srcFrame by it
+    Error _copybackIf(AVFrame *&srcFrame) {
+        if (!IsHardwareAVPixelFormat(AVPixelFormat(srcFrame->format))) {
+            return Error::Ok;
+        }
+        if (!mSwFrame) {
+            mSwFrame = av_frame_alloc();
+        }
+        int ret = av_hwframe_transfer_data(mSwFrame, srcFrame, 0);
+        if (ret < 0) {
+            return ToError(ret);
+        }
+        av_frame_copy_props(mSwFrame, srcFrame);
+        srcFrame = mSwFrame;
+        return Error::Ok;
+    }
+    // do YUV -> RGBA
+    Error _yuvConvert(AVFrame *dstFrame, AVFrame *srcFrame) {
+        if (auto err = _copybackIf(srcFrame); err != Error::Ok) {
+            return err;
+        }
+        dstFrame->width = srcFrame->width;
+        dstFrame->height = srcFrame->height;
+        dstFrame->format = mSwsFormat;
+        if (auto ret = mPool.getVideoBuffer(dstFrame); ret < 0) {
+            return ToError(ret);
+        }
+        auto matrix = YUVMatrix::BT601; //< As sws, on unspecified
+        switch (srcFrame->colorspace) {
+            case AVCOL_SPC_BT709: matrix = YUVMatrix::BT709; break;
+            case AVCOL_SPC_BT2020_NCL: 
+            case AVCOL_SPC_BT2020_CL: matrix = YUVMatrix::BT2020; break;
+            default: break;
+        }
+        auto srcFormat = ToPixelFormat(AVPixelFormat(srcFrame->format));
+        auto dstFormat = ToPixelFormat(AVPixelFormat(dstFrame->format));
+        bool fullRange = srcFrame->color_range == AVCOL_RANGE_JPEG;
+        auto planes = GetPixelFormatLayout(srcFormat).planes;
+
+        // The slices start at the even rows, the chroma rows are shared by two
+        auto slices = _computeSlices(srcFrame->height, 2);
+        Atomic<Error> result {Error::Ok};
+        mSlices.run(slices.count, [&](size_t n) {
+            auto [begin, end] = slices.range(n);
+            const uint8_t *data[3] { };
+            for (int plane = 0; plane < planes; plane++) {
+                data[plane] = srcFrame->data[plane] + ptrdiff_t(plane == 0 ? begin : begin / 2) * srcFrame->linesize[plane];
+            }
+            auto err = ConvertYUVToRGBA(
+                srcFormat, data, srcFrame->linesize,
+                dstFormat, dstFrame->data[0] + ptrdiff_t(begin) * dstFrame->linesize[0], dstFrame->linesize[0],
+                srcFrame->width, end - begin,
+                matrix, fullRange
+            );
+            if (err != Error::Ok) {
+                result.store(err, std::memory_order_relaxed);
+            }
+        });
+        if (auto err = result.load(); err != Error::Ok) {
+            return err;
+        }
         av_frame_copy_props(dstFrame, srcFrame);
         return Error::Ok;
     }
     // do Sws scale
     Error _swsConvert(AVFrame *dstFrame, AVFrame *srcFrame) {
         int ret = 0;
-        if (IsHardwareAVPixelFormat(AVPixelFormat(srcFrame->format))) {
-            // Copy back
-            if (!mSwFrame) {
-                mSwFrame = av_frame_alloc();
-            }
-            ret = av_hwframe_transfer_data(mSwFrame, srcFrame, 0);
-            if (ret < 0) {
-                return ToError(ret);
-            }
-            av_frame_copy_props(mSwFrame, srcFrame);
-            srcFrame = mSwFrame;
+        if (auto err = _copybackIf(srcFrame); err != Error::Ok) {
+            return err;
         }
-        // New version of api
-#if     LIBSWSCALE_VERSION_INT > AV_VERSION_INT(6, 1, 100)
-        ret = sws_scale_frame(mCtxt, dstFrame, srcFrame);        
-#else
-        // Use old one, alloc data
-        auto n = av_image_get_buffer_size(mSwsFormat, srcFrame->width, srcFrame->height, 32);
-        auto buffer = av_buffer_alloc(n);
-        ret = av_image_fill_arrays(
-            dstFrame->data,
-            dstFrame->linesize,
-            buffer->data,
-            mSwsFormat,
-            srcFrame->width,
-            srcFrame->height,
-            32
-        );
+        // Output buffer from the pool, sws never allocates
+        dstFrame->width = srcFrame->width;
+        dstFrame->height = srcFrame->height;
+        dstFrame->format = mSwsFormat;
+        ret = mPool.getVideoBuffer(dstFrame);
         if (ret < 0) {
-            av_buffer_unref(&buffer);
-            return Error::OutOfMemory;
+            return ToError(ret);
+        }
+        // New version of api
+#if     defined(HAVE_SWS_SLICE)
+        if (!mSliceCtxts.empty()) {
+            ret = _swsConvertSliced(dstFrame, srcFrame);
+        }
+        else {
+            ret = sws_scale_frame(mCtxt, dstFrame, srcFrame);        
         }
-        dstFrame->buf[0] = buffer;
+#else
         ret = sws_scale(
             mCtxt,
             srcFrame->data,
@@ -232,26 +342,66 @@ public:
             dstFrame->data,
             dstFrame->linesize
         );
-        dstFrame->width = srcFrame->width;
-        dstFrame->height = srcFrame->height;
-        dstFrame->format = mSwsFormat;
 #endif
         if (ret < 0) {
-            av_frame_free(&dstFrame);
+            // The caller frees the dstFrame
             return Error::OutOfMemory;
         }
         av_frame_copy_props(dstFrame, srcFrame);
         return Error::Ok;
     }
-    // Get the supported format of peer
-    Vec<AVPixelFormat> _peerSupportedPixelFormat() {
-        Vec<AVPixelFormat> formats;
-        auto &pixfmt = mSourcePad->next()->property(Properties::PixelFormatList);
-        if (pixfmt.isNull()) {
-            return formats;
+#ifdef HAVE_SWS_SLICE
+    // Every context takes the whole source and writes a range of the output rows
+    int _swsConvertSliced(AVFrame *dstFrame, AVFrame *srcFrame) {
+        auto slices = _computeSlices(dstFrame->height, sws_receive_slice_alignment(mCtxt), mSliceCtxts.size() + 1);
+        Atomic<int> result {0};
+        mSlices.run(slices.count, [&](size_t n) {
+            auto [begin, end] = slices.range(n);
+            auto ctxt = n == 0 ? mCtxt : mSliceCtxts[n - 1];
+            int ret = sws_frame_start(ctxt, dstFrame, srcFrame);
+            if (ret >= 0) {
+                ret = sws_send_slice(ctxt, 0, srcFrame->height);
+            }
+            if (ret >= 0) {
+                ret = sws_receive_slice(ctxt, begin, end - begin);
+            }
+            sws_frame_end(ctxt);
+            if (ret < 0) {
+                result.store(ret, std::memory_order_relaxed);
+            }
+        });
+        return result.load();
+    }
+#endif
+    // Split the rows into slices for the threads, every slice starts at a multiple of align
+    struct Slices {
+        int    height;
+        int    rows; //< Rows of every slice but the last one
+        size_t count;
+
+        std::pair<int, int> range(size_t n) const noexcept {
+            int begin = int(n) * rows;
+            return {begin, std::min(begin + rows, height)};
         }
-        for (const auto &v : pixfmt.toList()) {
-            formats.push_back(ToAVPixelFormat(v.toEnum<PixelFormat>()));
+    };
+    Slices _computeSlices(int height, int align, size_t maxSlices = SIZE_MAX) const noexcept {
+        if (height <= 0) {
+            return {height, 0, 0};
+        }
+        align = std::max(align, 1);
+        auto count = std::min({mSlices.numOfThreads(), maxSlices, size_t(std::max(height / MinSliceRows, 1))});
+        int rows = (height + int(count) - 1) / int(count);
+        rows = (rows + align - 1) / align * align;
+        return {height, rows, size_t((height + rows - 1) / rows)};
+    }
+    // Get the supported format of peer, empty on accepting all, it never inserts or allocates
+    PropertyEnumList<PixelFormat> _peerPixelFormats() const {
+        return std::as_const(*mSourcePad->next()).properties().pixelFormatList();
+    }
+    Vec<AVPixelFormat> _peerSupportedPixelFormat() const {
+        Vec<AVPixelFormat> formats;
+        for (auto fmt : _peerPixelFormats()) {
+            formats.push_back(ToAVPixelFormat(fmt));
         }
         return formats;
     }
@@ -323,7 +473,9 @@ public:
         dstFrame->width = srcFrame->width;
         dstFrame->height = srcFrame->height;
         dstFrame->format = mD3D11OutputAVFormat;
-        av_frame_get_buffer(dstFrame, 0);
+        if (auto ret = mPool.getVideoBuffer(dstFrame); ret < 0) {
+            return ToError(ret);
+        }
         av_frame_copy_props(dstFrame, srcFrame);
 
         // Do convert
@@ -390,8 +542,15 @@ public:
 #endif
 
 private:
+    static constexpr size_t MaxAutoThreads = 4; //< Auto threads are capped, the decoder and filters need the cores too
+    static constexpr int    MinSliceRows = 64; //< Smaller slices cost more on waking up the threads
+
     SwsContext *mCtxt = nullptr;
+    Vec<SwsContext*> mSliceCtxts; //< Contexts of the slices after the first one (it uses mCtxt)
+    SliceRunner mSlices; //< Threads converting the slices
+    size_t      mNumOfThreads = 0; //< 0 on auto
     AVFrame    *mSwFrame = nullptr; //< Used when hardware format
+    FramePool   mPool; //< Buffers of the output frames
     Pad        *mSinkPad = nullptr;
     Pad        *mSourcePad = nullptr;
     bool        mPassthrough = false; //< Directly passthrough
@@ -221,4 +221,71 @@ constexpr bool IsHardwarePixelFormat(PixelFormat fmt) noexcept {
     return false;
 }
 
+/**
+ * @brief The memory layout of a software pixel format
+ * 
+ */
+struct PixelFormatLayout {
+    int planes = 0;       //< Number of planes, 0 on hardware or unknown format
+    int bits[4] {0};      //< Bits per pixel of each plane, counted on the (subsampled) width of the plane
+    int chromaShiftW = 0; //< log2 of the horizontal subsampling, applied to planes except the first
+    int chromaShiftH = 0; //< log2 of the vertical subsampling, applied to planes except the first
+};
+
+/**
+ * @brief Get the memory layout of the given pixel format
+ * 
+ * @param fmt 
+ * @return PixelFormatLayout, planes is 0 on hardware or unknown format
+ */
+constexpr PixelFormatLayout GetPixelFormatLayout(PixelFormat fmt) noexcept {
+    switch (fmt) {
+        case PixelFormat::YUV420P: return { 3, {8, 8, 8}, 1, 1 };
+        case PixelFormat::YUV422P: return { 3, {8, 8, 8}, 1, 0 };
+        case PixelFormat::YUV444P: return { 3, {8, 8, 8}, 0, 0 };
+        case PixelFormat::YUV410P: return { 3, {8, 8, 8}, 2, 2 };
+        case PixelFormat::YUV411P: return { 3, {8, 8, 8}, 2, 0 };
+        case PixelFormat::UYVY422: return { 1, {16} };
+        case PixelFormat::UYYVYY411: return { 1, {12} };
+        case PixelFormat::BGR8: return { 1, {8} };
+        case PixelFormat::BGR4: return { 1, {4} };
+        case PixelFormat::BGR4_BYTE: return { 1, {8} };
+        case PixelFormat::RGB8: return { 1, {8} };
+        case PixelFormat::RGB4: return { 1, {4} };
+        case PixelFormat::NV12: return { 2, {8, 16}, 1, 1 };
+        case PixelFormat::NV21: return { 2, {8, 16}, 1, 1 };
+
+        case PixelFormat::RGBA: return { 1, {32} };
+        case PixelFormat::BGRA: return { 1, {32} };
+        case PixelFormat::ARGB: return { 1, {32} };
+
+        case PixelFormat::RGBA64LE: return { 1, {64} };
+        case PixelFormat::RGBA64BE: return { 1, {64} };
+
+        case PixelFormat::P010LE: return { 2, {16, 32}, 1, 1 };
+        case PixelFormat::P010BE: return { 2, {16, 32}, 1, 1 };
+        default: return { };
+    }
+}
+/**
+ * @brief Get the size of a plane of the given pixel format
+ * 
+ * @param fmt 
+ * @param plane The plane index
+ * @param width The width of the image
+ * @param height The height of the image
+ * @return std::pair<int, int> The width and height of the plane, in pixels
+ */
+constexpr std::pair<int, int> GetPlaneSize(PixelFormat fmt, int plane, int width, int height) noexcept {
+    if (plane == 0) {
+        return std::make_pair(width, height);
+    }
+    auto layout = GetPixelFormatLayout(fmt);
+    // Round up, the last chroma sample covers the remaining pixels
+    return std::make_pair(
+        (width + (1 << layout.chromaShiftW) - 1) >> layout.chromaShiftW,
+        (height + (1 << layout.chromaShiftH) - 1) >> layout.chromaShiftH
+    );
+}
+
 NEKO_NS_END
\ No newline at end of file
@@ -24,14 +24,6 @@ NEKO_NS_BEGIN
 
 namespace libc {
 
-void *malloc(size_t n) {
-    return ::malloc(n);
-}
-
-void  free(void *ptr) {
-    return ::free(ptr);
-}
-
 void  painc(const char *msg, std::source_location loc) {
     // Mark RED
 
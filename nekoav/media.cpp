@@ -1,56 +1,157 @@
 #define _NEKO_SOURCE
+#include "allocator.hpp"
 #include "time.hpp"
 #include "media.hpp"
 #include "format.hpp"
 #include "context.hpp"
 #include "elements.hpp"
 #include <memory_resource>
+#include <utility>
+#include <vector>
+#include <mutex>
+#include <map>
 
 NEKO_NS_BEGIN
 
 NEKO_IMPL_BEGIN
 
+static constexpr size_t FrameAlignment = 64; //< Alignment of planes and linesizes, enough for AVX512
+
+/**
+ * @brief Recycle the frame buffers, keyed by (type, format, width / channels, height / samples)
+ * @details The sizes of a key never change, so a freed buffer can be directly handed out again.
+ * The pool is never destroyed, the frames released at exit are still safe. The cache is bounded by
+ * MaxCachedBytes and only emptied by an explicit TrimFrameBuffers(), it is shared by all the pipelines.
+ * 
+ */
+class FrameBufferPool {
+public:
+    struct Key {
+        int type;
+        int format;
+        int a; //< Width or channels
+        int b; //< Height or samples
+        std::pmr::memory_resource *resource; //< Where the buffers come from and go back
+
+        auto operator <=>(const Key &) const = default;
+    };
+
+    void *allocate(const Key &key, size_t size) {
+        std::unique_lock lock(mMutex);
+        auto iter = mFree.find(key);
+        if (iter != mFree.end()) {
+            auto ptr = iter->second.buffers.back();
+            iter->second.buffers.pop_back();
+            if (iter->second.buffers.empty()) {
+                mFree.erase(iter); //< Only keep the keys in use, a audio key has the sample count
+            }
+            mCachedBytes -= size;
+            return ptr;
+        }
+        lock.unlock();
+        return key.resource->allocate(size, FrameAlignment);
+    }
+    void deallocate(const Key &key, void *ptr, size_t size) {
+        std::unique_lock lock(mMutex);
+        if (mCachedBytes + size <= MaxCachedBytes) {
+            auto iter = mFree.find(key);
+            if (iter == mFree.end()) {
+                iter = mFree.try_emplace(key, FreeList {size, { }}).first;
+            }
+            if (iter->second.buffers.size() < MaxBuffersPerKey) {
+                iter->second.buffers.push_back(ptr);
+                mCachedBytes += size;
+                return;
+            }
+        }
+        lock.unlock();
+        key.resource->deallocate(ptr, size, FrameAlignment);
+    }
+    /**
+     * @brief Give all cached buffers back to their memory resources
+     * 
+     * @return size_t The bytes released
+     */
+    size_t trim() {
+        std::unique_lock lock(mMutex);
+        auto free = std::move(mFree);
+        auto bytes = std::exchange(mCachedBytes, 0);
+        mFree.clear(); //< Moved from, make it valid again
+        lock.unlock();
+        for (auto &[key, list] : free) {
+            for (auto ptr : list.buffers) {
+                key.resource->deallocate(ptr, list.size, FrameAlignment);
+            }
+        }
+        return bytes;
+    }
+
+    static FrameBufferPool *instance() {
+        static auto pool = new FrameBufferPool;
+        return pool;
+    }
+private:
+    static constexpr size_t MaxBuffersPerKey = 16;
+    static constexpr size_t MaxCachedBytes = 256 * 1024 * 1024;
+
+    struct FreeList {
+        size_t              size; //< The sizes of a key never change
+        std::vector<void *> buffers;
+    };
+
+    std::mutex              mMutex;
+    std::map<Key, FreeList> mFree; //< No empty list kept
+    size_t                  mCachedBytes = 0;
+};
+
+static constexpr size_t AlignFrameSize(size_t n) noexcept {
+    return (n + FrameAlignment - 1) & ~(FrameAlignment - 1);
+}
+
 class MediaFrameImpl final : public MediaFrame {
 public:
     MediaFrameImpl(SampleFormat format, int channels, int sampleCount) :
         mSampleFormat(format), mChannels(channels), mSampleCount(sampleCount) 
     {
         mType = Audio;
+        mKey = { Audio, int(format), channels, sampleCount, std::pmr::get_default_resource() };
+
+        size_t offsets[8] {0};
         if (IsSampleFormatPlanar(format)) {
             // Planar
+            NEKO_ASSERT(channels <= 8);
             for (int n = 0; n < channels; n++) {
                 mLinesize[n] = GetBytesPerSample(format) * sampleCount;
-                mSize[n] = GetBytesPerSample(format) * sampleCount;
-                mData[n] = mPool->allocate(mLinesize[n]);
+                offsets[n] = mBufferSize;
+                mBufferSize += AlignFrameSize(mLinesize[n]);
             }
         }
         else {
             // Packed
             mLinesize[0] = GetBytesPerSample(format) * channels * sampleCount;
-            mSize[0] = GetBytesPerSample(format) * channels * sampleCount;
-            mData[0] = mPool->allocate(mLinesize[0]);
+            mBufferSize = AlignFrameSize(mLinesize[0]);
         }
+        _allocate(offsets);
     }
     MediaFrameImpl(PixelFormat format, int width, int height) : 
         mPixelFormat(format), mWidth(width), mHeight(height)
     {
-        switch (format) {
-            case PixelFormat::RGBA: {
-                mData[0] = mPool->allocate(width * height * 4);
-                mSize[0] = width * height * 4;
-                mLinesize[0] = width * 4;
-                break;
-            }
-            default: ::abort();
-        }
         mType = Video;
+        mKey = { Video, int(format), width, height, GetFrameMemoryResource() }; //< Huge pages on opted in
+
+        auto layout = GetPixelFormatLayout(format);
+        size_t offsets[8] {0};
+        for (int n = 0; n < layout.planes; n++) {
+            auto [w, h] = GetPlaneSize(format, n, width, height);
+            mLinesize[n] = AlignFrameSize((size_t(w) * layout.bits[n] + 7) / 8);
+            offsets[n] = mBufferSize;
+            mBufferSize += size_t(mLinesize[n]) * h;
+        }
+        _allocate(offsets);
     }
     ~MediaFrameImpl() {
-        for (size_t n = 0; n < sizeof(mData) / sizeof(void*); n++) {
-            if (!mData[n]) {
-                continue;
-            }
-            mPool->deallocate(mData[n], mSize[n]);
+        if (mBuffer) {
+            FrameBufferPool::instance()->deallocate(mKey, mBuffer, mBufferSize);
         }
     }
 
@@ -75,6 +176,9 @@ public:
     int linesize(int p) const override {
         return mLinesize[p];
     }
+    size_t memorySize() const override {
+        return mBufferSize;
+    }
     void *data(int p) const override {
         return mData[p];
     }
@@ -100,6 +204,18 @@ public:
         return true;
     }
 private:
+    void _allocate(const size_t (&offsets)[8]) {
+        if (mBufferSize == 0) {
+            return;
+        }
+        mBuffer = FrameBufferPool::instance()->allocate(mKey, mBufferSize);
+        for (int n = 0; n < 8; n++) {
+            if (mLinesize[n]) {
+                mData[n] = static_cast<uint8_t *>(mBuffer) + offsets[n];
+            }
+        }
+    }
+
     // Header
     enum {
         Video,
@@ -119,13 +235,13 @@ private:
 
     // Common part
     void *mData[8]     {0};
-    int   mSize[8]     {0};
     int   mLinesize[8] {0};
+    void *mBuffer = nullptr; //< All planes in one block from the pool
+    size_t mBufferSize = 0;
+    FrameBufferPool::Key mKey { };
 
     double mTimestamp = 0.0;
     double mDuration = 0.0;
-
-    std::pmr::memory_resource* mPool = std::pmr::get_default_resource();
 };
 
 NEKO_IMPL_END
@@ -178,11 +294,17 @@ void ExternalClock::setPosition(double position) {
     mCurrent = position;
 }
 
-Arc<MediaFrame> CreateAudioFrame(SampleFormat fmt, int channels, int samples) {
-    return make_shared<MediaFrameImpl>(fmt, channels, samples);
+size_t TrimFrameBuffers() {
+    return FrameBufferPool::instance()->trim();
+}
+Ref<MediaFrame> CreateAudioFrame(SampleFormat fmt, int channels, int samples) {
+    return MakeRef<MediaFrameImpl>(fmt, channels, samples);
 }
-Arc<MediaFrame> CreateVideoFrame(PixelFormat fmt, int width, int height) {
-    return make_shared<MediaFrameImpl>(fmt, width, height);
+Ref<MediaFrame> CreateVideoFrame(PixelFormat fmt, int width, int height) {
+    if (GetPixelFormatLayout(fmt).planes == 0 || width <= 0 || height <= 0) {
+        return nullptr;
+    }
+    return MakeRef<MediaFrameImpl>(fmt, width, height);
 }
 MediaController *GetMediaController(View<Element> element) {
     if (!element || !element->context()) {
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "resource.hpp"
+#include <algorithm>
+#include <cstdlib>
 #include <string>
 #include <span>
 
@@ -43,6 +45,21 @@ public:
     virtual auto data(int plane) const -> void * = 0;
 
     virtual auto makeWritable() -> bool = 0;
+
+    /**
+     * @brief Get the bytes of the planes held by this frame, used by the memory budgets of queues
+     * @details The default one estimates it by linesize, override it on knowing the real buffer size
+     * 
+     * @return size_t 
+     */
+    virtual auto memorySize() const -> size_t {
+        size_t bytes = 0;
+        int rows = std::max(query(Value::Height), 1); //< Audio planes are a single row
+        for (int plane = 0; plane < 8 && data(plane); plane++) {
+            bytes += size_t(std::abs(linesize(plane))) * rows;
+        }
+        return bytes;
+    }
     
     /**
      * @brief Detail based Prop
@@ -78,6 +95,13 @@ public:
     inline  auto setSampleRate(int sampleRate) -> bool { return set(Value::SampleRate, &sampleRate); }
     inline  auto setTimestamp(double timestamp) -> bool { return set(Value::Timestamp, &timestamp); }
     inline  auto setDuration(double duration) -> bool { return set(Value::Duration, &duration); }
+
+    void *operator new(size_t size) {
+        return libc::malloc(size, AllocCategory::Frame);
+    }
+    void operator delete(void *ptr) {
+        return libc::free(ptr);
+    }
 };
 
 /**
@@ -90,6 +114,13 @@ public:
     virtual auto data() const -> void * = 0;
     virtual auto duration() const -> double = 0;
     virtual auto timestamp() const -> double = 0;
+
+    void *operator new(size_t size) {
+        return libc::malloc(size, AllocCategory::Packet);
+    }
+    void operator delete(void *ptr) {
+        return libc::free(ptr);
+    }
 };
 
 /**
@@ -271,22 +302,34 @@ private:
 
 /**
  * @brief Create a Audio Frame object
+ * @details Every plane is 64 bytes aligned, the buffer is recycled by (fmt, channels, samples)
  * 
  * @param fmt The format type
  * @param channels Numbe of channels
  * @param samples Number of samples in a single channel
- * @return Arc<MediaFrame> 
+ * @return Ref<MediaFrame>, call shared_from_this() on it for a Arc
  */
-extern NEKO_API Arc<MediaFrame> CreateAudioFrame(SampleFormat fmt, int channels, int samples);
+extern NEKO_API Ref<MediaFrame> CreateAudioFrame(SampleFormat fmt, int channels, int samples);
 /**
  * @brief Create a Video Frame object
+ * @details Every plane and linesize is 64 bytes aligned, the buffer is recycled by (fmt, width, height).
+ * The buffer comes from GetFrameMemoryResource(), see SetFrameHugePages()
  * 
- * @param fmt 
+ * @param fmt The software pixel format
  * @param width 
  * @param height 
- * @return Arc<MediaFrame> 
+ * @return Ref<MediaFrame>, nullptr on hardware or unknown format
+ */
+extern NEKO_API Ref<MediaFrame> CreateVideoFrame(PixelFormat fmt, int width, int height);
+/**
+ * @brief Release the frame buffers cached for reuse by CreateAudioFrame() / CreateVideoFrame()
+ * @details The cache is shared by all pipelines and bounded by its own size cap, nothing trims it automatically.
+ * Call it when the app is done with playback (or after changing SetFrameHugePages() to drop the buffers of the previous mode),
+ * the buffers of the frames still alive go back to the cache as usual.
+ * 
+ * @return size_t The bytes released
  */
-extern NEKO_API Arc<MediaFrame> CreateVideoFrame(PixelFormat fmt, int width, int height);
+extern NEKO_API size_t TrimFrameBuffers();
 /**
  * @brief Get the Media Controller object with object
  * 
@@ -0,0 +1,318 @@
+#define _NEKO_SOURCE
+#include "blend.hpp"
+#include "../cpu.hpp"
+#include <algorithm>
+#include <cstring>
+
+#if defined(NEKO_X86)
+    #include <immintrin.h>
+#endif
+
+NEKO_NS_BEGIN
+
+NEKO_IMPL_BEGIN
+
+// Blend a row of n pixels, the color has the alpha byte 255, the coverage is mask * alpha / 255
+using MaskFn = void (*)(uint8_t *dst, const uint8_t *mask, int n, const uint8_t color[4], uint32_t alpha);
+// Blend a row of n pixels, the source is the color and its alpha is the coverage
+using RGBAFn = void (*)(uint8_t *dst, const uint8_t *src, int n);
+
+// x / 255 rounded, exact for x in [0, 255 * 255]
+inline uint32_t Div255(uint32_t x) noexcept {
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+void ScalarMaskRange(uint8_t *dst, const uint8_t *mask, int begin, int end, const uint8_t color[4], uint32_t alpha) {
+    for (int x = begin; x < end; x++) {
+        uint32_t k = Div255(mask[x] * alpha);
+        if (k == 0) {
+            continue;
+        }
+        for (int c = 0; c < 4; c++) {
+            dst[x * 4 + c] = uint8_t(Div255(color[c] * k + dst[x * 4 + c] * (255 - k)));
+        }
+    }
+}
+void ScalarRGBARange(uint8_t *dst, const uint8_t *src, int begin, int end) {
+    for (int x = begin; x < end; x++) {
+        uint32_t k = src[x * 4 + 3];
+        if (k == 0) {
+            continue;
+        }
+        for (int c = 0; c < 3; c++) {
+            dst[x * 4 + c] = uint8_t(Div255(src[x * 4 + c] * k + dst[x * 4 + c] * (255 - k)));
+        }
+        dst[x * 4 + 3] = uint8_t(Div255(255 * k + dst[x * 4 + 3] * (255 - k)));
+    }
+}
+
+void ScalarMask(uint8_t *dst, const uint8_t *mask, int n, const uint8_t color[4], uint32_t alpha) {
+    ScalarMaskRange(dst, mask, 0, n, color, alpha);
+}
+void ScalarRGBA(uint8_t *dst, const uint8_t *src, int n) {
+    ScalarRGBARange(dst, src, 0, n);
+}
+
+#if defined(NEKO_X86)
+
+// The pixels are unpacked to 16 bits, color * k + dst * (255 - k) is at most 255 * 255 so it fits in uint16
+// The coverage k is broadcasted to the 4 bytes of every pixel, the blocks of zero coverage are skipped
+
+NEKO_TARGET("sse2")
+inline __m128i SSE2Div255(__m128i v) {
+    v = _mm_add_epi16(v, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(v, _mm_srli_epi16(v, 8)), 8);
+}
+NEKO_TARGET("sse2")
+inline __m128i SSE2Over(__m128i dst, __m128i color, __m128i k) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i full = _mm_set1_epi16(255);
+    auto kl = _mm_unpacklo_epi8(k, zero);
+    auto kh = _mm_unpackhi_epi8(k, zero);
+    auto lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(color, zero), kl), _mm_mullo_epi16(_mm_unpacklo_epi8(dst, zero), _mm_sub_epi16(full, kl)));
+    auto hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(color, zero), kh), _mm_mullo_epi16(_mm_unpackhi_epi8(dst, zero), _mm_sub_epi16(full, kh)));
+    return _mm_packus_epi16(SSE2Div255(lo), SSE2Div255(hi));
+}
+// The coverage of 16 pixels, mask * alpha / 255
+NEKO_TARGET("sse2")
+inline __m128i SSE2Coverage(__m128i mask, uint32_t alpha) {
+    if (alpha == 255) {
+        return mask;
+    }
+    const __m128i zero = _mm_setzero_si128();
+    auto a = _mm_set1_epi16(short(alpha));
+    auto lo = SSE2Div255(_mm_mullo_epi16(_mm_unpacklo_epi8(mask, zero), a));
+    auto hi = SSE2Div255(_mm_mullo_epi16(_mm_unpackhi_epi8(mask, zero), a));
+    return _mm_packus_epi16(lo, hi);
+}
+
+NEKO_TARGET("sse2")
+void SSE2Mask(uint8_t *dst, const uint8_t *mask, int n, const uint8_t color[4], uint32_t alpha) {
+    const __m128i zero = _mm_setzero_si128();
+    uint32_t rgba;
+    ::memcpy(&rgba, color, 4);
+    const __m128i c = _mm_set1_epi32(int(rgba));
+    int x = 0;
+    for (; x + 16 <= n; x += 16) {
+        auto m = _mm_loadu_si128(reinterpret_cast<const __m128i*>(mask + x));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(m, zero)) == 0xFFFF) {
+            continue;
+        }
+        auto k = SSE2Coverage(m, alpha);
+        auto k8 = _mm_unpacklo_epi8(k, k);
+        auto k16 = _mm_unpackhi_epi8(k, k);
+        __m128i ks[4] = {
+            _mm_unpacklo_epi16(k8, k8), _mm_unpackhi_epi16(k8, k8),
+            _mm_unpacklo_epi16(k16, k16), _mm_unpackhi_epi16(k16, k16)
+        };
+        for (int b = 0; b < 4; b++) {
+            auto ptr = reinterpret_cast<__m128i*>(dst + (x + b * 4) * 4);
+            _mm_storeu_si128(ptr, SSE2Over(_mm_loadu_si128(ptr), c, ks[b]));
+        }
+    }
+    ScalarMaskRange(dst, mask, x, n, color, alpha);
+}
+NEKO_TARGET("sse2")
+void SSE2RGBA(uint8_t *dst, const uint8_t *src, int n) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alphaMask = _mm_set1_epi32(int(0xFF000000));
+    int x = 0;
+    for (; x + 4 <= n; x += 4) {
+        auto s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x * 4));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(s, alphaMask), zero)) == 0xFFFF) {
+            continue;
+        }
+        auto k = _mm_srli_epi32(s, 24);
+        k = _mm_or_si128(k, _mm_slli_epi32(k, 8));
+        k = _mm_or_si128(k, _mm_slli_epi32(k, 16));
+        auto ptr = reinterpret_cast<__m128i*>(dst + x * 4);
+        _mm_storeu_si128(ptr, SSE2Over(_mm_loadu_si128(ptr), _mm_or_si128(s, alphaMask), k));
+    }
+    ScalarRGBARange(dst, src, x, n);
+}
+
+NEKO_TARGET("avx2")
+inline __m256i AVX2Div255(__m256i v) {
+    v = _mm256_add_epi16(v, _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(v, _mm256_srli_epi16(v, 8)), 8);
+}
+NEKO_TARGET("avx2")
+inline __m256i AVX2Over(__m256i dst, __m256i color, __m256i k) {
+    // The unpacks and the pack work in lanes, so the pixels come back in order
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i full = _mm256_set1_epi16(255);
+    auto kl = _mm256_unpacklo_epi8(k, zero);
+    auto kh = _mm256_unpackhi_epi8(k, zero);
+    auto lo = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(color, zero), kl), _mm256_mullo_epi16(_mm256_unpacklo_epi8(dst, zero), _mm256_sub_epi16(full, kl)));
+    auto hi = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(color, zero), kh), _mm256_mullo_epi16(_mm256_unpackhi_epi8(dst, zero), _mm256_sub_epi16(full, kh)));
+    return _mm256_packus_epi16(AVX2Div255(lo), AVX2Div255(hi));
+}
+// The coverage of a pixel in every byte of its 32 bits
+NEKO_TARGET("avx2")
+inline __m256i AVX2Broadcast(__m256i k) {
+    k = _mm256_or_si256(k, _mm256_slli_epi32(k, 8));
+    return _mm256_or_si256(k, _mm256_slli_epi32(k, 16));
+}
+
+NEKO_TARGET("avx2")
+void AVX2Mask(uint8_t *dst, const uint8_t *mask, int n, const uint8_t color[4], uint32_t alpha) {
+    const __m128i zero = _mm_setzero_si128();
+    uint32_t rgba;
+    ::memcpy(&rgba, color, 4);
+    const __m256i c = _mm256_set1_epi32(int(rgba));
+    int x = 0;
+    for (; x + 16 <= n; x += 16) {
+        auto m = _mm_loadu_si128(reinterpret_cast<const __m128i*>(mask + x));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(m, zero)) == 0xFFFF) {
+            continue;
+        }
+        auto k = SSE2Coverage(m, alpha);
+        __m256i ks[2] = {
+            AVX2Broadcast(_mm256_cvtepu8_epi32(k)),
+            AVX2Broadcast(_mm256_cvtepu8_epi32(_mm_srli_si128(k, 8)))
+        };
+        for (int b = 0; b < 2; b++) {
+            auto ptr = reinterpret_cast<__m256i*>(dst + (x + b * 8) * 4);
+            _mm256_storeu_si256(ptr, AVX2Over(_mm256_loadu_si256(ptr), c, ks[b]));
+        }
+    }
+    ScalarMaskRange(dst, mask, x, n, color, alpha);
+}
+NEKO_TARGET("avx2")
+void AVX2RGBA(uint8_t *dst, const uint8_t *src, int n) {
+    const __m256i alphaMask = _mm256_set1_epi32(int(0xFF000000));
+    int x = 0;
+    for (; x + 8 <= n; x += 8) {
+        auto s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + x * 4));
+        if (_mm256_testz_si256(s, alphaMask)) {
+            continue;
+        }
+        auto k = AVX2Broadcast(_mm256_srli_epi32(s, 24));
+        auto ptr = reinterpret_cast<__m256i*>(dst + x * 4);
+        _mm256_storeu_si256(ptr, AVX2Over(_mm256_loadu_si256(ptr), _mm256_or_si256(s, alphaMask), k));
+    }
+    ScalarRGBARange(dst, src, x, n);
+}
+
+NEKO_TARGET("avx512f,avx512bw")
+inline __m512i AVX512Div255(__m512i v) {
+    v = _mm512_add_epi16(v, _mm512_set1_epi16(128));
+    return _mm512_srli_epi16(_mm512_add_epi16(v, _mm512_srli_epi16(v, 8)), 8);
+}
+NEKO_TARGET("avx512f,avx512bw")
+inline __m512i AVX512Over(__m512i dst, __m512i color, __m512i k) {
+    const __m512i zero = _mm512_setzero_si512();
+    const __m512i full = _mm512_set1_epi16(255);
+    auto kl = _mm512_unpacklo_epi8(k, zero);
+    auto kh = _mm512_unpackhi_epi8(k, zero);
+    auto lo = _mm512_add_epi16(_mm512_mullo_epi16(_mm512_unpacklo_epi8(color, zero), kl), _mm512_mullo_epi16(_mm512_unpacklo_epi8(dst, zero), _mm512_sub_epi16(full, kl)));
+    auto hi = _mm512_add_epi16(_mm512_mullo_epi16(_mm512_unpackhi_epi8(color, zero), kh), _mm512_mullo_epi16(_mm512_unpackhi_epi8(dst, zero), _mm512_sub_epi16(full, kh)));
+    return _mm512_packus_epi16(AVX512Div255(lo), AVX512Div255(hi));
+}
+NEKO_TARGET("avx512f,avx512bw")
+inline __m512i AVX512Broadcast(__m512i k) {
+    k = _mm512_or_si512(k, _mm512_slli_epi32(k, 8));
+    return _mm512_or_si512(k, _mm512_slli_epi32(k, 16));
+}
+
+NEKO_TARGET("avx512f,avx512bw")
+void AVX512Mask(uint8_t *dst, const uint8_t *mask, int n, const uint8_t color[4], uint32_t alpha) {
+    const __m128i zero = _mm_setzero_si128();
+    uint32_t rgba;
+    ::memcpy(&rgba, color, 4);
+    const __m512i c = _mm512_set1_epi32(int(rgba));
+    int x = 0;
+    for (; x + 16 <= n; x += 16) {
+        auto m = _mm_loadu_si128(reinterpret_cast<const __m128i*>(mask + x));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(m, zero)) == 0xFFFF) {
+            continue;
+        }
+        auto k = AVX512Broadcast(_mm512_cvtepu8_epi32(SSE2Coverage(m, alpha)));
+        auto ptr = dst + x * 4;
+        _mm512_storeu_si512(ptr, AVX512Over(_mm512_loadu_si512(ptr), c, k));
+    }
+    ScalarMaskRange(dst, mask, x, n, color, alpha);
+}
+NEKO_TARGET("avx512f,avx512bw")
+void AVX512RGBA(uint8_t *dst, const uint8_t *src, int n) {
+    const __m512i alphaMask = _mm512_set1_epi32(int(0xFF000000));
+    int x = 0;
+    for (; x + 16 <= n; x += 16) {
+        auto s = _mm512_loadu_si512(src + x * 4);
+        if (_mm512_test_epi32_mask(s, alphaMask) == 0) {
+            continue;
+        }
+        auto k = AVX512Broadcast(_mm512_srli_epi32(s, 24));
+        auto ptr = dst + x * 4;
+        _mm512_storeu_si512(ptr, AVX512Over(_mm512_loadu_si512(ptr), _mm512_or_si512(s, alphaMask), k));
+    }
+    ScalarRGBARange(dst, src, x, n);
+}
+
+#endif
+
+MaskFn SelectMask(SimdLevel level) noexcept {
+#if defined(NEKO_X86)
+    switch (level) {
+        case SimdLevel::AVX512: return AVX512Mask;
+        case SimdLevel::AVX2: return AVX2Mask;
+        case SimdLevel::SSE2: return SSE2Mask;
+        default: break;
+    }
+#endif
+    return ScalarMask;
+}
+RGBAFn SelectRGBA(SimdLevel level) noexcept {
+#if defined(NEKO_X86)
+    switch (level) {
+        case SimdLevel::AVX512: return AVX512RGBA;
+        case SimdLevel::AVX2: return AVX2RGBA;
+        case SimdLevel::SSE2: return SSE2RGBA;
+        default: break;
+    }
+#endif
+    return ScalarRGBA;
+}
+
+NEKO_IMPL_END
+
+void BlendMask(
+    uint8_t *dst, int dstPitch, int dstWidth, int dstHeight,
+    const uint8_t *mask, int maskStride, int maskWidth, int maskHeight,
+    int x, int y, uint32_t color) noexcept
+{
+    // Clip by the image
+    int x0 = std::max(x, 0);
+    int y0 = std::max(y, 0);
+    int x1 = std::min(x + maskWidth, dstWidth);
+    int y1 = std::min(y + maskHeight, dstHeight);
+    uint32_t alpha = 255 - (color & 0xFF);
+    if (x0 >= x1 || y0 >= y1 || alpha == 0) {
+        return;
+    }
+    const uint8_t rgba[4] = {uint8_t(color >> 24), uint8_t(color >> 16), uint8_t(color >> 8), 255};
+    auto blend = SelectMask(GetSimdLevel());
+    for (int row = y0; row < y1; row++) {
+        blend(dst + ptrdiff_t(row) * dstPitch + x0 * 4, mask + ptrdiff_t(row - y) * maskStride + (x0 - x), x1 - x0, rgba, alpha);
+    }
+}
+void BlendRGBA(
+    uint8_t *dst, int dstPitch, int dstWidth, int dstHeight,
+    const uint8_t *src, int srcPitch, int srcWidth, int srcHeight,
+    int x, int y) noexcept
+{
+    int x0 = std::max(x, 0);
+    int y0 = std::max(y, 0);
+    int x1 = std::min(x + srcWidth, dstWidth);
+    int y1 = std::min(y + srcHeight, dstHeight);
+    if (x0 >= x1 || y0 >= y1) {
+        return;
+    }
+    auto blend = SelectRGBA(GetSimdLevel());
+    for (int row = y0; row < y1; row++) {
+        blend(dst + ptrdiff_t(row) * dstPitch + x0 * 4, src + ptrdiff_t(row - y) * srcPitch + (x0 - x) * 4, x1 - x0);
+    }
+}
+
+NEKO_NS_END
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "../defs.hpp"
+#include <cstdint>
+
+NEKO_NS_BEGIN
+
+/**
+ * @brief Blend a coverage mask of one color (like an ASS_Image glyph bitmap) over a RGBA image, in place
+ * @details Every pixel is (color * k + dst * (255 - k)) / 255 with k = mask * alpha / 255, rounded,
+ * the alpha channel is blended as a color of 255. The mask is clipped by the image.
+ * It runs by rows with the SIMD kernel of GetSimdLevel(), the blocks of zero coverage are skipped.
+ *
+ * @param dst The RGBA image
+ * @param dstPitch The linesize of the image in bytes
+ * @param dstWidth
+ * @param dstHeight
+ * @param mask The coverage, 0 on transparent
+ * @param maskStride The linesize of the mask in bytes
+ * @param maskWidth
+ * @param maskHeight
+ * @param x The position of the mask in the image, can be out of the image
+ * @param y
+ * @param color 0xRRGGBBAA, the AA is the transparency (0 on opaque) as the ASS_Image color
+ */
+extern NEKO_API void BlendMask(
+    uint8_t *dst, int dstPitch, int dstWidth, int dstHeight,
+    const uint8_t *mask, int maskStride, int maskWidth, int maskHeight,
+    int x, int y, uint32_t color
+) noexcept;
+/**
+ * @brief Blend a RGBA image with straight alpha (like a converted bitmap subtitle) over a RGBA image, in place
+ * @details Every pixel is (src * a + dst * (255 - a)) / 255 with the alpha a of the source, the same as BlendMask()
+ * with the source as color and its alpha as coverage. The source is clipped by the image.
+ *
+ * @param dst The RGBA image
+ * @param dstPitch The linesize of the image in bytes
+ * @param dstWidth
+ * @param dstHeight
+ * @param src The RGBA source
+ * @param srcPitch The linesize of the source in bytes
+ * @param srcWidth
+ * @param srcHeight
+ * @param x The position of the source in the image, can be out of the image
+ * @param y
+ */
+extern NEKO_API void BlendRGBA(
+    uint8_t *dst, int dstPitch, int dstWidth, int dstHeight,
+    const uint8_t *src, int srcPitch, int srcWidth, int srcHeight,
+    int x, int y
+) noexcept;
+
+NEKO_NS_END
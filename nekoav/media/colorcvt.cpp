@@ -0,0 +1,359 @@
+#define _NEKO_SOURCE
+#include "colorcvt.hpp"
+#include "../cpu.hpp"
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+#if defined(NEKO_X86)
+    #include <immintrin.h>
+#endif
+
+NEKO_NS_BEGIN
+
+NEKO_IMPL_BEGIN
+
+/**
+ * @brief The fixed point coefficients, byte n of a pixel is (y * cy + u * cu[n] + v * cv[n] + bias[n]) >> shift
+ * @details The bias folds the offsets of Y / UV and the rounding, so the kernels take the samples as they are.
+ * The byte 3 is the alpha (255).
+ *
+ */
+struct Coefficients {
+    int16_t cy;
+    int16_t cu[3];
+    int16_t cv[3];
+    int32_t bias[3];
+    int     shift;
+};
+
+enum class Layout {
+    Planar8,      //< YUV420P
+    SemiPlanar8,  //< NV12, u is the interleaved UV, v is unused
+    SemiPlanar16, //< P010LE, 10 bits in the high bits of every uint16
+};
+
+// Convert a row, return the number of pixels done, the rest is done by the C one
+using RowFn = int (*)(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *dst, int width, const Coefficients &c);
+
+Coefficients MakeCoefficients(YUVMatrix matrix, bool fullRange, int bits, bool bgra) {
+    double kr = 0.299, kb = 0.114;
+    switch (matrix) {
+        case YUVMatrix::BT601: break;
+        case YUVMatrix::BT709: kr = 0.2126; kb = 0.0722; break;
+        case YUVMatrix::BT2020: kr = 0.2627; kb = 0.0593; break;
+    }
+    double kg = 1.0 - kr - kb;
+    int depth = bits - 8;
+    int yOffset = fullRange ? 0 : (16 << depth);
+    int cOffset = 128 << depth;
+    // The scale to 8 bits output, the shift takes off the extra bits of the depth
+    double yScale = fullRange ? 255.0 * (1 << depth) / ((1 << bits) - 1) : 255.0 / 219.0;
+    double cScale = fullRange ? yScale : 255.0 / 224.0;
+    auto fixed = [](double v) {
+        return int16_t(std::lround(v * 8192.0));
+    };
+    int16_t rv = fixed(cScale * 2.0 * (1.0 - kr));
+    int16_t bu = fixed(cScale * 2.0 * (1.0 - kb));
+    int16_t gu = -fixed(cScale * 2.0 * (1.0 - kb) * kb / kg);
+    int16_t gv = -fixed(cScale * 2.0 * (1.0 - kr) * kr / kg);
+
+    Coefficients c { };
+    c.cy = fixed(yScale);
+    c.shift = 13 + depth;
+    int r = bgra ? 2 : 0, b = bgra ? 0 : 2;
+    c.cu[r] = 0;  c.cv[r] = rv;
+    c.cu[1] = gu; c.cv[1] = gv;
+    c.cu[b] = bu; c.cv[b] = 0;
+    for (int n = 0; n < 3; n++) {
+        c.bias[n] = -yOffset * c.cy - cOffset * (c.cu[n] + c.cv[n]) + (1 << (c.shift - 1));
+    }
+    return c;
+}
+
+inline uint8_t Clamp8(int v) noexcept {
+    return uint8_t(std::clamp(v, 0, 255));
+}
+
+// The reference, and the tail of the SIMD ones, gives the same result as them
+template <Layout L>
+void CRow(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *dst, int x, int width, const Coefficients &c) {
+    for (; x < width; x++) {
+        int Y, U, V;
+        if constexpr (L == Layout::Planar8) {
+            Y = y[x];
+            U = u[x / 2];
+            V = v[x / 2];
+        }
+        else if constexpr (L == Layout::SemiPlanar8) {
+            Y = y[x];
+            U = u[x / 2 * 2];
+            V = u[x / 2 * 2 + 1];
+        }
+        else {
+            auto y16 = reinterpret_cast<const uint16_t*>(y);
+            auto uv16 = reinterpret_cast<const uint16_t*>(u);
+            Y = y16[x] >> 6;
+            U = uv16[x / 2 * 2] >> 6;
+            V = uv16[x / 2 * 2 + 1] >> 6;
+        }
+        int yt = Y * c.cy;
+        for (int n = 0; n < 3; n++) {
+            dst[x * 4 + n] = Clamp8((yt + U * c.cu[n] + V * c.cv[n] + c.bias[n]) >> c.shift);
+        }
+        dst[x * 4 + 3] = 255;
+    }
+}
+
+#if defined(NEKO_X86)
+
+inline int LoadU32(const void *ptr) noexcept {
+    int v;
+    ::memcpy(&v, ptr, sizeof(v));
+    return v;
+}
+// The (u, v) int16 pair of the channel, for madd
+inline int PairOf(const Coefficients &c, int n) noexcept {
+    return int(uint16_t(c.cu[n]) | (uint32_t(uint16_t(c.cv[n])) << 16));
+}
+
+// 8 pixels a step, pack to bytes by the saturation of packs / packus
+template <Layout L>
+NEKO_TARGET("sse2")
+int SSE2Row(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *dst, int width, const Coefficients &c) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alpha = _mm_set1_epi16(255);
+    const __m128i cy = _mm_set1_epi32(c.cy); //< (cy, 0) pairs, the Y lanes are (y, 0) pairs
+    const __m128i shift = _mm_cvtsi32_si128(c.shift);
+    __m128i cuv[3], bias[3];
+    for (int n = 0; n < 3; n++) {
+        cuv[n] = _mm_set1_epi32(PairOf(c, n));
+        bias[n] = _mm_set1_epi32(c.bias[n]);
+    }
+
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m128i yy, uv; //< 8 Y in uint16, 4 (u, v) pairs in int16
+        if constexpr (L == Layout::Planar8) {
+            yy = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(y + x)), zero);
+            auto uu = _mm_cvtsi32_si128(LoadU32(u + x / 2));
+            auto vv = _mm_cvtsi32_si128(LoadU32(v + x / 2));
+            uv = _mm_unpacklo_epi8(_mm_unpacklo_epi8(uu, vv), zero);
+        }
+        else if constexpr (L == Layout::SemiPlanar8) {
+            yy = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(y + x)), zero);
+            uv = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(u + x)), zero);
+        }
+        else {
+            yy = _mm_srli_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(y + x * 2)), 6);
+            uv = _mm_srli_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(u + x * 2)), 6);
+        }
+        auto y0 = _mm_madd_epi16(_mm_unpacklo_epi16(yy, zero), cy);
+        auto y1 = _mm_madd_epi16(_mm_unpackhi_epi16(yy, zero), cy);
+
+        __m128i ch[3]; //< 8 int16 of every channel
+        for (int n = 0; n < 3; n++) {
+            auto t = _mm_madd_epi16(uv, cuv[n]); //< One lane for two pixels
+            auto lo = _mm_sra_epi32(_mm_add_epi32(_mm_add_epi32(y0, _mm_unpacklo_epi32(t, t)), bias[n]), shift);
+            auto hi = _mm_sra_epi32(_mm_add_epi32(_mm_add_epi32(y1, _mm_unpackhi_epi32(t, t)), bias[n]), shift);
+            ch[n] = _mm_packs_epi32(lo, hi);
+        }
+        auto p01 = _mm_packus_epi16(ch[0], ch[1]);
+        auto p23 = _mm_packus_epi16(ch[2], alpha);
+        auto a = _mm_unpacklo_epi8(p01, _mm_srli_si128(p01, 8));
+        auto b = _mm_unpacklo_epi8(p23, _mm_srli_si128(p23, 8));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x * 4), _mm_unpacklo_epi16(a, b));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x * 4 + 16), _mm_unpackhi_epi16(a, b));
+    }
+    return x;
+}
+
+// 16 pixels a step, clamp in int32 and pack the pixel by shifts, no lane crossing pack
+template <Layout L>
+NEKO_TARGET("avx2")
+int AVX2Row(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *dst, int width, const Coefficients &c) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i max = _mm256_set1_epi32(255);
+    const __m256i alpha = _mm256_set1_epi32(int(0xFF000000));
+    const __m256i cy = _mm256_set1_epi32(c.cy);
+    const __m256i dupLo = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+    const __m256i dupHi = _mm256_setr_epi32(4, 4, 5, 5, 6, 6, 7, 7);
+    const __m128i shift = _mm_cvtsi32_si128(c.shift);
+    __m256i cuv[3], bias[3];
+    for (int n = 0; n < 3; n++) {
+        cuv[n] = _mm256_set1_epi32(PairOf(c, n));
+        bias[n] = _mm256_set1_epi32(c.bias[n]);
+    }
+
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m256i y0, y1, uv; //< Y of pixel 0 ~ 7 / 8 ~ 15 in int32, 8 (u, v) pairs in int16
+        if constexpr (L == Layout::Planar8) {
+            auto yy = _mm_loadu_si128(reinterpret_cast<const __m128i*>(y + x));
+            y0 = _mm256_cvtepu8_epi32(yy);
+            y1 = _mm256_cvtepu8_epi32(_mm_srli_si128(yy, 8));
+            auto uu = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(u + x / 2));
+            auto vv = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(v + x / 2));
+            uv = _mm256_cvtepu8_epi16(_mm_unpacklo_epi8(uu, vv));
+        }
+        else if constexpr (L == Layout::SemiPlanar8) {
+            auto yy = _mm_loadu_si128(reinterpret_cast<const __m128i*>(y + x));
+            y0 = _mm256_cvtepu8_epi32(yy);
+            y1 = _mm256_cvtepu8_epi32(_mm_srli_si128(yy, 8));
+            uv = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(u + x)));
+        }
+        else {
+            auto yy = _mm256_srli_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(y + x * 2)), 6);
+            y0 = _mm256_cvtepu16_epi32(_mm256_castsi256_si128(yy));
+            y1 = _mm256_cvtepu16_epi32(_mm256_extracti128_si256(yy, 1));
+            uv = _mm256_srli_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(u + x * 2)), 6);
+        }
+        y0 = _mm256_madd_epi16(y0, cy);
+        y1 = _mm256_madd_epi16(y1, cy);
+
+        __m256i px0 = alpha, px1 = alpha;
+        for (int n = 0; n < 3; n++) {
+            auto t = _mm256_madd_epi16(uv, cuv[n]);
+            auto lo = _mm256_sra_epi32(_mm256_add_epi32(_mm256_add_epi32(y0, _mm256_permutevar8x32_epi32(t, dupLo)), bias[n]), shift);
+            auto hi = _mm256_sra_epi32(_mm256_add_epi32(_mm256_add_epi32(y1, _mm256_permutevar8x32_epi32(t, dupHi)), bias[n]), shift);
+            lo = _mm256_min_epi32(_mm256_max_epi32(lo, zero), max);
+            hi = _mm256_min_epi32(_mm256_max_epi32(hi, zero), max);
+            px0 = _mm256_or_si256(px0, _mm256_slli_epi32(lo, n * 8));
+            px1 = _mm256_or_si256(px1, _mm256_slli_epi32(hi, n * 8));
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + x * 4), px0);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + x * 4 + 32), px1);
+    }
+    return x;
+}
+
+// 32 pixels a step, as the AVX2 one
+template <Layout L>
+NEKO_TARGET("avx512f,avx512bw")
+int AVX512Row(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *dst, int width, const Coefficients &c) {
+    const __m512i zero = _mm512_setzero_si512();
+    const __m512i max = _mm512_set1_epi32(255);
+    const __m512i alpha = _mm512_set1_epi32(int(0xFF000000));
+    const __m512i cy = _mm512_set1_epi32(c.cy);
+    const __m512i dupLo = _mm512_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7);
+    const __m512i dupHi = _mm512_setr_epi32(8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13, 14, 14, 15, 15);
+    const __m128i shift = _mm_cvtsi32_si128(c.shift);
+    __m512i cuv[3], bias[3];
+    for (int n = 0; n < 3; n++) {
+        cuv[n] = _mm512_set1_epi32(PairOf(c, n));
+        bias[n] = _mm512_set1_epi32(c.bias[n]);
+    }
+
+    int x = 0;
+    for (; x + 32 <= width; x += 32) {
+        __m512i y0, y1, uv; //< Y of pixel 0 ~ 15 / 16 ~ 31 in int32, 16 (u, v) pairs in int16
+        if constexpr (L == Layout::Planar8) {
+            auto yy = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(y + x));
+            y0 = _mm512_cvtepu8_epi32(_mm256_castsi256_si128(yy));
+            y1 = _mm512_cvtepu8_epi32(_mm256_extracti128_si256(yy, 1));
+            auto uu = _mm_loadu_si128(reinterpret_cast<const __m128i*>(u + x / 2));
+            auto vv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(v + x / 2));
+            auto pairs = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi8(uu, vv)), _mm_unpackhi_epi8(uu, vv), 1);
+            uv = _mm512_cvtepu8_epi16(pairs);
+        }
+        else if constexpr (L == Layout::SemiPlanar8) {
+            auto yy = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(y + x));
+            y0 = _mm512_cvtepu8_epi32(_mm256_castsi256_si128(yy));
+            y1 = _mm512_cvtepu8_epi32(_mm256_extracti128_si256(yy, 1));
+            uv = _mm512_cvtepu8_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(u + x)));
+        }
+        else {
+            auto yy = _mm512_srli_epi16(_mm512_loadu_si512(y + x * 2), 6);
+            y0 = _mm512_cvtepu16_epi32(_mm512_castsi512_si256(yy));
+            y1 = _mm512_cvtepu16_epi32(_mm512_extracti64x4_epi64(yy, 1));
+            uv = _mm512_srli_epi16(_mm512_loadu_si512(u + x * 2), 6);
+        }
+        y0 = _mm512_madd_epi16(y0, cy);
+        y1 = _mm512_madd_epi16(y1, cy);
+
+        __m512i px0 = alpha, px1 = alpha;
+        for (int n = 0; n < 3; n++) {
+            auto t = _mm512_madd_epi16(uv, cuv[n]);
+            auto lo = _mm512_sra_epi32(_mm512_add_epi32(_mm512_add_epi32(y0, _mm512_permutexvar_epi32(dupLo, t)), bias[n]), shift);
+            auto hi = _mm512_sra_epi32(_mm512_add_epi32(_mm512_add_epi32(y1, _mm512_permutexvar_epi32(dupHi, t)), bias[n]), shift);
+            lo = _mm512_min_epi32(_mm512_max_epi32(lo, zero), max);
+            hi = _mm512_min_epi32(_mm512_max_epi32(hi, zero), max);
+            px0 = _mm512_or_si512(px0, _mm512_slli_epi32(lo, n * 8));
+            px1 = _mm512_or_si512(px1, _mm512_slli_epi32(hi, n * 8));
+        }
+        _mm512_storeu_si512(dst + x * 4, px0);
+        _mm512_storeu_si512(dst + x * 4 + 64, px1);
+    }
+    return x;
+}
+
+#endif
+
+template <Layout L>
+RowFn SelectRow(SimdLevel level) noexcept {
+#if defined(NEKO_X86)
+    switch (level) {
+        case SimdLevel::AVX512: return AVX512Row<L>;
+        case SimdLevel::AVX2: return AVX2Row<L>;
+        case SimdLevel::SSE2: return SSE2Row<L>;
+        default: break;
+    }
+#endif
+    return nullptr;
+}
+
+template <Layout L>
+void ConvertRows(const uint8_t *const srcData[], const int srcLinesize[], uint8_t *dst, int dstLinesize, int width, int height, const Coefficients &c) {
+    auto simd = SelectRow<L>(GetSimdLevel());
+    for (int row = 0; row < height; row++) {
+        auto y = srcData[0] + ptrdiff_t(row) * srcLinesize[0];
+        auto u = srcData[1] + ptrdiff_t(row / 2) * srcLinesize[1];
+        auto v = L == Layout::Planar8 ? srcData[2] + ptrdiff_t(row / 2) * srcLinesize[2] : nullptr;
+        auto d = dst + ptrdiff_t(row) * dstLinesize;
+        int x = simd ? simd(y, u, v, d, width, c) : 0;
+        CRow<L>(y, u, v, d, x, width, c);
+    }
+}
+
+NEKO_IMPL_END
+
+bool  IsYUVToRGBASupported(PixelFormat src, PixelFormat dst) noexcept {
+    if (dst != PixelFormat::RGBA && dst != PixelFormat::BGRA) {
+        return false;
+    }
+    return src == PixelFormat::YUV420P || src == PixelFormat::NV12 || src == PixelFormat::P010LE;
+}
+Error ConvertYUVToRGBA(
+    PixelFormat srcFormat, const uint8_t *const srcData[], const int srcLinesize[],
+    PixelFormat dstFormat, uint8_t *dst, int dstLinesize,
+    int width, int height,
+    YUVMatrix matrix, bool fullRange) noexcept
+{
+    if (!IsYUVToRGBASupported(srcFormat, dstFormat)) {
+        return Error::UnsupportedPixelFormat;
+    }
+    if (!srcData || !srcLinesize || !dst || width < 0 || height < 0) {
+        return Error::InvalidArguments;
+    }
+    bool bgra = dstFormat == PixelFormat::BGRA;
+    switch (srcFormat) {
+        case PixelFormat::YUV420P: {
+            auto c = MakeCoefficients(matrix, fullRange, 8, bgra);
+            ConvertRows<Layout::Planar8>(srcData, srcLinesize, dst, dstLinesize, width, height, c);
+            break;
+        }
+        case PixelFormat::NV12: {
+            auto c = MakeCoefficients(matrix, fullRange, 8, bgra);
+            ConvertRows<Layout::SemiPlanar8>(srcData, srcLinesize, dst, dstLinesize, width, height, c);
+            break;
+        }
+        default: {
+            auto c = MakeCoefficients(matrix, fullRange, 10, bgra);
+            ConvertRows<Layout::SemiPlanar16>(srcData, srcLinesize, dst, dstLinesize, width, height, c);
+            break;
+        }
+    }
+    return Error::Ok;
+}
+
+NEKO_NS_END
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "../format.hpp"
+#include "../error.hpp"
+
+NEKO_NS_BEGIN
+
+/**
+ * @brief The YUV -> RGB matrix
+ *
+ */
+enum class YUVMatrix : int {
+    BT601,
+    BT709,
+    BT2020,
+};
+
+/**
+ * @brief Check the conversion is supported by ConvertYUVToRGBA()
+ * @details The sources are YUV420P, NV12 and P010LE, the destinations are RGBA and BGRA
+ *
+ * @param src
+ * @param dst
+ * @return true
+ * @return false
+ */
+extern NEKO_API bool  IsYUVToRGBASupported(PixelFormat src, PixelFormat dst) noexcept;
+/**
+ * @brief Convert a YUV image to RGBA / BGRA of the same size, by the SIMD kernel of GetSimdLevel()
+ * @details The chroma is taken by the nearest sample (like the unscaled path of swscale), the alpha is 255.
+ *
+ * @param srcFormat The format of the source, checked by IsYUVToRGBASupported()
+ * @param srcData The planes of the source
+ * @param srcLinesize The linesize of the planes in bytes
+ * @param dstFormat RGBA or BGRA
+ * @param dst The destination buffer
+ * @param dstLinesize The linesize of the destination in bytes
+ * @param width
+ * @param height
+ * @param matrix The matrix of the source
+ * @param fullRange Is the source full range (JPEG) or limited range (MPEG)
+ * @return Error Error::UnsupportedPixelFormat on unsupported format
+ */
+extern NEKO_API Error ConvertYUVToRGBA(
+    PixelFormat srcFormat, const uint8_t *const srcData[], const int srcLinesize[],
+    PixelFormat dstFormat, uint8_t *dst, int dstLinesize,
+    int width, int height,
+    YUVMatrix matrix = YUVMatrix::BT601, bool fullRange = false
+) noexcept;
+
+NEKO_NS_END
@@ -0,0 +1,714 @@
+#define _NEKO_SOURCE
+#include "convolve.hpp"
+#include "../threading.hpp"
+#include "../cpu.hpp"
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <climits>
+
+#if defined(NEKO_X86)
+    #include <immintrin.h>
+#endif
+
+NEKO_NS_BEGIN
+
+NEKO_IMPL_BEGIN
+
+// Convert n pixels from x (mirrored on out of the row) to floats
+using LoadFn   = void (*)(const uint8_t *row, int width, int x, int n, float *line);
+// out[k] = (out[k] +) sum of weights[j] * line[k + j], k in [0, n)
+using RowFn    = void (*)(const float *line, int n, const float *weights, int taps, float *out, bool accumulate);
+// dst[k] = sum of weights[i] * rows[i * stride + k], k in [0, n), the alpha from src
+using ColumnFn = void (*)(const float *rows, size_t stride, const float *weights, int taps, int n, const uint8_t *src, uint8_t *dst);
+
+struct Kernels {
+    LoadFn   load;
+    RowFn    row;
+    ColumnFn column;
+};
+
+// The fixed point ones, the pixels are int16 and the weights are int16 scaled by 2^shift
+using FixedLoadFn = void (*)(const uint8_t *row, int width, int x, int n, int16_t *line);
+// dst[k] = (sum of weights[i][j] * lines[i * stride + k + j] + round) >> shift, k in [0, n), the alpha from src
+// The SIMD ones take the weights as pairs (j, j + 1) of int16 in int32, the lines have a pixel more for the odd taps
+using FixedFn     = void (*)(
+    const int16_t *lines, size_t stride, int rows, const int16_t *weights, const int32_t *pairs, int cols,
+    int shift, int n, const uint8_t *src, uint8_t *dst
+);
+
+struct FixedKernels {
+    FixedLoadFn load;
+    FixedFn     apply;
+};
+
+// Mirror with the edge repeated, -1 => 0, n => n - 1
+inline int Mirror(int x, int n) noexcept {
+    if (x < 0) {
+        x = -x - 1;
+    }
+    else if (x >= n) {
+        x = 2 * n - 1 - x;
+    }
+    return std::clamp(x, 0, n - 1);
+}
+
+// The plain ones on a range of pixels, for the tails of SIMD ones
+template <typename T>
+void ScalarLoadRange(const uint8_t *row, int width, int x, int begin, int end, T *line) {
+    for (int k = begin; k < end; k++) {
+        auto px = row + Mirror(x + k, width) * 4;
+        for (int c = 0; c < 4; c++) {
+            line[k * 4 + c] = px[c];
+        }
+    }
+}
+void ScalarRowRange(const float *line, int begin, int end, const float *weights, int taps, float *out, bool accumulate) {
+    for (int k = begin; k < end; k++) {
+        float sum[4] { };
+        if (accumulate) {
+            std::copy_n(out + k * 4, 4, sum);
+        }
+        for (int j = 0; j < taps; j++) {
+            for (int c = 0; c < 4; c++) {
+                sum[c] += line[(k + j) * 4 + c] * weights[j];
+            }
+        }
+        std::copy_n(sum, 4, out + k * 4);
+    }
+}
+void ScalarColumnRange(const float *rows, size_t stride, const float *weights, int taps, int begin, int end, const uint8_t *src, uint8_t *dst) {
+    for (int k = begin; k < end; k++) {
+        float sum[3] { };
+        for (int i = 0; i < taps; i++) {
+            for (int c = 0; c < 3; c++) {
+                sum[c] += rows[i * stride + k * 4 + c] * weights[i];
+            }
+        }
+        for (int c = 0; c < 3; c++) {
+            dst[k * 4 + c] = uint8_t(std::lrint(std::clamp(sum[c], 0.0f, 255.0f)));
+        }
+        dst[k * 4 + 3] = src[k * 4 + 3];
+    }
+}
+
+void ScalarLoad(const uint8_t *row, int width, int x, int n, float *line) {
+    ScalarLoadRange(row, width, x, 0, n, line);
+}
+void ScalarRow(const float *line, int n, const float *weights, int taps, float *out, bool accumulate) {
+    ScalarRowRange(line, 0, n, weights, taps, out, accumulate);
+}
+void ScalarColumn(const float *rows, size_t stride, const float *weights, int taps, int n, const uint8_t *src, uint8_t *dst) {
+    ScalarColumnRange(rows, stride, weights, taps, 0, n, src, dst);
+}
+
+void ScalarFixedRange(
+    const int16_t *lines, size_t stride, int rows, const int16_t *weights, int cols,
+    int shift, int begin, int end, const uint8_t *src, uint8_t *dst) 
+{
+    int32_t round = shift > 0 ? 1 << (shift - 1) : 0;
+    for (int k = begin; k < end; k++) {
+        int32_t sum[3] {round, round, round};
+        for (int i = 0; i < rows; i++) {
+            auto line = lines + i * stride + k * 4;
+            for (int j = 0; j < cols; j++) {
+                for (int c = 0; c < 3; c++) {
+                    sum[c] += line[j * 4 + c] * weights[i * cols + j];
+                }
+            }
+        }
+        for (int c = 0; c < 3; c++) {
+            dst[k * 4 + c] = uint8_t(std::clamp(sum[c] >> shift, 0, 255));
+        }
+        dst[k * 4 + 3] = src[k * 4 + 3];
+    }
+}
+void ScalarFixedLoad(const uint8_t *row, int width, int x, int n, int16_t *line) {
+    ScalarLoadRange(row, width, x, 0, n, line);
+}
+void ScalarFixed(
+    const int16_t *lines, size_t stride, int rows, const int16_t *weights, const int32_t *, int cols,
+    int shift, int n, const uint8_t *src, uint8_t *dst) 
+{
+    ScalarFixedRange(lines, stride, rows, weights, cols, shift, 0, n, src, dst);
+}
+
+#if defined(NEKO_X86)
+
+// Every SIMD one works on 8 pixels (32 floats) a step, the tails and the mirrored borders go to the plain ones
+
+NEKO_TARGET("sse2")
+void SSE2Load(const uint8_t *row, int width, int x, int n, float *line) {
+    const __m128i zero = _mm_setzero_si128();
+    int begin = std::clamp(-x, 0, n); //< [begin, end) is inside the row
+    int end = std::clamp(width - x, begin, n);
+    ScalarLoadRange(row, width, x, 0, begin, line);
+    int k = begin;
+    for (; k + 4 <= end; k += 4) {
+        auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + (x + k) * 4));
+        auto lo = _mm_unpacklo_epi8(v, zero);
+        auto hi = _mm_unpackhi_epi8(v, zero);
+        _mm_storeu_ps(line + k * 4 + 0, _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)));
+        _mm_storeu_ps(line + k * 4 + 4, _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)));
+        _mm_storeu_ps(line + k * 4 + 8, _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)));
+        _mm_storeu_ps(line + k * 4 + 12, _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)));
+    }
+    ScalarLoadRange(row, width, x, k, n, line);
+}
+NEKO_TARGET("sse2")
+void SSE2Row(const float *line, int n, const float *weights, int taps, float *out, bool accumulate) {
+    int k = 0;
+    for (; k + 8 <= n; k += 8) {
+        __m128 acc[8];
+        for (int p = 0; p < 8; p++) {
+            acc[p] = accumulate ? _mm_loadu_ps(out + (k + p) * 4) : _mm_setzero_ps();
+        }
+        for (int j = 0; j < taps; j++) {
+            auto w = _mm_set1_ps(weights[j]);
+            auto in = line + (k + j) * 4;
+            for (int p = 0; p < 8; p++) {
+                acc[p] = _mm_add_ps(acc[p], _mm_mul_ps(_mm_loadu_ps(in + p * 4), w));
+            }
+        }
+        for (int p = 0; p < 8; p++) {
+            _mm_storeu_ps(out + (k + p) * 4, acc[p]);
+        }
+    }
+    ScalarRowRange(line, k, n, weights, taps, out, accumulate);
+}
+NEKO_TARGET("sse2")
+void SSE2Column(const float *rows, size_t stride, const float *weights, int taps, int n, const uint8_t *src, uint8_t *dst) {
+    const __m128 max = _mm_set1_ps(255.0f);
+    const __m128 min = _mm_setzero_ps();
+    const __m128i rgb = _mm_set1_epi32(0x00FFFFFF);
+    const __m128i alpha = _mm_set1_epi32(int(0xFF000000));
+    int k = 0;
+    for (; k + 8 <= n; k += 8) {
+        __m128 acc[8];
+        for (int p = 0; p < 8; p++) {
+            acc[p] = _mm_setzero_ps();
+        }
+        for (int i = 0; i < taps; i++) {
+            auto w = _mm_set1_ps(weights[i]);
+            auto in = rows + i * stride + k * 4;
+            for (int p = 0; p < 8; p++) {
+                acc[p] = _mm_add_ps(acc[p], _mm_mul_ps(_mm_loadu_ps(in + p * 4), w));
+            }
+        }
+        __m128i v[8];
+        for (int p = 0; p < 8; p++) {
+            v[p] = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(acc[p], min), max));
+        }
+        for (int half = 0; half < 2; half++) {
+            auto px = _mm_packus_epi16(
+                _mm_packs_epi32(v[half * 4 + 0], v[half * 4 + 1]),
+                _mm_packs_epi32(v[half * 4 + 2], v[half * 4 + 3])
+            );
+            auto in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + (k + half * 4) * 4));
+            px = _mm_or_si128(_mm_and_si128(px, rgb), _mm_and_si128(in, alpha));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + (k + half * 4) * 4), px);
+        }
+    }
+    ScalarColumnRange(rows, stride, weights, taps, k, n, src, dst);
+}
+
+NEKO_TARGET("avx2")
+void AVX2Load(const uint8_t *row, int width, int x, int n, float *line) {
+    int begin = std::clamp(-x, 0, n);
+    int end = std::clamp(width - x, begin, n);
+    ScalarLoadRange(row, width, x, 0, begin, line);
+    int k = begin;
+    for (; k + 4 <= end; k += 4) {
+        auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + (x + k) * 4));
+        _mm256_storeu_ps(line + k * 4 + 0, _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(v)));
+        _mm256_storeu_ps(line + k * 4 + 8, _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(v, 8))));
+    }
+    ScalarLoadRange(row, width, x, k, n, line);
+}
+NEKO_TARGET("avx2")
+void AVX2Row(const float *line, int n, const float *weights, int taps, float *out, bool accumulate) {
+    int k = 0;
+    for (; k + 8 <= n; k += 8) {
+        __m256 acc[4];
+        for (int p = 0; p < 4; p++) {
+            acc[p] = accumulate ? _mm256_loadu_ps(out + k * 4 + p * 8) : _mm256_setzero_ps();
+        }
+        for (int j = 0; j < taps; j++) {
+            auto w = _mm256_set1_ps(weights[j]);
+            auto in = line + (k + j) * 4;
+            for (int p = 0; p < 4; p++) {
+                acc[p] = _mm256_add_ps(acc[p], _mm256_mul_ps(_mm256_loadu_ps(in + p * 8), w));
+            }
+        }
+        for (int p = 0; p < 4; p++) {
+            _mm256_storeu_ps(out + k * 4 + p * 8, acc[p]);
+        }
+    }
+    ScalarRowRange(line, k, n, weights, taps, out, accumulate);
+}
+NEKO_TARGET("avx2")
+void AVX2Column(const float *rows, size_t stride, const float *weights, int taps, int n, const uint8_t *src, uint8_t *dst) {
+    const __m256 max = _mm256_set1_ps(255.0f);
+    const __m256 min = _mm256_setzero_ps();
+    const __m256i rgb = _mm256_set1_epi32(0x00FFFFFF);
+    const __m256i alpha = _mm256_set1_epi32(int(0xFF000000));
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    int k = 0;
+    for (; k + 8 <= n; k += 8) {
+        __m256 acc[4];
+        for (int p = 0; p < 4; p++) {
+            acc[p] = _mm256_setzero_ps();
+        }
+        for (int i = 0; i < taps; i++) {
+            auto w = _mm256_set1_ps(weights[i]);
+            auto in = rows + i * stride + k * 4;
+            for (int p = 0; p < 4; p++) {
+                acc[p] = _mm256_add_ps(acc[p], _mm256_mul_ps(_mm256_loadu_ps(in + p * 8), w));
+            }
+        }
+        __m256i v[4];
+        for (int p = 0; p < 4; p++) {
+            v[p] = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(acc[p], min), max));
+        }
+        // The packs work in lanes, the pixels come out as 0 2 4 6 | 1 3 5 7
+        auto px = _mm256_packus_epi16(_mm256_packs_epi32(v[0], v[1]), _mm256_packs_epi32(v[2], v[3]));
+        px = _mm256_permutevar8x32_epi32(px, order);
+        auto in = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + k * 4));
+        px = _mm256_or_si256(_mm256_and_si256(px, rgb), _mm256_and_si256(in, alpha));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + k * 4), px);
+    }
+    ScalarColumnRange(rows, stride, weights, taps, k, n, src, dst);
+}
+
+NEKO_TARGET("avx512f,avx512bw")
+void AVX512Load(const uint8_t *row, int width, int x, int n, float *line) {
+    int begin = std::clamp(-x, 0, n);
+    int end = std::clamp(width - x, begin, n);
+    ScalarLoadRange(row, width, x, 0, begin, line);
+    int k = begin;
+    for (; k + 4 <= end; k += 4) {
+        auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + (x + k) * 4));
+        _mm512_storeu_ps(line + k * 4, _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(v)));
+    }
+    ScalarLoadRange(row, width, x, k, n, line);
+}
+NEKO_TARGET("avx512f,avx512bw")
+void AVX512Row(const float *line, int n, const float *weights, int taps, float *out, bool accumulate) {
+    int k = 0;
+    for (; k + 8 <= n; k += 8) {
+        __m512 acc0 = accumulate ? _mm512_loadu_ps(out + k * 4) : _mm512_setzero_ps();
+        __m512 acc1 = accumulate ? _mm512_loadu_ps(out + k * 4 + 16) : _mm512_setzero_ps();
+        for (int j = 0; j < taps; j++) {
+            auto w = _mm512_set1_ps(weights[j]);
+            auto in = line + (k + j) * 4;
+            acc0 = _mm512_add_ps(acc0, _mm512_mul_ps(_mm512_loadu_ps(in), w));
+            acc1 = _mm512_add_ps(acc1, _mm512_mul_ps(_mm512_loadu_ps(in + 16), w));
+        }
+        _mm512_storeu_ps(out + k * 4, acc0);
+        _mm512_storeu_ps(out + k * 4 + 16, acc1);
+    }
+    ScalarRowRange(line, k, n, weights, taps, out, accumulate);
+}
+NEKO_TARGET("avx512f,avx512bw")
+void AVX512Column(const float *rows, size_t stride, const float *weights, int taps, int n, const uint8_t *src, uint8_t *dst) {
+    const __m512 max = _mm512_set1_ps(255.0f);
+    const __m512 min = _mm512_setzero_ps();
+    const __m128i rgb = _mm_set1_epi32(0x00FFFFFF);
+    const __m128i alpha = _mm_set1_epi32(int(0xFF000000));
+    int k = 0;
+    for (; k + 8 <= n; k += 8) {
+        __m512 acc0 = _mm512_setzero_ps();
+        __m512 acc1 = _mm512_setzero_ps();
+        for (int i = 0; i < taps; i++) {
+            auto w = _mm512_set1_ps(weights[i]);
+            auto in = rows + i * stride + k * 4;
+            acc0 = _mm512_add_ps(acc0, _mm512_mul_ps(_mm512_loadu_ps(in), w));
+            acc1 = _mm512_add_ps(acc1, _mm512_mul_ps(_mm512_loadu_ps(in + 16), w));
+        }
+        __m512 acc[2] = {acc0, acc1};
+        for (int half = 0; half < 2; half++) {
+            auto v = _mm512_cvtps_epi32(_mm512_min_ps(_mm512_max_ps(acc[half], min), max));
+            auto px = _mm512_cvtusepi32_epi8(v);
+            auto in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + (k + half * 4) * 4));
+            px = _mm_or_si128(_mm_and_si128(px, rgb), _mm_and_si128(in, alpha));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + (k + half * 4) * 4), px);
+        }
+    }
+    ScalarColumnRange(rows, stride, weights, taps, k, n, src, dst);
+}
+
+// The fixed point ones interleave the pixels j and j + 1 of a channel, so pmaddwd sums a pair of taps at once
+// The pairs of pixels (base, base + 1) of every 128 bits come out as (base) on unpacklo and (base + 1) on unpackhi
+
+NEKO_TARGET("sse2")
+void SSE2FixedLoad(const uint8_t *row, int width, int x, int n, int16_t *line) {
+    const __m128i zero = _mm_setzero_si128();
+    int begin = std::clamp(-x, 0, n);
+    int end = std::clamp(width - x, begin, n);
+    ScalarLoadRange(row, width, x, 0, begin, line);
+    int k = begin;
+    for (; k + 4 <= end; k += 4) {
+        auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + (x + k) * 4));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(line + k * 4 + 0), _mm_unpacklo_epi8(v, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(line + k * 4 + 8), _mm_unpackhi_epi8(v, zero));
+    }
+    ScalarLoadRange(row, width, x, k, n, line);
+}
+NEKO_TARGET("sse2")
+void SSE2Fixed(
+    const int16_t *lines, size_t stride, int rows, const int16_t *weights, const int32_t *pairs, int cols,
+    int shift, int n, const uint8_t *src, uint8_t *dst) 
+{
+    const __m128i rgb = _mm_set1_epi32(0x00FFFFFF);
+    const __m128i alpha = _mm_set1_epi32(int(0xFF000000));
+    const __m128i round = _mm_set1_epi32(shift > 0 ? 1 << (shift - 1) : 0);
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    int numOfPairs = (cols + 1) / 2;
+    int k = 0;
+    for (; k + 4 <= n; k += 4) {
+        __m128i acc[4] = {round, round, round, round};
+        for (int i = 0; i < rows; i++) {
+            auto line = lines + i * stride + k * 4;
+            for (int p = 0; p < numOfPairs; p++) {
+                auto w = _mm_set1_epi32(pairs[i * numOfPairs + p]);
+                for (int b = 0; b < 2; b++) {
+                    auto in = line + (p * 2 + b * 2) * 4;
+                    auto a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+                    auto c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 4));
+                    acc[b * 2 + 0] = _mm_add_epi32(acc[b * 2 + 0], _mm_madd_epi16(_mm_unpacklo_epi16(a, c), w));
+                    acc[b * 2 + 1] = _mm_add_epi32(acc[b * 2 + 1], _mm_madd_epi16(_mm_unpackhi_epi16(a, c), w));
+                }
+            }
+        }
+        auto px = _mm_packus_epi16(
+            _mm_packs_epi32(_mm_sra_epi32(acc[0], count), _mm_sra_epi32(acc[1], count)),
+            _mm_packs_epi32(_mm_sra_epi32(acc[2], count), _mm_sra_epi32(acc[3], count))
+        );
+        auto in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + k * 4));
+        px = _mm_or_si128(_mm_and_si128(px, rgb), _mm_and_si128(in, alpha));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + k * 4), px);
+    }
+    ScalarFixedRange(lines, stride, rows, weights, cols, shift, k, n, src, dst);
+}
+
+NEKO_TARGET("avx2")
+void AVX2FixedLoad(const uint8_t *row, int width, int x, int n, int16_t *line) {
+    int begin = std::clamp(-x, 0, n);
+    int end = std::clamp(width - x, begin, n);
+    ScalarLoadRange(row, width, x, 0, begin, line);
+    int k = begin;
+    for (; k + 4 <= end; k += 4) {
+        auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + (x + k) * 4));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(line + k * 4), _mm256_cvtepu8_epi16(v));
+    }
+    ScalarLoadRange(row, width, x, k, n, line);
+}
+NEKO_TARGET("avx2")
+void AVX2Fixed(
+    const int16_t *lines, size_t stride, int rows, const int16_t *weights, const int32_t *pairs, int cols,
+    int shift, int n, const uint8_t *src, uint8_t *dst) 
+{
+    const __m256i rgb = _mm256_set1_epi32(0x00FFFFFF);
+    const __m256i alpha = _mm256_set1_epi32(int(0xFF000000));
+    const __m256i round = _mm256_set1_epi32(shift > 0 ? 1 << (shift - 1) : 0);
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    int numOfPairs = (cols + 1) / 2;
+    int k = 0;
+    for (; k + 8 <= n; k += 8) {
+        __m256i acc[4] = {round, round, round, round};
+        for (int i = 0; i < rows; i++) {
+            auto line = lines + i * stride + k * 4;
+            for (int p = 0; p < numOfPairs; p++) {
+                auto w = _mm256_set1_epi32(pairs[i * numOfPairs + p]);
+                for (int b = 0; b < 2; b++) {
+                    auto in = line + (p * 2 + b * 4) * 4;
+                    auto a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in));
+                    auto c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + 4));
+                    acc[b * 2 + 0] = _mm256_add_epi32(acc[b * 2 + 0], _mm256_madd_epi16(_mm256_unpacklo_epi16(a, c), w));
+                    acc[b * 2 + 1] = _mm256_add_epi32(acc[b * 2 + 1], _mm256_madd_epi16(_mm256_unpackhi_epi16(a, c), w));
+                }
+            }
+        }
+        // The packs work in lanes, the quads of pixels come out as 0 2 1 3
+        auto px = _mm256_packus_epi16(
+            _mm256_packs_epi32(_mm256_sra_epi32(acc[0], count), _mm256_sra_epi32(acc[1], count)),
+            _mm256_packs_epi32(_mm256_sra_epi32(acc[2], count), _mm256_sra_epi32(acc[3], count))
+        );
+        px = _mm256_permute4x64_epi64(px, _MM_SHUFFLE(3, 1, 2, 0));
+        auto in = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + k * 4));
+        px = _mm256_or_si256(_mm256_and_si256(px, rgb), _mm256_and_si256(in, alpha));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + k * 4), px);
+    }
+    ScalarFixedRange(lines, stride, rows, weights, cols, shift, k, n, src, dst);
+}
+
+NEKO_TARGET("avx512f,avx512bw")
+void AVX512FixedLoad(const uint8_t *row, int width, int x, int n, int16_t *line) {
+    int begin = std::clamp(-x, 0, n);
+    int end = std::clamp(width - x, begin, n);
+    ScalarLoadRange(row, width, x, 0, begin, line);
+    int k = begin;
+    for (; k + 8 <= end; k += 8) {
+        auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + (x + k) * 4));
+        _mm512_storeu_si512(line + k * 4, _mm512_cvtepu8_epi16(v));
+    }
+    ScalarLoadRange(row, width, x, k, n, line);
+}
+NEKO_TARGET("avx512f,avx512bw")
+void AVX512Fixed(
+    const int16_t *lines, size_t stride, int rows, const int16_t *weights, const int32_t *pairs, int cols,
+    int shift, int n, const uint8_t *src, uint8_t *dst) 
+{
+    const __m512i zero = _mm512_setzero_si512();
+    const __m256i rgb = _mm256_set1_epi32(0x00FFFFFF);
+    const __m256i alpha = _mm256_set1_epi32(int(0xFF000000));
+    const __m512i round = _mm512_set1_epi32(shift > 0 ? 1 << (shift - 1) : 0);
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    int numOfPairs = (cols + 1) / 2;
+    int k = 0;
+    for (; k + 16 <= n; k += 16) {
+        __m512i acc[4] = {round, round, round, round};
+        for (int i = 0; i < rows; i++) {
+            auto line = lines + i * stride + k * 4;
+            for (int p = 0; p < numOfPairs; p++) {
+                auto w = _mm512_set1_epi32(pairs[i * numOfPairs + p]);
+                for (int b = 0; b < 2; b++) {
+                    auto in = line + (p * 2 + b * 8) * 4;
+                    auto a = _mm512_loadu_si512(in);
+                    auto c = _mm512_loadu_si512(in + 4);
+                    acc[b * 2 + 0] = _mm512_add_epi32(acc[b * 2 + 0], _mm512_madd_epi16(_mm512_unpacklo_epi16(a, c), w));
+                    acc[b * 2 + 1] = _mm512_add_epi32(acc[b * 2 + 1], _mm512_madd_epi16(_mm512_unpackhi_epi16(a, c), w));
+                }
+            }
+        }
+        for (int b = 0; b < 2; b++) {
+            // In order after packs, the 8 pixels of int16 saturate to uint8 at once
+            auto v = _mm512_packs_epi32(_mm512_sra_epi32(acc[b * 2 + 0], count), _mm512_sra_epi32(acc[b * 2 + 1], count));
+            auto px = _mm512_cvtusepi16_epi8(_mm512_max_epi16(v, zero));
+            auto in = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + (k + b * 8) * 4));
+            px = _mm256_or_si256(_mm256_and_si256(px, rgb), _mm256_and_si256(in, alpha));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + (k + b * 8) * 4), px);
+        }
+    }
+    ScalarFixedRange(lines, stride, rows, weights, cols, shift, k, n, src, dst);
+}
+
+#endif
+
+Kernels SelectKernels(SimdLevel level) noexcept {
+#if defined(NEKO_X86)
+    switch (level) {
+        case SimdLevel::AVX512: return {AVX512Load, AVX512Row, AVX512Column};
+        case SimdLevel::AVX2: return {AVX2Load, AVX2Row, AVX2Column};
+        case SimdLevel::SSE2: return {SSE2Load, SSE2Row, SSE2Column};
+        default: break;
+    }
+#endif
+    return {ScalarLoad, ScalarRow, ScalarColumn};
+}
+FixedKernels SelectFixedKernels(SimdLevel level) noexcept {
+#if defined(NEKO_X86)
+    switch (level) {
+        case SimdLevel::AVX512: return {AVX512FixedLoad, AVX512Fixed};
+        case SimdLevel::AVX2: return {AVX2FixedLoad, AVX2Fixed};
+        case SimdLevel::SSE2: return {SSE2FixedLoad, SSE2Fixed};
+        default: break;
+    }
+#endif
+    return {ScalarFixedLoad, ScalarFixed};
+}
+
+NEKO_IMPL_END
+
+Error Convolver::setKernel(const double *kernel, int kernelCol, int kernelRow) {
+    if (kernelCol <= 0 || kernelRow <= 0 || kernel == nullptr) {
+        return Error::InvalidArguments;
+    }
+    mCols = kernelCol;
+    mRows = kernelRow;
+    mWeights.assign(kernel, kernel + kernelCol * kernelRow);
+
+    // Rank 1 on every weight is the product of its row and column at the largest one
+    int pivot = int(std::max_element(kernel, kernel + kernelCol * kernelRow, [](double a, double b) {
+        return std::abs(a) < std::abs(b);
+    }) - kernel);
+    int pivotRow = pivot / kernelCol;
+    int pivotCol = pivot % kernelCol;
+    double scale = kernel[pivot];
+    mSeparable = scale != 0.0;
+    for (int i = 0; i < kernelRow && mSeparable; i++) {
+        for (int j = 0; j < kernelCol && mSeparable; j++) {
+            double product = kernel[i * kernelCol + pivotCol] * kernel[pivotRow * kernelCol + j] / scale;
+            mSeparable = std::abs(product - kernel[i * kernelCol + j]) <= std::abs(scale) * 1e-9;
+        }
+    }
+    mRowWeights.clear();
+    mColWeights.clear();
+    if (mSeparable) {
+        for (int j = 0; j < kernelCol; j++) {
+            mRowWeights.push_back(float(kernel[pivotRow * kernelCol + j]));
+        }
+        for (int i = 0; i < kernelRow; i++) {
+            mColWeights.push_back(float(kernel[i * kernelCol + pivotCol] / scale));
+        }
+    }
+
+    // Quantize by the largest shift keeping the weights in int16 and the sums in int32
+    mFixedShift = -1;
+    mFixedError = 0;
+    for (int shift = MaxFixedShift; shift >= 0 && mFixedShift < 0; shift--) {
+        double unit = std::ldexp(1.0, shift);
+        int64_t total = 0;
+        bool fits = true;
+        mFixedWeights.clear();
+        for (int n = 0; n < kernelCol * kernelRow && fits; n++) {
+            fits = std::abs(kernel[n] * unit) <= 32767.0;
+            auto q = fits ? std::llround(kernel[n] * unit) : 0;
+            total += std::abs(q);
+            mFixedWeights.push_back(int16_t(q));
+        }
+        if (fits && total * 255 + int64_t(unit) <= INT32_MAX) {
+            mFixedShift = shift;
+        }
+    }
+    mFixedPairs.clear();
+    if (mFixedShift >= 0) {
+        // The rounded weights differ by the sum of the errors times 255 at most, and the rounding of both by 1
+        double error = 0;
+        for (int n = 0; n < kernelCol * kernelRow; n++) {
+            error += std::abs(std::ldexp(mFixedWeights[n], -mFixedShift) - kernel[n]) * 255;
+        }
+        mFixedError = int(std::floor(error + 1e-6)) + 1;
+        for (int i = 0; i < kernelRow; i++) {
+            for (int j = 0; j < kernelCol; j += 2) {
+                auto w0 = uint16_t(mFixedWeights[i * kernelCol + j]);
+                auto w1 = uint16_t(j + 1 < kernelCol ? mFixedWeights[i * kernelCol + j + 1] : 0);
+                mFixedPairs.push_back(int32_t(w0 | (uint32_t(w1) << 16)));
+            }
+        }
+    }
+    return Error::Ok;
+}
+
+Error Convolver::apply(const uint8_t *src, int srcPitch, uint8_t *dst, int dstPitch, int width, int height, SliceRunner *runner) {
+    if (mWeights.empty()) {
+        return Error::InvalidState;
+    }
+    if (!src || !dst || width <= 0 || height <= 0) {
+        return Error::InvalidArguments;
+    }
+    auto kernels = SelectKernels(GetSimdLevel());
+    int rx = mCols / 2;
+    int ry = mRows / 2;
+    int bandRows = std::max(MinBandRows, mRows * 2); //< Keep the rows computed twice (by the bands above and below) small
+    int numOfBands = (height + bandRows - 1) / bandRows;
+    size_t numOfSlices = runner ? std::min<size_t>(runner->numOfThreads(), numOfBands) : 1;
+
+    auto row = [&](int y) {
+        return src + ptrdiff_t(Mirror(y, height)) * srcPitch;
+    };
+    if (mFixedPoint && mFixedShift >= 0) {
+        // Every kernel as 2D, the converted rows of the band with a pixel more for the odd taps
+        auto fixed = SelectFixedKernels(GetSimdLevel());
+        size_t fixedLineSize = size_t(TileWidth + mCols) * 4;
+        size_t fixedSize = fixedLineSize * (bandRows + mRows - 1);
+        if (mFixedScratch.size() < numOfSlices) {
+            mFixedScratch.resize(numOfSlices);
+        }
+        for (auto &scratch : mFixedScratch) {
+            if (scratch.size() < fixedSize) {
+                scratch.resize(fixedSize);
+            }
+        }
+        auto work = [&](size_t slice) {
+            auto lines = mFixedScratch[slice].data();
+            for (int band = int(numOfBands * slice / numOfSlices); band < int(numOfBands * (slice + 1) / numOfSlices); band++) {
+                int y0 = band * bandRows;
+                int y1 = std::min(y0 + bandRows, height);
+                for (int x0 = 0; x0 < width; x0 += TileWidth) {
+                    int tw = std::min(TileWidth, width - x0);
+                    for (int r = 0; r < y1 - y0 + mRows - 1; r++) {
+                        fixed.load(row(y0 - ry + r), width, x0 - rx, tw + mCols, lines + r * fixedLineSize);
+                    }
+                    for (int y = y0; y < y1; y++) {
+                        fixed.apply(
+                            lines + (y - y0) * fixedLineSize, fixedLineSize, mRows, mFixedWeights.data(), mFixedPairs.data(), mCols,
+                            mFixedShift, tw, src + ptrdiff_t(y) * srcPitch + x0 * 4, dst + ptrdiff_t(y) * dstPitch + x0 * 4
+                        );
+                    }
+                }
+            }
+        };
+        if (runner) {
+            runner->run(numOfSlices, work);
+        }
+        else {
+            work(0);
+        }
+        return Error::Ok;
+    }
+
+    // Every slice has the lines (the source rows of a tile with the borders, all rows of the band on 2D kernels)
+    // and the tile rows of the row pass (one accumulated row on 2D kernels)
+    size_t lineSize = size_t(TileWidth + mCols - 1) * 4;
+    size_t linesSize = lineSize * (mSeparable ? 1 : bandRows + mRows - 1);
+    size_t tileSize = size_t(mSeparable ? bandRows + mRows - 1 : 1) * TileWidth * 4;
+    if (mScratch.size() < numOfSlices) {
+        mScratch.resize(numOfSlices);
+    }
+    for (auto &scratch : mScratch) {
+        if (scratch.size() < linesSize + tileSize) {
+            scratch.resize(linesSize + tileSize);
+        }
+    }
+
+    const float one = 1.0f;
+    auto work = [&](size_t slice) {
+        auto line = mScratch[slice].data();
+        auto tile = line + linesSize;
+        for (int band = int(numOfBands * slice / numOfSlices); band < int(numOfBands * (slice + 1) / numOfSlices); band++) {
+            int y0 = band * bandRows;
+            int y1 = std::min(y0 + bandRows, height);
+            for (int x0 = 0; x0 < width; x0 += TileWidth) {
+                int tw = std::min(TileWidth, width - x0);
+                size_t stride = size_t(tw) * 4;
+                if (mSeparable) {
+                    // Row pass of the rows of the band and the borders, then column pass from the tile
+                    for (int r = 0; r < y1 - y0 + mRows - 1; r++) {
+                        kernels.load(row(y0 - ry + r), width, x0 - rx, tw + mCols - 1, line);
+                        kernels.row(line, tw, mRowWeights.data(), mCols, tile + r * stride, false);
+                    }
+                    for (int y = y0; y < y1; y++) {
+                        kernels.column(
+                            tile + (y - y0) * stride, stride, mColWeights.data(), mRows, tw,
+                            src + ptrdiff_t(y) * srcPitch + x0 * 4, dst + ptrdiff_t(y) * dstPitch + x0 * 4
+                        );
+                    }
+                    continue;
+                }
+                // Convert the rows once, then sum the row passes of every kernel row
+                for (int r = 0; r < y1 - y0 + mRows - 1; r++) {
+                    kernels.load(row(y0 - ry + r), width, x0 - rx, tw + mCols - 1, line + r * lineSize);
+                }
+                for (int y = y0; y < y1; y++) {
+                    for (int i = 0; i < mRows; i++) {
+                        kernels.row(line + (y - y0 + i) * lineSize, tw, mWeights.data() + i * mCols, mCols, tile, i > 0);
+                    }
+                    kernels.column(
+                        tile, 0, &one, 1, tw,
+                        src + ptrdiff_t(y) * srcPitch + x0 * 4, dst + ptrdiff_t(y) * dstPitch + x0 * 4
+                    );
+                }
+            }
+        }
+    };
+    if (runner) {
+        runner->run(numOfSlices, work);
+    }
+    else {
+        work(0);
+    }
+    return Error::Ok;
+}
+
+NEKO_NS_END
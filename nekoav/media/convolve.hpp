@@ -0,0 +1,105 @@
+#pragma once
+
+#include "../error.hpp"
+#include <cstdint>
+#include <vector>
+
+NEKO_NS_BEGIN
+
+class SliceRunner;
+
+/**
+ * @brief The convolution of RGBA images on CPU, used by KernelFilter
+ * @details The kernel is prepared once by setKernel(), a rank 1 (separable) kernel runs as a row pass and a column pass.
+ * The image is processed by tiles of TileWidth pixels and a band of rows, the bands are split across the threads.
+ * The borders are mirrored with the edge repeated (as CL_ADDRESS_MIRRORED_REPEAT), the alpha channel is kept.
+ * @note Not thread safe, a Convolver can only apply() on one image at the same time
+ *
+ */
+class NEKO_API Convolver {
+public:
+    static constexpr int TileWidth = 256;  //< Pixels of a tile, a float row of it is 4 KB
+    static constexpr int MinBandRows = 32; //< Rows of a band at least, it grows with the kernel height
+    static constexpr int MaxFixedShift = 14; //< Fraction bits of the fixed point weights at most
+
+    Convolver() = default;
+    Convolver(const Convolver &) = delete;
+    ~Convolver() = default;
+
+    /**
+     * @brief Set the kernel, the anchor is (kernelCol / 2, kernelRow / 2)
+     *
+     * @param kernel The weights, kernelRow rows of kernelCol weights
+     * @param kernelCol The width of the kernel
+     * @param kernelRow The height of the kernel
+     * @return Error Error::InvalidArguments on empty kernel
+     */
+    Error setKernel(const double *kernel, int kernelCol, int kernelRow);
+    /**
+     * @brief Apply the kernel on the image
+     *
+     * @param src The source RGBA image, it can not overlap the dst
+     * @param srcPitch The linesize of the source in bytes
+     * @param dst The destination RGBA image
+     * @param dstPitch The linesize of the destination in bytes
+     * @param width
+     * @param height
+     * @param runner The threads the bands split across (nullptr on the calling thread only)
+     * @return Error Error::InvalidState on no kernel
+     */
+    Error apply(const uint8_t *src, int srcPitch, uint8_t *dst, int dstPitch, int width, int height, SliceRunner *runner = nullptr);
+
+    /**
+     * @brief Check the kernel is rank 1, it runs as two passes
+     *
+     * @return true
+     * @return false
+     */
+    bool  separable() const noexcept {
+        return mSeparable;
+    }
+    bool  empty() const noexcept {
+        return mWeights.empty();
+    }
+    /**
+     * @brief Use the fixed point path, the weights are int16 scaled by 2^shift, the sums are int32 saturated to uint8
+     * @details The shift is the largest one (up to MaxFixedShift) keeping the weights and the sums in range.
+     * Every kernel runs as 2D on it, so the large separable ones are faster on float.
+     * It falls back to float if the kernel can not be quantized (a weight out of int16).
+     * 
+     * @param fixedPoint 
+     */
+    void  setFixedPoint(bool fixedPoint) noexcept {
+        mFixedPoint = fixedPoint;
+    }
+    bool  fixedPoint() const noexcept {
+        return mFixedPoint;
+    }
+    /**
+     * @brief Get the max difference (in 1 / 255) between the fixed point and the float result of the kernel
+     * @details It is 1 (the rounding) on the weights exact in fixed point, like the edge detect and sharpen presets
+     * 
+     * @return int 0 on the kernel can not be quantized
+     */
+    int   fixedPointError() const noexcept {
+        return mFixedError;
+    }
+private:
+    std::vector<float> mWeights;    //< The whole kernel, by rows
+    std::vector<float> mRowWeights; //< The row pass of the separable kernel
+    std::vector<float> mColWeights; //< The column pass of the separable kernel
+    int                mCols = 0;
+    int                mRows = 0;
+    bool               mSeparable = false;
+
+    std::vector<int16_t> mFixedWeights; //< The whole kernel in fixed point, by rows
+    std::vector<int32_t> mFixedPairs;   //< The fixed point weights (j, j + 1) of every row, for pmaddwd
+    int                  mFixedShift = -1; //< -1 on the kernel can not be quantized
+    int                  mFixedError = 0;
+    bool                 mFixedPoint = false;
+
+    std::vector<std::vector<float> > mScratch; //< The line and tile buffers of every slice
+    std::vector<std::vector<int16_t> > mFixedScratch; //< The lines of every slice on fixed point
+};
+
+NEKO_NS_END
@@ -1,4 +1,5 @@
 #define _NEKO_SOURCE
+#include "resource.hpp"
 #include "event.hpp"
 #include "time.hpp"
 #include "libc.hpp"
@@ -15,6 +16,13 @@ Pad::~Pad() {
 }
 
 Error Pad::push(View<Resource> resourceView) {
+    // Types matched at link(), only compare the exact type here, others (null, derived, wrong one) go the checked path
+    if (mNegotiated && resourceView && (!mPushType || typeid(*resourceView.get()) == *mPushType)) {
+        return mNext->mTypedCallback(mNext->mTypedUser, mNext, resourceView.get());
+    }
+    return _pushSlow(resourceView);
+}
+Error Pad::_pushSlow(View<Resource> resourceView) {
     if (mType == Input) {
         // You can not push a Input pad
         return Error::InvalidArguments;
@@ -22,6 +30,13 @@ Error Pad::push(View<Resource> resourceView) {
     if (!mNext) {
         return Error::NoLink;
     }
+    if (mNext->mTypedCallback) {
+        // Not negotiated, check it by the RTTI
+        if (!resourceView || !mNext->mTypeChecker(resourceView.get())) {
+            return Error::UnsupportedResource;
+        }
+        return mNext->mTypedCallback(mNext->mTypedUser, mNext, resourceView.get());
+    }
     if (!mNext->mCallback) {
         return Error::InvalidState;
     }
@@ -58,24 +73,70 @@ Error Pad::link(View<Pad> pad) {
     }
     mNext = pad.get();
     mNext->mPrev = this;
+    _negotiate();
     return Error::Ok;
 }
 Error Pad::unlink() {
     if (mPrev) {
         NEKO_ASSERT(mType == Input);
         mPrev->mNext = nullptr;
+        mPrev->mNegotiated = false;
         mPrev = nullptr;
     }
     if (mNext) {
         NEKO_ASSERT(mType == Output);
         mNext->mPrev = nullptr;
         mNext = nullptr;
+        mNegotiated = false;
     }
     return Error::Ok;
 }
 void Pad::setCallback(Callback &&callback) {
     NEKO_ASSERT(mType == Input);
     mCallback = std::move(callback);
+    // The generic callback replaces the typed one
+    mAcceptType = nullptr;
+    mTypeChecker = nullptr;
+    mTypedCallback = nullptr;
+    mTypedUser = nullptr;
+    if (mPrev) {
+        mPrev->_negotiate();
+    }
+}
+void Pad::_setResourceTypes(std::initializer_list<const std::type_info *> types) {
+    NEKO_ASSERT(mType == Output);
+    mResourceTypes.assign(types.begin(), types.end());
+    _negotiate();
+}
+void Pad::_setTypedCallback(const std::type_info &type, TypeChecker checker, TypedCallback callback, void *user) {
+    NEKO_ASSERT(mType == Input);
+    mAcceptType = &type;
+    mTypeChecker = checker;
+    mTypedCallback = callback;
+    mTypedUser = user;
+    mCallback = nullptr;
+    if (mPrev) {
+        mPrev->_negotiate();
+    }
+}
+void Pad::_negotiate() {
+    mNegotiated = false;
+    mPushType = nullptr;
+    if (!mNext || !mNext->mTypedCallback) {
+        return;
+    }
+    if (*mNext->mAcceptType == typeid(Resource)) {
+        // Accept anything
+        mNegotiated = true;
+        return;
+    }
+    for (auto type : mResourceTypes) {
+        if (*type == *mNext->mAcceptType) {
+            mNegotiated = true;
+            mPushType = mResourceTypes.front(); //< The most derived type declared
+            return;
+        }
+    }
 }
 void Pad::setEventCallback(EventCallback &&callback) {
     // NEKO_ASSERT(mType == Input);
@@ -91,11 +152,12 @@ std::string Pad::toDocoument() const {
     libc::sprintf(&ret, "    type: %s\n", mType == Input ? "input" : "output");
     libc::sprintf(&ret, "    next: %p\n", mNext);
     libc::sprintf(&ret, "    prev: %p\n", mPrev);
+    libc::sprintf(&ret, "    negotiated: %s\n", isNegotiated() ? "true" : "false");
     ret += "    properties:\n";
 
     // Print properties
     for (const auto &[key, value] : mProperties) {
-        libc::sprintf(&ret, "        %s: %s\n", key.c_str(), value.toDocoument().c_str());
+        libc::sprintf(&ret, "        %.*s: %s\n", int(key.name().size()), key.name().data(), value.toDocoument().c_str());
     }
     return ret;
 }
@@ -3,8 +3,12 @@
 #include "defs.hpp"
 #include "error.hpp"
 #include "property.hpp"
-#include <stdexcept>
+#include <initializer_list>
+#include <type_traits>
 #include <functional>
+#include <stdexcept>
+#include <typeinfo>
+#include <vector>
 
 NEKO_NS_BEGIN
 
@@ -19,6 +23,8 @@ class NEKO_API Pad {
     };
     using Callback = std::function<Error(View<Resource> )>;
     using EventCallback = std::function<Error(View<Event> )>;
+    using TypedCallback = Error (*)(void *user, Pad *pad, Resource *resource);
+    using TypeChecker   = bool  (*)(Resource *resource);
 
     Pad(Element *master, Type type, std::string_view name);
     Pad(const Pad &) = delete;
@@ -63,6 +69,62 @@ class NEKO_API Pad {
      * @param callback 
      */
     void setEventCallback(EventCallback &&callback);
+    /**
+     * @brief Declare the type of all resources pushed by this Output pad
+     * @details The peer Input pad with a typed callback accepting one of these types is called directly,
+     * without the per-buffer dynamic_cast, list the bases T can be viewed as in Bases.
+     * push() only compares the exact type with T, the other resources are checked by dynamic_cast
+     * 
+     * @tparam T The most derived type pushed
+     * @tparam Bases The bases of T the peer may accept
+     */
+    template <typename T, typename ...Bases>
+    void setResourceType() {
+        static_assert(std::is_base_of_v<Resource, T>);
+        static_assert((std::is_base_of_v<Bases, T> && ...));
+        _setResourceTypes({&typeid(T), &typeid(Bases)...});
+    }
+    /**
+     * @brief Set the typed resource arrived Callback of this Input pad
+     * @details The type is negotiated once at link(), then push() call the method with static_cast.
+     * If the peer did not declare a matched type, the resource is checked by dynamic_cast,
+     * and UnsupportedResource is returned on mismatch
+     * 
+     * @tparam T The type accepted, Resource for any
+     * @tparam Method The member function of Object, called with (T *) or (Pad *, T *)
+     * @param object 
+     */
+    template <typename T, auto Method, typename Object>
+    void setTypedCallback(Object *object) {
+        static_assert(std::is_base_of_v<Resource, T>);
+        _setTypedCallback(
+            typeid(T),
+            [](Resource *resource) -> bool {
+                if constexpr (std::is_same_v<T, Resource>) {
+                    return true;
+                }
+                else {
+                    return dynamic_cast<T*>(resource) != nullptr;
+                }
+            },
+            [](void *user, Pad *pad, Resource *resource) -> Error {
+                if constexpr (std::is_invocable_v<decltype(Method), Object*, Pad*, T*>) {
+                    return std::invoke(Method, static_cast<Object*>(user), pad, static_cast<T*>(resource));
+                }
+                else {
+                    return std::invoke(Method, static_cast<Object*>(user), static_cast<T*>(resource));
+                }
+            },
+            object
+        );
+    }
+    /**
+     * @brief Check the link is negotiated, push() go through the typed fast path
+     * 
+     * @return true 
+     * @return false 
+     */
+    bool isNegotiated() const noexcept;
     /**
      * @brief Set the Name object
      * 
@@ -142,14 +204,14 @@ class NEKO_API Pad {
      * @param name 
      * @return Property& 
      */
-    Property        &property(std::string_view name);
+    Property        &property(PropertyKey name);
     /**
      * @brief Find the property of this pad
      * 
      * @param name 
      * @return const Property& 
      */
-    const Property  &property(std::string_view name) const;
+    const Property  &property(PropertyKey name) const;
     /**
      * @brief Check the pad has this property
      * 
@@ -157,14 +219,14 @@ class NEKO_API Pad {
      * @return true 
      * @return false 
      */
-    bool             hasProperty(std::string_view name) const noexcept;
+    bool             hasProperty(PropertyKey name) const noexcept;
     /**
      * @brief Add a property by name
      * 
      * @param name The name 
      * @param p The property
      */
-    void             addProperty(std::string_view name, Property &&p);
+    void             addProperty(PropertyKey name, Property &&p);
     /**
      * @brief Remove the property by name
      * 
@@ -172,7 +234,7 @@ class NEKO_API Pad {
      * @return true 
      * @return false No property founded 
      */
-    bool             removeProperty(std::string_view name);
+    bool             removeProperty(PropertyKey name);
     /**
      * @brief Clear all property
      * 
@@ -180,12 +242,17 @@ class NEKO_API Pad {
     void             clearProperties();
 
     void *operator new(size_t size) {
-        return libc::malloc(size);
+        return libc::malloc(size, AllocCategory::Element);
     }
     void operator delete(void *ptr) {
         return libc::free(ptr);
     }
 private:
+    void _setResourceTypes(std::initializer_list<const std::type_info *> types);
+    void _setTypedCallback(const std::type_info &type, TypeChecker checker, TypedCallback callback, void *user);
+    void _negotiate();
+    Error _pushSlow(View<Resource> resource);
+
     Element *mElement = nullptr;
     Type        mType;
     std::string mName;
@@ -194,6 +261,15 @@ private:
     Properties mProperties;
     Callback   mCallback;
     EventCallback mEventCallback;
+
+    // Typed fast path
+    std::vector<const std::type_info *> mResourceTypes; //< Output: types the pushed resources can be viewed as
+    const std::type_info *mAcceptType = nullptr; //< Input: type of mTypedCallback
+    TypeChecker   mTypeChecker = nullptr;
+    TypedCallback mTypedCallback = nullptr;
+    void         *mTypedUser = nullptr;
+    bool          mNegotiated = false; //< Output: call mNext->mTypedCallback directly
+    const std::type_info *mPushType = nullptr; //< Output: the exact type of the fast path (nullptr on peer accepts any)
 };
 
 class NEKO_API ProxyPad final : public Pad {
@@ -239,33 +315,30 @@ inline const Properties &Pad::properties() const noexcept {
 inline bool Pad::isLinked() const noexcept {
     return mNext != nullptr;
 }
-inline Property &Pad::property(std::string_view name) {
-    auto it = mProperties.find(name);
-    if (it != mProperties.end()) {
-        return it->second;
+inline bool Pad::isNegotiated() const noexcept {
+    if (mType == Input) {
+        return mPrev && mPrev->mNegotiated;
     }
-    return mProperties[std::string(name)];
+    return mNegotiated;
 }
-inline const Property &Pad::property(std::string_view name) const {
+inline Property &Pad::property(PropertyKey name) {
+    return mProperties[name];
+}
+inline const Property &Pad::property(PropertyKey name) const {
     auto it = mProperties.find(name);
     if (it != mProperties.end()) {
         return it->second;
     }
     throw std::out_of_range("Pad::property");
 }
-inline bool Pad::hasProperty(std::string_view name) const noexcept {
+inline bool Pad::hasProperty(PropertyKey name) const noexcept {
     return mProperties.contains(name);
 }
-inline void Pad::addProperty(std::string_view name, Property &&property) {
-    mProperties.emplace(std::string(name), std::move(property));
+inline void Pad::addProperty(PropertyKey name, Property &&property) {
+    mProperties.emplace(name, std::move(property));
 }
-inline bool Pad::removeProperty(std::string_view name) {
-    auto iter = mProperties.find(name);
-    if (iter != mProperties.end()) {
-        mProperties.erase(iter);
-        return true;
-    }
-    return false;
+inline bool Pad::removeProperty(PropertyKey name) {
+    return mProperties.erase(name) != 0;
 }
 inline void Pad::clearProperties() {
     mProperties.clear();
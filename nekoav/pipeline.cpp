@@ -1,5 +1,6 @@
 #define _NEKO_SOURCE
 #include "pipeline.hpp"
+#include "allocator.hpp"
 #include "eventsink.hpp"
 #include "threading.hpp"
 #include "context.hpp"
@@ -7,11 +8,16 @@
 #include "media.hpp"
 #include "event.hpp"
 #include "log.hpp"
+#include "pad.hpp"
 #include <shared_mutex>
+#include <algorithm>
 #include <vector>
+#include <map>
 
 NEKO_NS_BEGIN
 
+static thread_local bool _inStateWorker = false; //< Running Element::setState() for PipelineImpl::_changeElementsState()
+
 class PipelineImpl final : public Pipeline, public MediaController {
 public:
     PipelineImpl() {
@@ -21,6 +27,8 @@ public:
         _addClock(&mExternalClock);
 
         mContext.addObjectView<MediaController>(this);
+        mContext.addObjectView<ThreadPolicyTable>(&mThreadPolicies);
+        mContext.addObjectView<MemoryBudget>(&mMemoryBudget);
     }
     ~PipelineImpl() {
         setState(State::Null);
@@ -59,6 +67,16 @@ public:
         }
         return Error::Ok;
     }
+    Error setThreadPolicies(const ThreadPolicyTable &table) override {
+        if (state() != State::Null) {
+            return Error::InvalidState;
+        }
+        mThreadPolicies = table;
+        return Error::Ok;
+    }
+    void setMemoryBudget(size_t bytes) override {
+        mMemoryBudget.setLimit(bytes);
+    }
     Error forElements(const std::function<bool (View<Element>)> &cb) override {
         if (!cb) {
             return Error::InvalidArguments;
@@ -75,22 +93,30 @@ public:
             // Initalize, new a thread
             NEKO_ASSERT(!mThread && "Already initialized");
             mRunning = true;
-            mThread = new Thread(&PipelineImpl::_threadEntry, this);
+            // Assign mThread before the entry runs, it uses mThread
+            mThread = new Thread();
+            mThread->postTask(std::bind(&PipelineImpl::_threadEntry, this));
 
             // Init media controller here
             mPosition = 0.0;
         }
         Error ret = Error::Ok;
         auto cb = [&, this]() {
-            for (const auto &elem : mElements) {
-                ret = elem->setState(GetTargetState(stateChange));
-                if (ret != Error::Ok) {
-                    NEKO_LOG("Failed to set state for {} : {}", elem->name(), ret);
-                    return;
-                }
+            ret = _changeElementsState(stateChange);
+            if (ret != Error::Ok) {
+                return;
             }
             overrideState(GetTargetState(stateChange));
 
+            // Poll clock by a timer only when running
+            if (mClockTimer) {
+                mThread->cancelTimer(mClockTimer);
+                mClockTimer = 0;
+            }
+            if (stateChange == StateChange::Run) {
+                mClockTimer = mThread->startTimer(std::bind(&PipelineImpl::_updateClock, this), std::chrono::milliseconds(10));
+            }
+
             // Handle clock here
             if (stateChange == StateChange::Run && !mTriggeredEndOfFile) {
                 // Not End and say run
@@ -117,6 +143,7 @@ public:
             NEKO_ASSERT(mThread && "Not initialized");
             mRunning = false;
 
+            mStateWorkers.clear();
             if (Thread::currentThread() != mThread) {
                 //< Call setState at user thread
                 delete mThread;
@@ -241,19 +268,19 @@ private:
     } mBusSink {this};
 
     Error _postBusEvent(View<Event> event) {
-        mThread->postTask(std::bind(&PipelineImpl::_processEvent, this, event->shared_from_this()));
+        mThread->postTask(std::bind(&PipelineImpl::_processEvent, this, Ref<Event>(event.get())));
         return Error::Ok;
     }
     Error _sendBusEvent(View<Event> event) {
-        if (Thread::currentThread() != mThread) {
-            mThread->sendTask(std::bind(&PipelineImpl::_processEvent, this, event->shared_from_this()));
+        if (Thread::currentThread() != mThread && !_inStateWorker) {
+            mThread->sendTask(std::bind(&PipelineImpl::_processEvent, this, Ref<Event>(event.get())));
         }
         else {
-            mThread->postTask(std::bind(&PipelineImpl::_processEvent, this, event->shared_from_this()));
+            mThread->postTask(std::bind(&PipelineImpl::_processEvent, this, Ref<Event>(event.get())));
         }
         return Error::Ok;
     }
-    Error _processEvent(const Arc<Event> &event) {
+    Error _processEvent(const Ref<Event> &event) {
         // Process event here
         NEKO_DEBUG(typeid(*event));
         NEKO_DEBUG(event->type());
@@ -270,16 +297,98 @@ private:
         }
         return Error::Ok;
     }
+    /**
+     * @brief Change the state of all elements, level by level by the links
+     * @details Elements in one level are not linked to each other, so they change concurrently at mStateWorkers,
+     * the slow ones (open device, demuxer, renderer) overlap. Sinks go first on upward changes, 
+     * so they are ready before upstream pushes, sources go first on downward ones, so they stop pushing first
+     * 
+     * @param change 
+     * @return Error The first error, the levels after it are not changed
+     */
+    Error _changeElementsState(StateChange change) {
+        auto levels = _computeLevels();
+        bool upward = (change == StateChange::Initialize || change == StateChange::Prepare || change == StateChange::Run);
+        if (!upward) {
+            std::reverse(levels.begin(), levels.end());
+        }
+        auto target = GetTargetState(change);
+        for (const auto &level : levels) {
+            // Others at workers, the first one at here
+            while (mStateWorkers.size() + 1 < level.size()) {
+                auto worker = std::make_unique<Thread>();
+                worker->setName("NekoStateWorker");
+                mStateWorkers.push_back(std::move(worker));
+            }
+            Vec<Error> results(level.size(), Error::Ok);
+            std::latch latch {ptrdiff_t(level.size() - 1)};
+            for (size_t i = 1; i < level.size(); i++) {
+                mStateWorkers[i - 1]->postTask([&, i]() {
+                    // mThread is waiting for us, do not send to it
+                    _inStateWorker = true;
+                    results[i] = level[i]->setState(target);
+                    _inStateWorker = false;
+                    latch.count_down();
+                });
+            }
+            results[0] = level[0]->setState(target);
+            latch.wait();
+
+            for (size_t i = 0; i < level.size(); i++) {
+                if (results[i] != Error::Ok) {
+                    NEKO_LOG("Failed to set state for {} : {}", level[i]->name(), results[i]);
+                    return results[i];
+                }
+            }
+        }
+        return Error::Ok;
+    }
+    /**
+     * @brief Group elements by the distance to the sinks, level 0 is the sinks and the unlinked ones
+     * 
+     * @return Vec<Vec<Element *> > 
+     */
+    Vec<Vec<Element *> > _computeLevels() const {
+        std::map<Element *, size_t> depths;
+        for (const auto &elem : mElements) {
+            depths[elem.get()] = 0;
+        }
+        // Relax until stable, bounded by the num of elements in case of a loop
+        for (size_t n = 0; n < mElements.size(); n++) {
+            bool changed = false;
+            for (const auto &elem : mElements) {
+                for (auto pad : elem->outputs()) {
+                    auto iter = depths.find(pad->peerElement());
+                    if (iter == depths.end()) {
+                        continue;
+                    }
+                    if (depths[elem.get()] < iter->second + 1) {
+                        depths[elem.get()] = iter->second + 1;
+                        changed = true;
+                    }
+                }
+            }
+            if (!changed) {
+                break;
+            }
+        }
+        Vec<Vec<Element *> > levels;
+        for (const auto &elem : mElements) {
+            auto depth = depths[elem.get()];
+            if (levels.size() <= depth) {
+                levels.resize(depth + 1);
+            }
+            levels[depth].push_back(elem.get());
+        }
+        // Drop the empty levels
+        levels.erase(std::remove_if(levels.begin(), levels.end(), [](const auto &level) { return level.empty(); }), levels.end());
+        return levels;
+    }
     void _threadEntry() {
         mThread->setName("NekoPipeline");
         NEKO_DEBUG("Pipeline Thread Started");
         while (mRunning) {
-            mThread->waitTask();
-            NEKO_DEBUG("Pipeline Thread Dispatch once");
-            while (state() == State::Running) {
-                mThread->waitTask(10); //< Delay 10ms if no event
-                _updateClock();
-            }
+            mThread->waitTask(); //< Clock updated by mClockTimer
         }
         NEKO_DEBUG("Pipeline Thread Quit");
     }
@@ -326,9 +435,13 @@ private:
 
     // Pipeline
     Thread            *mThread = nullptr;
+    Thread::TimerId    mClockTimer = 0; //< Periodic _updateClock() while running
+    Vec<Box<Thread> >  mStateWorkers; //< Change the state of elements concurrently, created on demand
     Vec<Arc<Element> > mElements;
     Atomic<bool>       mRunning {false};
     Context            mContext;
+    ThreadPolicyTable  mThreadPolicies; //< Queried by elements at initialize
+    MemoryBudget       mMemoryBudget; //< Shared by the queues
 
     // MediaController
     Vec<MediaClock *>  mClocks;
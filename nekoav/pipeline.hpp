@@ -1,6 +1,7 @@
 #pragma once
 
 #include "container.hpp"
+#include "threading.hpp"
 #include <functional>
 
 NEKO_NS_BEGIN
@@ -18,6 +19,21 @@ public:
      * @param cb The event callback
      */
     virtual void setEventCallback(std::function<void(View<Event> )> &&cb) = 0;
+    /**
+     * @brief Set the policies of threads by role, like ThreadPolicyTable::isolatedAudio()
+     * @details Elements apply it at initialize, so call it before leaving the Null state
+     * 
+     * @param table 
+     * @return InvalidState on not in Null state
+     */
+    virtual Error setThreadPolicies(const ThreadPolicyTable &table) = 0;
+    /**
+     * @brief Set the memory budget of the pipeline, divided across its queues, see MemoryBudget
+     * @details The producers over budget are throttled by backpressure, it could be changed at any state
+     * 
+     * @param bytes The limit in bytes, 0 on unlimited (default)
+     */
+    virtual void setMemoryBudget(size_t bytes) = 0;
 };
 
 /**
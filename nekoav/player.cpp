@@ -148,11 +148,11 @@ void Player::setOptions(const Properties *options) {
         mOptions.reset();
     }
 }
-void Player::setOption(std::string_view key, std::string_view value) {
+void Player::setOption(PropertyKey key, std::string_view value) {
     if (!mOptions) {
         mOptions.reset(new Properties);
     }
-    mOptions->insert(std::make_pair(std::string(key), Property(value)));
+    mOptions->emplace(key, Property(value));
 }
 
 void Player::setVideoRenderer(VideoRenderer* renderer) {
@@ -480,6 +480,21 @@ bool Player::_configureSubtitle() {
     // Done
     return true;
 }
+static Properties _streamMetadata(const Pad *stream) {
+    // Look up without inserting, and copy the entries only, not the whole map
+    auto &props = stream->properties();
+    auto iter = props.find(Properties::Metadata);
+    if (iter == props.end() || !iter->second.isMap()) {
+        return Properties();
+    }
+    auto &mp = iter->second.toMap();
+    Properties metadata;
+    metadata.reserve(mp.size());
+    for (const auto &[key, value] : mp) {
+        metadata.emplace(key, Property(value));
+    }
+    return metadata;
+}
 void Player::_collectMetadata() {
     if (d->mSubtitleFilter) {
         d->mSubtitleStreams = d->mSubtitleFilter->subtitles();
@@ -488,24 +503,10 @@ void Player::_collectMetadata() {
     // int audioIndex = 0;
     for (const auto& stream : d->mDemuxer->outputs()) {
         if (stream->name().starts_with("video")) {
-            Property prop = stream->property(Properties::Metadata);
-            if (prop.isMap()) {
-                auto &mp = prop.toMap();
-                d->mVideoStreams.emplace_back(mp.begin(), mp.end());
-            }
-            else {
-                d->mVideoStreams.push_back({});
-            }
+            d->mVideoStreams.emplace_back(_streamMetadata(stream));
         }
         else if (stream->name().starts_with("audio")) {
-            Property prop = stream->property(Properties::Metadata);
-            if (prop.isMap()) {
-                auto &mp = prop.toMap();
-                d->mAudioStreams.emplace_back(mp.begin(), mp.end());
-            }
-            else {
-                d->mAudioStreams.push_back({});
-            }
+            d->mAudioStreams.emplace_back(_streamMetadata(stream));
         }
     }
 }
@@ -149,7 +149,7 @@ public:
      * @param key 
      * @param value 
      */
-    void setOption(std::string_view key, std::string_view value);
+    void setOption(PropertyKey key, std::string_view value);
     /**
      * @brief Set the Video Renderer object
      * 
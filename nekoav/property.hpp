@@ -1,7 +1,11 @@
 #pragma once
 
 #include "defs.hpp"
+#include <algorithm>
+#include <iterator>
 #include <variant>
+#include <cstring>
+#include <memory>
 #include <string>
 #include <vector>
 #include <map>
@@ -108,7 +112,7 @@ public:
     }
 
     auto operator new(size_t size) -> void * {
-        return libc::malloc(size);
+        return libc::malloc(size, AllocCategory::Property);
     }
     auto operator delete(void *ptr) -> void {
         return libc::free(ptr);
@@ -125,32 +129,297 @@ private:
     > mValue;
 };
 
-class Properties final : public Property::Map {
+/**
+ * @brief Key of Properties, hashed at compile time, compared by the hash and then the pointer
+ * @details A key made at compile time (like Properties::Width) is stored as is, others are copied into the Properties
+ * holding them at the insertion, so the stored keys never dangle and the lookup never allocates.
+ * 
+ */
+class PropertyKey {
+public:
+    constexpr PropertyKey(std::string_view name) noexcept :
+        mName(name.data()), mSize(uint32_t(name.size())), mStatic(std::is_constant_evaluated()), mHash(_hash(name)) { }
+    constexpr PropertyKey(const char *name) noexcept : PropertyKey(std::string_view(name)) { }
+    PropertyKey(const std::string &name) noexcept : PropertyKey(std::string_view(name)) { }
+
+    constexpr std::string_view name() const noexcept {
+        return std::string_view(mName, mSize);
+    }
+    constexpr uint32_t         hash() const noexcept {
+        return mHash;
+    }
+    /**
+     * @brief Check the name is made at compile time and lives forever
+     * 
+     * @return true 
+     * @return false 
+     */
+    constexpr bool             isStatic() const noexcept {
+        return mStatic;
+    }
+
+    constexpr bool operator ==(const PropertyKey &other) const noexcept {
+        if (mHash != other.mHash || mSize != other.mSize) {
+            return false;
+        }
+        return mName == other.mName || name() == other.name();
+    }
+private:
+    static constexpr uint32_t _hash(std::string_view name) noexcept {
+        // FNV-1a
+        uint32_t hash = 2166136261u;
+        for (auto ch : name) {
+            hash = (hash ^ uint8_t(ch)) * 16777619u;
+        }
+        return hash;
+    }
+
+    const char *mName;
+    uint32_t    mSize   : 31;
+    uint32_t    mStatic : 1; //< The name lives forever
+    uint32_t    mHash;
+};
+
+/**
+ * @brief View a list Property as a list of enum, no allocation
+ * 
+ * @tparam T The enum type
+ */
+template <typename T>
+class PropertyEnumList {
+public:
+    class iterator {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using difference_type   = ptrdiff_t;
+        using value_type        = T;
+        using pointer           = void;
+        using reference         = T;
+
+        iterator() = default;
+        explicit iterator(const Property *ptr) : mPtr(ptr) { }
+
+        T         operator *() const {
+            return mPtr->toEnum<T>();
+        }
+        iterator &operator ++() noexcept {
+            ++mPtr;
+            return *this;
+        }
+        iterator  operator ++(int) noexcept {
+            return iterator(mPtr++);
+        }
+        bool      operator ==(const iterator &) const = default;
+    private:
+        const Property *mPtr = nullptr;
+    };
+
+    PropertyEnumList() = default;
+    explicit PropertyEnumList(const Property::List *list) : mList(list) { }
+
+    iterator begin() const noexcept {
+        return mList ? iterator(mList->data()) : iterator();
+    }
+    iterator end() const noexcept {
+        return mList ? iterator(mList->data() + mList->size()) : iterator();
+    }
+    size_t   size() const noexcept {
+        return mList ? mList->size() : 0;
+    }
+    bool     empty() const noexcept {
+        return size() == 0;
+    }
+    T        operator [](size_t idx) const {
+        return (*mList)[idx].template toEnum<T>();
+    }
+    bool     contains(T value) const {
+        for (auto v : *this) {
+            if (v == value) {
+                return true;
+            }
+        }
+        return false;
+    }
+private:
+    const Property::List *mList = nullptr;
+};
+
+/**
+ * @brief The properties of a pad, options or metadata, a small flat map in the insertion order
+ * @details The caps are only a few entries, a linear scan of hashed keys beats the tree and its node allocations.
+ * The names of the runtime keys are owned by each Properties, copied on copy.
+ * 
+ */
+class Properties final {
 public:
+    using value_type     = std::pair<PropertyKey, Property>;
+    using iterator       = std::vector<value_type>::iterator;
+    using const_iterator = std::vector<value_type>::const_iterator;
+
     //< Pad
-    static constexpr const char *PixelFormatList = "pixelFormatList";
-    static constexpr const char *PixelFormat = "pixelFormat";
-    static constexpr const char *Width = "width";
-    static constexpr const char *Height = "height";
-    static constexpr const char *Channels = "channels";
-    static constexpr const char *SampleRate = "sampleRate";
-    static constexpr const char *SampleFormat = "sampleFormat";
-    static constexpr const char *SampleFormatList = "sampleFormatList";
-    static constexpr const char *Duration = "duration";
+    static constexpr PropertyKey PixelFormatList {"pixelFormatList"};
+    static constexpr PropertyKey PixelFormat {"pixelFormat"};
+    static constexpr PropertyKey Width {"width"};
+    static constexpr PropertyKey Height {"height"};
+    static constexpr PropertyKey Channels {"channels"};
+    static constexpr PropertyKey SampleRate {"sampleRate"};
+    static constexpr PropertyKey SampleFormat {"sampleFormat"};
+    static constexpr PropertyKey SampleFormatList {"sampleFormatList"};
+    static constexpr PropertyKey Duration {"duration"};
 
     // Metadata
-    static constexpr const char *Metadata = "metadata";
-    static constexpr const char *Title = "title";
-    static constexpr const char *Artist = "artist";
-    static constexpr const char *Album = "album";
-    static constexpr const char *Language = "language";
+    static constexpr PropertyKey Metadata {"metadata"};
+    static constexpr PropertyKey Title {"title"};
+    static constexpr PropertyKey Artist {"artist"};
+    static constexpr PropertyKey Album {"album"};
+    static constexpr PropertyKey Language {"language"};
 
     //< HTTP
-    static constexpr const char *HttpUserAgent = "HttpUserAgent";
-    static constexpr const char *HttpReferer = "HttpReferer";
-    static constexpr const char *HttpHeader = "HttpHeader";
+    static constexpr PropertyKey HttpUserAgent {"HttpUserAgent"};
+    static constexpr PropertyKey HttpReferer {"HttpReferer"};
+    static constexpr PropertyKey HttpHeader {"HttpHeader"};
+
+    Properties() = default;
+    Properties(Properties &&) noexcept = default;
+    Properties(const Properties &other) {
+        *this = other;
+    }
+    template <typename It>
+    Properties(It first, It last) {
+        for (; first != last; ++first) {
+            emplace(first->first, Property(first->second));
+        }
+    }
+
+    Properties    &operator =(Properties &&) noexcept = default;
+    Properties    &operator =(const Properties &other) {
+        if (this != &other) {
+            clear();
+            reserve(other.size());
+            for (const auto &[key, value] : other) {
+                emplace(key, Property(value));
+            }
+        }
+        return *this;
+    }
+
+    iterator       begin() noexcept {
+        return mItems.begin();
+    }
+    iterator       end() noexcept {
+        return mItems.end();
+    }
+    const_iterator begin() const noexcept {
+        return mItems.begin();
+    }
+    const_iterator end() const noexcept {
+        return mItems.end();
+    }
+    size_t         size() const noexcept {
+        return mItems.size();
+    }
+    bool           empty() const noexcept {
+        return mItems.empty();
+    }
+    void           clear() noexcept {
+        mItems.clear();
+        mNames.clear();
+    }
+    void           reserve(size_t n) {
+        mItems.reserve(n);
+    }
+
+    iterator       find(PropertyKey key) noexcept {
+        return std::find_if(mItems.begin(), mItems.end(), [&](const value_type &item) { return item.first == key; });
+    }
+    const_iterator find(PropertyKey key) const noexcept {
+        return std::find_if(mItems.begin(), mItems.end(), [&](const value_type &item) { return item.first == key; });
+    }
+    bool           contains(PropertyKey key) const noexcept {
+        return find(key) != end();
+    }
+    /**
+     * @brief Insert if the key doesn't exist, like std::map::emplace
+     * 
+     * @return std::pair<iterator, bool> The item and is it inserted
+     */
+    std::pair<iterator, bool> emplace(PropertyKey key, Property &&value) {
+        if (auto iter = find(key); iter != end()) {
+            return std::make_pair(iter, false);
+        }
+        mItems.emplace_back(_own(key), std::move(value));
+        return std::make_pair(mItems.end() - 1, true);
+    }
+    iterator       erase(const_iterator iter) {
+        _release(iter->first);
+        return mItems.erase(iter);
+    }
+    size_t         erase(PropertyKey key) {
+        if (auto iter = find(key); iter != end()) {
+            erase(iter);
+            return 1;
+        }
+        return 0;
+    }
+    Property      &operator [](PropertyKey key) {
+        return emplace(key, Property()).first->second;
+    }
+
+    // Typed accessors of the well-known caps, no allocation
+    int64_t width() const noexcept {
+        return _int(Width);
+    }
+    int64_t height() const noexcept {
+        return _int(Height);
+    }
+    /**
+     * @brief Get the pixel formats accepted, empty on accepting all
+     * 
+     * @return PropertyEnumList<PixelFormat> 
+     */
+    PropertyEnumList<NEKO_NAMESPACE::PixelFormat>  pixelFormatList() const noexcept {
+        return PropertyEnumList<NEKO_NAMESPACE::PixelFormat>(_list(PixelFormatList));
+    }
+    /**
+     * @brief Get the sample formats accepted, empty on accepting all
+     * 
+     * @return PropertyEnumList<SampleFormat> 
+     */
+    PropertyEnumList<NEKO_NAMESPACE::SampleFormat> sampleFormatList() const noexcept {
+        return PropertyEnumList<NEKO_NAMESPACE::SampleFormat>(_list(SampleFormatList));
+    }
+private:
+    // Copy the name of a runtime key into mNames, the buffers never move
+    PropertyKey           _own(PropertyKey key) {
+        if (key.isStatic()) {
+            return key;
+        }
+        auto name = key.name();
+        auto &buffer = mNames.emplace_back(std::make_unique<char[]>(name.size() + 1));
+        ::memcpy(buffer.get(), name.data(), name.size());
+        buffer[name.size()] = '\0';
+        return PropertyKey(std::string_view(buffer.get(), name.size()));
+    }
+    void                  _release(PropertyKey key) noexcept {
+        if (key.isStatic()) {
+            return;
+        }
+        auto iter = std::find_if(mNames.begin(), mNames.end(), [&](const auto &buffer) { return buffer.get() == key.name().data(); });
+        if (iter != mNames.end()) {
+            mNames.erase(iter);
+        }
+    }
+    int64_t               _int(PropertyKey key) const noexcept {
+        auto iter = find(key);
+        return iter != end() && iter->second.isInt() ? iter->second.toInt() : 0;
+    }
+    const Property::List *_list(PropertyKey key) const noexcept {
+        auto iter = find(key);
+        return iter != end() && iter->second.isList() ? &iter->second.toList() : nullptr;
+    }
 
-    using Property::Map::map;
+    std::vector<value_type> mItems;
+    std::vector<std::unique_ptr<char[]> > mNames; //< Storage of the runtime keys in mItems
 };
 
 
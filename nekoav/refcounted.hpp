@@ -0,0 +1,333 @@
+#pragma once
+
+#include "defs.hpp"
+#include "allocator.hpp"
+#include <utility>
+#include <memory>
+#include <thread>
+
+NEKO_NS_BEGIN
+
+/**
+ * @brief Base of the intrusive reference counted objects, the count lives in the object, no control block
+ * @details Hold it by Ref<T>, the object is destroyed by _destroy() when the last Ref dropped.
+ *
+ */
+class RefCounted {
+public:
+    /**
+     * @brief Add a reference
+     *
+     */
+    void     addRef() const noexcept {
+        mRefcount.fetch_add(1, std::memory_order_relaxed);
+    }
+    /**
+     * @brief Drop a reference, destroy it on the last one
+     *
+     */
+    void     release() const noexcept {
+        if (mRefcount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            const_cast<RefCounted*>(this)->_destroy();
+        }
+    }
+    /**
+     * @brief Get the current reference count
+     *
+     * @return uint32_t
+     */
+    uint32_t refcount() const noexcept {
+        return mRefcount.load(std::memory_order_acquire);
+    }
+protected:
+    RefCounted() = default;
+    RefCounted(const RefCounted &) noexcept { } //< The copy is a new object, no reference yet
+    virtual ~RefCounted() = default;
+
+    RefCounted &operator =(const RefCounted &) noexcept {
+        return *this;
+    }
+
+    /**
+     * @brief Called when the last reference dropped, delete this by default, override it to recycle the object
+     *
+     */
+    virtual void _destroy() noexcept {
+        delete this;
+    }
+private:
+    mutable Atomic<uint32_t> mRefcount {0};
+};
+
+/**
+ * @brief Smart pointer of a RefCounted, only one atomic operation for a copy
+ *
+ * @tparam T RefCounted, SharedRefCounted or any type with addRef() / release()
+ */
+template <typename T>
+class Ref {
+public:
+    Ref() = default;
+    Ref(std::nullptr_t) noexcept { }
+    Ref(T *ptr) noexcept : mPtr(ptr) {
+        if (mPtr) {
+            mPtr->addRef();
+        }
+    }
+    Ref(const Ref &other) noexcept : Ref(other.mPtr) { }
+    Ref(Ref &&other) noexcept : mPtr(std::exchange(other.mPtr, nullptr)) { }
+    template <typename U>
+    Ref(const Ref<U> &other) noexcept : Ref(other.get()) { }
+    template <typename U>
+    Ref(Ref<U> &&other) noexcept : mPtr(other.detach()) { }
+    ~Ref() {
+        if (mPtr) {
+            mPtr->release();
+        }
+    }
+
+    Ref &operator =(Ref other) noexcept {
+        std::swap(mPtr, other.mPtr);
+        return *this;
+    }
+
+    T *get() const noexcept {
+        return mPtr;
+    }
+    T *operator ->() const noexcept {
+        return mPtr;
+    }
+    T &operator *() const noexcept {
+        return *mPtr;
+    }
+    explicit operator bool() const noexcept {
+        return mPtr != nullptr;
+    }
+    /**
+     * @brief Drop the reference, make it empty
+     *
+     */
+    void reset() noexcept {
+        Ref().swap(*this);
+    }
+    void swap(Ref &other) noexcept {
+        std::swap(mPtr, other.mPtr);
+    }
+    /**
+     * @brief Give up the ownship without release, the caller must release() it
+     *
+     * @return T*
+     */
+    T   *detach() noexcept {
+        return std::exchange(mPtr, nullptr);
+    }
+
+    template <typename U>
+    bool operator ==(const Ref<U> &other) const noexcept {
+        return mPtr == other.get();
+    }
+    bool operator ==(std::nullptr_t) const noexcept {
+        return mPtr == nullptr;
+    }
+private:
+    T *mPtr = nullptr;
+};
+
+/**
+ * @brief Base of the objects counted intrusively and owned by Arc as well, hold it by Ref<T> or by Arc<T>
+ * @details It can be created by MakeRef (one allocation, no control block) or by make_shared:
+ *
+ * - Created by MakeRef (or AdoptRef), the last Ref destroy it by _destroy(), shared_from_this() gives a Arc holding a Ref
+ * - Owned by Arc, the first Ref pins it by a Arc of itself, the last Ref drops the pin
+ *
+ * @warning A object on the stack, as a member or in a Box must not be given to anything taking a Ref,
+ * it panics on the first Ref
+ *
+ * @tparam T The derived type, given to std::enable_shared_from_this
+ */
+template <typename T>
+class SharedRefCounted : public std::enable_shared_from_this<T> {
+public:
+    /**
+     * @brief Add a reference, used by Ref<>
+     *
+     */
+    void addRef() const noexcept {
+        if (mMode.load(std::memory_order_relaxed) == Intrusive) {
+            mRefcount.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        auto count = mRefcount.load(std::memory_order_relaxed);
+        while (count != 0) {
+            if (mRefcount.compare_exchange_weak(count, count + 1, std::memory_order_relaxed)) {
+                return;
+            }
+        }
+        _addFirstRef();
+    }
+    /**
+     * @brief Drop a reference, used by Ref<>
+     *
+     */
+    void release() const noexcept {
+        if (mMode.load(std::memory_order_relaxed) == Intrusive) {
+            if (mRefcount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                const_cast<SharedRefCounted*>(this)->_destroy();
+            }
+            return;
+        }
+        auto count = mRefcount.load(std::memory_order_relaxed);
+        while (count != 1) {
+            if (mRefcount.compare_exchange_weak(count, count - 1, std::memory_order_release)) {
+                return;
+            }
+        }
+        _releaseLastRef();
+    }
+    /**
+     * @brief Get the number of Ref to it
+     *
+     * @return uint32_t
+     */
+    uint32_t refcount() const noexcept {
+        return mRefcount.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief Get a Arc of it, it works on the object created by MakeRef too
+     *
+     * @return Arc<T>
+     */
+    Arc<T> shared_from_this() {
+        if (mMode.load(std::memory_order_relaxed) == Shared) [[likely]] {
+            return std::enable_shared_from_this<T>::shared_from_this();
+        }
+        return std::const_pointer_cast<T>(_sharedFromThis());
+    }
+    Arc<const T> shared_from_this() const {
+        if (mMode.load(std::memory_order_relaxed) == Shared) [[likely]] {
+            return std::enable_shared_from_this<T>::shared_from_this();
+        }
+        return _sharedFromThis();
+    }
+    template <typename U>
+    auto shared_from_this() -> Arc<U> {
+        return std::static_pointer_cast<U>(shared_from_this());
+    }
+protected:
+    SharedRefCounted() = default;
+    SharedRefCounted(const SharedRefCounted &) noexcept : std::enable_shared_from_this<T>() { } //< The copy has no reference
+    virtual ~SharedRefCounted() = default;
+
+    SharedRefCounted &operator =(const SharedRefCounted &) noexcept {
+        return *this;
+    }
+
+    /**
+     * @brief Called when the last Ref dropped on created by MakeRef, delete this by default, override it to recycle
+     *
+     */
+    virtual void _destroy() noexcept {
+        delete this;
+    }
+private:
+    enum Mode : uint8_t {
+        Unknown,   //< Not adopted, it must be owned by Arc
+        Intrusive, //< Adopted by MakeRef / AdoptRef before any Ref, the count owns it, never changed after
+        Shared,    //< Owned by Arc, pinned while any Ref alive, the weak this is always valid
+    };
+
+    // Called by AdoptRef() on the fresh object, nobody else can see it yet
+    void _adoptRef() noexcept {
+        mMode.store(Intrusive, std::memory_order_relaxed);
+    }
+    void _lock() const noexcept {
+        while (mLock.test_and_set(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+    }
+    void _unlock() const noexcept {
+        mLock.clear(std::memory_order_release);
+    }
+    // The 0 <-> 1 transitions of Shared are done in the lock, so the pin always matches the count
+    void _addFirstRef() const noexcept {
+        _lock();
+        if (mRefcount.fetch_add(1, std::memory_order_relaxed) == 0) {
+            mPin = this->weak_from_this().lock();
+            if (!mPin) {
+                // Not created by MakeRef and no Arc owns it (on the stack, a member, ...), nobody may delete it
+                NEKO_PANIC(Ref taken on a object neither created by MakeRef nor owned by Arc);
+            }
+            mMode.store(Shared, std::memory_order_relaxed);
+        }
+        _unlock();
+    }
+    void _releaseLastRef() const noexcept {
+        _lock();
+        if (mRefcount.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+            return _unlock();
+        }
+        auto pin = std::move(mPin);
+        _unlock();
+        // Drop the pin here, it may destroy this
+    }
+    Arc<const T> _sharedFromThis() const {
+        if (mMode.load(std::memory_order_relaxed) != Intrusive) {
+            // Must be owned by Arc, throw bad_weak_ptr as std::enable_shared_from_this on not
+            auto arc = std::enable_shared_from_this<T>::shared_from_this();
+            mMode.store(Shared, std::memory_order_relaxed);
+            return arc;
+        }
+        addRef(); //< Keep it alive, given to the new Arc if we create one
+        _lock();
+        auto arc = this->weak_from_this().lock();
+        if (arc) {
+            _unlock();
+            release();
+            return arc;
+        }
+        arc = Arc<const T>(static_cast<const T*>(this), [](const T *self) { self->release(); }, StdAllocator<T>());
+        _unlock();
+        return arc;
+    }
+
+    mutable Atomic<uint32_t> mRefcount {0};
+    mutable Atomic<Mode>     mMode {Unknown}; //< Intrusive is fixed by AdoptRef, Shared is only a hint of Unknown
+    mutable std::atomic_flag mLock; //< Guard the pin and the weak this
+    mutable Arc<const T>     mPin; //< The Arc kept while any Ref alive, on owned by Arc
+
+    template <typename U>
+    friend Ref<U> AdoptRef(U *ptr) noexcept;
+};
+
+/**
+ * @brief Take a object just created (by new or in a pool), its reference count owns it from now on
+ * @details A SharedRefCounted is marked as owned by its count, so the last Ref destroy it,
+ * one not adopted must be owned by Arc before any Ref taken.
+ *
+ * @tparam T
+ * @param ptr The new object, no reference yet
+ * @return Ref<T>
+ */
+template <typename T>
+Ref<T> AdoptRef(T *ptr) noexcept {
+    if constexpr (requires { ptr->_adoptRef(); }) {
+        ptr->_adoptRef();
+    }
+    return Ref<T>(ptr);
+}
+
+/**
+ * @brief Create a RefCounted object, held by the returned Ref
+ *
+ * @tparam T
+ * @tparam Args
+ * @param args
+ * @return Ref<T>
+ */
+template <typename T, typename ...Args>
+Ref<T> MakeRef(Args &&...args) {
+    return AdoptRef(new T(std::forward<Args>(args)...));
+}
+
+NEKO_NS_END
@@ -1,32 +1,26 @@
 #pragma once
 
 #include "defs.hpp"
+#include "allocator.hpp"
+#include "refcounted.hpp"
 
 NEKO_NS_BEGIN
 
 /**
  * @brief All object passed from Element to Element must inherit it, it support RTTI
- * 
+ * @details It has a intrusive reference count, hold it by Ref<T> to keep it with only one atomic operation.
+ * It can be created by MakeRef (one allocation, no control block) or by make_shared as before,
+ * see SharedRefCounted for the ownership.
+ *
  */
-class Resource : public std::enable_shared_from_this<Resource> { 
+class Resource : public SharedRefCounted<Resource> {
 public:
     virtual ~Resource() = default;
 
-    auto shared_from_this() {
-        return std::enable_shared_from_this<Resource>::shared_from_this();
-    }
-    auto shared_from_this() const {
-        return std::enable_shared_from_this<Resource>::shared_from_this();
-    }
-    template <typename T>
-    auto shared_from_this() -> Arc<T> {
-        return std::static_pointer_cast<T>(shared_from_this());
-    }
-
     template <typename T>
     auto as() noexcept {
         return dynamic_cast<T*>(this);
-    }    
+    }
     template <typename T>
     auto as() const noexcept {
         return dynamic_cast<const T*>(this);
@@ -40,8 +34,9 @@ public:
     }
 protected:
     Resource() = default;
+    Resource(const Resource &) = default; //< The copy has no reference
 };
 
 using ResourceView = View<Resource>;
 
-NEKO_NS_END
\ No newline at end of file
+NEKO_NS_END
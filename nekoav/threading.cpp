@@ -3,11 +3,19 @@
 #include "utils.hpp"
 #include "error.hpp"
 #include "log.hpp"
+#include <algorithm>
+#include <deque>
 #include <mutex>
 
 #ifdef _WIN32
     #include <Windows.h>
     #define NEKO_WIN_DISPATCHER
+#elif defined(__linux__)
+    #include <sys/resource.h>
+    #include <sys/syscall.h>
+    #include <pthread.h>
+    #include <unistd.h>
+    #include <sched.h>
 #endif
 
 #ifdef _MSC_VER
@@ -19,12 +27,52 @@ NEKO_NS_BEGIN
 
 static thread_local Thread *_currentThread = nullptr;
 
+// Executor
+class ExecutorWorker {
+public:
+    std::mutex         mMutex;
+    std::deque<Thread*> mQueue; //< Owner pop from back, thieves steal from front
+    std::thread        mThread;
+};
+class ExecutorPrivate {
+public:
+    Box<ExecutorWorker[]> mWorkers;
+    size_t                mNumOfWorkers = 0;
+    Atomic<size_t>        mNext {0}; //< Round-robin index for external schedule
+    Atomic<size_t>        mPending {0}; //< Num of Threads in all queues
+    Atomic<size_t>        mSleeping {0};
+    Atomic<size_t>        mNumOfThreads {0}; //< Num of alive Threads allocated
+    bool                  mRunning = true;
+    std::mutex            mMutex;
+    std::condition_variable mCondition;
+
+    // Timers of Threads, a idle worker sleeps until the earliest one and schedules the Thread
+    std::vector<std::pair<Thread::Clock::time_point, Thread*> > mDeadlines; //< Min heap, protected by mMutex
+    Atomic<bool>          mHasDeadlines {false}; //< Skip the lock after each slice if no timer
+};
+
 Thread::Thread() {
     std::latch latch {1};
     mThread = std::thread(&Thread::_run, this, &latch);
     latch.wait();
 }
+Thread::Thread(Executor *executor) : mExecutor(executor) {
+    NEKO_ASSERT(executor);
+}
 Thread::~Thread() {
+    if (mExecutor) {
+        // Wait for the last slice done
+        std::latch latch {1};
+        postTask([this, &latch]() {
+            mRunning = false;
+            mQuitLatch = &latch;
+        });
+        latch.wait();
+        // No slice can add one now, mScheduled keeps true so the fired one does not schedule us
+        mExecutor->_removeDeadlines(this);
+        mExecutor->d->mNumOfThreads -= 1;
+        return;
+    }
     postTask([this]() {
         mRunning = false;
     });
@@ -58,13 +106,64 @@ void Thread::_run(void *latch) {
         if (!mQueue.empty()) {
             continue;
         }
+        mWakeup = false;
+        DWORD timeout = INFINITE;
+        if (!mTimers.empty()) {
+            auto ms = std::chrono::ceil<std::chrono::milliseconds>(mTimers.front().deadline - Clock::now()).count();
+            timeout = DWORD(std::max<int64_t>(ms, 0));
+        }
         lock.unlock();
-        ::WaitMessage();
+        ::MsgWaitForMultipleObjects(0, nullptr, FALSE, timeout, QS_ALLINPUT);
 #else
-        mCondition.wait(lock, [this]() { return !mQueue.empty(); });
+        while (mQueue.empty() && !mWakeup) {
+            if (mTimers.empty()) {
+                mCondition.wait(lock);
+            }
+            else if (mTimers.front().deadline <= Clock::now()) {
+                break;
+            }
+            else {
+                // Loop again, a earlier timer may be added while waiting
+                mCondition.wait_until(lock, mTimers.front().deadline);
+            }
+        }
+        if (mQueue.empty()) {
+            // Nobody waiting for it, drop. Otherwise keep it for the waitTask() in the coming task
+            mWakeup = false;
+        }
 #endif
     }
 }
+void Thread::_runSlice() {
+    // Called by the worker of executor
+    auto prev = _currentThread;
+    _currentThread = this;
+    mIdle = false;
+    dispatchTask();
+    mIdle = true;
+    _currentThread = prev;
+
+    if (!mRunning) {
+        // Destructor is waiting, do not touch this after it
+        mQuitLatch->count_down();
+        return;
+    }
+
+    // Check and give up the ownership in the lock, postTask() schedules us in the lock too, so no task is missed.
+    // Once mScheduled is false, ~Thread may free this at any time, nothing of this is touched after the unlock
+    std::unique_lock lock(mMutex);
+    if (!mQueue.empty()) {
+        // Still the owner, it is scheduled again as is
+        lock.unlock();
+        mExecutor->_schedule(this);
+        return;
+    }
+    if (!mTimers.empty()) {
+        // Added while we own it, ~Thread removes it after the quit slice
+        mExecutor->_addDeadline(this, mTimers.front().deadline);
+    }
+    mScheduled = false;
+}
 void Thread::setName(std::string_view name) {
     if (Thread::currentThread() != this) {
         return sendTask(std::bind(&Thread::setName, this, name));
@@ -73,51 +172,275 @@ void Thread::setName(std::string_view name) {
         name = "NekoWorkThread";
     }
     mName = name;
-    NEKO_SetThreadName(mName);
+    if (!mExecutor) {
+        NEKO_SetThreadName(mName);
+    }
 }
 void Thread::setPriority(ThreadPriority p) {
+    setPolicy(ThreadPolicy::fromPriority(p));
+}
+Error Thread::setPolicy(const ThreadPolicy &policy) {
+    if (mExecutor) {
+        // Workers are shared, nothing to do
+        return Error::InvalidState;
+    }
     if (Thread::currentThread() != this) {
-        return sendTask(std::bind(&Thread::setPriority, this, p));
+        return invokeQueued(&Thread::setPolicy, this, policy);
     }
+    return Thread::setCurrentPolicy(policy);
+}
+Error Thread::setCurrentPolicy(const ThreadPolicy &policy) noexcept {
+    Error ret = Error::Ok;
 
-#if defined(_WIN32) && !defined(NEKO_MINGW)
+#if defined(_WIN32)
     int priority = THREAD_PRIORITY_NORMAL;
-    switch (p) {
-        case ThreadPriority::Lowest: priority = THREAD_PRIORITY_LOWEST; break;
-        case ThreadPriority::Low: priority = THREAD_PRIORITY_BELOW_NORMAL; break;
-        case ThreadPriority::Normal: priority = THREAD_PRIORITY_NORMAL; break;
-        case ThreadPriority::High: priority = THREAD_PRIORITY_ABOVE_NORMAL; break;
-        case ThreadPriority::Highest: priority = THREAD_PRIORITY_HIGHEST; break;
-        case ThreadPriority::RealTime: priority = THREAD_PRIORITY_TIME_CRITICAL; break;
-    }
-    ::SetThreadPriority(::GetCurrentThread(), priority);
+    if (policy.policy != SchedulePolicy::Normal) {
+        priority = THREAD_PRIORITY_TIME_CRITICAL;
+    }
+    else if (policy.nice >= 15) {
+        priority = THREAD_PRIORITY_LOWEST;
+    }
+    else if (policy.nice >= 5) {
+        priority = THREAD_PRIORITY_BELOW_NORMAL;
+    }
+    else if (policy.nice <= -10) {
+        priority = THREAD_PRIORITY_HIGHEST;
+    }
+    else if (policy.nice <= -5) {
+        priority = THREAD_PRIORITY_ABOVE_NORMAL;
+    }
+    if (!::SetThreadPriority(::GetCurrentThread(), priority)) {
+        ret = Error::PermissionDenied;
+    }
+    if (policy.affinity != 0) {
+        ::SetThreadAffinityMask(::GetCurrentThread(), DWORD_PTR(policy.affinity));
+    }
 #elif __has_include(<sched.h>)
-    int priority = 0;
-    switch (p) {
-        case ThreadPriority::Lowest: priority = -20; break;
-        case ThreadPriority::Low: priority = -10; break;
-        case ThreadPriority::Normal: priority = 0; break;
-        case ThreadPriority::High: priority = 10; break;
-        case ThreadPriority::Highest: priority = 20; break;
-        case ThreadPriority::RealTime: priority = 1; break;
-    }
-    ::sched_param param;
-    param.sched_priority = priority;
-    ::pthread_setschedparam(::pthread_self(), SCHED_OTHER, &param);
+    bool realTime = false;
+    if (policy.policy != SchedulePolicy::Normal) {
+        // SCHED_OTHER only accepts priority 0, the real time one is a different policy
+        int sched = (policy.policy == SchedulePolicy::Fifo) ? SCHED_FIFO : SCHED_RR;
+        ::sched_param param { };
+        param.sched_priority = std::clamp(policy.priority, ::sched_get_priority_min(sched), ::sched_get_priority_max(sched));
+        if (::pthread_setschedparam(::pthread_self(), sched, &param) == 0) {
+            realTime = true;
+        }
+        else {
+            NEKO_LOG("Real time scheduling denied, fallback to nice {}", policy.nice);
+            ret = Error::PermissionDenied;
+        }
+    }
+    if (!realTime) {
+        ::sched_param param { };
+        ::pthread_setschedparam(::pthread_self(), SCHED_OTHER, &param);
+#if defined(__linux__)
+        // Linux nice level is per thread
+        if (::setpriority(PRIO_PROCESS, id_t(::syscall(SYS_gettid)), std::clamp(policy.nice, -20, 19)) != 0) {
+            ret = Error::PermissionDenied;
+        }
+#endif
+    }
+#if defined(__linux__)
+    if (policy.affinity != 0) {
+        ::cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int n = 0; n < 64 && n < CPU_SETSIZE; n++) {
+            if (policy.affinity & (uint64_t(1) << n)) {
+                CPU_SET(n, &set);
+            }
+        }
+        if (::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set) != 0) {
+            ret = Error::InvalidArguments;
+        }
+    }
+#endif
 #endif
 
+    return ret;
 }
-void Thread::postTask(std::function<void()> &&fn) {
-    std::lock_guard lock(mMutex);
-    mQueue.emplace(std::move(fn));
+
+// ThreadPolicy
+ThreadPolicy ThreadPolicy::fromPriority(ThreadPriority p) noexcept {
+    ThreadPolicy policy;
+    switch (p) {
+        case ThreadPriority::Lowest: policy.nice = 19; break;
+        case ThreadPriority::Low: policy.nice = 10; break;
+        case ThreadPriority::Normal: policy.nice = 0; break;
+        case ThreadPriority::High: policy.nice = -5; break;
+        case ThreadPriority::Highest: policy.nice = -10; break;
+        case ThreadPriority::RealTime: {
+            policy.policy = SchedulePolicy::Fifo;
+            policy.priority = 10;
+            policy.nice = -20;
+            break;
+        }
+    }
+    return policy;
+}
+
+// ThreadPolicyTable
+void ThreadPolicyTable::setPolicy(ThreadRole role, const ThreadPolicy &policy) {
+    NEKO_ASSERT(role < ThreadRole::NumberOfRoles);
+    mPolicies[size_t(role)] = policy;
+    mHas[size_t(role)] = true;
+}
+void ThreadPolicyTable::resetPolicy(ThreadRole role) {
+    NEKO_ASSERT(role < ThreadRole::NumberOfRoles);
+    mHas[size_t(role)] = false;
+}
+Error ThreadPolicyTable::apply(ThreadRole role, Thread *thread) const {
+    if (role >= ThreadRole::NumberOfRoles || !mHas[size_t(role)]) {
+        return Error::Ok;
+    }
+    auto &policy = mPolicies[size_t(role)];
+    if (thread) {
+        return thread->setPolicy(policy);
+    }
+    return Thread::setCurrentPolicy(policy);
+}
+ThreadPolicyTable ThreadPolicyTable::isolatedAudio(int core) {
+    NEKO_ASSERT(core >= 0 && core < 64);
+    uint64_t audioMask = uint64_t(1) << core;
+    uint64_t othersMask = 0;
+    auto numOfCores = std::min<unsigned>(std::thread::hardware_concurrency(), 64);
+    for (unsigned n = 0; n < numOfCores; n++) {
+        othersMask |= (uint64_t(1) << n);
+    }
+    othersMask &= ~audioMask;
+
+    ThreadPolicyTable table;
+    ThreadPolicy audio;
+    audio.policy = SchedulePolicy::Fifo;
+    audio.priority = 20;
+    audio.nice = -20;
+    audio.affinity = audioMask;
+    table.setPolicy(ThreadRole::AudioSink, audio);
+
+    ThreadPolicy video;
+    video.nice = -10;
+    video.affinity = othersMask;
+    table.setPolicy(ThreadRole::VideoSink, video);
+
+    ThreadPolicy worker;
+    worker.affinity = othersMask;
+    table.setPolicy(ThreadRole::Demuxer, worker);
+    table.setPolicy(ThreadRole::Decoder, worker);
+    return table;
+}
+void Thread::postTask(Task &&fn) {
+    std::unique_lock lock(mMutex);
+    mQueue.push(std::move(fn));
     mCondition.notify_one();
 
+    if (mExecutor) {
+        // Take the ownership in the lock, pair with the end of _runSlice()
+        bool schedule = !mScheduled.exchange(true);
+        lock.unlock();
+        if (schedule) {
+            mExecutor->_schedule(this);
+        }
+        return;
+    }
+
 #ifdef NEKO_WIN_DISPATCHER
     BOOL ret = ::PostThreadMessageW(mThreadId, mWeakupMessage, 0, 0);
     NEKO_ASSERT(ret);
 #endif
 }
-void Thread::sendTask(std::function<void()> &&fn) {
+void Thread::wakeup() {
+    std::unique_lock lock(mMutex);
+    mWakeup = true;
+    mCondition.notify_one();
+    lock.unlock();
+
+    if (mExecutor) {
+        // No task to run, only the waiter blocked in the slice cares
+        return;
+    }
+
+#ifdef NEKO_WIN_DISPATCHER
+    BOOL ret = ::PostThreadMessageW(mThreadId, mWeakupMessage, 0, 0);
+    NEKO_ASSERT(ret);
+#endif
+}
+Thread::TimerId Thread::postAt(Task &&fn, Clock::time_point deadline) {
+    return _addTimer(std::move(fn), deadline, Clock::duration::zero());
+}
+Thread::TimerId Thread::_addTimer(Task &&fn, Clock::time_point deadline, Clock::duration interval) {
+    std::unique_lock lock(mMutex);
+    auto id = ++mTimerId;
+    mTimers.push_back(Timer {deadline, interval, id, std::move(fn)});
+    std::push_heap(mTimers.begin(), mTimers.end(), std::greater<> { });
+    bool earliest = mTimers.front().id == id;
+    if (earliest) {
+        // The sleeping thread should recompute its deadline
+        mCondition.notify_one();
+    }
+    lock.unlock();
+
+    if (!earliest) {
+        return id;
+    }
+    if (mExecutor) {
+        mExecutor->_addDeadline(this, deadline);
+        return id;
+    }
+
+#ifdef NEKO_WIN_DISPATCHER
+    BOOL ret = ::PostThreadMessageW(mThreadId, mWeakupMessage, 0, 0);
+    NEKO_ASSERT(ret);
+#endif
+    return id;
+}
+bool Thread::cancelTimer(TimerId id) {
+    std::lock_guard lock(mMutex);
+    if (id != 0 && id == mRunningTimer) {
+        mRunningCanceled = true;
+        return true;
+    }
+    auto iter = std::find_if(mTimers.begin(), mTimers.end(), [id](const Timer &timer) { return timer.id == id; });
+    if (iter == mTimers.end()) {
+        return false;
+    }
+    mTimers.erase(iter);
+    std::make_heap(mTimers.begin(), mTimers.end(), std::greater<> { });
+    return true;
+}
+size_t Thread::_dispatchTimers() {
+    size_t n = 0;
+    std::unique_lock lock(mMutex);
+    if (mTimers.empty()) {
+        return n;
+    }
+    auto now = Clock::now();
+    while (!mTimers.empty() && mTimers.front().deadline <= now) {
+        std::pop_heap(mTimers.begin(), mTimers.end(), std::greater<> { });
+        auto timer = std::move(mTimers.back());
+        mTimers.pop_back();
+        mRunningTimer = timer.id;
+        mRunningCanceled = false;
+        lock.unlock();
+
+        // Call timer
+        n += 1;
+        timer.task();
+
+        lock.lock();
+        mRunningTimer = 0;
+        if (timer.interval == Clock::duration::zero() || mRunningCanceled) {
+            continue;
+        }
+        timer.deadline += timer.interval;
+        if (timer.deadline <= now) {
+            // Too late, skip the missed ticks
+            timer.deadline = now + timer.interval;
+        }
+        mTimers.push_back(std::move(timer));
+        std::push_heap(mTimers.begin(), mTimers.end(), std::greater<> { });
+    }
+    return n;
+}
+void Thread::sendTask(Task &&fn) {
 #ifndef NEKO_NO_EXCEPTIONS
     std::exception_ptr exceptionPtr;
     std::latch latch {1};
@@ -147,11 +470,10 @@ void Thread::sendTask(std::function<void()> &&fn) {
 size_t Thread::dispatchTask() {
     _dispatchWin32();
 
-    size_t n = 0;
+    size_t n = _dispatchTimers();
     std::unique_lock lock(mMutex);
     while (!mQueue.empty()) {
-        auto fn = std::move(mQueue.front());
-        mQueue.pop();
+        auto fn = mQueue.pop();
         lock.unlock();
 
         // Call task
@@ -165,23 +487,37 @@ size_t Thread::dispatchTask() {
 size_t Thread::waitTask(int64_t timeoutMS) {
     _dispatchWin32();
 
-    size_t n = 0;
+    auto timeout = Clock::time_point::max();
+    if (timeoutMS != -1) {
+        timeout = Clock::now() + std::chrono::milliseconds(timeoutMS);
+    }
+    size_t n = _dispatchTimers();
     std::unique_lock lock(mMutex);
-    while (mQueue.empty()) {
-        if (timeoutMS != -1) {
-            if (mCondition.wait_for(lock, std::chrono::milliseconds(timeoutMS)) == std::cv_status::timeout) {
-                return n;
-            }
+    while (n == 0 && mQueue.empty() && !mWakeup) {
+        auto deadline = timeout;
+        if (!mTimers.empty()) {
+            deadline = std::min(deadline, mTimers.front().deadline);
         }
-        else {
+        if (deadline == Clock::time_point::max()) {
             mCondition.wait(lock);
+            continue;
+        }
+        if (Clock::now() < deadline && mCondition.wait_until(lock, deadline) == std::cv_status::no_timeout) {
+            continue;
+        }
+        // A timer is due or timeout
+        lock.unlock();
+        n += _dispatchTimers();
+        lock.lock();
+        if (n == 0 && Clock::now() >= timeout) {
+            return n;
         }
     }
+    mWakeup = false;
 
     // Do dispatch
     while (!mQueue.empty()) {
-        auto fn = std::move(mQueue.front());
-        mQueue.pop();
+        auto fn = mQueue.pop();
         lock.unlock();
 
         // Call task
@@ -210,8 +546,13 @@ Error Thread::usleep(int64_t us) noexcept {
     }
     std::unique_lock lock(current->mMutex);
     size_t numofTasks = current->mQueue.size();
-    current->mCondition.wait_for(lock, std::chrono::microseconds(us));
-    if (current->mQueue.size() == numofTasks) {
+    if (!current->mWakeup) {
+        current->mCondition.wait_for(lock, std::chrono::microseconds(us));
+    }
+    if (current->mWakeup) {
+        current->mWakeup = false;
+    }
+    else if (current->mQueue.size() == numofTasks) {
         return Error::Ok;
     }
     NEKO_LOG("sleep({}us) Interrupted at thread {}", us, current->name());
@@ -221,6 +562,313 @@ Error Thread::usleep(int64_t us) noexcept {
 Error Thread::msleep(int64_t ms) noexcept {
     return Thread::usleep(ms * 1000);
 }
+// Waiter
+static thread_local Waiter::AsyncScope *_currentScope = nullptr;
+
+Waiter::AsyncScope::AsyncScope(Task &&callback) : mCallback(std::move(callback)), mPrev(_currentScope) {
+    _currentScope = this;
+}
+Waiter::AsyncScope::~AsyncScope() {
+    _currentScope = mPrev;
+}
+Error Waiter::wait(int64_t timeoutMS) {
+    if (_currentScope && !_currentScope->mCallback.empty()) {
+        std::lock_guard lock(mMutex);
+        mWaiting = true;
+        if (mNotified.exchange(false)) {
+            mWaiting = false;
+            return Error::Ok;
+        }
+        mCallback = std::move(_currentScope->mCallback);
+        _currentScope->mArmed = true;
+        return Error::TemporarilyUnavailable;
+    }
+
+    auto current = Thread::currentThread();
+    std::unique_lock lock(mMutex);
+    mCallback.reset(); //< A blocking wait supersedes the armed one
+    mThread = current;
+    mWaiting = true; //< Pair with notify(), one of us must see the other
+    if (!current) {
+        if (timeoutMS != -1) {
+            mCondition.wait_for(lock, std::chrono::milliseconds(timeoutMS), [this]() { return mNotified.load(); });
+        }
+        else {
+            mCondition.wait(lock, [this]() { return mNotified.load(); });
+        }
+        mWaiting = false;
+        mThread = nullptr;
+        mNotified = false;
+        return Error::Ok;
+    }
+    lock.unlock();
+
+    // Sleep on the condition of current thread, so new task can interrupt us
+    Error err = Error::Ok;
+    std::unique_lock threadLock(current->mMutex);
+    size_t numofTasks = current->mQueue.size();
+    auto cond = [&, this]() {
+        return mNotified.load() || current->mWakeup || current->mQueue.size() != numofTasks;
+    };
+    if (timeoutMS != -1) {
+        current->mCondition.wait_for(threadLock, std::chrono::milliseconds(timeoutMS), cond);
+    }
+    else {
+        current->mCondition.wait(threadLock, cond);
+    }
+    if (current->mWakeup || current->mQueue.size() != numofTasks) {
+        NEKO_LOG("Waiter Interrupted at thread {}", current->name());
+        current->mWakeup = false;
+        err = Error::Interrupted;
+    }
+    threadLock.unlock();
+
+    lock.lock();
+    mWaiting = false;
+    mThread = nullptr;
+    mNotified = false;
+    return err;
+}
+void Waiter::notify() {
+    mNotified = true;
+    if (!mWaiting) {
+        return;
+    }
+    std::unique_lock lock(mMutex);
+    if (mCallback) {
+        // Armed by AsyncScope
+        auto callback = std::move(mCallback);
+        mWaiting = false;
+        mNotified = false;
+        lock.unlock();
+        callback();
+        return;
+    }
+    if (mThread) {
+        std::lock_guard threadLock(mThread->mMutex);
+        mThread->mCondition.notify_all();
+    }
+    else {
+        mCondition.notify_all();
+    }
+}
+
+// Executor
+static thread_local ExecutorPrivate *_currentExecutor = nullptr;
+static thread_local size_t           _currentWorker = 0;
+
+Executor::Executor(size_t n) : d(new ExecutorPrivate) {
+    if (n == 0) {
+        n = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    }
+    d->mNumOfWorkers = n;
+    d->mWorkers.reset(new ExecutorWorker[n]);
+    for (size_t i = 0; i < n; i++) {
+        d->mWorkers[i].mThread = std::thread(&Executor::_run, this, i);
+    }
+}
+Executor::~Executor() {
+    NEKO_ASSERT(d->mNumOfThreads == 0 && "All Threads must be freed before executor");
+
+    std::unique_lock lock(d->mMutex);
+    d->mRunning = false;
+    lock.unlock();
+    d->mCondition.notify_all();
+
+    for (size_t i = 0; i < d->mNumOfWorkers; i++) {
+        d->mWorkers[i].mThread.join();
+    }
+}
+Thread *Executor::allocThread() {
+    d->mNumOfThreads += 1;
+    return new Thread(this);
+}
+void Executor::freeThread(Thread *thread) {
+    if (!thread) {
+        return;
+    }
+    NEKO_ASSERT(thread->executor() == this);
+    delete thread;
+}
+size_t Executor::numOfWorkers() const noexcept {
+    return d->mNumOfWorkers;
+}
+void Executor::_schedule(Thread *thread) {
+    _enqueue(thread);
+    if (d->mSleeping > 0) {
+        std::lock_guard locker(d->mMutex);
+        d->mCondition.notify_one();
+    }
+}
+void Executor::_enqueue(Thread *thread) {
+    // Prefer the local queue if we are the worker of this executor
+    size_t idx = 0;
+    if (_currentExecutor == d.get()) {
+        idx = _currentWorker;
+    }
+    else {
+        idx = d->mNext.fetch_add(1, std::memory_order_relaxed) % d->mNumOfWorkers;
+    }
+    auto &worker = d->mWorkers[idx];
+    std::unique_lock lock(worker.mMutex);
+    worker.mQueue.push_back(thread);
+    lock.unlock();
+
+    d->mPending += 1;
+}
+void Executor::_addDeadline(Thread *thread, Thread::Clock::time_point deadline) {
+    std::lock_guard lock(d->mMutex);
+    for (const auto &[time, target] : d->mDeadlines) {
+        if (target == thread && time <= deadline) {
+            // Already wakeup it earlier, it adds the next one after the slice
+            return;
+        }
+    }
+    d->mDeadlines.emplace_back(deadline, thread);
+    std::push_heap(d->mDeadlines.begin(), d->mDeadlines.end(), std::greater<> { });
+    d->mHasDeadlines = true;
+    if (d->mDeadlines.front().second == thread) {
+        d->mCondition.notify_one();
+    }
+}
+void Executor::_removeDeadlines(Thread *thread) {
+    std::lock_guard lock(d->mMutex);
+    auto count = std::erase_if(d->mDeadlines, [thread](const auto &item) { return item.second == thread; });
+    if (count > 0) {
+        std::make_heap(d->mDeadlines.begin(), d->mDeadlines.end(), std::greater<> { });
+    }
+    d->mHasDeadlines = !d->mDeadlines.empty();
+}
+void Executor::_fireDeadlines() {
+    if (!d->mHasDeadlines.load(std::memory_order_relaxed)) {
+        return;
+    }
+    std::lock_guard lock(d->mMutex);
+    auto now = Thread::Clock::now();
+    bool scheduled = false;
+    while (!d->mDeadlines.empty() && d->mDeadlines.front().first <= now) {
+        std::pop_heap(d->mDeadlines.begin(), d->mDeadlines.end(), std::greater<> { });
+        auto thread = d->mDeadlines.back().second;
+        d->mDeadlines.pop_back();
+        // Still under the lock, the Thread can not be freed by ~Thread
+        if (!thread->mScheduled.exchange(true)) {
+            _enqueue(thread);
+            scheduled = true;
+        }
+    }
+    d->mHasDeadlines = !d->mDeadlines.empty();
+    if (scheduled && d->mSleeping > 0) {
+        d->mCondition.notify_one();
+    }
+}
+bool Executor::_pop(size_t idx, Thread **thread) {
+    // Local first
+    auto &local = d->mWorkers[idx];
+    std::unique_lock lock(local.mMutex);
+    if (!local.mQueue.empty()) {
+        *thread = local.mQueue.back();
+        local.mQueue.pop_back();
+        d->mPending -= 1;
+        return true;
+    }
+    lock.unlock();
+
+    // Steal from others
+    for (size_t i = 1; i < d->mNumOfWorkers; i++) {
+        auto &victim = d->mWorkers[(idx + i) % d->mNumOfWorkers];
+        std::lock_guard locker(victim.mMutex);
+        if (!victim.mQueue.empty()) {
+            *thread = victim.mQueue.front();
+            victim.mQueue.pop_front();
+            d->mPending -= 1;
+            return true;
+        }
+    }
+    return false;
+}
+void Executor::_run(size_t idx) {
+    NEKO_SetThreadName("NekoExecutor");
+    _currentExecutor = d.get();
+    _currentWorker = idx;
+
+    Thread *thread = nullptr;
+    while (true) {
+        if (_pop(idx, &thread)) {
+            thread->_runSlice();
+            _fireDeadlines();
+            continue;
+        }
+        std::unique_lock lock(d->mMutex);
+        d->mSleeping += 1;
+        while (d->mRunning && d->mPending == 0) {
+            if (d->mDeadlines.empty()) {
+                d->mCondition.wait(lock);
+            }
+            else if (d->mDeadlines.front().first <= Thread::Clock::now()) {
+                break;
+            }
+            else {
+                d->mCondition.wait_until(lock, d->mDeadlines.front().first);
+            }
+        }
+        d->mSleeping -= 1;
+        if (!d->mRunning) {
+            break;
+        }
+        lock.unlock();
+        _fireDeadlines();
+    }
+}
+Executor *Executor::shared() {
+    static Executor executor;
+    return &executor;
+}
+
+SliceRunner::SliceRunner(size_t numOfThreads) {
+    setNumOfThreads(numOfThreads);
+}
+SliceRunner::~SliceRunner() = default;
+
+void SliceRunner::setNumOfThreads(size_t numOfThreads) {
+    if (numOfThreads == 0) {
+        numOfThreads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    }
+    while (mWorkers.size() + 1 > numOfThreads) {
+        mWorkers.pop_back();
+    }
+    while (mWorkers.size() + 1 < numOfThreads) {
+        auto worker = std::make_unique<Thread>();
+        worker->setName("NekoSliceThread");
+        mWorkers.emplace_back(std::move(worker));
+    }
+}
+void SliceRunner::_run(size_t numOfSlices, void (*fn)(void *, size_t), void *arg) {
+    auto numOfWorkers = std::min(mWorkers.size(), numOfSlices > 0 ? numOfSlices - 1 : 0);
+    if (numOfWorkers == 0) {
+        for (size_t slice = 0; slice < numOfSlices; slice++) {
+            fn(arg, slice);
+        }
+        return;
+    }
+    // Take the slice by a counter, so a slow thread does not hold others
+    Atomic<size_t> next {0};
+    std::latch done {ptrdiff_t(numOfWorkers)};
+    auto work = [&]() {
+        for (auto slice = next.fetch_add(1, std::memory_order_relaxed); slice < numOfSlices; 
+                  slice = next.fetch_add(1, std::memory_order_relaxed)) {
+            fn(arg, slice);
+        }
+    };
+    for (size_t n = 0; n < numOfWorkers; n++) {
+        mWorkers[n]->postTask([&]() {
+            work();
+            done.count_down();
+        });
+    }
+    work();
+    done.wait();
+}
+
 #ifdef NEKO_WIN_DISPATCHER
 void Thread::_dispatchWin32() {
     ::MSG msg;
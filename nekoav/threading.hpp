@@ -1,12 +1,15 @@
 #pragma once
 
 #include "defs.hpp"
+#include "detail/queue.hpp"
 
 #include <condition_variable>
+#include <type_traits>
 #include <functional>
+#include <chrono>
 #include <thread>
 #include <string>
-#include <queue>
+#include <vector>
 #include <mutex>
 
 // #ifdef _WIN32
@@ -15,6 +18,10 @@
 
 NEKO_NS_BEGIN
 
+class ExecutorPrivate;
+class Executor;
+class Waiter;
+
 /**
  * @brief ThreadPriority
  * 
@@ -28,12 +35,214 @@ enum class ThreadPriority {
     RealTime
 };
 
+/**
+ * @brief The scheduling policy of ThreadPolicy
+ * 
+ */
+enum class SchedulePolicy {
+    Normal,     //< Time sharing, ordered by the nice level
+    Fifo,       //< Real time, run until it blocks or a higher one comes
+    RoundRobin, //< Real time, with time slice among the same priority
+};
+
+/**
+ * @brief The scheduling settings of a thread
+ * @details A real time policy needs the permission (CAP_SYS_NICE or RLIMIT_RTPRIO on Linux), 
+ * if it is denied, the thread falls back to Normal with the nice level
+ * 
+ */
+class ThreadPolicy {
+public:
+    SchedulePolicy policy   = SchedulePolicy::Normal;
+    int            priority = 0; //< Real time priority (1 ~ 99) for Fifo / RoundRobin
+    int            nice     = 0; //< Nice level (-20 ~ 19) for Normal and the fallback, lower is more favorable
+    uint64_t       affinity = 0; //< CPU mask, bit n for core n, 0 on all cores
+
+    /**
+     * @brief Get the policy of ThreadPriority
+     * 
+     * @param priority 
+     * @return ThreadPolicy 
+     */
+    static ThreadPolicy fromPriority(ThreadPriority priority) noexcept;
+};
+
+/**
+ * @brief The thread roles used by ThreadPolicyTable
+ * 
+ */
+enum class ThreadRole {
+    Demuxer,   //< Read and demux the source
+    Decoder,   //< The queue thread driving the decoders
+    AudioSink, //< The audio device callback
+    VideoSink, //< Present frames
+    NumberOfRoles,
+};
+
+/**
+ * @brief The policies of threads by role, the Pipeline puts it into the Context, 
+ * elements apply it to their threads at initialize
+ * 
+ */
+class NEKO_API ThreadPolicyTable {
+public:
+    /**
+     * @brief Set the Policy of the role
+     * 
+     * @param role 
+     * @param policy 
+     */
+    void  setPolicy(ThreadRole role, const ThreadPolicy &policy);
+    /**
+     * @brief Remove the policy of the role, its threads keep the default settings
+     * 
+     * @param role 
+     */
+    void  resetPolicy(ThreadRole role);
+    /**
+     * @brief Apply the policy of the role
+     * 
+     * @param role 
+     * @param thread The Thread (nullptr on the calling OS thread, like the audio device callback)
+     * @return Ok on no policy for this role, see Thread::setPolicy()
+     */
+    Error apply(ThreadRole role, Thread *thread = nullptr) const;
+
+    /**
+     * @brief Preset, the audio callback runs with Fifo alone on the core, others avoid it
+     * 
+     * @param core The index of the core for audio
+     * @return ThreadPolicyTable 
+     */
+    static ThreadPolicyTable isolatedAudio(int core);
+private:
+    ThreadPolicy mPolicies[size_t(ThreadRole::NumberOfRoles)];
+    bool         mHas[size_t(ThreadRole::NumberOfRoles)] = { };
+};
+
+/**
+ * @brief A move-only void() callable with small buffer, used as the task of Thread
+ * @details Callables up to InlineSize bytes (a lambda with a few captures, std::bind, std::function) are stored inline,
+ * so building a Task does not allocate, only the larger one fallback to the heap
+ * 
+ */
+class Task {
+public:
+    static constexpr size_t InlineSize = 6 * sizeof(void*);
+
+    Task() = default;
+    Task(const Task &) = delete;
+    Task(Task &&other) noexcept {
+        _moveFrom(other);
+    }
+    template <typename Callable, 
+              typename _Cond = std::enable_if_t<!std::is_same_v<std::decay_t<Callable>, Task> >
+    >
+    Task(Callable &&callable) {
+        using Fn = std::decay_t<Callable>;
+        if constexpr (IsInline<Fn>) {
+            new (mStorage) Fn(std::forward<Callable>(callable));
+            mOps = &InlineOps<Fn>;
+        }
+        else {
+            auto mem = libc::malloc(sizeof(Fn), AllocCategory::Thread);
+            *reinterpret_cast<Fn**>(mStorage) = new (mem) Fn(std::forward<Callable>(callable));
+            mOps = &HeapOps<Fn>;
+        }
+    }
+    ~Task() {
+        reset();
+    }
+
+    Task &operator =(Task &&other) noexcept {
+        if (this != &other) {
+            reset();
+            _moveFrom(other);
+        }
+        return *this;
+    }
+    void operator ()() {
+        NEKO_ASSERT(mOps);
+        mOps->invoke(mStorage);
+    }
+    /**
+     * @brief Destroy the callable, make it empty
+     * 
+     */
+    void reset() noexcept {
+        if (mOps) {
+            mOps->destroy(mStorage);
+            mOps = nullptr;
+        }
+    }
+    bool empty() const noexcept {
+        return mOps == nullptr;
+    }
+    explicit operator bool() const noexcept {
+        return mOps != nullptr;
+    }
+private:
+    struct Ops {
+        void (*invoke)(void *self);
+        void (*move)(void *dst, void *src) noexcept; //< Move src to dst and destroy src
+        void (*destroy)(void *self) noexcept;
+    };
+
+    template <typename Fn>
+    static constexpr bool IsInline = sizeof(Fn) <= InlineSize && 
+                                     alignof(std::max_align_t) % alignof(Fn) == 0 &&
+                                     std::is_nothrow_move_constructible_v<Fn>;
+
+    template <typename Fn>
+    static constexpr Ops InlineOps {
+        [](void *self) { 
+            (*static_cast<Fn*>(self))(); 
+        },
+        [](void *dst, void *src) noexcept {
+            new (dst) Fn(std::move(*static_cast<Fn*>(src)));
+            static_cast<Fn*>(src)->~Fn();
+        },
+        [](void *self) noexcept { 
+            static_cast<Fn*>(self)->~Fn(); 
+        }
+    };
+    template <typename Fn>
+    static constexpr Ops HeapOps {
+        [](void *self) { 
+            (**static_cast<Fn**>(self))(); 
+        },
+        [](void *dst, void *src) noexcept {
+            *static_cast<Fn**>(dst) = *static_cast<Fn**>(src);
+        },
+        [](void *self) noexcept {
+            auto fn = *static_cast<Fn**>(self);
+            fn->~Fn();
+            libc::free(fn);
+        }
+    };
+
+    void _moveFrom(Task &other) noexcept {
+        if (other.mOps) {
+            other.mOps->move(mStorage, other.mStorage);
+            mOps = other.mOps;
+            other.mOps = nullptr;
+        }
+    }
+
+    alignas(std::max_align_t) uint8_t mStorage[InlineSize];
+    const Ops                        *mOps = nullptr;
+};
+
 /**
  * @brief Thread with callback queue
+ * @details A Thread allocated by Executor has no OS thread, its tasks are executed by the workers of the executor one by one
  * 
  */
 class NEKO_API Thread {
 public:
+    using Clock   = std::chrono::steady_clock;
+    using TimerId = uint64_t;
+
     Thread();
     Thread(const Thread &) = delete;
     ~Thread();
@@ -50,11 +259,19 @@ public:
      */
     void setName(std::string_view name);
     /**
-     * @brief Set the Priority of the thread
+     * @brief Set the Priority of the thread, same as setPolicy(ThreadPolicy::fromPriority(priority))
      * 
      * @param priority 
      */
     void setPriority(ThreadPriority priority);
+    /**
+     * @brief Set the scheduling policy and CPU affinity of the thread
+     * 
+     * @param policy 
+     * @return Ok, PermissionDenied on real time denied (the nice level fallback applied) or nice level denied,
+     * InvalidState on the thread of executor (the workers are shared)
+     */
+    Error setPolicy(const ThreadPolicy &policy);
     /**
      * @brief Poll task from the queue and execute it
      * 
@@ -76,14 +293,64 @@ public:
      * 
      * @param func the callable function
      */
-    void sendTask(std::function<void()> &&func);
+    void sendTask(Task &&func);
     /**
      * @brief Send a task into queue and return
-     * @details It will block the thread
+     * @details The queue is a ring that never shrinks, so it does not allocate in steady state
      * 
      * @param func the callable function
      */
-    void postTask(std::function<void()> &&func);
+    void postTask(Task &&func);
+    /**
+     * @brief Wakeup the thread without a task
+     * @details The pending or next waitTask() returns, msleep() / usleep() at this thread returns Interrupted
+     * 
+     */
+    void wakeup();
+    /**
+     * @brief Post a task executed at the deadline
+     * @details Timers are kept in a heap, the thread sleeps until the earliest one instead of polling.
+     * They run between tasks, so a task blocking the thread delays them
+     * 
+     * @param task the callable function
+     * @param deadline 
+     * @return TimerId for cancelTimer()
+     */
+    TimerId postAt(Task &&task, Clock::time_point deadline);
+    /**
+     * @brief Post a task executed after the delay
+     * 
+     * @param task the callable function
+     * @param delay 
+     * @return TimerId for cancelTimer()
+     */
+    template <typename Rep, typename Period>
+    TimerId postDelayed(Task &&task, std::chrono::duration<Rep, Period> delay) {
+        return postAt(std::move(task), Clock::now() + std::chrono::ceil<Clock::duration>(delay));
+    }
+    /**
+     * @brief Start a periodic timer, the first tick is after one interval
+     * @details The ticks missed by a busy thread are skipped, not run in a burst
+     * 
+     * @param task the callable function, invoked on every tick
+     * @param interval 
+     * @return TimerId for cancelTimer()
+     */
+    template <typename Rep, typename Period>
+    TimerId startTimer(Task &&task, std::chrono::duration<Rep, Period> interval) {
+        auto duration = std::chrono::ceil<Clock::duration>(interval);
+        NEKO_ASSERT(duration > Clock::duration::zero());
+        return _addTimer(std::move(task), Clock::now() + duration, duration);
+    }
+    /**
+     * @brief Cancel a timer from postAt(), postDelayed() or startTimer()
+     * @note A periodic timer can cancel itself in its task
+     * 
+     * @param id 
+     * @return true 
+     * @return false The timer was fired or not found
+     */
+    bool    cancelTimer(TimerId id);
     /**
      * @brief Wrap a callable and args and send it to the queue, wait for it done
      * @note If you throw an exception at callback, The exception will be rethrow to the caller
@@ -111,9 +378,17 @@ public:
      * @return std::string_view 
      */
     std::string_view name() const noexcept;
+    /**
+     * @brief Get the executor of this thread
+     * 
+     * @return Executor* (nullptr on it own a OS thread)
+     */
+    Executor        *executor() const noexcept {
+        return mExecutor;
+    }
     
     void *operator new(size_t size) {
-        return libc::malloc(size);
+        return libc::malloc(size, AllocCategory::Thread);
     }
     void operator delete(void *ptr) {
         return libc::free(ptr);
@@ -139,14 +414,47 @@ public:
      * @return Ok by default, Interrupted on a new task that has arrived to the current thread
      */
     static Error usleep(int64_t microseconds) noexcept;
+    /**
+     * @brief Set the scheduling policy and CPU affinity of the calling OS thread, for threads not owned by us
+     * 
+     * @param policy 
+     * @return Error same as setPolicy()
+     */
+    static Error setCurrentPolicy(const ThreadPolicy &policy) noexcept;
 private:
-    void _run(void *latch);
-    void _dispatchWin32();
+    explicit Thread(Executor *executor);
+
+    struct Timer {
+        Clock::time_point deadline;
+        Clock::duration   interval; //< Zero on one-shot
+        TimerId           id;
+        Task              task;
+
+        bool operator >(const Timer &other) const noexcept {
+            return deadline != other.deadline ? deadline > other.deadline : id > other.id;
+        }
+    };
+
+    void    _run(void *latch);
+    void    _runSlice();
+    void    _dispatchWin32();
+    size_t  _dispatchTimers();
+    TimerId _addTimer(Task &&task, Clock::time_point deadline, Clock::duration interval);
 
     Atomic<bool> mIdle {true};
     Atomic<bool> mRunning {true};
 
-    std::queue<std::function<void()>> mQueue;
+    // For Executor
+    Executor     *mExecutor = nullptr;
+    Atomic<bool>  mScheduled {false}; //< Is in the executor's queue or running
+    std::latch   *mQuitLatch = nullptr;
+
+    RingBuffer<Task>                  mQueue;
+    bool                              mWakeup = false; //< Wakeup requested, consumed by the waiter
+    std::vector<Timer>                mTimers; //< Min heap by deadline
+    TimerId                           mTimerId = 0;
+    TimerId                           mRunningTimer = 0; //< The timer invoking, cancelTimer() on it stops the periodic one
+    bool                              mRunningCanceled = false;
     std::mutex                        mMutex;
     std::string                       mName {"NekoWorkThread"};
     std::condition_variable           mCondition;
@@ -157,6 +465,188 @@ private:
     uint32_t                          mWeakupMessage = 0;
 #endif
 
+friend class Executor;
+friend class Waiter;
+};
+
+/**
+ * @brief Wait until notified by other thread, but it will be interrupted if new task comming like Thread::msleep()
+ * @details Used for backpressure, the producer waits on it when the queue is full, 
+ * the consumer calls notify() as soon as space frees up, flush and state changes call notify() too.
+ * notify() is a atomic store and load when nobody is waiting, so it is cheap to call it per item.
+ * @note Only one thread can wait on it at the same time
+ * 
+ */
+class NEKO_API Waiter {
+public:
+    /**
+     * @brief In this scope, the first wait() at this thread does not block, 
+     * it keeps the callback and returns TemporarilyUnavailable, notify() invokes the callback later
+     * @details For coroutines, the callback resumes the suspended one instead of blocking the worker
+     * 
+     */
+    class NEKO_API AsyncScope {
+    public:
+        explicit AsyncScope(Task &&callback);
+        AsyncScope(const AsyncScope &) = delete;
+        ~AsyncScope();
+
+        /**
+         * @brief Check a wait() in this scope has taken the callback
+         * 
+         * @return true 
+         * @return false 
+         */
+        bool armed() const noexcept {
+            return mArmed;
+        }
+    private:
+        Task        mCallback;
+        AsyncScope *mPrev = nullptr;
+        bool        mArmed = false;
+
+    friend class Waiter;
+    };
+
+    Waiter() = default;
+    Waiter(const Waiter &) = delete;
+    ~Waiter() = default;
+
+    /**
+     * @brief Wait for notify(), return at once if it was notified after the last wait
+     * @note The caller should check its condition again after it returns, the notification may be a stale one
+     * 
+     * @param timeout timeout in millseconds (-1 on infinite)
+     * @return Ok on notified or timeout, Interrupted on a new task or wakeup arrived to the current thread, 
+     * TemporarilyUnavailable on the callback of AsyncScope was taken, the caller should return
+     */
+    Error wait(int64_t timeout = -1);
+    /**
+     * @brief Wakeup the waiter
+     * 
+     */
+    void  notify();
+private:
+    Atomic<bool>            mNotified {false};
+    Atomic<bool>            mWaiting {false};
+    Thread                 *mThread = nullptr; //< The Thread of waiter, protected by mMutex
+    Task                    mCallback; //< From AsyncScope, protected by mMutex
+    std::mutex              mMutex;
+    std::condition_variable mCondition; //< For waiter without Thread
+};
+
+/**
+ * @brief A work-stealing thread pool, run many Threads on a fixed number of OS threads
+ * @details Each worker has its own deque, it steals from others when empty. 
+ * It is suitable for event driven element (which onLoop() return NoImpl), 
+ * a blocking loop will occupy a worker until it returns
+ * 
+ */
+class NEKO_API Executor {
+public:
+    /**
+     * @brief Construct a new Executor object
+     * 
+     * @param numOfWorkers The number of workers (0 on hardware concurrency)
+     */
+    explicit Executor(size_t numOfWorkers = 0);
+    Executor(const Executor &) = delete;
+    ~Executor();
+
+    /**
+     * @brief Alloc a Thread scheduled on this executor
+     * 
+     * @return Thread* 
+     */
+    Thread *allocThread();
+    /**
+     * @brief Free the Thread, same as delete thread
+     * 
+     * @param thread 
+     */
+    void    freeThread(Thread *thread);
+    /**
+     * @brief Get the number of worker
+     * 
+     * @return size_t 
+     */
+    size_t  numOfWorkers() const noexcept;
+
+    void *operator new(size_t size) {
+        return libc::malloc(size, AllocCategory::Thread);
+    }
+    void operator delete(void *ptr) {
+        return libc::free(ptr);
+    }
+
+    /**
+     * @brief Get the process wide executor, created at first call
+     * 
+     * @return Executor* 
+     */
+    static Executor *shared();
+private:
+    void _schedule(Thread *thread);
+    void _enqueue(Thread *thread);
+    void _run(size_t index);
+    bool _pop(size_t index, Thread **thread);
+    void _addDeadline(Thread *thread, Thread::Clock::time_point deadline);
+    void _removeDeadlines(Thread *thread);
+    void _fireDeadlines();
+
+    Box<ExecutorPrivate> d;
+
+friend class Thread;
+};
+
+/**
+ * @brief Run a job split into slices (like the rows of a frame) on a group of threads, for the per frame work of elements
+ * @details The caller works on the slices too, the workers take the slices one by one until all taken, 
+ * run() returns after all slices done. It does not allocate on run().
+ * 
+ */
+class NEKO_API SliceRunner {
+public:
+    /**
+     * @brief Construct a new SliceRunner object
+     * 
+     * @param numOfThreads The number of threads including the caller (0 on hardware concurrency)
+     */
+    explicit SliceRunner(size_t numOfThreads = 1);
+    SliceRunner(const SliceRunner &) = delete;
+    ~SliceRunner();
+
+    /**
+     * @brief Set the number of threads, the workers are created or destroyed here, do not call it in run()
+     * 
+     * @param numOfThreads The number of threads including the caller (0 on hardware concurrency)
+     */
+    void   setNumOfThreads(size_t numOfThreads);
+    /**
+     * @brief Get the number of threads, including the caller
+     * 
+     * @return size_t 
+     */
+    size_t numOfThreads() const noexcept {
+        return mWorkers.size() + 1;
+    }
+    /**
+     * @brief Invoke callable(slice) for every slice in [0, numOfSlices), wait for all done
+     * @note The callable should not throw
+     * 
+     * @tparam Callable void(size_t slice)
+     * @param numOfSlices 
+     * @param callable 
+     */
+    template <typename Callable>
+    void   run(size_t numOfSlices, Callable &&callable) {
+        using Fn = std::remove_reference_t<Callable>;
+        _run(numOfSlices, [](void *fn, size_t slice) { (*static_cast<Fn*>(fn))(slice); }, const_cast<void*>(static_cast<const void*>(&callable)));
+    }
+private:
+    void _run(size_t numOfSlices, void (*fn)(void *, size_t), void *arg);
+
+    std::vector<Box<Thread> > mWorkers;
 };
 
 // -- IMPL
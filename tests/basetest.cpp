@@ -1,10 +1,12 @@
 #include <gtest/gtest.h>
 #include "../nekoav/detail/tracer.hpp"
 #include "../nekoav/detail/base.hpp"
+#include "../nekoav/elements/mediaqueue.hpp"
 #include "../nekoav/elements/appsrc.hpp"
 #include "../nekoav/resource.hpp"
 #include "../nekoav/factory.hpp"
 #include "../nekoav/context.hpp"
+#include "../nekoav/threading.hpp"
 
 using namespace NEKO_NAMESPACE;
 
@@ -58,6 +60,198 @@ TEST(Base_ABIV1, ABIV1) {
     appsrc->setState(State::Null);
 }
 
+TEST(Base_ABIV1, Executor) {
+    class TestClass final : public ExecutorImpl<Element> {
+    public:
+        TestClass(Atomic<int> &count) : mCount(count) {
+            addInput("sink");
+        }
+        Error onSinkPush(View<Pad> pad, View<Resource> resourceView) override {
+            if (!isWorkThread()) {
+                return invokeMethodQueued(&TestClass::onSinkPush, this, pad, resourceView);
+            }
+            EXPECT_NE(thread()->executor(), nullptr);
+            mCount += 1;
+            return Error::Ok;
+        }
+    private:
+        Atomic<int> &mCount;
+    };
+    class Data final : public Resource {
+
+    };
+
+    // Many elements on 2 workers
+    Executor executor(2);
+    Context ctxt;
+    ctxt.addObjectView<Executor>(&executor);
+
+    Atomic<int> count {0};
+    Vec<Arc<AppSource> > sources;
+    Vec<Arc<TestClass> > elements;
+    for (int i = 0; i < 64; i++) {
+        auto appsrc = GetElementFactory()->createElement<AppSource>();
+        auto elem = std::make_shared<TestClass>(count);
+        elem->setContext(&ctxt);
+        ASSERT_EQ(LinkElements(appsrc, elem), Error::Ok);
+        elem->setState(State::Running);
+        appsrc->setState(State::Running);
+
+        sources.push_back(appsrc);
+        elements.push_back(elem);
+    }
+    auto data = std::make_shared<Data>();
+    for (int n = 0; n < 10; n++) {
+        for (auto &appsrc : sources) {
+            appsrc->push(data);
+        }
+    }
+    ASSERT_EQ(count.load(), 64 * 10);
+
+    for (int i = 0; i < 64; i++) {
+        elements[i]->setState(State::Null);
+        sources[i]->setState(State::Null);
+    }
+}
+
+TEST(Base_ABIV1, ExecutorThreadLifetime) {
+    // Each task posts the next one and arms a timer, the Thread is freed in the middle of it
+    struct Spinner {
+        Thread         *thread;
+        Atomic<size_t> *count;
+        int             left;
+
+        void operator()() {
+            *count += 1;
+            if (--left <= 0) {
+                return;
+            }
+            thread->postTask(Spinner {thread, count, left});
+            thread->postDelayed(Spinner {thread, count, left / 2}, std::chrono::milliseconds(left % 3));
+        }
+    };
+    Executor executor(4);
+    Atomic<size_t> count {0};
+    for (int round = 0; round < 100; round++) {
+        Vec<Thread*> threads;
+        for (int i = 0; i < 8; i++) {
+            threads.push_back(executor.allocThread());
+        }
+        for (auto thread : threads) {
+            thread->postTask(Spinner {thread, &count, 16});
+            thread->postDelayed(Spinner {thread, &count, 4}, std::chrono::milliseconds(1));
+        }
+        for (auto thread : threads) {
+            thread->postTask([&count]() { count += 1; });
+            executor.freeThread(thread);
+        }
+    }
+    ASSERT_GT(count.load(), 0);
+}
+
+static void RunCoroutineProducer(MediaQueue::Mode mode, size_t capacity) {
+    class Data final : public Resource {
+    public:
+        Data(int v) : value(v) { }
+        int value;
+    };
+    class Producer final : public CoroutineImpl<Element> {
+    public:
+        Producer(int count) : mCount(count) {
+            mSrc = addOutput("src");
+        }
+        CoLoop onAsyncLoop() override {
+            int n = 0;
+            while (!stopRequested()) {
+                if (loopState() != State::Running) {
+                    co_await waitStateChange();
+                    continue;
+                }
+                if (n == mCount) {
+                    // Wait the event from main
+                    auto event = co_await waitEvent();
+                    if (event) {
+                        numOfEvents += 1;
+                    }
+                    continue;
+                }
+                EXPECT_NE(thread()->executor(), nullptr);
+                if (n % 100 == 0) {
+                    EXPECT_EQ(co_await sleepFor(1), Error::Ok);
+                }
+                auto err = co_await pushAsync(mSrc, make_shared<Data>(n));
+                EXPECT_EQ(err, Error::Ok);
+                n += 1;
+            }
+            co_return Error::Ok;
+        }
+
+        Atomic<int> numOfEvents {0};
+    private:
+        Pad *mSrc;
+        int  mCount;
+    };
+    class Sink final : public Impl<Element> {
+    public:
+        Sink() {
+            addInput("sink");
+        }
+        Error onSinkPush(View<Pad> pad, View<Resource> resource) override {
+            EXPECT_EQ(resource.viewAs<Data>()->value, count.load());
+            // The queue drains on the executor of the context too
+            EXPECT_NE(Thread::currentThread()->executor(), nullptr);
+            count += 1;
+            return Error::Ok;
+        }
+
+        Atomic<int> count {0};
+    };
+
+    // Producer is suspended by the full queue instead of blocking the only worker
+    Executor executor(1);
+    Context ctxt;
+    ctxt.addObjectView<Executor>(&executor);
+
+    auto producer = std::make_shared<Producer>(1000);
+    auto queue = GetElementFactory()->createElement<MediaQueue>();
+    auto sink = std::make_shared<Sink>();
+    producer->setContext(&ctxt);
+    queue->setContext(&ctxt);
+    sink->setContext(&ctxt);
+    ASSERT_EQ(queue->setMode(mode), Error::Ok);
+    queue->setCapacity(capacity);
+    ASSERT_EQ(LinkElements(producer, queue, sink), Error::Ok);
+
+    sink->setState(State::Running);
+    queue->setState(State::Running);
+    producer->setState(State::Running);
+
+    while (sink->count != 1000) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    View<Element>(producer)->sendEvent(make_shared<Event>(Event::User, nullptr));
+    while (producer->numOfEvents != 1) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    // Pause and resume
+    producer->setState(State::Paused);
+    producer->setState(State::Running);
+
+    producer->setState(State::Null);
+    queue->setState(State::Null);
+    sink->setState(State::Null);
+}
+
+TEST(Base_ABIV1, Coroutine) {
+    RunCoroutineProducer(MediaQueue::Locked, 2);
+}
+
+TEST(Base_ABIV1, CoroutineLockFree) {
+    // The ring is full on every push, the suspended producer must be resumed and lose nothing
+    RunCoroutineProducer(MediaQueue::LockFree, 1);
+}
+
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
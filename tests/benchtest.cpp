@@ -0,0 +1,866 @@
+#include "../nekoav/elements/mediaqueue.hpp"
+#include "../nekoav/elements/demuxer.hpp"
+#include "../nekoav/elements/appsrc.hpp"
+#include "../nekoav/elements/appsink.hpp"
+#include "../nekoav/detail/template.hpp"
+#include "../nekoav/media/blend.hpp"
+#include "../nekoav/media/colorcvt.hpp"
+#include "../nekoav/media/convolve.hpp"
+#include "../nekoav/allocator.hpp"
+#include "../nekoav/cpu.hpp"
+#include "../nekoav/event.hpp"
+#include "../nekoav/factory.hpp"
+#include "../nekoav/media.hpp"
+#include "../nekoav/threading.hpp"
+#include "../nekoav/pad.hpp"
+#include "../nekoav/property.hpp"
+#include "../nekoav/format.hpp"
+
+#if __has_include(<libswscale/swscale.h>)
+extern "C" {
+    #include <libswscale/swscale.h>
+    #include <libavutil/frame.h>
+}
+    #define HAVE_SWSCALE
+#endif
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <thread>
+#include <vector>
+
+using namespace NEKO_NAMESPACE;
+
+/**
+ * @brief Get seconds costed by the callable
+ * 
+ */
+template <typename Callable>
+static double Measure(Callable &&callable) {
+    auto start = std::chrono::steady_clock::now();
+    callable();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(end - start).count();
+}
+
+class BenchPacket final : public MediaPacket {
+public:
+    int64_t size() const override {
+        return 0;
+    }
+    void *data() const override {
+        return nullptr;
+    }
+    double duration() const override {
+        return 0.0;
+    }
+    double timestamp() const override {
+        return 0.0;
+    }
+};
+class CountSink final : public Template::GetImpl<Element> {
+public:
+    CountSink() {
+        addInput("sink")->setCallback([this](View<Resource>) {
+            mCount.fetch_add(1, std::memory_order_relaxed);
+            return Error::Ok;
+        });
+    }
+    size_t count() const noexcept {
+        return mCount.load(std::memory_order_relaxed);
+    }
+private:
+    Atomic<size_t> mCount {0};
+};
+
+// MediaQueue throughput, Locked vs LockFree
+static void BenchMediaQueue(MediaQueue::Mode mode, const char *name, size_t numOfItems) {
+    auto src = CreateElement<AppSource>();
+    auto queue = CreateElement<MediaQueue>();
+    auto sink = make_shared<CountSink>();
+    queue->setMode(mode);
+
+    LinkElements(src, queue, sink);
+    sink->setState(State::Running);
+    queue->setState(State::Running);
+    src->setState(State::Running);
+
+    auto packet = make_shared<BenchPacket>();
+    auto seconds = Measure([&]() {
+        for (size_t n = 0; n < numOfItems; n++) {
+            src->push(packet);
+        }
+        while (sink->count() != numOfItems) {
+            std::this_thread::yield();
+        }
+    });
+    ::printf("MediaQueue %-8s: %zu items in %.3f s, %.0f items/s\n", name, numOfItems, seconds, numOfItems / seconds);
+
+    src->setState(State::Null);
+    queue->setState(State::Null);
+    sink->setState(State::Null);
+}
+
+class StampPacket final : public MediaPacket {
+public:
+    int64_t size() const override {
+        return 0;
+    }
+    void *data() const override {
+        return nullptr;
+    }
+    double duration() const override {
+        return 0.0;
+    }
+    double timestamp() const override {
+        return 0.0;
+    }
+
+    std::chrono::steady_clock::time_point pushed;
+};
+class LatencySink final : public Template::GetImpl<Element> {
+public:
+    LatencySink() {
+        addInput("sink")->setCallback([this](View<Resource> resource) {
+            auto now = std::chrono::steady_clock::now();
+            auto delay = std::chrono::duration<double, std::micro>(now - resource.viewAs<StampPacket>()->pushed).count();
+            mTotal += delay;
+            mMax = std::max(mMax, delay);
+
+            // Simulate the work of consumer
+            while (std::chrono::steady_clock::now() - now < std::chrono::microseconds(50)) { }
+            mCount.fetch_add(1, std::memory_order_release);
+            return Error::Ok;
+        });
+    }
+    size_t count() const noexcept {
+        return mCount.load(std::memory_order_acquire);
+    }
+    double mTotal = 0.0;
+    double mMax = 0.0;
+private:
+    Atomic<size_t> mCount {0};
+};
+
+// Queue-hop delay from push to the consumer, the producer is blocked by a small capacity (interval 0),
+// or paced at the interval (longer than the consumer work), so the queue is mostly empty and the consumer sleeping
+static void BenchQueueLatency(MediaQueue::Mode mode, const char *name, size_t numOfItems, int64_t intervalUs = 0) {
+    auto src = CreateElement<AppSource>();
+    auto queue = CreateElement<MediaQueue>();
+    auto sink = make_shared<LatencySink>();
+    queue->setMode(mode);
+    queue->setCapacity(4);
+
+    LinkElements(src, queue, sink);
+    sink->setState(State::Running);
+    queue->setState(State::Running);
+    src->setState(State::Running);
+
+    // Producer on a element thread like the demuxer
+    Thread producer;
+    auto seconds = Measure([&]() {
+        producer.postTask([&]() {
+            auto start = std::chrono::steady_clock::now();
+            for (size_t n = 0; n < numOfItems; n++) {
+                // Sleep instead of spin, so the consumer is not starved on a few cores, the stamp is taken after it
+                if (intervalUs) {
+                    std::this_thread::sleep_until(start + std::chrono::microseconds(intervalUs * int64_t(n)));
+                }
+                auto packet = make_shared<StampPacket>();
+                packet->pushed = std::chrono::steady_clock::now();
+                src->push(packet);
+            }
+        });
+        while (sink->count() != numOfItems) {
+            std::this_thread::yield();
+        }
+    });
+    ::printf("MediaQueue %-8s hop (%s): avg %.1f us, max %.1f us, %zu items in %.3f s (consumer work %.3f s)\n", 
+        name, intervalUs ? "paced" : "saturated", sink->mTotal / numOfItems, sink->mMax, numOfItems, seconds, numOfItems * 50e-6
+    );
+    producer.sendTask([]() { });
+
+    src->setState(State::Null);
+    queue->setState(State::Null);
+    sink->setState(State::Null);
+}
+
+// Pad::push through a 5 elements chain, std::function + dynamic_cast vs the negotiated typed call
+class ChainElement final : public Template::GetImpl<Element> {
+public:
+    ChainElement(bool typed, bool hasInput, bool hasOutput) {
+        if (hasOutput) {
+            mSrc = addOutput("src");
+            if (typed) {
+                mSrc->setResourceType<BenchPacket, MediaPacket>();
+            }
+        }
+        if (!hasInput) {
+            return;
+        }
+        auto sink = addInput("sink");
+        if (typed) {
+            sink->setTypedCallback<MediaPacket, &ChainElement::process>(this);
+        }
+        else {
+            sink->setCallback([this](View<Resource> resourceView) {
+                auto packet = resourceView.viewAs<MediaPacket>();
+                if (!packet) {
+                    return Error::UnsupportedResource;
+                }
+                return process(packet);
+            });
+        }
+    }
+    Error process(View<MediaPacket> packet) {
+        mCount += 1;
+        // Keep the buffer like a queue or a sink does
+        if (mKeep == KeepArc) {
+            mArc = packet->shared_from_this<MediaPacket>();
+        }
+        else if (mKeep == KeepRef) {
+            mRef = packet.get();
+        }
+        if (!mSrc) {
+            return Error::Ok;
+        }
+        return mSrc->push(packet.get());
+    }
+    size_t count() const noexcept {
+        return mCount;
+    }
+    void setKeep(int keep) noexcept {
+        mKeep = keep;
+    }
+
+    enum : int {
+        KeepNone,
+        KeepArc,
+        KeepRef,
+    };
+private:
+    Pad              *mSrc = nullptr;
+    size_t            mCount = 0;
+    int               mKeep = KeepNone;
+    Arc<MediaPacket>  mArc;
+    Ref<MediaPacket>  mRef;
+};
+
+static void BenchPadChain(bool typed, const char *name, size_t numOfItems) {
+    auto src = make_shared<ChainElement>(typed, false, true);
+    auto a = make_shared<ChainElement>(typed, true, true);
+    auto b = make_shared<ChainElement>(typed, true, true);
+    auto c = make_shared<ChainElement>(typed, true, true);
+    auto sink = make_shared<ChainElement>(typed, true, false);
+    LinkElements(src, a, b, c, sink);
+
+    auto pad = src->outputs().front();
+    auto packet = make_shared<BenchPacket>();
+    auto seconds = Measure([&]() {
+        for (size_t n = 0; n < numOfItems; n++) {
+            pad->push(packet);
+        }
+    });
+    if (sink->count() != numOfItems) {
+        ::printf("PadChain %-8s: only %zu of %zu items arrived\n", name, sink->count(), numOfItems);
+        return;
+    }
+    ::printf("PadChain %-8s: %zu pushes through 5 elements in %.3f s, %.0f pushes/s (negotiated %d)\n", 
+        name, numOfItems, seconds, numOfItems / seconds, pad->isNegotiated()
+    );
+}
+
+// Cost of keeping a new buffer at every hop, shared_from_this() vs Ref
+static void BenchPadHops(bool ref, const char *name, size_t numOfItems) {
+    Arc<ChainElement> elements[5];
+    for (size_t n = 0; n < 5; n++) {
+        elements[n] = make_shared<ChainElement>(true, n != 0, n != 4);
+        elements[n]->setKeep(ref ? ChainElement::KeepRef : ChainElement::KeepArc);
+    }
+    LinkElements(elements[0], elements[1], elements[2], elements[3], elements[4]);
+
+    auto pad = elements[0]->outputs().front();
+    auto seconds = Measure([&]() {
+        for (size_t n = 0; n < numOfItems; n++) {
+            if (ref) {
+                pad->push(MakeRef<BenchPacket>());
+            }
+            else {
+                pad->push(make_shared<BenchPacket>());
+            }
+        }
+    });
+    ::printf("PadHops %-4s: %zu new buffers kept by 4 elements in %.3f s, %.1f ns per hop\n", 
+        name, numOfItems, seconds, seconds * 1e9 / numOfItems / 4
+    );
+}
+
+// Small object churn at many threads, the blocks are freed by the next thread like in a pipeline
+template <typename Alloc, typename Free>
+static void BenchAllocator(const char *name, Alloc &&alloc, Free &&free, size_t numOfThreads, size_t numOfItems) {
+    std::vector<std::vector<void*> > blocks(numOfThreads);
+    auto seconds = Measure([&]() {
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < numOfThreads; t++) {
+            threads.emplace_back([&, t]() {
+                auto &mine = blocks[t];
+                for (size_t n = 0; n < numOfItems; n++) {
+                    mine.push_back(alloc(32 + (n % 8) * 48));
+                    if (mine.size() == 64) {
+                        for (auto ptr : mine) {
+                            free(ptr);
+                        }
+                        mine.clear();
+                    }
+                }
+            });
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+    });
+    for (auto &mine : blocks) {
+        for (auto ptr : mine) {
+            free(ptr);
+        }
+    }
+    ::printf("Allocator %-12s: %zu threads, %.0f alloc+free/s\n", name, numOfThreads, numOfThreads * numOfItems / seconds);
+}
+
+// Event create, copy to the receivers, and release, like the clock updates of pipeline
+static void BenchEvents(size_t numOfItems) {
+    std::vector<Arc<ClockEvent> > shared;
+    std::vector<Ref<ClockEvent> > refs;
+    shared.reserve(64);
+    refs.reserve(64);
+    auto sharedSeconds = Measure([&]() {
+        for (size_t n = 0; n < numOfItems; n++) {
+            auto event = std::make_shared<ClockEvent>(Event::ClockUpdated, double(n), nullptr);
+            shared.push_back(event);
+            if (shared.size() == 64) {
+                shared.clear();
+            }
+        }
+        shared.clear();
+    });
+    auto refSeconds = Measure([&]() {
+        for (size_t n = 0; n < numOfItems; n++) {
+            auto event = ClockEvent::make(Event::ClockUpdated, double(n), nullptr);
+            refs.push_back(event);
+            if (refs.size() == 64) {
+                refs.clear();
+            }
+        }
+        refs.clear();
+    });
+    ::printf("Events: shared_ptr %.0f events/s, pooled Ref %.0f events/s\n", numOfItems / sharedSeconds, numOfItems / refSeconds);
+}
+
+// Frame grabbing by AppSink, one Arc per pull (unbounded) vs lent batches (bounded, blocking)
+static void BenchAppSink(bool batch, const char *name, size_t numOfItems) {
+    auto src = make_shared<ChainElement>(false, false, true);
+    auto sink = CreateElement<AppSink>();
+    if (batch) {
+        sink->setCapacity(64, AppSink::Block);
+    }
+    LinkElements(src, sink);
+    sink->setState(State::Running);
+
+    auto pad = src->outputs().front();
+    size_t peak = 0;
+    auto seconds = Measure([&]() {
+        std::thread producer([&]() {
+            for (size_t n = 0; n < numOfItems; n++) {
+                auto frame = CreateVideoFrame(PixelFormat::RGBA, 320, 240);
+                pad->push(frame.get());
+            }
+        });
+        size_t received = 0;
+        Ref<Resource> frames[16];
+        Arc<MediaFrame> frame;
+        while (received != numOfItems) {
+            peak = std::max<size_t>(peak, GetAllocStats(AllocCategory::Frame).blocks); //< Frames alive
+            if (batch) {
+                size_t count = std::size(frames);
+                if (sink->pull(frames, &count, 100) == Error::Ok) {
+                    received += count;
+                    for (size_t i = 0; i < count; i++) {
+                        frames[i].reset();
+                    }
+                }
+            }
+            else if (sink->pull(&frame, 100) == Error::Ok) {
+                received += 1;
+                frame.reset();
+            }
+        }
+        producer.join();
+    });
+    ::printf("AppSink %-6s: %.0f frames/s, peak %zu frames alive\n", name, numOfItems / seconds, peak);
+    sink->setState(State::Null);
+}
+
+// Passes over 8K RGBA frames, normal pages vs huge pages, the column one walks like the vertical pass of filters
+static void BenchHugePages(HugePages mode, const char *name, int width, int height, int rounds) {
+    SetFrameHugePages(mode);
+    auto src = CreateVideoFrame(PixelFormat::RGBA, width, height);
+    auto dst = CreateVideoFrame(PixelFormat::RGBA, width, height);
+    SetFrameHugePages(HugePages::Off);
+
+    auto srcData = src->data<uint8_t*>(0);
+    auto dstData = dst->data<uint8_t*>(0);
+    size_t pitch = src->linesize(0);
+    ::memset(srcData, 0x7f, pitch * height); //< Fault in, not measured
+    ::memset(dstData, 0, pitch * height);
+
+    auto rowSeconds = Measure([&]() {
+        // RGBA -> BGRA
+        for (int n = 0; n < rounds; n++) {
+            for (int y = 0; y < height; y++) {
+                auto s = srcData + y * pitch;
+                auto d = dstData + y * pitch;
+                for (int x = 0; x < width; x++) {
+                    d[x * 4 + 0] = s[x * 4 + 2];
+                    d[x * 4 + 1] = s[x * 4 + 1];
+                    d[x * 4 + 2] = s[x * 4 + 0];
+                    d[x * 4 + 3] = s[x * 4 + 3];
+                }
+            }
+        }
+    });
+    auto columnSeconds = Measure([&]() {
+        // Vertical 3 taps box, by 16 pixels (a cache line) wide strips
+        for (int n = 0; n < rounds; n++) {
+            for (int x0 = 0; x0 < width * 4; x0 += 64) {
+                for (int y = 1; y < height - 1; y++) {
+                    auto s = srcData + y * pitch + x0;
+                    auto d = dstData + y * pitch + x0;
+                    for (int x = 0; x < 64; x++) {
+                        d[x] = (s[x - pitch] + s[x] + s[x + pitch]) / 3;
+                    }
+                }
+            }
+        }
+    });
+    auto frames = double(rounds);
+    ::printf("Frame pages %-11s: %dx%d row pass %.1f frames/s, column pass %.1f frames/s\n", 
+        name, width, height, frames / rowSeconds, frames / columnSeconds);
+}
+
+// YUV -> RGBA of the VideoConverter, by every SIMD level the CPU has
+static void BenchColorConvert(PixelFormat format, const char *name, int width, int height, int rounds) {
+    auto src = CreateVideoFrame(format, width, height);
+    auto dst = CreateVideoFrame(PixelFormat::RGBA, width, height);
+    auto layout = GetPixelFormatLayout(format);
+    for (int n = 0; n < layout.planes; n++) {
+        ::memset(src->data(n), 0x50 + n * 0x20, src->linesize(n) * GetPlaneSize(format, n, width, height).second);
+    }
+    const uint8_t *data[3] = {src->data<uint8_t*>(0), src->data<uint8_t*>(1), src->data<uint8_t*>(2)};
+    const int linesize[3] = {src->linesize(0), src->linesize(1), src->linesize(2)};
+
+    auto level = GetSimdLevel();
+    const char *names[] = {"C", "SSE2", "AVX2", "AVX512"};
+    for (auto simd : {SimdLevel::None, SimdLevel::SSE2, SimdLevel::AVX2, SimdLevel::AVX512}) {
+        if (simd > GetCPUSimdLevel()) {
+            continue;
+        }
+        SetSimdLevel(simd);
+        auto seconds = Measure([&]() {
+            for (int n = 0; n < rounds; n++) {
+                ConvertYUVToRGBA(format, data, linesize, PixelFormat::RGBA, dst->data<uint8_t*>(0), dst->linesize(0), width, height);
+            }
+        });
+        ::printf("YUVToRGBA %-7s %-6s: %dx%d %.1f frames/s\n", name, names[int(simd)], width, height, rounds / seconds);
+    }
+    SetSimdLevel(level);
+}
+
+// YUV -> RGBA of a 4K frame split into slices like the VideoConverter, by the number of threads
+static void BenchSlicedConvert(size_t numOfThreads, int width, int height, int rounds) {
+    auto src = CreateVideoFrame(PixelFormat::YUV420P, width, height);
+    auto dst = CreateVideoFrame(PixelFormat::RGBA, width, height);
+    for (int n = 0; n < 3; n++) {
+        ::memset(src->data(n), 0x50 + n * 0x20, src->linesize(n) * GetPlaneSize(PixelFormat::YUV420P, n, width, height).second);
+    }
+    const int linesize[3] = {src->linesize(0), src->linesize(1), src->linesize(2)};
+
+    SliceRunner runner(numOfThreads);
+    int rows = ((height + int(numOfThreads) - 1) / int(numOfThreads) + 1) / 2 * 2;
+    size_t numOfSlices = (height + rows - 1) / rows;
+    auto convert = [&](size_t n) {
+        int begin = int(n) * rows;
+        int end = std::min(begin + rows, height);
+        const uint8_t *data[3] = {
+            src->data<uint8_t*>(0) + begin * linesize[0],
+            src->data<uint8_t*>(1) + begin / 2 * linesize[1],
+            src->data<uint8_t*>(2) + begin / 2 * linesize[2],
+        };
+        ConvertYUVToRGBA(
+            PixelFormat::YUV420P, data, linesize, 
+            PixelFormat::RGBA, dst->data<uint8_t*>(0) + begin * dst->linesize(0), dst->linesize(0), 
+            width, end - begin
+        );
+    };
+    auto seconds = Measure([&]() {
+        for (int n = 0; n < rounds; n++) {
+            runner.run(numOfSlices, convert);
+        }
+    });
+    ::printf("Sliced YUVToRGBA %zu threads: %dx%d %.1f frames/s\n", numOfThreads, width, height, rounds / seconds);
+}
+
+#ifdef HAVE_SWSCALE
+// sws_scale of a 4K frame with a context per slice, as the VideoConverter does, by the number of threads
+static void BenchSlicedSws(size_t numOfThreads, int width, int height, int rounds) {
+    auto src = av_frame_alloc();
+    auto dst = av_frame_alloc();
+    src->format = AV_PIX_FMT_YUV420P;
+    src->width = width;
+    src->height = height;
+    dst->format = AV_PIX_FMT_BGRA;
+    dst->width = width;
+    dst->height = height;
+    av_frame_get_buffer(src, 64);
+    av_frame_get_buffer(dst, 64);
+    for (int n = 0; n < 3; n++) {
+        ::memset(src->data[n], 0x50 + n * 0x20, src->linesize[n] * (n == 0 ? height : height / 2));
+    }
+
+    SliceRunner runner(numOfThreads);
+    std::vector<SwsContext*> ctxts;
+    for (size_t n = 0; n < numOfThreads; n++) {
+        ctxts.push_back(sws_getContext(width, height, AV_PIX_FMT_YUV420P, width, height, AV_PIX_FMT_BGRA, SWS_BICUBIC, nullptr, nullptr, nullptr));
+    }
+    int align = sws_receive_slice_alignment(ctxts[0]);
+    int rows = ((height + int(numOfThreads) - 1) / int(numOfThreads) + align - 1) / align * align;
+    size_t numOfSlices = (height + rows - 1) / rows;
+    auto seconds = Measure([&]() {
+        for (int n = 0; n < rounds; n++) {
+            runner.run(numOfSlices, [&](size_t slice) {
+                int begin = int(slice) * rows;
+                sws_frame_start(ctxts[slice], dst, src);
+                sws_send_slice(ctxts[slice], 0, height);
+                sws_receive_slice(ctxts[slice], begin, std::min(rows, height - begin));
+                sws_frame_end(ctxts[slice]);
+            });
+        }
+    });
+    ::printf("Sliced sws_scale %zu threads: %dx%d %.1f frames/s\n", numOfThreads, width, height, rounds / seconds);
+    for (auto ctxt : ctxts) {
+        sws_freeContext(ctxt);
+    }
+    av_frame_free(&src);
+    av_frame_free(&dst);
+}
+#endif
+
+// The CPU path of KernelFilter, the old per pixel loop against the Convolver by every SIMD level, precision and threads
+static void BenchConvolution(const char *name, const std::vector<double> &kernel, int size, int width, int height, int rounds) {
+    int pitch = width * 4;
+    std::vector<uint8_t> src(pitch * height);
+    std::vector<uint8_t> dst(pitch * height);
+    for (size_t n = 0; n < src.size(); n++) {
+        src[n] = uint8_t(n * 31 + n / pitch * 7);
+    }
+
+    // The old loop is too slow on the large ones
+    if (size <= 5 && width <= 1920) {
+        auto seconds = Measure([&]() {
+            for (int y = 0; y < height; y++) {
+                for (int x = 0; x < width; x++) {
+                    double sum[3] {0, 0, 0};
+                    for (int i = 0; i < size; i++) {
+                        for (int j = 0; j < size; j++) {
+                            int xx = std::clamp(x + j - size / 2, 0, width - 1);
+                            int yy = std::clamp(y + i - size / 2, 0, height - 1);
+                            for (int c = 0; c < 3; c++) {
+                                sum[c] += kernel[i * size + j] * src[yy * pitch + xx * 4 + c];
+                            }
+                        }
+                    }
+                    for (int c = 0; c < 3; c++) {
+                        dst[y * pitch + x * 4 + c] = std::clamp(sum[c], 0.0, 255.0);
+                    }
+                }
+            }
+        });
+        ::printf("Convolution %-9s naive            : %dx%d %.1f frames/s\n", name, width, height, 1 / seconds);
+    }
+
+    Convolver conv;
+    conv.setKernel(kernel.data(), size, size);
+    auto level = GetSimdLevel();
+    const char *names[] = {"C", "SSE2", "AVX2", "AVX512"};
+    for (auto simd : {SimdLevel::None, SimdLevel::SSE2, SimdLevel::AVX2, SimdLevel::AVX512}) {
+        if (simd > GetCPUSimdLevel()) {
+            continue;
+        }
+        SetSimdLevel(simd);
+        for (bool fixedPoint : {false, true}) {
+            conv.setFixedPoint(fixedPoint);
+            for (size_t numOfThreads : {1, 4}) {
+                SliceRunner runner(numOfThreads);
+                auto seconds = Measure([&]() {
+                    for (int n = 0; n < rounds; n++) {
+                        conv.apply(src.data(), pitch, dst.data(), pitch, width, height, &runner);
+                    }
+                });
+                ::printf("Convolution %-9s %-6s %-5s %zu thr: %dx%d %.1f frames/s\n", 
+                    name, names[int(simd)], fixedPoint ? "fixed" : "float", numOfThreads, width, height, rounds / seconds);
+            }
+        }
+    }
+    SetSimdLevel(level);
+}
+
+// The subtitle overlay, full screen karaoke lines of ASS glyph masks and a full screen bitmap subtitle,
+// the old column major loop against BlendMask() / BlendRGBA() by every SIMD level
+static void BenchSubtitleBlend(int width, int height, int rounds) {
+    int pitch = width * 4;
+    std::vector<uint8_t> image(pitch * height, 0x40);
+
+    // 12 lines, each one has the shadow, the outline, the fill and the karaoke fill, as libass renders them
+    struct Layer {
+        int y;
+        int h;
+        uint32_t color;
+        std::vector<uint8_t> mask;
+    };
+    std::vector<Layer> layers;
+    const int lineHeight = height / 12;
+    const uint32_t colors[] = {0x00000080, 0x00000000, 0xFFFFFF00, 0xFF00FF00};
+    for (int line = 0; line < 12; line++) {
+        for (int l = 0; l < 4; l++) {
+            Layer layer {line * lineHeight, lineHeight, colors[l], std::vector<uint8_t>(width * lineHeight)};
+            // Glyph like coverage, strokes of 0xFF with the antialiasing edges and the gaps between them
+            for (int y = 0; y < lineHeight; y++) {
+                for (int x = 0; x < width; x++) {
+                    int phase = (x + y / 3 + l * 2) % 24;
+                    uint8_t v = phase < 8 ? 0xFF : (phase < 12 ? uint8_t(255 - (phase - 8) * 60) : 0);
+                    // The karaoke fill only covers the sung part of the line
+                    if (l == 3 && x > width * (line + 1) / 13) {
+                        v = 0;
+                    }
+                    layer.mask[y * width + x] = v;
+                }
+            }
+            layers.emplace_back(std::move(layer));
+        }
+    }
+
+    auto seconds = Measure([&]() {
+        for (int n = 0; n < rounds; n++) {
+            for (auto &layer : layers) {
+                const uint32_t r = (layer.color >> 24) & 0xff;
+                const uint32_t g = (layer.color >> 16) & 0xff;
+                const uint32_t b = (layer.color >>  8) & 0xff;
+                const uint32_t a = 0xff - (layer.color & 0xff);
+                for (int x = 0; x < width; x++) {
+                    for (int y = 0; y < layer.h; y++) {
+                        const uint32_t v = layer.mask[y * width + x];
+                        const uint32_t aa = a * v;
+                        uint8_t *p = &image[(layer.y + y) * pitch + x * 4];
+                        p[0] = (r * aa + p[0] * (255 * 255 - aa)) / (255 * 255);
+                        p[1] = (g * aa + p[1] * (255 * 255 - aa)) / (255 * 255);
+                        p[2] = (b * aa + p[2] * (255 * 255 - aa)) / (255 * 255);
+                        p[3] = (aa * 255 + p[3] * (255 * 255 - aa)) / (255 * 255);
+                    }
+                }
+            }
+        }
+    });
+    ::printf("Subtitle blend ASS    old     : %dx%d %.1f frames/s\n", width, height, rounds / seconds);
+
+    std::vector<uint8_t> bitmap(pitch * height);
+    for (size_t n = 0; n < bitmap.size(); n++) {
+        bitmap[n] = uint8_t(n * 13);
+    }
+
+    auto level = GetSimdLevel();
+    const char *names[] = {"C", "SSE2", "AVX2", "AVX512"};
+    for (auto simd : {SimdLevel::None, SimdLevel::SSE2, SimdLevel::AVX2, SimdLevel::AVX512}) {
+        if (simd > GetCPUSimdLevel()) {
+            continue;
+        }
+        SetSimdLevel(simd);
+        seconds = Measure([&]() {
+            for (int n = 0; n < rounds; n++) {
+                for (auto &layer : layers) {
+                    BlendMask(image.data(), pitch, width, height, layer.mask.data(), width, width, layer.h, 0, layer.y, layer.color);
+                }
+            }
+        });
+        ::printf("Subtitle blend ASS    %-7s : %dx%d %.1f frames/s\n", names[int(simd)], width, height, rounds / seconds);
+        seconds = Measure([&]() {
+            for (int n = 0; n < rounds; n++) {
+                BlendRGBA(image.data(), pitch, width, height, bitmap.data(), pitch, width, height, 0, 0);
+            }
+        });
+        ::printf("Subtitle blend Bitmap %-7s : %dx%d %.1f frames/s\n", names[int(simd)], width, height, rounds / seconds);
+    }
+    SetSimdLevel(level);
+}
+
+// Caps lookups of the negotiation and the metadata copy of Player, compared with the old std::map layout
+static void BenchProperties(size_t numOfItems) {
+    using OldMap = std::map<std::string, Property, std::less<> >;
+    auto formatList = {PixelFormat::NV12, PixelFormat::YUV420P, PixelFormat::BGRA, PixelFormat::RGBA};
+    auto md = Property::newMap();
+    md["title"] = "Title";
+    md["language"] = "jpn";
+    md["handler_name"] = "VideoHandler";
+    md["vendor_id"] = "[0][0][0][0]";
+
+    OldMap old;
+    Properties props;
+    old["width"] = 1920;
+    old["height"] = 1080;
+    old["pixelFormat"] = PixelFormat::YUV420P;
+    old["duration"] = 10.0;
+    old["metadata"] = md;
+    auto &list = old["pixelFormatList"] = Property::newList();
+    for (auto fmt : formatList) {
+        list.push_back(fmt);
+    }
+    for (const auto &[key, value] : old) {
+        props[key] = value;
+    }
+
+    int64_t sum = 0;
+    auto oldSeconds = Measure([&]() {
+        for (size_t n = 0; n < numOfItems; n++) {
+            // Like the old _peerSupportedPixelFormat(), a vector of formats then search
+            std::vector<PixelFormat> formats;
+            for (const auto &v : old.find("pixelFormatList")->second.toList()) {
+                formats.push_back(v.toEnum<PixelFormat>());
+            }
+            sum += std::find(formats.begin(), formats.end(), PixelFormat::RGBA) != formats.end();
+            sum += old.find("width")->second.toInt() + old.find("height")->second.toInt();
+        }
+    });
+    auto newSeconds = Measure([&]() {
+        for (size_t n = 0; n < numOfItems; n++) {
+            sum += props.pixelFormatList().contains(PixelFormat::RGBA);
+            sum += props.width() + props.height();
+        }
+    });
+    ::printf("Properties negotiation: std::map %.1f ns, flat %.1f ns (%lld)\n",
+        oldSeconds * 1e9 / numOfItems, newSeconds * 1e9 / numOfItems, (long long) sum);
+
+    std::vector<OldMap> oldStreams;
+    std::vector<Properties> streams;
+    oldStreams.reserve(numOfItems / 10);
+    streams.reserve(numOfItems / 10);
+    oldSeconds = Measure([&]() {
+        for (size_t n = 0; n < numOfItems / 10; n++) {
+            // Copy the property out, then the map into the stream list
+            Property prop = old["metadata"];
+            auto &mp = prop.toMap();
+            oldStreams.emplace_back(mp.begin(), mp.end());
+        }
+    });
+    newSeconds = Measure([&]() {
+        for (size_t n = 0; n < numOfItems / 10; n++) {
+            auto &mp = props.find(Properties::Metadata)->second.toMap();
+            Properties metadata;
+            metadata.reserve(mp.size());
+            for (const auto &[key, value] : mp) {
+                metadata.emplace(key, Property(value));
+            }
+            streams.emplace_back(std::move(metadata));
+        }
+    });
+    ::printf("Properties metadata: std::map %.0f ns, flat %.0f ns\n",
+        oldSeconds * 1e9 / (numOfItems / 10), newSeconds * 1e9 / (numOfItems / 10));
+}
+
+// Demuxing speed of a local file, packets are dropped at the sinks
+static void BenchDemuxer(const char *path) {
+    auto demuxer = CreateElement<Demuxer>();
+    if (!demuxer) {
+        ::printf("Demuxer: no implementation, skipped\n");
+        return;
+    }
+    demuxer->setUrl(path);
+    if (auto err = demuxer->setState(State::Ready); err != Error::Ok) {
+        ::printf("Demuxer: failed to open %s\n", path);
+        return;
+    }
+    std::vector<Arc<CountSink> > sinks;
+    for (auto pad : demuxer->outputs()) {
+        auto sink = make_shared<CountSink>();
+        pad->link(sink->inputs().front());
+        sinks.push_back(sink);
+    }
+    auto media = dynamic_cast<MediaElement*>(demuxer.get());
+    auto seconds = Measure([&]() {
+        demuxer->setState(State::Running);
+        while (!media->isEndOfFile()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+    size_t numOfPackets = 0;
+    for (auto &sink : sinks) {
+        numOfPackets += sink->count();
+    }
+    ::printf("Demuxer: %zu packets in %.3f s, %.0f packets/s\n", numOfPackets, seconds, numOfPackets / seconds);
+    demuxer->setState(State::Null);
+}
+
+int main(int argc, char **argv) {
+    auto threads = std::max<size_t>(std::thread::hardware_concurrency(), 2);
+    BenchAllocator("::malloc", [](size_t n) { return ::malloc(n); }, [](void *ptr) { ::free(ptr); }, threads, 2000000);
+    BenchAllocator("libc::malloc", [](size_t n) { return libc::malloc(n); }, [](void *ptr) { libc::free(ptr); }, threads, 2000000);
+
+    BenchEvents(10000000);
+    BenchProperties(10000000);
+    BenchAppSink(false, "Arc", 200000);
+    BenchAppSink(true, "Batch", 200000);
+    BenchHugePages(HugePages::Off, "Normal", 7680, 4320, 5);
+    BenchHugePages(HugePages::Transparent, "Transparent", 7680, 4320, 5);
+    BenchColorConvert(PixelFormat::YUV420P, "YUV420P", 1920, 1080, 200);
+    BenchColorConvert(PixelFormat::NV12, "NV12", 1920, 1080, 200);
+    BenchColorConvert(PixelFormat::P010LE, "P010LE", 1920, 1080, 200);
+    for (size_t n : {1, 2, 4, 8}) {
+        BenchSlicedConvert(n, 3840, 2160, 100);
+#ifdef HAVE_SWSCALE
+        BenchSlicedSws(n, 3840, 2160, 20);
+#endif
+    }
+
+    const std::vector<double> sharpen = {0, -0.5, 0, -0.5, 3, -0.5, 0, -0.5, 0};
+    std::vector<double> gaussian;
+    for (double a : {1, 4, 6, 4, 1}) {
+        for (double b : {1, 4, 6, 4, 1}) {
+            gaussian.push_back(a * b / 256);
+        }
+    }
+    const std::vector<double> box(15 * 15, 1.0 / 225);
+    for (auto [width, height] : {std::pair{1920, 1080}, std::pair{3840, 2160}}) {
+        int rounds = width > 1920 ? 5 : 20;
+        BenchConvolution("3x3 2D", sharpen, 3, width, height, rounds);
+        BenchConvolution("5x5 sep", gaussian, 5, width, height, rounds);
+        BenchConvolution("15x15 sep", box, 15, width, height, rounds / 2);
+    }
+    BenchSubtitleBlend(3840, 2160, 10);
+
+    BenchPadChain(false, "Callback", 10000000);
+    BenchPadChain(true, "Typed", 10000000);
+    BenchPadHops(false, "Arc", 10000000);
+    BenchPadHops(true, "Ref", 10000000);
+
+    BenchMediaQueue(MediaQueue::Locked, "Locked", 1000000);
+    BenchMediaQueue(MediaQueue::LockFree, "LockFree", 1000000);
+
+    BenchQueueLatency(MediaQueue::Locked, "Locked", 20000);
+    BenchQueueLatency(MediaQueue::LockFree, "LockFree", 20000);
+    BenchQueueLatency(MediaQueue::Locked, "Locked", 5000, 200);
+    BenchQueueLatency(MediaQueue::LockFree, "LockFree", 5000, 200);
+
+    // benchtest [local media file]
+    if (argc > 1) {
+        BenchDemuxer(argv[1]);
+    }
+}
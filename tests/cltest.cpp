@@ -1,7 +1,17 @@
 #define CL_HPP_ENABLE_EXCEPTIONS
 #include "../nekoav/hwcontext/opencl.hpp"
+#include "../nekoav/elements/appsink.hpp"
+#include "../nekoav/elements/filters.hpp"
+#include "../nekoav/detail/template.hpp"
+#include "../nekoav/media/convolve.hpp"
+#include "../nekoav/factory.hpp"
+#include "../nekoav/format.hpp"
+#include "../nekoav/event.hpp"
+#include "../nekoav/media.hpp"
+#include "../nekoav/pad.hpp"
 #include "../nekoav/log.hpp"
 #include <CL/opencl.hpp>
+#include <cstdlib>
 
 
 void doCompute(cl::Context &ctxt, cl::CommandQueue &queue) {
@@ -35,7 +45,75 @@ void doCompute(cl::Context &ctxt, cl::CommandQueue &queue) {
     NEKO_DEBUG(arrayD);
 }
 
+class FrameSource final : public NekoAV::Template::GetImpl<NekoAV::Element> {
+public:
+    FrameSource() {
+        mPad = addOutput("src");
+    }
+    NekoAV::Pad *pad() const noexcept {
+        return mPad;
+    }
+private:
+    NekoAV::Pad *mPad;
+};
+
+// The pipelined KernelFilter against the CPU Convolver, frames in flight across a resize, works on a CPU runtime (PoCL)
+void doKernelFilter() {
+    using namespace NekoAV;
+    FrameSource src;
+    auto filter = GetElementFactory()->createElement<KernelFilter>();
+    auto sink = GetElementFactory()->createElement<AppSink>();
+    NEKO_ASSERT(LinkElements(&src, filter, sink) == Error::Ok);
+    filter->setSharpenKernel();
+    filter->setNumOfFramesInFlight(3);
+    filter->setState(State::Running);
+    sink->setState(State::Running);
+
+    const double sharpen[9] = {0.0, -0.5, 0.0, -0.5, 3, -0.5, 0.0, -0.5, 0.0};
+    Convolver conv;
+    conv.setKernel(sharpen, 3, 3);
+
+    std::vector<Ref<MediaFrame> > frames;
+    std::vector<std::vector<uint8_t> > expected;
+    for (int n = 0; n < 9; n++) {
+        int width = n < 5 ? 64 : 80;
+        int height = n < 5 ? 48 : 40;
+        auto frame = CreateVideoFrame(PixelFormat::RGBA, width, height);
+        auto data = frame->data<uint8_t*>(0);
+        int pitch = frame->linesize(0);
+        for (int i = 0; i < pitch * height; i++) {
+            data[i] = ::rand();
+        }
+        expected.emplace_back(pitch * height);
+        conv.apply(data, pitch, expected.back().data(), pitch, width, height);
+        frames.push_back(frame);
+        src.pad()->push(frame);
+    }
+    // The last ones are pushed on the end of the media
+    src.pad()->pushEvent(Event::make(Event::MediaEndOfFile, &src));
+
+    Ref<Resource> results[16];
+    size_t count = 16;
+    NEKO_ASSERT(sink->pull(results, &count) == Error::Ok);
+    NEKO_ASSERT(count == frames.size());
+    for (size_t n = 0; n < count; n++) {
+        NEKO_ASSERT(results[n].get() == frames[n].get());
+        auto data = frames[n]->data<uint8_t*>(0);
+        for (int y = 0; y < frames[n]->height(); y++) {
+            for (int x = 0; x < frames[n]->width() * 4; x++) {
+                auto offset = y * frames[n]->linesize(0) + x;
+                NEKO_ASSERT(x % 4 == 3 || std::abs(data[offset] - expected[n][offset]) <= 1);
+            }
+        }
+    }
+    NEKO_DEBUG("KernelFilter on OpenCL matches the CPU");
+
+    filter->setState(State::Null);
+    sink->setState(State::Null);
+}
+
 int main() {
     auto ctxt = NekoAV::OpenCLContext::create();
     doCompute(ctxt->context(), ctxt->commandQueue());
+    doKernelFilter();
 }
\ No newline at end of file
@@ -1,18 +1,38 @@
 #include <thread>
+#include <set>
+#include <optional>
+#include <condition_variable>
+#include <cmath>
 #include <gtest/gtest.h>
 #include "../nekoav/detail/template.hpp"
+#include "../nekoav/detail/queue.hpp"
 #include "../nekoav/backtrace.hpp"
 #include "../nekoav/elements.hpp"
 #include "../nekoav/container.hpp"
+#include "../nekoav/allocator.hpp"
+#include "../nekoav/elements/mediaqueue.hpp"
+#include "../nekoav/media/blend.hpp"
+#include "../nekoav/media/colorcvt.hpp"
+#include "../nekoav/media/convolve.hpp"
+#include "../nekoav/elements/appsink.hpp"
+#include "../nekoav/pipeline.hpp"
+#include "../nekoav/context.hpp"
+#include "../nekoav/cpu.hpp"
+#include "../nekoav/factory.hpp"
 #include "../nekoav/property.hpp"
 #include "../nekoav/format.hpp"
 #include "../nekoav/media.hpp"
+#include "../nekoav/event.hpp"
 #include "../nekoav/enum.hpp"
 #include "../nekoav/time.hpp"
 #include "../nekoav/libc.hpp"
 #include "../nekoav/log.hpp"
 #include "../nekoav/pad.hpp"
 
+#ifdef __linux__
+    #include <sched.h>
+#endif
+
 using namespace std::chrono_literals;
 using namespace NEKO_NAMESPACE;
 
@@ -74,6 +94,18 @@ public:
         return Error::Ok;
     }
 };
+class TinyTypedSink final : public Template::GetImpl<Element> {
+public:
+    TinyTypedSink() {
+        addInput("sink")->setTypedCallback<TinyResource, &TinyTypedSink::process>(this);
+    }
+    Error process(Pad *pad, View<TinyResource> resource) {
+        NEKO_ASSERT(pad == inputs().front());
+        mCount += 1;
+        return Error::Ok;
+    }
+    size_t mCount = 0;
+};
 class TinyMiddle final : public Template::GetImpl<Element> {
 public:
     TinyMiddle() {
@@ -137,6 +169,51 @@ TEST(CoreTest, PropertyTest) {
     ASSERT_EQ(prop.toEnum<BEnum>(), BEnum::VB);
 }
 
+TEST(CoreTest, Properties) {
+    Properties props;
+    props[Properties::Width] = 1920;
+    props[Properties::Height] = 1080;
+    props[Properties::PixelFormatList] = {PixelFormat::RGBA, PixelFormat::BGRA};
+    ASSERT_EQ(props.width(), 1920);
+    ASSERT_EQ(props.height(), 1080);
+    ASSERT_EQ(props.size(), 3);
+
+    // Typed list view
+    auto formats = props.pixelFormatList();
+    ASSERT_EQ(formats.size(), 2);
+    ASSERT_EQ(formats[0], PixelFormat::RGBA);
+    ASSERT_TRUE(formats.contains(PixelFormat::BGRA));
+    ASSERT_FALSE(formats.contains(PixelFormat::YUV420P));
+    ASSERT_TRUE(props.sampleFormatList().empty());
+
+    // Runtime keys are owned by the Properties, the same name finds the same entry
+    std::string name = "ffstream";
+    props[name] = 1;
+    name = "changed";
+    ASSERT_TRUE(props.contains("ffstream"));
+    ASSERT_EQ(props.find(std::string_view("ffstream"))->first.name(), "ffstream");
+    ASSERT_TRUE(props.contains(std::string("width")));
+
+    // The copy owns its keys
+    std::optional<Properties> source(props);
+    Properties copied = *source;
+    source.reset();
+    ASSERT_EQ(copied.find("ffstream")->first.name(), "ffstream");
+    ASSERT_EQ(copied.erase(std::string("ffstream")), 1);
+    ASSERT_FALSE(copied.contains("ffstream"));
+
+    // emplace never overwrites, like std::map
+    ASSERT_FALSE(props.emplace(Properties::Width, 1280).second);
+    ASSERT_EQ(props.width(), 1920);
+    ASSERT_EQ(props.erase(Properties::Width), 1);
+    ASSERT_EQ(props.width(), 0);
+
+    // Const lookup never inserts
+    const Properties &cprops = props;
+    ASSERT_EQ(cprops.find(Properties::Title), cprops.end());
+    ASSERT_EQ(cprops.size(), 3);
+}
+
 TEST(CoreTest, StateEnum) {
     NEKO_DEBUG(ComputeStateChanges(State::Null, State::Running));
     NEKO_DEBUG(ComputeStateChanges(State::Running, State::Null));
@@ -149,6 +226,342 @@ TEST(CoreTest, StateEnum) {
 TEST(CoreTest, Format) {
     constexpr auto sfmt = GetAltSampleFormat(SampleFormat::FLTP);
     constexpr auto sfmt1 = GetPackedSampleFormat(SampleFormat::FLT);
+    static_assert(GetPixelFormatLayout(PixelFormat::NV12).planes == 2);
+    static_assert(GetPlaneSize(PixelFormat::YUV420P, 1, 33, 17) == std::make_pair(17, 9));
+}
+
+TEST(CoreTest, VideoFrame) {
+    for (auto fmt : {PixelFormat::YUV420P, PixelFormat::NV12, PixelFormat::P010, PixelFormat::RGBA}) {
+        auto frame = CreateVideoFrame(fmt, 33, 17);
+        ASSERT_TRUE(frame);
+        auto layout = GetPixelFormatLayout(fmt);
+        for (int n = 0; n < layout.planes; n++) {
+            auto [w, h] = GetPlaneSize(fmt, n, 33, 17);
+            ASSERT_NE(frame->data(n), nullptr);
+            ASSERT_EQ(uintptr_t(frame->data(n)) % 64, 0);
+            ASSERT_EQ(frame->linesize(n) % 64, 0);
+            ASSERT_GE(frame->linesize(n) * 8, w * layout.bits[n]);
+            ::memset(frame->data(n), 0, frame->linesize(n) * h);
+        }
+        ASSERT_EQ(frame->data(layout.planes), nullptr);
+    }
+    ASSERT_FALSE(CreateVideoFrame(PixelFormat::D3D11, 33, 17));
+
+    // Recycled by (format, width, height)
+    void *data = CreateVideoFrame(PixelFormat::YUV420P, 640, 480)->data(0);
+    ASSERT_EQ(CreateVideoFrame(PixelFormat::YUV420P, 640, 480)->data(0), data);
+
+    // Trimmed, nothing cached after
+    for (int samples = 1000; samples < 1010; samples++) {
+        CreateAudioFrame(SampleFormat::S16, 2, samples);
+    }
+    ASSERT_GE(TrimFrameBuffers(), 640 * 480 * 3 / 2 + 10 * 4000);
+    ASSERT_EQ(TrimFrameBuffers(), 0);
+}
+
+TEST(CoreTest, ColorConvert) {
+    ASSERT_TRUE(IsYUVToRGBASupported(PixelFormat::NV12, PixelFormat::BGRA));
+    ASSERT_FALSE(IsYUVToRGBASupported(PixelFormat::RGBA, PixelFormat::RGBA));
+    ASSERT_FALSE(IsYUVToRGBASupported(PixelFormat::YUV420P, PixelFormat::NV12));
+
+    // Odd sizes, every kernel leaves a tail to the C one
+    const int width = 101, height = 7;
+    uint32_t seed = 1;
+    auto random = [&]() {
+        seed = seed * 1664525 + 1013904223;
+        return seed >> 8;
+    };
+    auto level = GetSimdLevel();
+    for (auto fmt : {PixelFormat::YUV420P, PixelFormat::NV12, PixelFormat::P010LE}) {
+        auto src = CreateVideoFrame(fmt, width, height);
+        auto layout = GetPixelFormatLayout(fmt);
+        for (int n = 0; n < layout.planes; n++) {
+            auto [w, h] = GetPlaneSize(fmt, n, width, height);
+            for (int i = 0; i < src->linesize(n) * h; i++) {
+                src->data<uint8_t*>(n)[i] = random();
+            }
+        }
+        const uint8_t *data[3] = {src->data<uint8_t*>(0), src->data<uint8_t*>(1), src->data<uint8_t*>(2)};
+        const int linesize[3] = {src->linesize(0), src->linesize(1), src->linesize(2)};
+
+        for (auto dstFmt : {PixelFormat::RGBA, PixelFormat::BGRA}) {
+            for (auto matrix : {YUVMatrix::BT601, YUVMatrix::BT709, YUVMatrix::BT2020}) {
+                for (bool fullRange : {false, true}) {
+                    std::vector<uint8_t> expected(width * height * 4);
+                    SetSimdLevel(SimdLevel::None);
+                    ASSERT_EQ(ConvertYUVToRGBA(fmt, data, linesize, dstFmt, expected.data(), width * 4, width, height, matrix, fullRange), Error::Ok);
+                    for (auto simd : {SimdLevel::SSE2, SimdLevel::AVX2, SimdLevel::AVX512}) {
+                        if (simd > GetCPUSimdLevel()) {
+                            continue;
+                        }
+                        std::vector<uint8_t> result(width * height * 4);
+                        SetSimdLevel(simd);
+                        ASSERT_EQ(ConvertYUVToRGBA(fmt, data, linesize, dstFmt, result.data(), width * 4, width, height, matrix, fullRange), Error::Ok);
+                        ASSERT_EQ(result, expected) << "SimdLevel " << int(simd) << " format " << int(fmt);
+                    }
+                }
+            }
+        }
+    }
+    SetSimdLevel(level);
+
+    // Known colors, BT.601 limited range
+    const uint8_t y[2] = {235, 16}, u[1] = {128}, v[1] = {128};
+    const uint8_t *planes[3] = {y, u, v};
+    const int pitches[3] = {2, 1, 1};
+    uint8_t rgba[8];
+    ASSERT_EQ(ConvertYUVToRGBA(PixelFormat::YUV420P, planes, pitches, PixelFormat::RGBA, rgba, 8, 2, 1), Error::Ok);
+    ASSERT_EQ(::memcmp(rgba, "\xff\xff\xff\xff\x00\x00\x00\xff", 8), 0);
+    const uint8_t red[3] = {81, 90, 240};
+    const uint8_t *redPlanes[3] = {&red[0], &red[1], &red[2]};
+    ASSERT_EQ(ConvertYUVToRGBA(PixelFormat::YUV420P, redPlanes, pitches, PixelFormat::BGRA, rgba, 8, 1, 1), Error::Ok);
+    ASSERT_LE(rgba[0], 2);
+    ASSERT_LE(rgba[1], 2);
+    ASSERT_GE(rgba[2], 253);
+    ASSERT_EQ(ConvertYUVToRGBA(PixelFormat::RGBA, planes, pitches, PixelFormat::RGBA, rgba, 8, 2, 1), Error::UnsupportedPixelFormat);
+}
+
+TEST(CoreTest, Convolution) {
+    // Odd size and a padded pitch, the tiles leave tails to the plain path
+    const int width = 301, height = 77, pitch = width * 4 + 36;
+    uint32_t seed = 1;
+    auto random = [&]() {
+        seed = seed * 1664525 + 1013904223;
+        return seed >> 8;
+    };
+    std::vector<uint8_t> src(pitch * height);
+    for (auto &v : src) {
+        v = random();
+    }
+    // Mirrored with the edge repeated, as the OpenCL sampler
+    auto mirror = [](int x, int n) {
+        x = x < 0 ? -x - 1 : (x >= n ? 2 * n - 1 - x : x);
+        return std::clamp(x, 0, n - 1);
+    };
+    auto reference = [&](const std::vector<double> &kernel, int cols, int rows, int w, int h) {
+        std::vector<uint8_t> out(pitch * h);
+        for (int y = 0; y < h; y++) {
+            for (int x = 0; x < w; x++) {
+                double sum[3] { };
+                for (int i = 0; i < rows; i++) {
+                    for (int j = 0; j < cols; j++) {
+                        auto px = &src[mirror(y + i - rows / 2, h) * pitch + mirror(x + j - cols / 2, w) * 4];
+                        for (int c = 0; c < 3; c++) {
+                            sum[c] += kernel[i * cols + j] * px[c];
+                        }
+                    }
+                }
+                for (int c = 0; c < 3; c++) {
+                    out[y * pitch + x * 4 + c] = std::lround(std::clamp(sum[c], 0.0, 255.0));
+                }
+                out[y * pitch + x * 4 + 3] = src[y * pitch + x * 4 + 3];
+            }
+        }
+        return out;
+    };
+    auto maxDiff = [&](const std::vector<uint8_t> &a, const std::vector<uint8_t> &b, int w, int h) {
+        int diff = 0;
+        for (int y = 0; y < h; y++) {
+            for (int x = 0; x < w * 4; x++) {
+                diff = std::max(diff, std::abs(a[y * pitch + x] - b[y * pitch + x]));
+            }
+        }
+        return diff;
+    };
+
+    struct Case {
+        std::vector<double> kernel;
+        int cols, rows;
+        bool separable;
+    };
+    std::vector<double> gaussian;
+    const double taps[5] = {1, 4, 6, 4, 1};
+    for (int i = 0; i < 5; i++) {
+        for (int j = 0; j < 5; j++) {
+            gaussian.push_back(taps[i] * taps[j] / 256);
+        }
+    }
+    std::vector<double> large;
+    for (int i = 0; i < 15 * 15; i++) {
+        large.push_back(((i * 7) % 11 - 5) / 60.0); //< Not rank 1
+    }
+    const Case cases[] = {
+        {std::vector<double>(9, 1.0 / 9), 3, 3, true},
+        {gaussian, 5, 5, true},
+        {{0, -0.5, 0, -0.5, 3, -0.5, 0, -0.5, 0}, 3, 3, false},
+        {{-1, -1, -1, -1, 8, -1, -1, -1, -1}, 3, 3, false},
+        {{1, 2, 1, 0, 0, 0, -1, -2, -1}, 3, 3, true},
+        {large, 15, 15, false},
+        {std::vector<double>(15 * 15, 1.0 / 225), 15, 15, true},
+        {{0.25, 0.5, 0.25}, 3, 1, true},
+    };
+
+    Convolver conv;
+    std::vector<uint8_t> dst(pitch * height);
+    ASSERT_EQ(conv.apply(src.data(), pitch, dst.data(), pitch, width, height), Error::InvalidState);
+    ASSERT_EQ(conv.setKernel(nullptr, 3, 3), Error::InvalidArguments);
+
+    auto level = GetSimdLevel();
+    SliceRunner runner(3);
+    for (auto &[kernel, cols, rows, separable] : cases) {
+        ASSERT_EQ(conv.setKernel(kernel.data(), cols, rows), Error::Ok);
+        ASSERT_EQ(conv.separable(), separable) << cols << "x" << rows;
+
+        // An image smaller than the kernel mirrors more than once
+        for (auto [w, h] : {std::pair{width, height}, std::pair{5, 3}}) {
+            auto expected = reference(kernel, cols, rows, w, h);
+            std::vector<uint8_t> single(pitch * h);
+            SetSimdLevel(SimdLevel::None);
+            ASSERT_EQ(conv.apply(src.data(), pitch, single.data(), pitch, w, h), Error::Ok);
+            ASSERT_LE(maxDiff(single, expected, w, h), 1) << cols << "x" << rows;
+
+            for (auto simd : {SimdLevel::SSE2, SimdLevel::AVX2, SimdLevel::AVX512}) {
+                if (simd > GetCPUSimdLevel()) {
+                    continue;
+                }
+                SetSimdLevel(simd);
+                std::vector<uint8_t> result(pitch * h);
+                ASSERT_EQ(conv.apply(src.data(), pitch, result.data(), pitch, w, h), Error::Ok);
+                ASSERT_LE(maxDiff(result, single, w, h), 1) << "SimdLevel " << int(simd);
+
+                // The bands on threads are the same as on one
+                std::vector<uint8_t> threaded(pitch * h);
+                ASSERT_EQ(conv.apply(src.data(), pitch, threaded.data(), pitch, w, h, &runner), Error::Ok);
+                ASSERT_EQ(maxDiff(threaded, result, w, h), 0) << "SimdLevel " << int(simd);
+            }
+
+            // The fixed point one is in the bound of the float one, and exactly the same on every SIMD level
+            conv.setFixedPoint(true);
+            SetSimdLevel(SimdLevel::None);
+            std::vector<uint8_t> fixed(pitch * h);
+            ASSERT_EQ(conv.apply(src.data(), pitch, fixed.data(), pitch, w, h), Error::Ok);
+            ASSERT_LE(maxDiff(fixed, single, w, h), conv.fixedPointError()) << cols << "x" << rows;
+            for (auto simd : {SimdLevel::SSE2, SimdLevel::AVX2, SimdLevel::AVX512}) {
+                if (simd > GetCPUSimdLevel()) {
+                    continue;
+                }
+                SetSimdLevel(simd);
+                std::vector<uint8_t> result(pitch * h);
+                ASSERT_EQ(conv.apply(src.data(), pitch, result.data(), pitch, w, h, &runner), Error::Ok);
+                ASSERT_EQ(maxDiff(result, fixed, w, h), 0) << "SimdLevel " << int(simd);
+            }
+            conv.setFixedPoint(false);
+        }
+    }
+    SetSimdLevel(level);
+
+    // The presets are exact in fixed point, a weight out of int16 falls back to float
+    ASSERT_EQ(conv.setKernel(cases[2].kernel.data(), 3, 3), Error::Ok);
+    ASSERT_EQ(conv.fixedPointError(), 1);
+    ASSERT_EQ(conv.setKernel(cases[3].kernel.data(), 3, 3), Error::Ok);
+    ASSERT_EQ(conv.fixedPointError(), 1);
+    const double huge[1] = {40000};
+    ASSERT_EQ(conv.setKernel(huge, 1, 1), Error::Ok);
+    ASSERT_EQ(conv.fixedPointError(), 0);
+    conv.setFixedPoint(true);
+    ASSERT_EQ(conv.apply(src.data(), pitch, dst.data(), pitch, width, height), Error::Ok);
+}
+TEST(CoreTest, Blend) {
+    // A padded pitch, the sources are out of the image on every side
+    const int width = 203, height = 61, pitch = width * 4 + 20;
+    uint32_t seed = 7;
+    auto random = [&]() {
+        seed = seed * 1664525 + 1013904223;
+        return seed >> 8;
+    };
+    std::vector<uint8_t> image(pitch * height);
+    for (auto &v : image) {
+        v = random();
+    }
+    const int mw = 77, mh = 23, mstride = mw + 5;
+    std::vector<uint8_t> mask(mstride * mh);
+    for (auto &v : mask) {
+        // Plenty of zero, the zero blocks are skipped
+        auto r = random() % 4;
+        v = r == 0 ? 0 : (r == 1 ? 255 : random());
+    }
+    for (int x = 0; x < 32; x++) {
+        for (int y = 0; y < mh; y++) {
+            mask[y * mstride + x] = 0;
+        }
+    }
+    const int bw = 45, bh = 19, bpitch = bw * 4 + 8;
+    std::vector<uint8_t> bitmap(bpitch * bh);
+    for (auto &v : bitmap) {
+        v = random();
+    }
+    for (int x = 0; x < 16; x++) {
+        bitmap[x * 4 + 3] = 0;
+    }
+
+    const std::pair<int, int> positions[] = {{10, 5}, {-13, -7}, {width - 40, height - 9}, {-30, 40}, {width + 1, 0}};
+    const uint32_t colors[] = {0xFF804000, 0x20C0E07F, 0x123456FF};
+    // c * k + d * (255 - k) with k = a * v / 255
+    auto reference = [](uint8_t &d, double c, double av) {
+        d = uint8_t(std::lround((c * av + d * (255 * 255 - av)) / (255 * 255)));
+    };
+    auto level = GetSimdLevel();
+    auto run = [&](SimdLevel simd, bool rgba) {
+        SetSimdLevel(simd);
+        auto out = image;
+        for (auto [x, y] : positions) {
+            if (rgba) {
+                BlendRGBA(out.data(), pitch, width, height, bitmap.data(), bpitch, bw, bh, x, y);
+            }
+            else {
+                for (auto color : colors) {
+                    BlendMask(out.data(), pitch, width, height, mask.data(), mstride, mw, mh, x, y, color);
+                }
+            }
+        }
+        return out;
+    };
+    for (bool rgba : {false, true}) {
+        auto expected = image;
+        for (auto [x, y] : positions) {
+            int w = rgba ? bw : mw;
+            int h = rgba ? bh : mh;
+            for (auto color : rgba ? std::vector<uint32_t>{0} : std::vector<uint32_t>(std::begin(colors), std::end(colors))) {
+                for (int yy = std::max(y, 0); yy < std::min(y + h, height); yy++) {
+                    for (int xx = std::max(x, 0); xx < std::min(x + w, width); xx++) {
+                        auto d = &expected[yy * pitch + xx * 4];
+                        if (rgba) {
+                            auto s = &bitmap[(yy - y) * bpitch + (xx - x) * 4];
+                            for (int c = 0; c < 3; c++) {
+                                reference(d[c], s[c], s[3] * 255.0);
+                            }
+                            reference(d[3], 255, s[3] * 255.0);
+                        }
+                        else {
+                            double av = (255 - (color & 0xFF)) * mask[(yy - y) * mstride + (xx - x)];
+                            for (int c = 0; c < 3; c++) {
+                                reference(d[c], (color >> (24 - c * 8)) & 0xFF, av);
+                            }
+                            reference(d[3], 255, av);
+                        }
+                    }
+                }
+            }
+        }
+        auto scalar = run(SimdLevel::None, rgba);
+        // The rounding of the coverage, 1 for each of the 3 colors at most
+        int limit = rgba ? 1 : 3;
+        for (int n = 0; n < pitch * height; n++) {
+            if (n % pitch >= width * 4) {
+                // The padding is never touched
+                ASSERT_EQ(scalar[n], image[n]);
+                continue;
+            }
+            ASSERT_LE(std::abs(scalar[n] - expected[n]), limit) << "at " << n << (rgba ? " rgba" : " mask");
+        }
+        for (auto simd : {SimdLevel::SSE2, SimdLevel::AVX2, SimdLevel::AVX512}) {
+            if (simd > GetCPUSimdLevel()) {
+                continue;
+            }
+            ASSERT_TRUE(run(simd, rgba) == scalar) << "SimdLevel " << int(simd) << (rgba ? " rgba" : " mask");
+        }
+    }
+    SetSimdLevel(level);
 }
 
 TEST(CoreTest, Elem) {
@@ -175,6 +588,372 @@ TEST(CoreTest, Elem) {
     NEKO_DEBUG(src.toDocoument());
 };
 
+TEST(CoreTest, PadNegotiation) {
+    class OtherResource final : public Resource { };
+
+    TinySource src;
+    TinyTypedSink sink;
+    LinkElements(&src, &sink);
+
+    // Undeclared type, checked by RTTI
+    auto pad = src.outputs().front();
+    ASSERT_FALSE(pad->isNegotiated());
+    ASSERT_EQ(pad->push(make_shared<TinyResource>()), Error::Ok);
+    ASSERT_EQ(pad->push(make_shared<OtherResource>()), Error::UnsupportedResource);
+    ASSERT_EQ(sink.mCount, 1);
+
+    // Declared after link, negotiated at once
+    pad->setResourceType<TinyResource>();
+    ASSERT_TRUE(pad->isNegotiated());
+    ASSERT_TRUE(sink.inputs().front()->isNegotiated());
+    ASSERT_EQ(pad->push(make_shared<TinyResource>()), Error::Ok);
+    ASSERT_EQ(sink.mCount, 2);
+
+    // Negotiated, but a null one or not the declared type is still rejected
+    ASSERT_EQ(pad->push(nullptr), Error::UnsupportedResource);
+    ASSERT_EQ(pad->push(make_shared<OtherResource>()), Error::UnsupportedResource);
+    ASSERT_EQ(sink.mCount, 2);
+
+    // Mismatch one falls back to the checked path
+    pad->setResourceType<OtherResource>();
+    ASSERT_FALSE(pad->isNegotiated());
+    ASSERT_EQ(pad->push(make_shared<OtherResource>()), Error::UnsupportedResource);
+
+    pad->setResourceType<TinyResource>();
+    ASSERT_EQ(pad->unlink(), Error::Ok);
+    ASSERT_FALSE(pad->isNegotiated());
+    ASSERT_EQ(pad->push(make_shared<TinyResource>()), Error::NoLink);
+}
+
+TEST(CoreTest, PipelineStateOrder) {
+    struct Tracker {
+        std::mutex              mutex;
+        std::condition_variable cond;
+        Vec<Element *>          order;
+        int                     running = 0; //< The onInitialize() in progress
+        int                     peak = 0;
+    };
+    // Slow to initialize, like opening a device
+    class SlowElement final : public Template::GetImpl<Element> {
+    public:
+        SlowElement(Tracker *tracker, bool input, bool output) : mTracker(tracker) {
+            if (input) {
+                addInput("sink")->setCallback([](View<Resource>) { return Error::Ok; });
+            }
+            if (output) {
+                addOutput("src");
+            }
+        }
+        Error onInitialize() override {
+            std::unique_lock lock(mTracker->mutex);
+            mTracker->running += 1;
+            mTracker->peak = std::max(mTracker->peak, mTracker->running);
+            mTracker->cond.notify_all();
+            // Stay here until all sinks are in, only returns by the timeout if they run one by one
+            mTracker->cond.wait_for(lock, 5s, [this]() { return mTracker->peak >= 3; });
+            mTracker->running -= 1;
+            mTracker->order.push_back(this);
+            return Error::Ok;
+        }
+    private:
+        Tracker *mTracker;
+    };
+
+    Tracker tracker;
+    auto pipeline = GetElementFactory()->createElement<Pipeline>();
+    auto src = std::make_shared<SlowElement>(&tracker, false, true);
+    auto sinkA = std::make_shared<SlowElement>(&tracker, true, false);
+    auto sinkB = std::make_shared<SlowElement>(&tracker, true, false);
+    auto sinkC = std::make_shared<SlowElement>(&tracker, true, false);
+    pipeline->addElements(src, sinkA, sinkB, sinkC);
+    ASSERT_EQ(LinkElements(src, sinkA), Error::Ok);
+
+    // Sinks in one level concurrently, then the source
+    ASSERT_EQ(pipeline->setState(State::Ready), Error::Ok);
+    ASSERT_EQ(tracker.peak, 3);
+    ASSERT_EQ(tracker.order.size(), 4);
+    ASSERT_EQ(tracker.order.back(), src.get());
+    ASSERT_EQ(pipeline->setState(State::Null), Error::Ok);
+}
+
+class CountingAllocator final : public Allocator {
+public:
+    void *allocate(size_t size) override {
+        mAllocated += 1;
+        return ::malloc(size);
+    }
+    void  deallocate(void *ptr, size_t size) override {
+        mDeallocated += 1;
+        ::free(ptr);
+    }
+
+    Atomic<int> mAllocated {0};
+    Atomic<int> mDeallocated {0};
+};
+
+TEST(CoreTest, Allocator) {
+    auto before = GetAllocStats(AllocCategory::Property);
+    Vec<void*> blocks;
+    for (size_t n = 1; n < 4096; n *= 3) {
+        auto ptr = libc::malloc(n, AllocCategory::Property);
+        ASSERT_NE(ptr, nullptr);
+        ASSERT_EQ(uintptr_t(ptr) % alignof(std::max_align_t), 0);
+        ::memset(ptr, 0xCC, n);
+        blocks.push_back(ptr);
+    }
+    auto after = GetAllocStats(AllocCategory::Property);
+    ASSERT_EQ(after.blocks - before.blocks, blocks.size());
+    ASSERT_EQ(after.allocations - before.allocations, blocks.size());
+
+    // Free at another thread
+    std::thread([&]() {
+        for (auto ptr : blocks) {
+            libc::free(ptr);
+        }
+    }).join();
+    after = GetAllocStats(AllocCategory::Property);
+    ASSERT_EQ(after.blocks, before.blocks);
+    ASSERT_EQ(after.bytes, before.bytes);
+
+    // Custom allocator, the old blocks go back to where they from
+    CountingAllocator allocator;
+    auto old = libc::malloc(32);
+    SetAllocator(&allocator);
+    auto ptr = libc::malloc(32);
+    libc::free(old);
+    SetAllocator(nullptr);
+    libc::free(ptr);
+    ASSERT_EQ(allocator.mAllocated, 1);
+    ASSERT_EQ(allocator.mDeallocated, 1);
+
+    auto events = GetAllocStats(AllocCategory::Event).blocks;
+    auto event = ErrorEvent::make(Error::Unknown, nullptr);
+    ASSERT_EQ(GetAllocStats(AllocCategory::Event).blocks, events + 1);
+}
+
+TEST(CoreTest, EventPool) {
+    auto event = ClockEvent::make(Event::ClockUpdated, 1.0, nullptr);
+    ASSERT_EQ(event->refcount(), 1);
+    Ref<Event> other = event;
+    View<Event> view = other;
+    ASSERT_EQ(event->refcount(), 2);
+    ASSERT_EQ(view->type(), Event::ClockUpdated);
+
+    // Storage reused after the last reference dropped
+    void *ptr = event.get();
+    event.reset();
+    ASSERT_EQ(other->refcount(), 1);
+    other.reset();
+    auto events = GetAllocStats(AllocCategory::Event).allocations;
+    event = ClockEvent::make(Event::ClockUpdated, 2.0, nullptr);
+    ASSERT_EQ(event.get(), ptr);
+    ASSERT_EQ(event->position(), 2.0);
+    ASSERT_EQ(GetAllocStats(AllocCategory::Event).allocations, events);
+
+    // Owned by Arc, a Ref pins it after the Arc dropped
+    auto shared = std::make_shared<Event>(Event::User, nullptr);
+    Ref<Event> pinned = shared.get();
+    ASSERT_EQ(pinned->refcount(), 1);
+    shared.reset();
+    ASSERT_EQ(pinned->type(), Event::User);
+    pinned.reset();
+}
+
+TEST(CoreTest, ResourceRef) {
+    class Tracked final : public Resource {
+    public:
+        Tracked(bool *alive) : mAlive(alive) { *mAlive = true; }
+        ~Tracked() { *mAlive = false; }
+    private:
+        bool *mAlive;
+    };
+    bool alive = false;
+
+    // Created by MakeRef, the last Ref destroy it, even a Arc was taken
+    auto ref = MakeRef<Tracked>(&alive);
+    ASSERT_EQ(ref->refcount(), 1);
+    auto arc = ref->shared_from_this<Tracked>();
+    ASSERT_EQ(ref->refcount(), 2);
+    ASSERT_EQ(ref->shared_from_this().get(), arc.get());
+    ref.reset();
+    ASSERT_TRUE(alive);
+    arc.reset();
+    ASSERT_FALSE(alive);
+
+    // Owned by Arc, a Ref keeps it after the Arc dropped
+    auto shared = std::make_shared<Tracked>(&alive);
+    Ref<Resource> pinned = View<Resource>(shared).get();
+    ASSERT_EQ(pinned->refcount(), 1);
+    ASSERT_EQ(pinned->shared_from_this().get(), shared.get());
+    shared.reset();
+    ASSERT_TRUE(alive);
+    Ref<Resource> copy = pinned;
+    pinned.reset();
+    ASSERT_TRUE(alive);
+    copy.reset();
+    ASSERT_FALSE(alive);
+
+    // Neither created by MakeRef nor owned by Arc, the first Ref panics instead of adopting it
+    ASSERT_DEATH({
+        Tracked local(&alive);
+        Ref<Resource> ref(&local);
+    }, "");
+}
+
+TEST(CoreTest, MemoryBudget) {
+    class SizedPacket final : public MediaPacket {
+    public:
+        int64_t size() const override {
+            return 1024;
+        }
+        void *data() const override {
+            return nullptr;
+        }
+        double duration() const override {
+            return 0.1;
+        }
+        double timestamp() const override {
+            return 0.0;
+        }
+    };
+    class GateSink final : public Template::GetImpl<Element> {
+    public:
+        GateSink() {
+            addInput("sink")->setCallback([this](View<Resource>) {
+                while (!mOpen) {
+                    std::this_thread::sleep_for(1ms);
+                }
+                mCount += 1;
+                return Error::Ok;
+            });
+        }
+        Atomic<bool>   mOpen {false};
+        Atomic<size_t> mCount {0};
+    };
+
+    // Over the share, only wait when the whole budget is used up
+    MemoryBudget budget;
+    budget.setLimit(1000);
+    budget.join(nullptr);
+    budget.join(nullptr);
+    ASSERT_EQ(budget.share(), 500);
+    budget.consume(900);
+    ASSERT_TRUE(budget.hasSpace(600));
+    budget.consume(200);
+    ASSERT_FALSE(budget.hasSpace(600));
+    ASSERT_TRUE(budget.hasSpace(400));
+    budget.consume(-1100);
+    budget.leave(nullptr);
+    budget.leave(nullptr);
+
+    // The producer is throttled by the bytes and the budget
+    Context ctxt;
+    ctxt.addObjectView<MemoryBudget>(&budget);
+    budget.setLimit(8192);
+
+    TinySource src;
+    GateSink sink;
+    auto queue = GetElementFactory()->createElement<MediaQueue>();
+    queue->setContext(&ctxt);
+    queue->setMaxBytes(4096);
+    ASSERT_EQ(LinkElements(&src, queue, &sink), Error::Ok);
+    sink.setState(State::Running);
+    queue->setState(State::Running);
+
+    std::thread producer([&]() {
+        auto pad = src.outputs().front();
+        for (int n = 0; n < 64; n++) {
+            pad->push(make_shared<SizedPacket>());
+        }
+    });
+    std::this_thread::sleep_for(50ms);
+    ASSERT_LE(queue->bytes(), 4096 + 1024);
+    ASSERT_EQ(budget.used(), queue->bytes());
+    ASSERT_LT(sink.mCount, 64);
+
+    sink.mOpen = true;
+    producer.join();
+    while (sink.mCount != 64) {
+        std::this_thread::sleep_for(1ms);
+    }
+    ASSERT_EQ(queue->bytes(), 0);
+    ASSERT_EQ(budget.used(), 0);
+
+    queue->setState(State::Null);
+    sink.setState(State::Null);
+
+    // The waiters are notified out of the budget lock, a callback can leave the budget
+    MemoryBudget other;
+    Waiter waiter;
+    other.join(&waiter);
+    bool called = false;
+    {
+        Waiter::AsyncScope scope([&]() {
+            other.leave(&waiter);
+            called = true;
+        });
+        ASSERT_EQ(waiter.wait(), Error::TemporarilyUnavailable);
+    }
+    other.setLimit(1024);
+    ASSERT_TRUE(called);
+}
+
+TEST(CoreTest, AppSink) {
+    TinySource src;
+    auto sink = GetElementFactory()->createElement<AppSink>();
+    ASSERT_EQ(LinkElements(&src, sink), Error::Ok);
+    sink->setState(State::Running);
+    auto pad = src.outputs().front();
+
+    // Keep the latest ones
+    Vec<Arc<TinyResource> > resources;
+    for (int n = 0; n < 3; n++) {
+        resources.push_back(make_shared<TinyResource>());
+    }
+    sink->setCapacity(2, AppSink::DropOldest);
+    for (auto &res : resources) {
+        pad->push(res);
+    }
+    Ref<Resource> batch[4];
+    size_t count = 4;
+    ASSERT_EQ(sink->pull(batch, &count), Error::Ok);
+    ASSERT_EQ(count, 2);
+    ASSERT_EQ(batch[0].get(), resources[1].get());
+    ASSERT_EQ(batch[1].get(), resources[2].get());
+    ASSERT_EQ(sink->dropped(), 1);
+    count = 4;
+    ASSERT_EQ(sink->pull(batch, &count), Error::TemporarilyUnavailable);
+
+    // Drop the incoming one
+    sink->setCapacity(1, AppSink::DropNewest);
+    pad->push(resources[0]);
+    pad->push(resources[1]);
+    Arc<TinyResource> one;
+    ASSERT_EQ(sink->pull(&one), Error::Ok);
+    ASSERT_EQ(one, resources[0]);
+    ASSERT_EQ(sink->dropped(), 2);
+
+    // The producer is blocked by a slow application
+    sink->setCapacity(2, AppSink::Block);
+    std::thread producer([&]() {
+        for (int n = 0; n < 100; n++) {
+            pad->push(resources[n % 3]);
+        }
+    });
+    size_t received = 0;
+    while (received != 100) {
+        count = 4;
+        if (sink->pull(batch, &count, 100) == Error::Ok) {
+            ASSERT_LE(count, 3);
+            received += count;
+        }
+    }
+    producer.join();
+    ASSERT_EQ(sink->dropped(), 2);
+
+    sink->setState(State::Null);
+}
+
 TEST(CoreTest, PrintfWrapper) {
     std::string buf {"Hello"};
     libc::sprintf(&buf, "%d", 1);
@@ -182,6 +961,223 @@ TEST(CoreTest, PrintfWrapper) {
     ASSERT_EQ(libc::asprintf("This is a string %s", "str"), "This is a string str");
 };
 
+TEST(CoreTest, SpscQueue) {
+    SpscQueue<int> queue(3);
+    ASSERT_EQ(queue.capacity(), 4);
+    for (int i = 0; i < 4; i++) {
+        ASSERT_TRUE(queue.tryPush(int(i)));
+    }
+    ASSERT_TRUE(queue.full());
+    ASSERT_FALSE(queue.tryPush(4));
+
+    int value = -1;
+    ASSERT_TRUE(queue.tryPop(&value));
+    ASSERT_EQ(value, 0);
+    queue.clear();
+    ASSERT_TRUE(queue.empty());
+    ASSERT_FALSE(queue.tryPop(&value));
+
+    // Order between threads
+    constexpr int count = 100000;
+    std::thread producer([&]() {
+        for (int i = 0; i < count; i++) {
+            while (!queue.tryPush(int(i))) {
+                std::this_thread::yield();
+            }
+        }
+    });
+    for (int i = 0; i < count; i++) {
+        while (!queue.tryPop(&value)) {
+            std::this_thread::yield();
+        }
+        ASSERT_EQ(value, i);
+    }
+    producer.join();
+}
+
+TEST(CoreTest, ThreadTask) {
+    // Small callable inline, large one on heap
+    int value = 0;
+    Task task([&]() { value += 1; });
+    Task moved(std::move(task));
+    ASSERT_TRUE(task.empty());
+    moved();
+    ASSERT_EQ(value, 1);
+
+    auto ptr = std::make_shared<int>(0);
+    std::array<char, Task::InlineSize * 2> big { };
+    Task large([ptr, big]() { *ptr += big.size(); });
+    ASSERT_EQ(ptr.use_count(), 2);
+    moved = std::move(large);
+    moved();
+    ASSERT_EQ(*ptr, Task::InlineSize * 2);
+    moved.reset();
+    ASSERT_EQ(ptr.use_count(), 1);
+
+    // Order and wakeup
+    Thread thread;
+    Vec<int> order;
+    for (int i = 0; i < 100; i++) {
+        thread.postTask([&, i]() { order.push_back(i); });
+    }
+    thread.sendTask([]() { });
+    ASSERT_EQ(order.size(), 100);
+    for (int i = 0; i < 100; i++) {
+        ASSERT_EQ(order[i], i);
+    }
+
+    std::latch latch {1};
+    size_t numOfTasks = 1;
+    thread.postTask([&]() {
+        numOfTasks = thread.waitTask();
+        latch.count_down();
+    });
+    thread.wakeup();
+    latch.wait();
+    ASSERT_EQ(numOfTasks, 0);
+}
+
+TEST(CoreTest, SliceRunner) {
+    SliceRunner runner(4);
+    ASSERT_EQ(runner.numOfThreads(), 4);
+
+    // Every slice once, on the caller and the workers
+    std::array<Atomic<int>, 100> counts { };
+    std::mutex mutex;
+    std::set<std::thread::id> threads;
+    runner.run(counts.size(), [&](size_t n) {
+        counts[n].fetch_add(1);
+        std::lock_guard locker(mutex);
+        threads.insert(std::this_thread::get_id());
+    });
+    for (auto &count : counts) {
+        ASSERT_EQ(count.load(), 1);
+    }
+    ASSERT_GE(threads.size(), 1);
+    ASSERT_LE(threads.size(), 4);
+
+    // Less slices than threads, no slice
+    int sum = 0;
+    runner.run(1, [&](size_t n) { sum += int(n) + 1; });
+    runner.run(0, [&](size_t n) { sum += 100; });
+    ASSERT_EQ(sum, 1);
+
+    // Only the caller
+    runner.setNumOfThreads(1);
+    ASSERT_EQ(runner.numOfThreads(), 1);
+    auto caller = std::this_thread::get_id();
+    runner.run(10, [&](size_t) { ASSERT_EQ(std::this_thread::get_id(), caller); });
+}
+
+TEST(CoreTest, ThreadTimer) {
+    auto test = [](Thread &thread) {
+        Vec<int> order;
+        std::latch latch {1};
+        auto start = Thread::Clock::now();
+        thread.postDelayed([&]() { order.push_back(2); }, 20ms);
+        thread.postDelayed([&]() { order.push_back(1); }, 5ms);
+        auto canceled = thread.postDelayed([&]() { order.push_back(-1); }, 10ms);
+        ASSERT_TRUE(thread.cancelTimer(canceled));
+        ASSERT_FALSE(thread.cancelTimer(canceled));
+
+        // Periodic, cancel itself at the third tick
+        int ticks = 0;
+        Thread::TimerId timer = 0;
+        thread.sendTask([&]() {
+            timer = thread.startTimer([&]() {
+                if (++ticks == 3) {
+                    thread.cancelTimer(timer);
+                    latch.count_down();
+                }
+            }, 10ms);
+        });
+        latch.wait();
+        thread.postAt([]() { }, start + 40ms);
+        std::this_thread::sleep_for(50ms);
+        thread.sendTask([]() { });
+
+        ASSERT_EQ(ticks, 3);
+        ASSERT_EQ(order.size(), 2);
+        ASSERT_EQ(order[0], 1);
+        ASSERT_EQ(order[1], 2);
+        ASSERT_GE(Thread::Clock::now() - start, 30ms);
+    };
+
+    Thread thread;
+    test(thread);
+
+    Executor executor(2);
+    auto executorThread = executor.allocThread();
+    test(*executorThread);
+    executor.freeThread(executorThread);
+
+    // waitTask() returns on a timer fired
+    std::latch latch {1};
+    size_t numOfTasks = 0;
+    thread.postTask([&]() {
+        thread.postDelayed([]() { }, 5ms);
+        numOfTasks = thread.waitTask();
+        latch.count_down();
+    });
+    latch.wait();
+    ASSERT_EQ(numOfTasks, 1);
+}
+
+TEST(CoreTest, ThreadPolicy) {
+    Thread thread;
+    ThreadPolicy policy;
+    policy.nice = 5; //< Raise nice level is always permitted
+    policy.affinity = 1; //< Core 0
+    ASSERT_EQ(thread.setPolicy(policy), Error::Ok);
+#ifdef __linux__
+    ASSERT_EQ(thread.invokeQueued(::sched_getcpu), 0);
+#endif
+
+    // Real time may be denied, the nice fallback is applied then
+    policy.policy = SchedulePolicy::Fifo;
+    policy.priority = 10;
+    auto err = thread.setPolicy(policy);
+    ASSERT_TRUE(err == Error::Ok || err == Error::PermissionDenied);
+
+    // By role, no policy is no-op
+    ThreadPolicyTable table;
+    ASSERT_EQ(table.apply(ThreadRole::Decoder, &thread), Error::Ok);
+    table = ThreadPolicyTable::isolatedAudio(0);
+    err = table.apply(ThreadRole::AudioSink, &thread);
+    ASSERT_TRUE(err == Error::Ok || err == Error::PermissionDenied);
+
+    Executor executor(1);
+    auto executorThread = executor.allocThread();
+    ASSERT_EQ(executorThread->setPolicy(policy), Error::InvalidState);
+    executor.freeThread(executorThread);
+}
+
+TEST(CoreTest, Waiter) {
+    // Without Thread, notified before wait
+    Waiter waiter;
+    waiter.notify();
+    ASSERT_EQ(waiter.wait(), Error::Ok);
+    ASSERT_EQ(waiter.wait(1), Error::Ok); //< Timeout
+
+    // At a Thread, notify and task both wakeup it
+    Thread thread;
+    Vec<Error> results;
+    std::latch latch {1};
+    thread.postTask([&]() {
+        latch.count_down();
+        results.push_back(waiter.wait());
+        results.push_back(waiter.wait());
+    });
+    latch.wait();
+    std::this_thread::sleep_for(10ms);
+    waiter.notify();
+    std::this_thread::sleep_for(10ms);
+    thread.sendTask([]() { });
+    ASSERT_EQ(results.size(), 2);
+    ASSERT_EQ(results[0], Error::Ok);
+    ASSERT_EQ(results[1], Error::Interrupted);
+}
+
 TEST(MediaLayerTest, Reader) {
     using NEKO_NAMESPACE::Arc;
     auto reader = CreateMediaReader();
@@ -8,10 +8,21 @@
 #include "../nekoav/elements/videosink.hpp"
 #include "../nekoav/elements/mediaqueue.hpp"
 #include "../nekoav/detail/template.hpp"
+#include "../nekoav/media/colorcvt.hpp"
+#include "../nekoav/media.hpp"
 #include "../nekoav/pipeline.hpp"
 #include "../nekoav/factory.hpp"
 #include "../nekoav/libc.hpp"
 #include "../nekoav/pad.hpp"
+#include "../nekoav/cpu.hpp"
+
+#if __has_include(<libswscale/swscale.h>)
+extern "C" {
+    #include <libswscale/swscale.h>
+    #include <libavutil/pixfmt.h>
+}
+    #define HAVE_SWSCALE
+#endif
 
 using namespace NEKO_NAMESPACE;
 
@@ -72,6 +83,78 @@ TEST(ElemTest, TestPipeline) {
     puts(DumpTopology(pipeline).c_str());
 }
 
+#ifdef HAVE_SWSCALE
+// The YUV -> RGBA kernels of VideoConverter against swscale (the old path of it)
+TEST(ElemTest, ColorConvertWithSws) {
+    const int width = 1280, height = 720;
+    struct Case {
+        PixelFormat   format;
+        AVPixelFormat avFormat;
+    } cases[] = {
+        {PixelFormat::YUV420P, AV_PIX_FMT_YUV420P},
+        {PixelFormat::NV12, AV_PIX_FMT_NV12},
+        {PixelFormat::P010LE, AV_PIX_FMT_P010LE},
+    };
+    for (auto [fmt, avFormat] : cases) {
+        // Smooth gradients, sws may interpolate the chroma of some formats
+        auto src = CreateVideoFrame(fmt, width, height);
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                int luma = 16 + (x + y) * 219 / (width + height);
+                if (fmt == PixelFormat::P010LE) {
+                    src->data<uint16_t*>(0)[y * src->linesize(0) / 2 + x] = (luma << 2) << 6;
+                }
+                else {
+                    src->data<uint8_t*>(0)[y * src->linesize(0) + x] = luma;
+                }
+            }
+        }
+        for (int y = 0; y < height / 2; y++) {
+            for (int x = 0; x < width / 2; x++) {
+                int u = 16 + x * 224 / (width / 2);
+                int v = 16 + y * 224 / (height / 2);
+                if (fmt == PixelFormat::YUV420P) {
+                    src->data<uint8_t*>(1)[y * src->linesize(1) + x] = u;
+                    src->data<uint8_t*>(2)[y * src->linesize(2) + x] = v;
+                }
+                else if (fmt == PixelFormat::NV12) {
+                    src->data<uint8_t*>(1)[y * src->linesize(1) + x * 2] = u;
+                    src->data<uint8_t*>(1)[y * src->linesize(1) + x * 2 + 1] = v;
+                }
+                else {
+                    src->data<uint16_t*>(1)[y * src->linesize(1) / 2 + x * 2] = (u << 2) << 6;
+                    src->data<uint16_t*>(1)[y * src->linesize(1) / 2 + x * 2 + 1] = (v << 2) << 6;
+                }
+            }
+        }
+        const uint8_t *data[4] = {src->data<uint8_t*>(0), src->data<uint8_t*>(1), src->data<uint8_t*>(2), nullptr};
+        const int linesize[4] = {src->linesize(0), src->linesize(1), src->linesize(2), 0};
+
+        std::vector<uint8_t> expected(width * height * 4);
+        uint8_t *dstData[4] = {expected.data(), nullptr, nullptr, nullptr};
+        int dstLinesize[4] = {width * 4, 0, 0, 0};
+        auto ctxt = sws_getContext(width, height, avFormat, width, height, AV_PIX_FMT_RGBA, SWS_BICUBIC, nullptr, nullptr, nullptr);
+        ASSERT_NE(ctxt, nullptr);
+        ASSERT_EQ(sws_scale(ctxt, data, linesize, 0, height, dstData, dstLinesize), height);
+        sws_freeContext(ctxt);
+
+        std::vector<uint8_t> result(width * height * 4);
+        ASSERT_EQ(ConvertYUVToRGBA(fmt, data, linesize, PixelFormat::RGBA, result.data(), width * 4, width, height), Error::Ok);
+
+        int maxDiff = 0;
+        double sumDiff = 0;
+        for (size_t i = 0; i < result.size(); i++) {
+            int diff = std::abs(int(result[i]) - int(expected[i]));
+            maxDiff = std::max(maxDiff, diff);
+            sumDiff += diff;
+        }
+        ::printf("Format %d, SimdLevel %d: max diff %d, mean diff %.3f\n", int(fmt), int(GetSimdLevel()), maxDiff, sumDiff / result.size());
+        ASSERT_LE(maxDiff, 6);
+        ASSERT_LE(sumDiff / result.size(), 1.5);
+    }
+}
+#endif
+
 // TEST(ElemTest, TestDemuxer) {
 //     auto factory = GetElementFactory();
 //     auto pipeline = factory->createElement<Pipeline>();
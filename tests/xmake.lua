@@ -12,6 +12,14 @@ if has_config("test") then
         add_files("utilstest.cpp")
     target_end()
 
+    target("benchtest")
+        set_kind("binary")
+        add_deps("nekoav")
+        add_packages("ffmpeg")
+
+        add_files("benchtest.cpp")
+    target_end()
+
     target("cltest")
         set_kind("binary")
         add_deps("nekoav")
@@ -39,7 +47,7 @@ if has_config("test") then
     target("elemtest")
         set_kind("binary")
         add_deps("nekoav")
-        add_packages("gtest")
+        add_packages("gtest", "ffmpeg")
 
         add_files("elemtest.cpp")
     target_end()